@@ -0,0 +1,225 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "bench_helpers.h"
+#include "ipc_codec_compact.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Encode and decode cost per message, through the channel so that it includes what every real
+// message pays: the argument conversion, the segments and the dispatch. Nothing is written
+// anywhere; the transport keeps one copy of the message and then plays it back to the decoder
+// as many times as it is asked.
+
+namespace {
+
+const int kMsgInts = 10;
+const int kMsgStrings = 11;
+const int kMsgBytes = 12;
+
+// Keeps the first message sent to it and drops the later ones. ReceiveInto() hands out the
+// kept message over and over.
+class ReplayTransport {
+public:
+  ReplayTransport() : read_pos_(0) {}
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    const bool keep = msg_.empty();
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* cb = reinterpret_cast<const char*>(segs[ix].buf_);
+      if (keep)
+        msg_.insert(msg_.end(), cb, cb + segs[ix].sz_);
+    }
+    return ipc::RcOK;
+  }
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    size_t sz = msg_.size() - read_pos_;
+    if (sz > *size)
+      sz = *size;
+    if (!sz)
+      return ipc::RcErrTransportRead;
+    memcpy(buf, &msg_[read_pos_], sz);
+    read_pos_ += sz;
+    if (read_pos_ == msg_.size())
+      read_pos_ = 0;
+    *size = sz;
+    return ipc::RcOK;
+  }
+
+  size_t msg_size() const { return msg_.size(); }
+
+private:
+  std::vector<char> msg_;
+  size_t read_pos_;
+};
+
+class BenchMsgBase {
+public:
+  bool OnMsgArgCountError(int /*count*/) { return false; }
+  bool OnMsgArgConvertError(int /*code*/) { return false; }
+  void* OnNewTransport() { return NULL; }
+};
+
+}  // namespace
+
+DEFINE_IPC_MSG_CONV(10, 4) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(unsigned int, UInt32)
+  IPC_MSG_P3(int, Int32)
+  IPC_MSG_P4(unsigned int, UInt32)
+};
+
+DEFINE_IPC_MSG_CONV(11, 3) {
+  IPC_MSG_P1(const char*, String8)
+  IPC_MSG_P2(const char*, String8)
+  IPC_MSG_P3(const wchar_t*, String16)
+};
+
+DEFINE_IPC_MSG_CONV(12, 1) {
+  IPC_MSG_P1(ipc::ByteArray, ByteArray)
+};
+
+namespace {
+
+template <class ChannelT>
+class IntsMsg : public BenchMsgBase,
+                public ipc::MsgIn<kMsgInts, IntsMsg<ChannelT>, ChannelT>,
+                public ipc::MsgOut<ChannelT> {
+public:
+  size_t Send(ChannelT* ch) {
+    return this->SendMsg(kMsgInts, ch, 1, 2u, -3, 0x7FFFFFFFu);
+  }
+
+  size_t OnMsg(ChannelT*, int, unsigned int, int, unsigned int) {
+    return ipc::OnMsgReady;
+  }
+};
+
+template <class ChannelT>
+class StringsMsg : public BenchMsgBase,
+                   public ipc::MsgIn<kMsgStrings, StringsMsg<ChannelT>, ChannelT>,
+                   public ipc::MsgOut<ChannelT> {
+public:
+  size_t Send(ChannelT* ch) {
+    return this->SendMsg(kMsgStrings, ch, "c:\\temp\\file.txt", "read-only", L"user name");
+  }
+
+  size_t OnMsg(ChannelT*, const char*, const char*, const wchar_t*) {
+    return ipc::OnMsgReady;
+  }
+};
+
+// Sends |sz| bytes, copied into the message or referenced by it depending on |by_ref|.
+template <class ChannelT>
+class BytesMsg : public BenchMsgBase,
+                 public ipc::MsgIn<kMsgBytes, BytesMsg<ChannelT>, ChannelT>,
+                 public ipc::MsgOut<ChannelT> {
+public:
+  BytesMsg(size_t sz, bool by_ref) : data_(sz, 'b'), by_ref_(by_ref) {}
+
+  size_t Send(ChannelT* ch) {
+    if (by_ref_)
+      return this->SendMsg(kMsgBytes, ch, ipc::ByteArrayRef(data_.size(), &data_[0]));
+    return this->SendMsg(kMsgBytes, ch, ipc::ByteArray(data_.size(), &data_[0]));
+  }
+
+  size_t OnMsg(ChannelT*, ipc::ByteArray ba) {
+    return (ba.sz_ == data_.size()) ? ipc::OnMsgReady : ipc::OnMsgAppErrorBase;
+  }
+
+private:
+  std::vector<char> data_;
+  bool by_ref_;
+};
+
+// Runs the encode case and then the decode case of one message. The first send is not
+// measured because it also sizes the buffers of the channel.
+template <class ChannelT, class MsgT>
+int RunCase(const char* name, const char* codec, MsgT* msg) {
+  ReplayTransport transport;
+  ChannelT channel(&transport);
+  if (msg->Send(&channel) != ipc::RcOK)
+    return 1;
+  if (channel.Receive(msg) != ipc::OnMsgReady)
+    return 2;
+
+  BenchLoop encode;
+  while (encode.Next()) {
+    if (msg->Send(&channel) != ipc::RcOK)
+      return 3;
+  }
+  Report("encode", name, codec, "ns_per_msg", encode.NsPerOp());
+  Report("encode", name, codec, "allocs_per_msg", encode.AllocsPerOp());
+
+  BenchLoop decode;
+  while (decode.Next()) {
+    if (channel.Receive(msg) != ipc::OnMsgReady)
+      return 4;
+  }
+  Report("decode", name, codec, "ns_per_msg", decode.NsPerOp());
+  Report("decode", name, codec, "allocs_per_msg", decode.AllocsPerOp());
+  Report("decode", name, codec, "bytes_per_msg", static_cast<double>(transport.msg_size()));
+  return 0;
+}
+
+template <class ChannelT>
+int RunCodec(const char* codec) {
+  IntsMsg<ChannelT> ints;
+  int rc = RunCase<ChannelT>("ints", codec, &ints);
+  if (rc)
+    return rc;
+  StringsMsg<ChannelT> strings;
+  rc = RunCase<ChannelT>("strings", codec, &strings);
+  if (rc)
+    return 10 + rc;
+
+  struct BytesCase {
+    const char* name;
+    size_t sz;
+    bool by_ref;
+  };
+  const BytesCase cases[] = {
+    { "bytes_1k", 1024, false },
+    { "bytes_64k", 64 * 1024, false },
+    { "bytes_64k_ref", 64 * 1024, true },
+    { "bytes_1m", 1024 * 1024, false },
+    { "bytes_1m_ref", 1024 * 1024, true },
+  };
+  for (size_t ix = 0; ix != sizeof(cases) / sizeof(cases[0]); ++ix) {
+    BytesMsg<ChannelT> bytes(cases[ix].sz, cases[ix].by_ref);
+    rc = RunCase<ChannelT>(cases[ix].name, codec, &bytes);
+    if (rc)
+      return 20 + 10 * static_cast<int>(ix) + rc;
+  }
+  return 0;
+}
+
+typedef ipc::Channel<ReplayTransport, ipc::Encoder, ipc::Decoder> PlainChannel;
+typedef ipc::Channel<ReplayTransport, ipc::CompactEncoder, ipc::CompactDecoder> CompactChannel;
+typedef ipc::Channel<ReplayTransport, ipc::FixedEncoder, ipc::FixedDecoder> FixedChannel;
+
+}  // namespace
+
+int BenchCodec() {
+  int rc = RunCodec<PlainChannel>("plain");
+  if (rc)
+    return rc;
+  rc = RunCodec<CompactChannel>("compact");
+  if (rc)
+    return 100 + rc;
+  rc = RunCodec<FixedChannel>("fixed");
+  if (rc)
+    return 200 + rc;
+  return 0;
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_BENCH_HELPERS_H_
+#define SIMPLE_IPC_BENCH_HELPERS_H_
+
+#include <vector>
+
+#include "ipc_channel.h"
+#include "ipc_clock.h"
+#include "ipc_codec.h"
+#include "ipc_msg_dispatch.h"
+
+// Every result is one line of JSON on stdout so that runs can be kept and compared across
+// releases, for example:
+//
+//  {"bench": "encode", "case": "bytes_1k", "codec": "plain", "metric": "ns_per_msg", "value": 412.5}
+//
+// Progress and errors go to stderr.
+
+// How long each case runs, in milliseconds.
+const unsigned int kBenchRunMs = 300;
+
+// Heap allocations made by this process so far, counted by the operator new of bench_main.cpp.
+long AllocCount();
+
+void Report(const char* bench, const char* name, const char* codec, const char* metric,
+            double value);
+
+// Measures a loop of |op|. Call Next() before each iteration; it returns false once the run
+// has gone on for kBenchRunMs. The clock is only read every few iterations so that short
+// operations are not dominated by it.
+class BenchLoop {
+public:
+  BenchLoop() : iterations_(0), start_us_(ipc::TickCountUs()), elapsed_us_(0),
+                start_allocs_(AllocCount()), allocs_(0) {}
+
+  bool Next() {
+    if ((iterations_ & 15) == 0) {
+      elapsed_us_ = ipc::TickCountUs() - start_us_;
+      if (elapsed_us_ >= kBenchRunMs * 1000) {
+        allocs_ = AllocCount() - start_allocs_;
+        return false;
+      }
+    }
+    ++iterations_;
+    return true;
+  }
+
+  // Valid after Next() returned false.
+  double NsPerOp() const { return (elapsed_us_ * 1000.0) / iterations_; }
+  double OpsPerSec() const { return (iterations_ * 1000000.0) / elapsed_us_; }
+  double AllocsPerOp() const { return static_cast<double>(allocs_) / iterations_; }
+  unsigned long iterations() const { return iterations_; }
+
+private:
+  unsigned long iterations_;
+  unsigned int start_us_;
+  unsigned int elapsed_us_;
+  long start_allocs_;
+  long allocs_;
+};
+
+// Sorts |samples| and returns the value below which |percent| of them are.
+unsigned int Percentile(std::vector<unsigned int>* samples, unsigned int percent);
+
+int BenchCodec();
+int BenchPipe();
+
+#endif  // SIMPLE_IPC_BENCH_HELPERS_H_
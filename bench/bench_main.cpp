@@ -0,0 +1,100 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Benchmarks of the codecs, the channel and the pipe transport. See bench_helpers.h for the
+// output format.
+
+#include "os_includes.h"
+#include "ipc_sync.h"
+#include "bench_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+#if (__cplusplus >= 201103L) || defined(_MSC_VER)
+#define BENCH_THROW_BAD_ALLOC
+#else
+#define BENCH_THROW_BAD_ALLOC throw(std::bad_alloc)
+#endif
+
+namespace {
+
+volatile long g_allocs = 0;
+
+void* CountedAlloc(size_t sz) {
+  ipc::AtomicAdd(&g_allocs, 1);
+  void* p = ::malloc(sz ? sz : 1);
+  if (!p)
+    abort();
+  return p;
+}
+
+}  // namespace
+
+// Every allocation of the process goes through here, including the ones of the library.
+void* operator new(size_t sz) BENCH_THROW_BAD_ALLOC {
+  return CountedAlloc(sz);
+}
+
+void* operator new[](size_t sz) BENCH_THROW_BAD_ALLOC {
+  return CountedAlloc(sz);
+}
+
+void operator delete(void* p) throw() {
+  ::free(p);
+}
+
+void operator delete[](void* p) throw() {
+  ::free(p);
+}
+
+long AllocCount() {
+  return ipc::AtomicAdd(&g_allocs, 0);
+}
+
+void Report(const char* bench, const char* name, const char* codec, const char* metric,
+            double value) {
+  printf("{\"bench\": \"%s\", \"case\": \"%s\", \"codec\": \"%s\", \"metric\": \"%s\", "
+         "\"value\": %.1f}\n", bench, name, codec, metric, value);
+  fflush(stdout);
+}
+
+unsigned int Percentile(std::vector<unsigned int>* samples, unsigned int percent) {
+  if (samples->empty())
+    return 0;
+  std::sort(samples->begin(), samples->end());
+  size_t ix = (samples->size() * percent) / 100;
+  if (ix == samples->size())
+    --ix;
+  return (*samples)[ix];
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Benchmark driver. Returns non-zero if a benchmark could not run.
+
+int main() {
+  int rc = BenchCodec();
+  if (rc) {
+    fprintf(stderr, "BenchCodec failed with %d\n", rc);
+    return rc;
+  }
+  rc = BenchPipe();
+  if (rc) {
+    fprintf(stderr, "BenchPipe failed with %d\n", rc);
+    return rc;
+  }
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_sync.h"
+#include "bench_helpers.h"
+
+#if defined(WIN32)
+#include "pipe_win.h"
+#else
+#include "pipe_unix.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Round trips and one way throughput over the pipe transport: a socketpair on Unix and a
+// named pipe pair on Windows. The echo server runs in a second thread of this process. The
+// "spin" variant has both ends spin for kSpinUs before they block, see
+// Channel::SetReceiveSpin().
+
+namespace {
+
+const int kMsgPing = 20;
+const int kMsgPong = 21;
+const int kMsgPush = 22;
+const int kMsgStop = 23;
+
+const unsigned int kSpinUs = 100;
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+class BenchMsgBase {
+public:
+  bool OnMsgArgCountError(int /*count*/) { return false; }
+  bool OnMsgArgConvertError(int /*code*/) { return false; }
+  void* OnNewTransport() { return NULL; }
+};
+
+}  // namespace
+
+DEFINE_IPC_MSG_CONV(20, 2) {
+  IPC_MSG_P1(unsigned int, UInt32)
+  IPC_MSG_P2(ipc::ByteArray, ByteArray)
+};
+
+DEFINE_IPC_MSG_CONV(21, 2) {
+  IPC_MSG_P1(unsigned int, UInt32)
+  IPC_MSG_P2(ipc::ByteArray, ByteArray)
+};
+
+DEFINE_IPC_MSG_CONV(22, 2) {
+  IPC_MSG_P1(unsigned int, UInt32)
+  IPC_MSG_P2(ipc::ByteArray, ByteArray)
+};
+
+DEFINE_IPC_MSG_CONV(23, 1) {
+  IPC_MSG_P1(unsigned int, UInt32)
+};
+
+namespace {
+
+class PingSvc : public BenchMsgBase,
+                public ipc::MsgIn<kMsgPing, PingSvc, PipeChannel>,
+                public ipc::MsgOut<PipeChannel> {
+public:
+  // Sends the payload back, referencing the bytes of the received message.
+  size_t OnMsg(PipeChannel* ch, unsigned int seq, ipc::ByteArray ba) {
+    return SendMsg(kMsgPong, ch, seq, ipc::ByteArrayRef(ba.sz_, ba.buf_));
+  }
+};
+
+class PushSvc : public BenchMsgBase,
+                public ipc::MsgIn<kMsgPush, PushSvc, PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel*, unsigned int, ipc::ByteArray) {
+    return ipc::OnMsgLoopNext;
+  }
+};
+
+class StopSvc : public BenchMsgBase,
+                public ipc::MsgIn<kMsgStop, StopSvc, PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel*, unsigned int) {
+    return ipc::OnMsgReady;
+  }
+};
+
+class EchoServer : public ipc::MsgTable<PipeChannel, kMsgStop, kMsgPing> {
+public:
+  EchoServer() {
+    Add(&ping_);
+    Add(&push_);
+    Add(&stop_);
+  }
+
+private:
+  PingSvc ping_;
+  PushSvc push_;
+  StopSvc stop_;
+};
+
+struct ServerContext {
+#if defined(WIN32)
+  HANDLE pipe;
+#else
+  int pipe;
+#endif
+  unsigned int spin_us;
+  size_t result;
+};
+
+void EchoServerThread(void* p) {
+  ServerContext* ctx = static_cast<ServerContext*>(p);
+  PipeTransport transport;
+  if (!transport.OpenServer(ctx->pipe)) {
+    ctx->result = ipc::RcErrTransportConnect;
+    return;
+  }
+  PipeChannel channel(&transport);
+  channel.SetReceiveSpin(ctx->spin_us);
+  EchoServer server;
+  ctx->result = channel.Receive(&server);
+}
+
+class PongCli : public BenchMsgBase,
+                public ipc::MsgIn<kMsgPong, PongCli, PipeChannel>,
+                public ipc::MsgOut<PipeChannel> {
+public:
+  explicit PongCli(size_t sz) : data_(sz ? sz : 1, 'p'), sz_(sz), seq_(0) {}
+
+  // One round trip. Returns OnMsgReady when the reply matches.
+  size_t RoundTrip(PipeChannel* ch) {
+    ++seq_;
+    size_t rc = SendMsg(kMsgPing, ch, seq_, ipc::ByteArrayRef(sz_, &data_[0]));
+    if (rc != ipc::RcOK)
+      return rc;
+    return ch->Receive(this);
+  }
+
+  size_t Push(PipeChannel* ch) {
+    return SendMsg(kMsgPush, ch, seq_, ipc::ByteArrayRef(sz_, &data_[0]));
+  }
+
+  size_t Stop(PipeChannel* ch) {
+    return SendMsg(kMsgStop, ch, 0u);
+  }
+
+  size_t OnMsg(PipeChannel*, unsigned int seq, ipc::ByteArray ba) {
+    if ((seq != seq_) || (ba.sz_ != sz_))
+      return ipc::OnMsgAppErrorBase;
+    return ipc::OnMsgReady;
+  }
+
+private:
+  std::vector<char> data_;
+  size_t sz_;
+  unsigned int seq_;
+};
+
+int RunCase(const char* name, size_t sz, const char* variant, unsigned int spin_us) {
+  PipePair pair;
+  ServerContext ctx = { pair.fd1(), spin_us, ipc::RcOK };
+  ipc::ThreadHandle thread;
+  if (!ipc::StartThread(&EchoServerThread, &ctx, &thread))
+    return 1;
+
+  PipeTransport transport;
+  if (!transport.OpenClient(pair.fd2()))
+    return 2;
+  PipeChannel channel(&transport);
+  channel.SetReceiveSpin(spin_us);
+  PongCli client(sz);
+  if (client.RoundTrip(&channel) != ipc::OnMsgReady)
+    return 3;
+
+  // The samples are reserved up front so that they do not show up as allocations.
+  std::vector<unsigned int> samples;
+  samples.reserve(1 << 20);
+  BenchLoop rtt;
+  while (rtt.Next()) {
+    const unsigned int start = ipc::TickCountUs();
+    if (client.RoundTrip(&channel) != ipc::OnMsgReady)
+      return 4;
+    samples.push_back(ipc::TickCountUs() - start);
+  }
+  Report("rtt", name, variant, "us_p50", Percentile(&samples, 50));
+  Report("rtt", name, variant, "us_p99", Percentile(&samples, 99));
+  Report("rtt", name, variant, "allocs_per_rtt", rtt.AllocsPerOp());
+
+  // Until the last message has made it to the other side, which the round trip guarantees.
+  const unsigned int start = ipc::TickCountUs();
+  BenchLoop push;
+  while (push.Next()) {
+    if (client.Push(&channel) != ipc::RcOK)
+      return 5;
+  }
+  if (client.RoundTrip(&channel) != ipc::OnMsgReady)
+    return 6;
+  const unsigned int elapsed = ipc::TickCountUs() - start;
+  Report("push", name, variant, "msgs_per_sec", (push.iterations() * 1000000.0) / elapsed);
+  Report("push", name, variant, "allocs_per_msg", push.AllocsPerOp());
+
+  if (client.Stop(&channel) != ipc::RcOK)
+    return 7;
+  ipc::JoinThread(thread);
+  return (ctx.result == ipc::OnMsgReady) ? 0 : 8;
+}
+
+}  // namespace
+
+int BenchPipe() {
+  struct PipeCase {
+    const char* name;
+    size_t sz;
+  };
+  const PipeCase cases[] = {
+    { "empty", 0 },
+    { "bytes_1k", 1024 },
+    { "bytes_64k", 64 * 1024 },
+  };
+  for (size_t ix = 0; ix != sizeof(cases) / sizeof(cases[0]); ++ix) {
+    int rc = RunCase(cases[ix].name, cases[ix].sz, "plain", 0);
+    if (!rc)
+      rc = RunCase(cases[ix].name, cases[ix].sz, "spin", kSpinUs);
+    if (rc)
+      return 10 * static_cast<int>(ix) + rc;
+  }
+  return 0;
+}
@@ -18,6 +18,7 @@
 #include "..\..\src\pipe_win.h"
 #include "..\..\src\ipc_codec.h"
 #include "..\..\src\ipc_msg_dispatch.h"
+#include "..\..\src\ipc_msg_schema.h"
 
 typedef PipeTransport ActualTransportT;
 typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> ActualChannelT;
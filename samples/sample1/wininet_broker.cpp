@@ -105,21 +105,21 @@ protected:
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-DEFINE_IPC_MSG_CONV(kAInternetOpenASend, 5) {
-  IPC_MSG_P1(LPCSTR, String8)           // Agent.
-  IPC_MSG_P2(DWORD, ULong32)            // Access type.
-  IPC_MSG_P3(LPCSTR, String8)           // Proxy.
-  IPC_MSG_P4(LPCSTR, String8)           // Proxy bypass.
-  IPC_MSG_P5(DWORD, ULong32)            // Flags.
-};
-
-DEFINE_IPC_MSG_CONV(kAInternetOpenARecv, 2) {
-  IPC_MSG_P1(DWORD, ULong32)            // Last error.
-  IPC_MSG_P2(HINTERNET, VoidPtr)        // Internet handle.
-};
+// InternetOpenA() is declared with IPC_MSG_DEFn, see ipc_msg_schema.h. The rest of the calls
+// below still use DEFINE_IPC_MSG_CONV and MsgOut::SendMsg(); both send the same messages.
+IPC_MSG_DEF5(kAInternetOpenASend, InternetOpenASendMsg,
+             LPCSTR, String8,                 // Agent.
+             DWORD, ULong32,                  // Access type.
+             LPCSTR, String8,                 // Proxy.
+             LPCSTR, String8,                 // Proxy bypass.
+             DWORD, ULong32);                 // Flags.
+
+IPC_MSG_DEF2(kAInternetOpenARecv, InternetOpenARecvMsg,
+             DWORD, ULong32,                  // Last error.
+             HINTERNET, VoidPtr);             // Internet handle.
 
 class InternetOpenARpc : public CommonRpcBase,
-                         public ipc::MsgIn<kAInternetOpenARecv, InternetOpenARpc, ActualChannelT> {
+                         public InternetOpenARecvMsg::In<InternetOpenARpc, ActualChannelT> {
 public:
   InternetOpenARpc() : handle_(NULL), status_(0) {}
 
@@ -133,13 +133,12 @@ public:
       return NULL;
     }
 
-    size_t r = Recv(this, SendMsg(kAInternetOpenASend,
-                                  &ch_,
-                                  lpszAgent,
-                                  dwAccessType,
-                                  lpszProxy,
-                                  lpszProxyBypass,
-                                  dwFlags));
+    size_t r = Recv(this, InternetOpenASendMsg::Send(&ch_,
+                                                     lpszAgent,
+                                                     dwAccessType,
+                                                     lpszProxy,
+                                                     lpszProxyBypass,
+                                                     dwFlags));
     if (r) {
       return NULL;
     }
@@ -159,7 +158,7 @@ private:
 };
 
 class InternetOpenASvc : public CommonSvcBase,
-                         public ipc::MsgIn<kAInternetOpenASend, InternetOpenASvc, ActualChannelT> { 
+                         public InternetOpenASendMsg::In<InternetOpenASvc, ActualChannelT> {
 public:
   INTERNAL_MSG_REFLECT(ActualChannelT)
 
@@ -175,7 +174,7 @@ public:
                                     lpszProxyBypass,
                                     dwFlags);
     DWORD gle = (NULL == hin) ? ::GetLastError() : 0;
-    return SendMsg(kAInternetOpenARecv, ch, gle, hin); 
+    return InternetOpenARecvMsg::Send(ch, gle, hin);
   }
 };
 
@@ -17,14 +17,63 @@
       'msvs_guid': '61E911C1-F921-4F20-BA75-5F49424FCE79',
       'sources': [
         'src/ipc_channel.h',
+        'src/ipc_clock.h',
         'src/ipc_codec.h',
+        'src/ipc_codec_compact.h',
+        'src/ipc_codec_fixed.h',
+        'src/ipc_compress.h',
+        'src/ipc_dispatch_pool.h',
+        'src/ipc_handles.h',
+        'src/ipc_hello.h',
+        'src/ipc_metrics.h',
         'src/ipc_msg_dispatch.h',
+        'src/ipc_msg_schema.h',
+        'src/ipc_poll.h',
+        'src/ipc_stream.h',
+        'src/ipc_sync.h',
+        'src/ipc_trace.h',
+        'src/ipc_transport_pool.h',
         'src/ipc_wire_types.h',
+        'src/mapped_file_unix.cpp',
+        'src/mapped_file_unix.h',
+        'src/mapped_file_win.cpp',
+        'src/mapped_file_win.h',
         'src/os_includes.h',
         'src/pipe_unix.cpp',
         'src/pipe_unix.h',
         'src/pipe_win.cpp',
         'src/pipe_win.h',
+        'src/reactor_unix.cpp',
+        'src/reactor_unix.h',
+        'src/shm_ring.h',
+        'src/shm_unix.cpp',
+        'src/shm_unix.h',
+        'src/shm_win.cpp',
+        'src/shm_win.h',
+      ],
+      'conditions': [
+        ['OS=="linux"', {
+          'link_settings': {
+            'libraries': [ '-lrt', '-lpthread', ],
+          },
+        }],
+      ],
+    },
+    {
+      'target_name': 'benchmark',
+      'type': 'executable',
+      'msvs_guid': '405097AF-FD0E-4EAB-BA7D-7A361C52549B',
+      'dependencies': [
+        'ipc_lib',
+      ],
+      'sources': [
+        'bench/bench_codec.cpp',
+        'bench/bench_helpers.h',
+        'bench/bench_main.cpp',
+        'bench/bench_pipe.cpp',
+      ],
+      'include_dirs': [
+        'src',
       ],
     },
     {
@@ -35,10 +84,17 @@
         'ipc_lib',
       ],
       'sources': [
+        'test/ipc_codec_compact_unittest.cpp',
+        'test/ipc_codec_fixed_unittest.cpp',
         'test/ipc_codec_unittest.cpp',
+        'test/ipc_dispatch_pool_unittest.cpp',
         'test/ipc_dispatch_unnitest.cpp',
+        'test/ipc_metrics_unittest.cpp',
+        'test/ipc_msg_schema_unittest.cpp',
         'test/ipc_roundtrip_unittest.cpp',
+        'test/ipc_stream_unittest.cpp',
         'test/ipc_test_helpers.h',
+        'test/ipc_trace_unittest.cpp',
         'test/ipc_transport_unix_unittest.cpp',
         'test/ipc_transport_win_unittest.cpp',
         'test/test_main.cpp',
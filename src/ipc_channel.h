@@ -15,7 +15,13 @@
 #ifndef SIMPLE_IPC_CHANNEL_H_
 #define SIMPLE_IPC_CHANNEL_H_
 
+#include "ipc_clock.h"
 #include "ipc_constants.h"
+#include "ipc_handles.h"
+#include "ipc_metrics.h"
+#include "ipc_poll.h"
+#include "ipc_stream.h"
+#include "ipc_sync.h"
 #include "ipc_utils.h"
 #include "ipc_wire_types.h"
 
@@ -33,61 +39,421 @@
 // a message id. The encoder and decoder are loosely coupled with the message and it is the job
 // of the channel to interface them.
 //
+// Two encoder & decoder pairs come with the library: Encoder/Decoder in ipc_codec.h and the
+// smaller CompactEncoder/CompactDecoder in ipc_codec_compact.h. Both ends must use the same one.
+//
 // Sending Requirements
 //  Encoder should implement:
+//    void SetCallId(unsigned int call_id)
 //    bool Open(int n_args)
 //    bool Close()
 //    void SetMsgId(int msg_id)
 //    bool OnWord(void* bits, int tag)
-//    bool OnString8(const string& s, int tag)
-//    bool OnString16(const wstring& s, int tag)
+//    bool OnString8(const char* s, size_t sz, int tag)
+//    bool OnString16(const wchar_t* s, size_t sz, int tag)
 //    bool OnUnixFd(int fd, int tag)
 //    bool OnWinHandle(void* handle, int tag)
-//    const void* GetBuffer(size_t* sz)
+//    const IOSegment* GetSegments(size_t* count)
+//    const int* GetUnixFds(size_t* count)
+//    void Trim(size_t max_bytes)
+//  The strings passed to the encoder are only guaranteed to be valid until the message has been
+//  handed to the transport, so the encoder can reference them instead of copying. SetCallId()
+//  is called before Open() and its value, when not zero, must be carried in the message header.
+//
+//  Transport should implement:
+//    size_t Send(const IOSegment* segs, size_t count)
+//    size_t ReceiveInto(char* buf, size_t* size)
+//  ReceiveInto() blocks until it reads at least one byte and at most |*size| bytes into |buf|.
+//  Reading 0 bytes, for example because the other end closed, is an error. Transports that
+//  can pass OS handles also specialize HandleTransport, see ipc_handles.h, and the ones that
+//  can be read without blocking specialize PollTransport, see ipc_poll.h.
 //
 // Receiving Requirements
 //  Decoder<Handler> should implement:
 //    bool OnData(const char* buff, size_t sz)
 //    bool Success()
+//    bool NeedsMoreData()
+//    bool Idle()
+//    size_t BytesNeeded()
+//    char* GetReceiveBuffer(size_t sz)
+//    bool OnReceived(size_t sz)
+//    void Reset()
+//    void Clear()
+//    void Trim(size_t max_bytes)
 //  Decoder<Handler> should call:
 //    bool Handler::OnMessageStart(int id, int n_args)
+//    void Handler::OnCallId(unsigned int call_id)
 //    bool Handler::OnWord(const void* bits, int type_id)
-//    bool Handler::OnString8(string& str, int type_id) 
-//    bool Handler::OnString16(wstring& str, int type_id)
+//    bool Handler::OnString8(const char* str, size_t sz, int type_id)
+//    bool Handler::OnString16(const wchar_t* str, size_t sz, int type_id)
+//  The |str| pointers passed to the handler point inside the decoder buffer and are valid until
+//  Decoder::Reset() is called, which the channel does after dispatching the message.
+//  OnCallId() is called right after OnMessageStart() if the message has a call id.
+//
+// The channel keeps its encoders and its decoder from one message to the next so their buffers
+// are allocated once. Buffers that grow past kMaxRetainedSz bytes are released after use. The
+// received strings live in an arena which is recycled after each message is dispatched.
+//
+// Messages can be batched to save transport writes, see BeginBatch() and SendBatch(). The
+// receiver needs no changes since the decoder already handles several messages per read.
+//
+// Several calls can be in flight at the same time, see Call(). Each one carries a call id in the
+// message header so its reply can be matched even if replies arrive out of order.
+//
+// Send() can be called from several threads at once, so one channel and one transport can be
+// shared by all the threads of a process. Each sender encodes on its own and then queues its
+// segments on a lock-free list. Whichever sender finds the transport idle becomes the writer:
+// it takes every queued message and writes them together with one vectored write, while the
+// other senders wait for theirs to be written. The transport only sees one writer at a time.
+// A dispatcher can hand the received messages to other threads with DetachCall() and
+// DispatchDetached(), see DispatchPool.
+//
+// Payloads too big for one message, or that are produced or consumed a piece at a time, go
+// in a stream, see ipc_stream.h. The decoder then only holds one chunk at a time and the
+// receiver decides with its window how much can be in flight.
+//
+// |MetricsT| is told about every message sent and received, see ipc_metrics.h. The default
+// records nothing and costs nothing.
+//
+// With SetLaneChunkSize() the large messages go on a bulk lane, cut in pieces, and the other
+// messages on an urgent lane that the writer serves first. A control message or a small query
+// then waits for one piece of a large transfer at most, not for all of it.
+//
+// With SetReceiveSpin() the receiver polls the transport for a while before it blocks, which
+// saves the wake up on channels where the replies come fast. Only those channels burn CPU.
 //
 
 namespace ipc {
 
-template <class TransportT, class EncoderT, template <class> class DecoderT>
+// Operations of the kMessagePrivControl messages that carry the pieces of a bulk lane message,
+// after those of ipc_stream.h and ipc_metrics.h. The second argument is the id of the message
+// and the third one the piece, the last piece is LANE_END.
+enum {
+  LANE_DATA = 5,
+  LANE_END = 6
+};
+
+template <class TransportT, class EncoderT, template <class> class DecoderT,
+          class MetricsT = NoMetrics>
 class Channel {
  public:
+#if defined(IPC_USE_VARIADIC)
+  static const size_t kMaxNumArgs = 64;
+#else
   static const size_t kMaxNumArgs = 10;
-  Channel(TransportT* transport) : transport_(transport), last_msg_id_(-1) {}
+#endif
+  // Arguments of a received message that are stored without allocating.
+  static const size_t kInlineArgs = 10;
+  // Number of encoders that can be in use by concurrent senders before falling back to
+  // a temporary encoder.
+  static const size_t kEncoderPoolSize = 4;
+  // Largest buffer size in bytes that the encoders and the decoder keep between messages.
+  static const size_t kMaxRetainedSz = 64 * 1024;
+  // Bounds for the size of each transport read. See SetMaxReadSize().
+  static const size_t kMinReadSz = 4 * 1024;
+  static const size_t kMaxReadSz = 1024 * 1024;
+  // Number of calls that can wait for their reply at the same time.
+  static const size_t kMaxPendingCalls = 32;
+  // Set in the call id of a reply, so that the calls made by each side do not collide.
+  static const unsigned int kCallReplyBit = 0x80000000;
+  // Most segments handed to the transport in one write when coalescing concurrent sends.
+  static const size_t kMaxWriteSegs = 64;
+  // Times a sender checks if its message was written before it sleeps until it is.
+  static const size_t kSendSpins = 256;
+  // Number of streams that can be open at the same time, in each direction.
+  static const size_t kMaxStreams = 16;
+  // Largest chunk of stream data sent in one message.
+  static const size_t kStreamChunkSz = 32 * 1024;
+  // Smallest piece of a bulk lane message. See SetLaneChunkSize().
+  static const size_t kMinLaneChunkSz = 4 * 1024;
+  // Number of bulk lane messages that can be on their way at the same time, in each direction.
+  static const size_t kMaxBulkMsgs = 8;
+  // Largest message that the receiver puts back together from bulk lane pieces.
+  static const size_t kMaxBulkMsgSz = 64 * 1024 * 1024;
+
+  // One message of a SendBatch() call.
+  struct BatchMsg {
+    int msg_id;
+    const WireType* const* args;
+    int n_args;
+  };
+
+  // What the argument lists given to SendArgs() and CallArgs() encode themselves with. The
+  // first three functions go straight to the encoder of the message; OnWire() takes anything
+  // that needs the channel, like the handles.
+  class ArgWriter {
+   public:
+    ArgWriter(Channel* channel, EncoderT* encoder) : channel_(channel), encoder_(encoder) {}
+
+    bool OnWord(void* bits, int tag) { return encoder_->OnWord(bits, tag); }
+
+    bool OnString8(const char* s, size_t sz, int tag) { return encoder_->OnString8(s, sz, tag); }
+
+    bool OnString16(const wchar_t* s, size_t sz, int tag) {
+      return encoder_->OnString16(s, sz, tag);
+    }
+
+    bool OnWire(const WireType& wtype) { return channel_->AddMsgElement(encoder_, wtype); }
+
+   private:
+    Channel* channel_;
+    EncoderT* encoder_;
+  };
+
+  Channel(TransportT* transport)
+      : transport_(transport), last_msg_id_(-1), max_read_sz_(kMaxReadSz), spin_us_(0),
+        spin_yield_(false), decoder_(&handler_), rx_depth_(0), replies_(NULL), last_call_id_(0),
+        pending_count_(0), last_stream_id_(0), lane_chunk_sz_(0), last_bulk_id_(0),
+        bulk_out_(0), batch_max_sz_(0), batch_max_ms_(0), batch_count_(0),
+        batch_start_ms_(0), send_head_(NULL), writer_busy_(0) {
+    flush_gate_.Signal();
+    for (size_t ix = 0; ix != kEncoderPoolSize; ++ix) {
+      enc_busy_[ix] = 0;
+    }
+    for (size_t ix = 0; ix != kMaxPendingCalls; ++ix) {
+      calls_[ix].call_id = 0;
+    }
+    for (size_t ix = 0; ix != kMaxStreams; ++ix) {
+      out_streams_[ix].id = 0;
+      in_streams_[ix].id = 0;
+    }
+  }
 
   // This is the last message that was received. Or at least the header was
   // correct so we could extract the message id.
   int LastRecvMsgId() const { return last_msg_id_; }
 
+  // Each read from the transport asks for what the message being received still needs, but
+  // no more than |max_sz| bytes. Large messages then take few reads instead of one read per
+  // kMinReadSz bytes.
+  void SetMaxReadSize(size_t max_sz) {
+    max_read_sz_ = (max_sz < kMinReadSz) ? kMinReadSz : max_sz;
+  }
+
+  // Makes Receive() poll the transport for up to |spin_us| microseconds when it runs out of
+  // data, and block in ReceiveInto() only if nothing came by then. The metrics policy is told
+  // if each spin got its data, see MetricsT::OnSpin(). It needs a transport that specializes
+  // PollTransport, with the others it does nothing. 0 turns it off, which is the default.
+  // With a single processor the sender cannot run while the receiver spins, so there the
+  // receiver yields to it between polls.
+  void SetReceiveSpin(unsigned int spin_us) {
+    spin_us_ = spin_us;
+    spin_yield_ = (CpuCount() < 2);
+  }
+
+  // Turns on the priority lanes for what this end sends. A message that encodes to more than
+  // |chunk_sz| bytes goes on the bulk lane as kMessagePrivControl pieces of up to |chunk_sz|
+  // bytes, each one written on its own, and the messages that other threads send in the
+  // meantime go in between the pieces. The receiver decodes the pieces as they arrive and
+  // dispatches the message after the last one, so the messages that overtook it are
+  // dispatched first. The stream chunks and the messages with file descriptors are not cut,
+  // and neither are the messages of batch mode. 0 turns the lanes off, which is the default;
+  // the peer needs to be a channel that knows the LANE_DATA operation.
+  void SetLaneChunkSize(size_t chunk_sz) {
+    lane_chunk_sz_ = (chunk_sz && (chunk_sz < kMinLaneChunkSz)) ? kMinLaneChunkSz : chunk_sz;
+  }
+
   // Sends the message (|args| + msg_id) to the other end of the connected
   // |transport| passed to the constructor. This call can block or not depending
   // on the transport implementation.
+  //
+  // Between BeginBatch() and EndBatch() the message is queued instead and the call returns
+  // RcOK, unless it triggers a flush in which case the result of the write is returned.
+  //
+  // If the message being dispatched by Receive() on this thread belongs to a call, the first
+  // message sent is its reply and gets the call id.
   size_t Send(int msg_id, const WireType* const args[], int n_args)  {
-    EncoderT encoder;
-    encoder.Open(n_args);
-    for (int ix = 0; ix != n_args; ++ix) {
-      if (!AddMsgElement(&encoder, *args[ix]))
-        return RcErrEncoderType;
+    return SendWithCallId(TakeReplyCallId(), msg_id, args, n_args);
+  }
+
+  // Sends the message as a call. The reply is dispatched to |reply|, which needs to implement
+  // the same OnMsgIn() as the message handlers returned by DispatchT::MsgHandler(), by the
+  // Receive() or WaitCalls() that reads it. In the meantime other calls can be made and other
+  // messages received; replies do not need to arrive in the order the calls were made.
+  // |reply| must stay alive until then.
+  template <class ReplyT>
+  size_t Call(int msg_id, const WireType* const args[], int n_args, ReplyT* reply) {
+    return CallArgs(msg_id, WireArgs(args, n_args), reply);
+  }
+
+  // Same as Send() and Call() but |args| encodes the arguments itself, with no WireType in
+  // between. ArgsT needs to implement:
+  //   int Count() const;
+  //   template <class WriterT> bool Encode(WriterT* writer) const;
+  // where Encode() calls one of the ArgWriter functions per argument, in order, and returns
+  // false if one of them fails. The IPC_MSG_DEFn macros of ipc_msg_schema.h generate them.
+  template <class ArgsT>
+  size_t SendArgs(int msg_id, const ArgsT& args) {
+    return SendArgsWithCallId(TakeReplyCallId(), msg_id, args);
+  }
+
+  template <class ArgsT, class ReplyT>
+  size_t CallArgs(int msg_id, const ArgsT& args, ReplyT* reply) {
+    unsigned int call_id = AddPendingCall(reply, &ReplyThunk<ReplyT>);
+    if (!call_id)
+      return RcErrTooManyCalls;
+    size_t rc = SendArgsWithCallId(call_id, msg_id, args);
+    if (rc != RcOK) {
+      PendingCall unused;
+      TakePendingCall(call_id, &unused);
     }
+    return rc;
+  }
 
-    encoder.SetMsgId(msg_id);
-    if (!encoder.Close())
-      return RcErrEncoderClose;
+  // Number of calls waiting for their reply.
+  size_t PendingCalls() const { return pending_count_; }
 
-    size_t size;
-    const void* buf = encoder.GetBuffer(&size);
-    if (!buf)
-      return RcErrEncoderBuffer;
-    return transport_->Send(buf, size);
+  // Asks the other end for a snapshot of its metrics. |query| gets the reply like for a Call(),
+  // from a later Receive() or WaitCalls().
+  size_t QueryMetrics(MetricsQuery* query) {
+    WireType wt_op(static_cast<unsigned int>(CONTROL_METRICS));
+    WireType wt_id(0u);
+    WireType wt_arg(0u);
+    const WireType* const args[] = { &wt_op, &wt_id, &wt_arg };
+    return Call(kMessagePrivControl, args, 3, query);
+  }
+
+  MetricsT& metrics() { return metrics_; }
+
+  // Receives until there are no calls waiting for their reply. Messages that are not replies
+  // go to |top_dispatch| as in Receive(). Returns OnMsgReady or the first error.
+  template <class DispatchT>
+  size_t WaitCalls(DispatchT* top_dispatch) {
+    while (pending_count_) {
+      size_t rc = Receive(top_dispatch);
+      if (rc != ipc::OnMsgReady)
+        return rc;
+    }
+    return ipc::OnMsgReady;
+  }
+
+  // Registers |source| as the sender of a new stream and returns the stream id, or 0 if
+  // kMaxStreams streams are being sent already. Nothing can be written until the other end
+  // accepts the stream, which calls source->OnStreamCredit(). |source| must stay alive until
+  // CloseStream().
+  unsigned int OpenStream(StreamSource* source) {
+    AutoSpinLock lock(&streams_lock_);
+    StreamState* st = FindStream(out_streams_, 0);
+    if (!st)
+      return 0;
+    do {
+      ++last_stream_id_;
+    } while (!last_stream_id_ || FindStream(out_streams_, last_stream_id_));
+    st->id = last_stream_id_;
+    st->source = source;
+    st->sink = NULL;
+    st->credit = 0;
+    st->consumed = 0;
+    st->window = 0;
+    return st->id;
+  }
+
+  // Sends as much of the |sz| bytes at |buf| as the credit of stream |id| allows, in chunks
+  // of up to kStreamChunkSz bytes, and returns in |written| how many. It is not an error to
+  // write nothing: the rest can be written once OnStreamCredit() is called. A writer that has
+  // nothing else to do can call Receive() to wait for it. The stream must be written by one
+  // thread at a time.
+  size_t WriteStream(unsigned int id, const char* buf, size_t sz, size_t* written) {
+    *written = 0;
+    size_t allowed = 0;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = id ? FindStream(out_streams_, id) : NULL;
+      if (!st)
+        return RcErrBadStreamId;
+      allowed = (sz < st->credit) ? sz : st->credit;
+      st->credit -= allowed;
+    }
+    while (*written != allowed) {
+      size_t chunk = allowed - *written;
+      if (chunk > kStreamChunkSz)
+        chunk = kStreamChunkSz;
+      size_t rc = SendStreamMsg(STREAM_DATA, id, WireType(ByteArrayRef(chunk, buf + *written)));
+      if (rc != RcOK)
+        return rc;
+      *written += chunk;
+    }
+    return RcOK;
+  }
+
+  // Ends stream |id|. The receiver gets |status| in its OnStreamEnd().
+  size_t CloseStream(unsigned int id, int status) {
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = id ? FindStream(out_streams_, id) : NULL;
+      if (!st)
+        return RcErrBadStreamId;
+      st->id = 0;
+    }
+    return SendStreamMsg(STREAM_END, id, WireType(status));
+  }
+
+  // Starts receiving stream |id|, opened by the other end, into |sink|. At most |window| bytes
+  // can be on their way at any time; credit is sent back as |sink| consumes them, half a window
+  // at a time. |sink| must stay alive until its OnStreamEnd() is called.
+  size_t AcceptStream(unsigned int id, StreamSink* sink, unsigned int window) {
+    if (!id || !window)
+      return RcErrBadStreamId;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      if (FindStream(in_streams_, id))
+        return RcErrBadStreamId;
+      StreamState* st = FindStream(in_streams_, 0);
+      if (!st)
+        return RcErrTooManyStreams;
+      st->id = id;
+      st->source = NULL;
+      st->sink = sink;
+      st->credit = window;
+      st->consumed = 0;
+      st->window = window;
+    }
+    return SendStreamMsg(STREAM_CREDIT, id, WireType(window));
+  }
+
+  // Encodes the |count| messages back to back and sends them with a single transport write,
+  // after any messages already queued by batch mode. If one of them fails to encode none of
+  // them is sent.
+  size_t SendBatch(const BatchMsg msgs[], size_t count) {
+    {
+      AutoSpinLock lock(&batch_lock_);
+      const size_t mark = batch_.size();
+      for (size_t ix = 0; ix != count; ++ix) {
+        size_t rc = EncodeAndSend(&batch_, 0, msgs[ix].msg_id,
+                                  WireArgs(msgs[ix].args, msgs[ix].n_args));
+        if (rc != RcOK) {
+          batch_.resize(mark);
+          return rc;
+        }
+      }
+      batch_count_ += count;
+    }
+    return Flush();
+  }
+
+  // Starts batch mode. Sent messages are queued and written together once they add up to
+  // |max_bytes| or the oldest one has waited |max_ms| milliseconds. There is no timer, the
+  // time is only checked when a message is queued, so that a pause in the sending does not
+  // hold back the last messages call FlushBatch() or EndBatch(). Receive() also flushes first
+  // so that a request is never stuck in the queue while waiting for its reply.
+  void BeginBatch(size_t max_bytes, unsigned int max_ms) {
+    AutoSpinLock lock(&batch_lock_);
+    batch_max_sz_ = max_bytes ? max_bytes : 1;
+    batch_max_ms_ = max_ms;
+  }
+
+  // Sends the queued messages, if any.
+  size_t FlushBatch() {
+    return Flush();
+  }
+
+  // Sends the queued messages and leaves batch mode.
+  size_t EndBatch() {
+    {
+      AutoSpinLock lock(&batch_lock_);
+      batch_max_sz_ = 0;
+    }
+    return Flush();
   }
 
   // Blocking wait for a message to arrive to from the other end of the
@@ -97,7 +463,10 @@ class Channel {
   //
   // The DispatchT class is required to implement two functions:
   // 1- Tm* MsgHandler(int msg_id);
-  //    The return value is a pointer to an object of a type that can handle |msg_id|.
+  //    The return value is a pointer to an object of a type that can handle |msg_id|, or
+  //    NULL if there is none and then the message is dropped with RcErrBadMessageId.
+  //    It is also called as soon as the message id is decoded, so the arguments of a message
+  //    that has no handler are not converted.
   //    This class must implement:
   //    size_t Tm::OnMsgIn(int msg_id,
   //                       ChannelT* ch,
@@ -118,63 +487,103 @@ class Channel {
   //
   template <class DispatchT>
   size_t Receive(DispatchT* top_dispatch) {
+    if (batch_count_) {
+      size_t rc = FlushBatch();
+      if (rc != RcOK)
+        return rc;
+    }
+    if (rx_depth_) {
+      // Receive() called from inside a message handler. The channel decoder is busy with
+      // the outer message so this call gets its own.
+      RxHandler handler;
+      DecoderT<RxHandler> decoder(&handler);
+      return ReceiveWith(top_dispatch, handler, decoder);
+    }
+    ++rx_depth_;
+    size_t rc = ReceiveWith(top_dispatch, handler_, decoder_);
+    handler_.Trim(kMaxRetainedSz);
+    decoder_.Trim(kMaxRetainedSz);
+    --rx_depth_;
+    return rc;
+  }
 
-    RxHandler handler;
-    DecoderT<RxHandler> decoder(&handler);
-
-    // There are two do/while nested loops. The inner one runs until a full message
-    // has been decoded and the outer one runs until a dispatcher returns anything
-    // but a 0. The inner loop has two modes, in one it requires more external data
-    // and in the other it can keep processing what has been read so far. They are
-    // required to handle the case of reading less than a full message and when
-    // reading more than one message.
-    size_t retv = 0;
-    do {
-      size_t received = 0;
-       const char* buf = NULL;
-      do {
-        if (decoder.NeedsMoreData()) {
-          buf = transport_->Receive(&received);
-          if (!buf) {
-            // read failed.
-            return RcErrTransportRead;
-          }
-        } else {
-          buf = NULL;
-        }
-      } while (decoder.OnData(buf, received));
-
-      last_msg_id_ = handler.MsgId();
-
-      if(!decoder.Success())
-        return RcErrDecoderFormat;
+  // Non-blocking receive, for callers that wait for data themselves, like Reactor. Instead of
+  // Receive() they read from the transport into the buffer returned by GetReceiveBuffer() and
+  // then call OnReceived() with the number of bytes read, which dispatches every message that
+  // is now complete. It returns OnMsgLoopNext once it runs out of data, or the first non-zero
+  // value returned by a message handler. In the latter case the messages that are left will
+  // be dispatched by the next OnReceived() call, which can be given 0 bytes.
+  char* GetReceiveBuffer(size_t* size) {
+    *size = ReadSize(decoder_.BytesNeeded());
+    return decoder_.GetReceiveBuffer(*size);
+  }
 
-      size_t np = handler.GetArgCount();
-      if (np > kMaxNumArgs)
-        return RcErrDecoderArgs;
+  template <class DispatchT>
+  size_t OnReceived(DispatchT* top_dispatch, size_t received) {
+    ++rx_depth_;
+    handler_.SetDispatch(top_dispatch);
+    size_t rc = ipc::OnMsgLoopNext;
+    RxCost cost = { 0, 0 };
+    if (received) {
+      metrics_.OnRead(received);
+      cost.reads = 1;
+    }
+    unsigned int start = metrics_.Now();
+    bool more = decoder_.OnReceived(received);
+    cost.decode_us += metrics_.Now() - start;
+    while (!more) {
+      rc = DispatchDecoded(top_dispatch, handler_, decoder_, cost);
+      if (rc != ipc::OnMsgLoopNext)
+        break;
+      RxCost next = { 0, 0 };
+      cost = next;
+      start = metrics_.Now();
+      more = decoder_.NeedsMoreData() || decoder_.OnData(NULL, 0);
+      cost.decode_us += metrics_.Now() - start;
+    }
+    --rx_depth_;
+    return rc;
+  }
 
-      const WireType* args[kMaxNumArgs];
-      for (size_t ix = 0; ix != np; ++ix) {
-        args[ix] = &handler.GetArg(ix);
-      }
+  // Frees the receive buffers if they grew past kMaxRetainedSz. Receive() does it on its own,
+  // users of OnReceived() should call it when the channel goes idle. It does nothing while
+  // part of a message has been received.
+  void TrimReceive() {
+    if (!decoder_.Idle())
+      return;
+    handler_.Trim(kMaxRetainedSz);
+    decoder_.Trim(kMaxRetainedSz);
+  }
 
-      if ((handler.MsgId() == kMessagePrivNewTransport) &&
-          (np == 1) && (args[0]->GetAsBits() == NULL)) {
-        // Got special rpc to create a new transport. On the receiving side we handle it entirely
-        // here by calling OnNewTransport and then sending the reply, but on the sending side it
-        // is handled by a NewTransportHandler object so it actually uses top_dispatch->MsgHandler().
-        void* handle = top_dispatch->OnNewTransport();
-        retv = handle ? SendNewTransportMsg(handle) : ipc::OnMsgLoopNext;
-      } else {
-        // Got one regular message. Now dispatch it.
-        retv = top_dispatch->MsgHandler(handler.MsgId())->OnMsgIn(handler.MsgId(), this, args, np);
-      }
+  TransportT* transport() const { return transport_; }
 
-      handler.Clear();
-      decoder.Reset();
-    } while(ipc::OnMsgLoopNext == retv);
+  // For message handlers that finish the work on another thread. Called from OnMsgIn(), it
+  // returns the call id of the message being dispatched, or 0 if it is not a call, and the
+  // reply is no longer taken from what this thread sends.
+  unsigned int DetachCall() {
+    AutoSpinLock lock(&calls_lock_);
+    DetachedReply* reply = FindReply(CurrentThreadId());
+    if (!reply)
+      return 0;
+    const unsigned int call_id = reply->call_id;
+    reply->call_id = 0;
+    return call_id;
+  }
 
-    return retv;
+  // Dispatches to |handler| a message received earlier, on the calling thread. If |call_id|
+  // comes from DetachCall() the first message that this thread sends is its reply. The |args|
+  // must remain valid during the call since, unlike for Receive(), they are not owned by
+  // the channel.
+  template <class HandlerT>
+  size_t DispatchDetached(HandlerT* handler, unsigned int call_id, int msg_id,
+                          const WireType* const args[], int count) {
+    if (!call_id)
+      return handler->OnMsgIn(msg_id, this, args, count);
+    DetachedReply reply = { CurrentThreadId(), call_id, NULL };
+    PushReply(&reply);
+    size_t rc = handler->OnMsgIn(msg_id, this, args, count);
+    PopReply(&reply);
+    return rc;
   }
 
   // Issues an rpc to the remote side, usually the server to get a new transport identifier, it is
@@ -198,18 +607,40 @@ class Channel {
   // convenience. Treat it as private though.
   class RxHandler {
    public:
-    RxHandler() : msg_id_(-1) {} 
+    RxHandler()
+        : msg_id_(-1), call_id_(0), handles_(0), accepts_(NULL), dispatch_(NULL),
+          rejected_(false) {} 
+
+    // The messages that |top_dispatch| has no handler for are rejected as soon as their id
+    // is decoded, see Rejected().
+    template <class DispatchT>
+    void SetDispatch(DispatchT* top_dispatch) {
+      accepts_ = &Accepts<DispatchT>;
+      dispatch_ = top_dispatch;
+    }
 
     // Called when a valid message preamble is received.
     bool OnMessageStart(int id, int n_args) {
       msg_id_ = id;
+      rejected_ = accepts_ && (id != kMessagePrivNewTransport) &&
+          (id != kMessagePrivControl) && !accepts_(dispatch_, id);
       if (n_args > kMaxNumArgs)
         return false;
       return true;
     }
 
-    // Handles the word-sized 'value' decoded types.
+    // Replies go to the call that is waiting for them, not to the dispatcher.
+    void OnCallId(unsigned int call_id) {
+      call_id_ = call_id;
+      if (call_id & kCallReplyBit)
+        rejected_ = false;
+    }
+
+    // Handles the word-sized 'value' decoded types. The arguments of a rejected message are
+    // not converted, except the handles which still have to be taken from the transport.
     bool OnWord(const void* bits, int type_id) {
+      if (rejected_ && (type_id != ipc::TYPE_HANDLE))
+        return true;
       switch (type_id) {
         case ipc::TYPE_INT32:
           list_.push_back(WireType(*reinterpret_cast<const int*>(bits)));
@@ -230,8 +661,10 @@ class Channel {
           list_.push_back(WireType(*reinterpret_cast<const wchar_t*>(bits)));
           break;
         case ipc::TYPE_VOIDPTR:
-          list_.push_back(WireType(reinterpret_cast<const void*>(
-              *reinterpret_cast<const unsigned long*>(bits))));
+          list_.push_back(WireType(*reinterpret_cast<const void* const*>(bits)));
+          break;
+        case ipc::TYPE_FLOAT32:
+          list_.push_back(WireType(*reinterpret_cast<const float*>(bits)));
           break;
         case ipc::TYPE_NULLSTRING8:
           list_.push_back(WireType(static_cast<char*>(NULL)));
@@ -242,21 +675,58 @@ class Channel {
         case ipc::TYPE_NULLBARRAY:
           list_.push_back(WireType(ipc::ByteArray(0, NULL)));
           break;
+        case ipc::TYPE_NULLINT32ARRAY:
+          list_.push_back(WireType(ipc::Int32Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLUINT32ARRAY:
+          list_.push_back(WireType(ipc::UInt32Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLINT64ARRAY:
+          list_.push_back(WireType(ipc::Int64Array(0, NULL)));
+          break;
+        case ipc::TYPE_NULLUINT64ARRAY:
+          list_.push_back(WireType(ipc::UInt64Array(0, NULL)));
+          break;
+        case ipc::TYPE_HANDLE:
+          list_.push_back(WireType(OsHandle::FromBits(*reinterpret_cast<void* const*>(bits))));
+          ++handles_;
+          break;
         default:
           return false;
       }
       return true;
     }
 
-    // Handles the byte-sized arrays.
-    bool OnString8(IPCString& str, int type_id) {
+    // Handles the byte-sized arrays. Nothing is copied, the WireType borrows the decoder
+    // buffer which outlives the dispatch of the message. The wire format does not guarantee a
+    // null terminator for strings so the WireType makes a terminated copy, in the message
+    // arena, the first time the handler reads it. Arguments that the handler ignores, or
+    // messages that it rejects, cost no copies. The 64-bit values and the typed arrays also
+    // arrive here as their raw bytes.
+    bool OnString8(const char* str, size_t sz, int type_id) {
+      if (rejected_)
+        return true;
       switch (type_id) {
         case ipc::TYPE_STRING8:
-          list_.push_back(WireType(str.c_str()));
+          list_.push_back(WireType(String8LazyRef(sz, str, &arena_)));
           break;
         case ipc::TYPE_BARRAY:
-          list_.push_back(WireType(ByteArray(str.size(), str.c_str())));
+          list_.push_back(WireType(ByteArrayRef(sz, str)));
           break;
+        case ipc::TYPE_INT64:
+          return OnValue<long long>(str, sz);
+        case ipc::TYPE_UINT64:
+          return OnValue<unsigned long long>(str, sz);
+        case ipc::TYPE_FLOAT64:
+          return OnValue<double>(str, sz);
+        case ipc::TYPE_INT32ARRAY:
+          return OnArray<Int32Array>(str, sz);
+        case ipc::TYPE_UINT32ARRAY:
+          return OnArray<UInt32Array>(str, sz);
+        case ipc::TYPE_INT64ARRAY:
+          return OnArray<Int64Array>(str, sz);
+        case ipc::TYPE_UINT64ARRAY:
+          return OnArray<UInt64Array>(str, sz);
         default: 
           return false;
       }
@@ -264,10 +734,12 @@ class Channel {
     }
 
     // Handles the wchar-sized arrays.
-    bool OnString16(IPCWString& str, int type_id) {
+    bool OnString16(const wchar_t* str, size_t sz, int type_id) {
+      if (rejected_)
+        return true;
       switch (type_id) {
         case ipc::TYPE_STRING16:
-          list_.push_back(WireType(str.c_str()));
+          list_.push_back(WireType(String16LazyRef(sz, str, &arena_)));
           break;
         default: 
           return false;
@@ -276,6 +748,12 @@ class Channel {
     }
 
     int MsgId() const { return msg_id_; }
+
+    unsigned int CallId() const { return call_id_; }
+
+    // True if the dispatcher has no handler for the message. Only its handle arguments are
+    // kept.
+    bool Rejected() const { return rejected_; }
     
     const WireType& GetArg(size_t ix) {
       return list_[ix];
@@ -283,15 +761,96 @@ class Channel {
 
     size_t GetArgCount() const { return list_.size(); }
 
+    // Swaps what the message carried for each handle argument with the handle that
+    // |transport| received for it. On failure the ones imported so far are closed.
+    bool ImportHandles(TransportT* transport) {
+      for (size_t ix = 0; handles_ && (ix != list_.size()); ++ix) {
+        if (list_[ix].Id() != ipc::TYPE_HANDLE)
+          continue;
+        OsHandle::Value h = list_[ix].AsHandle().h_;
+        if (!HandleTransport<TransportT>::Import(transport, &h)) {
+          CloseHandles(ix);
+          return false;
+        }
+        list_[ix] = WireType(OsHandle(h));
+        --handles_;
+      }
+      return true;
+    }
+
+    // Closes the imported handle arguments, for the messages that no handler takes.
+    void CloseHandles() {
+      CloseHandles(list_.size());
+    }
+
+    // Releases all the arguments of the current message.
     void Clear() {
       list_.clear();
+      arena_.Reset();
       msg_id_ = -1;
+      call_id_ = 0;
+      handles_ = 0;
+      rejected_ = false;
+    }
+
+    // Frees the string storage if it holds more than |max_bytes|. Call after Clear().
+    void Trim(size_t max_bytes) {
+      arena_.Trim(max_bytes);
     }
 
   private:
-    typedef FixedArray<WireType, (kMaxNumArgs + 1)> RxList;
+    typedef bool (*AcceptsFn)(void* dispatch, int msg_id);
+
+    template <class DispatchT>
+    static bool Accepts(void* dispatch, int msg_id) {
+      return static_cast<DispatchT*>(dispatch)->MsgHandler(msg_id) != NULL;
+    }
+
+    void CloseHandles(size_t end) {
+      for (size_t ix = 0; ix != end; ++ix) {
+        if (list_[ix].Id() == ipc::TYPE_HANDLE)
+          list_[ix].AsHandle().Close();
+      }
+    }
+
+    template <typename T>
+    bool OnValue(const char* bytes, size_t sz) {
+      if (sz != sizeof(T))
+        return false;
+      T v;
+      memcpy(&v, bytes, sizeof(v));
+      list_.push_back(WireType(v));
+      return true;
+    }
+
+    // The array borrows the decoder buffer like the byte arrays do, unless the elements are
+    // not aligned in it, which the compact codec does not guarantee. Then they are copied to
+    // the arena.
+    template <class ArrayT>
+    bool OnArray(const char* bytes, size_t sz) {
+      typedef typename ArrayT::ElementType T;
+      if (sz % sizeof(T))
+        return false;
+      const size_t align = (sizeof(T) < sizeof(void*)) ? sizeof(T) : sizeof(void*);
+      if (reinterpret_cast<size_t>(bytes) & (align - 1)) {
+        char* copy = static_cast<char*>(arena_.Alloc(sz));
+        memcpy(copy, bytes, sz);
+        bytes = copy;
+      }
+      list_.push_back(WireType(ArrayT(sz / sizeof(T), reinterpret_cast<const T*>(bytes))));
+      return true;
+    }
+
+    typedef SmallArray<WireType, kInlineArgs> RxList;
     RxList list_;
+    Arena arena_;
     int msg_id_;
+    unsigned int call_id_;
+    // Handle arguments not imported yet.
+    size_t handles_;
+    AcceptsFn accepts_;
+    void* dispatch_;
+    bool rejected_;
   };
 
 private:
@@ -319,12 +878,797 @@ private:
     void* t_handle_;
   };
 
+  typedef size_t (*ReplyFn)(void* reply, int msg_id, Channel* ch,
+                           const WireType* const args[], int count);
+
+  struct PendingCall {
+    unsigned int call_id;
+    void* reply;
+    ReplyFn fn;
+  };
+
+  // What it took to receive a message, for |metrics_|.
+  struct RxCost {
+    unsigned int reads;
+    unsigned int decode_us;
+  };
+
+  // States of SendNode::done.
+  enum {
+    SEND_PENDING = 0,
+    SEND_DONE = 1,
+    // The sender sleeps on |wake| until the message is written.
+    SEND_BLOCKED = 2
+  };
+
+  // A message waiting to be written to the transport. They live on the stack of their sender.
+  struct SendNode {
+    const IOSegment* segs;
+    size_t count;
+    const int* fds;
+    size_t n_fds;
+    bool bulk;
+    size_t rc;
+    volatile long done;
+    Semaphore* wake;
+    SendNode* next;
+  };
+
+  // A message being dispatched by Receive() or DispatchDetached(), with the id of the call to
+  // reply to or 0. They live on the stack of their thread.
+  struct DetachedReply {
+    ThreadId thread;
+    unsigned int call_id;
+    DetachedReply* next;
+  };
+
+  // A bulk lane message being received, decoded as its pieces arrive. Free entries have a
+  // zero id.
+  struct BulkRx {
+    unsigned int id;
+    size_t size;
+    RxHandler handler;
+    DecoderT<RxHandler> decoder;
+
+    BulkRx() : id(0), size(0), decoder(&handler) {}
+  };
+
+  template <class ReplyT>
+  static size_t ReplyThunk(void* reply, int msg_id, Channel* ch,
+                           const WireType* const args[], int count) {
+    return static_cast<ReplyT*>(reply)->OnMsgIn(msg_id, ch, args, count);
+  }
+
+  // Returns the new call id or 0 if there are too many calls in flight.
+  unsigned int AddPendingCall(void* reply, ReplyFn fn) {
+    AutoSpinLock lock(&calls_lock_);
+    if (pending_count_ == kMaxPendingCalls)
+      return 0;
+    do {
+      last_call_id_ = (last_call_id_ + 1) & ~kCallReplyBit;
+    } while (!last_call_id_ || FindPendingCall(last_call_id_));
+    PendingCall* call = FindPendingCall(0);
+    call->call_id = last_call_id_;
+    call->reply = reply;
+    call->fn = fn;
+    ++pending_count_;
+    return last_call_id_;
+  }
+
+  // Removes the call from the pending table. Returns false if there is no such call.
+  bool TakePendingCall(unsigned int call_id, PendingCall* out) {
+    if (!call_id)
+      return false;
+    AutoSpinLock lock(&calls_lock_);
+    PendingCall* call = FindPendingCall(call_id);
+    if (!call)
+      return false;
+    *out = *call;
+    call->call_id = 0;
+    --pending_count_;
+    return true;
+  }
+
+  PendingCall* FindPendingCall(unsigned int call_id) {
+    for (size_t ix = 0; ix != kMaxPendingCalls; ++ix) {
+      if (calls_[ix].call_id == call_id)
+        return &calls_[ix];
+    }
+    return NULL;
+  }
+
+  // Dispatches a reply to its call. The call is over so Receive() returns even if the reply
+  // handler asks to loop.
+  size_t CompleteCall(unsigned int call_id, int msg_id, const WireType* const args[], int np) {
+    PendingCall call;
+    if (!TakePendingCall(call_id, &call)) {
+      CloseHandleArgs(args, np);
+      return RcErrBadCallId;
+    }
+    size_t rc = call.fn(call.reply, msg_id, this, args, np);
+    return (ipc::OnMsgLoopNext == rc) ? ipc::OnMsgReady : rc;
+  }
+
+  // Returns the id for a reply if the calling thread is dispatching a call that has not been
+  // replied yet, 0 otherwise.
+  unsigned int TakeReplyCallId() {
+    // A thread only finds its own entries, which it added itself, so the check without the
+    // lock is enough to know there are none.
+    if (!AtomicLoadPtr(reinterpret_cast<void* const volatile*>(&replies_)))
+      return 0;
+    AutoSpinLock lock(&calls_lock_);
+    DetachedReply* reply = FindReply(CurrentThreadId());
+    if (!reply || !reply->call_id)
+      return 0;
+    const unsigned int call_id = reply->call_id | kCallReplyBit;
+    reply->call_id = 0;
+    return call_id;
+  }
+
+  // The innermost message being dispatched by |thread|. Called with |calls_lock_| held.
+  DetachedReply* FindReply(ThreadId thread) {
+    for (DetachedReply* reply = replies_; reply; reply = reply->next) {
+      if (SameThread(reply->thread, thread))
+        return reply;
+    }
+    return NULL;
+  }
+
+  void PushReply(DetachedReply* reply) {
+    AutoSpinLock lock(&calls_lock_);
+    reply->next = replies_;
+    AtomicStorePtr(reinterpret_cast<void* volatile*>(&replies_), reply);
+  }
+
+  void PopReply(DetachedReply* reply) {
+    AutoSpinLock lock(&calls_lock_);
+    DetachedReply** link = const_cast<DetachedReply**>(&replies_);
+    while (*link != reply) {
+      link = &(*link)->next;
+    }
+    AtomicStorePtr(reinterpret_cast<void* volatile*>(link), reply->next);
+  }
+
+  // A stream being sent (|source| is set) or received (|sink| is set). Free entries have a zero
+  // id. For a stream being sent |credit| is what can be written now; for one being received it
+  // is what the sender can still send, |consumed| is what |sink| took since the last credit.
+  struct StreamState {
+    unsigned int id;
+    StreamSource* source;
+    StreamSink* sink;
+    size_t credit;
+    size_t consumed;
+    size_t window;
+  };
+
+  static StreamState* FindStream(StreamState* table, unsigned int id) {
+    for (size_t ix = 0; ix != kMaxStreams; ++ix) {
+      if (table[ix].id == id)
+        return &table[ix];
+    }
+    return NULL;
+  }
+
+  // The stream messages never take the call id of a pending reply.
+  size_t SendStreamMsg(unsigned int op, unsigned int id, const WireType& arg) {
+    WireType wt_op(op);
+    WireType wt_id(id);
+    const WireType* const args[] = { &wt_op, &wt_id, &arg };
+    return SendWithCallId(0, kMessagePrivControl, args, 3);
+  }
+
+  // Answers QueryMetrics(), with a null array if |metrics_| keeps no snapshot.
+  size_t SendMetrics(unsigned int call_id) {
+    if (!call_id)
+      return RcErrDecoderArgs;
+    MetricsSnapshot snapshot;
+    UInt32Array words(0, NULL);
+    if (metrics_.Snapshot(&snapshot)) {
+      words = UInt32Array(sizeof(snapshot) / sizeof(unsigned int),
+                          reinterpret_cast<const unsigned int*>(&snapshot));
+    }
+    WireType wt_op(static_cast<unsigned int>(CONTROL_METRICS));
+    WireType wt_id(0u);
+    WireType wt_words(words);
+    const WireType* const args[] = { &wt_op, &wt_id, &wt_words };
+    return SendWithCallId(call_id | kCallReplyBit, kMessagePrivControl, args, 3);
+  }
+
+  template <class DispatchT>
+  size_t OnControlMsg(DispatchT* top_dispatch, const WireType* const args[], size_t np,
+                      unsigned int call_id) {
+    if ((np != 3) || args[0]->CheckUInt32() || args[1]->CheckUInt32())
+      return RcErrDecoderArgs;
+    const unsigned int id = args[1]->AsUInt32();
+    switch (args[0]->AsUInt32()) {
+      case CONTROL_METRICS:
+        return SendMetrics(call_id);
+      case LANE_DATA:
+      case LANE_END:
+        if (args[2]->CheckByteArray())
+          return RcErrDecoderArgs;
+        return OnBulkPiece(top_dispatch, args[0]->AsUInt32() == LANE_END, id,
+                           args[2]->AsByteArray());
+      case STREAM_DATA:
+        if (args[2]->CheckByteArray())
+          return RcErrDecoderArgs;
+        return OnStreamData(id, args[2]->AsByteArray());
+      case STREAM_CREDIT:
+        if (args[2]->CheckUInt32())
+          return RcErrDecoderArgs;
+        return OnStreamCredit(id, args[2]->AsUInt32());
+      case STREAM_END:
+        if (args[2]->CheckInt32())
+          return RcErrDecoderArgs;
+        return OnStreamEnd(id, args[2]->AsInt32());
+      default:
+        return RcErrBadMessageId;
+    }
+  }
+
+  BulkRx* FindBulk(unsigned int id) {
+    for (size_t ix = 0; ix != kMaxBulkMsgs; ++ix) {
+      if (bulk_in_[ix].id == id)
+        return &bulk_in_[ix];
+    }
+    return NULL;
+  }
+
+  // Decodes the |piece| of the bulk lane message |id| and dispatches the message after the
+  // |last| piece. The message is not dispatched if it does not end with the last piece.
+  template <class DispatchT>
+  size_t OnBulkPiece(DispatchT* top_dispatch, bool last, unsigned int id,
+                     const ByteArray& piece) {
+    if (!id)
+      return RcErrDecoderArgs;
+    BulkRx* rx = FindBulk(id);
+    if (!rx) {
+      rx = FindBulk(0);
+      if (!rx)
+        return RcErrDecoderArgs;
+      rx->id = id;
+      rx->size = 0;
+    }
+    rx->size += piece.sz_;
+    rx->handler.SetDispatch(top_dispatch);
+    bool more = false;
+    if (rx->size <= kMaxBulkMsgSz) {
+      char* buf = rx->decoder.GetReceiveBuffer(piece.sz_);
+      if (piece.sz_)
+        memcpy(buf, piece.buf_, piece.sz_);
+      more = rx->decoder.OnReceived(piece.sz_);
+    }
+    // A bad lane message fails here. DispatchDecoded() would drop the handles that the transport
+    // holds for the messages that follow.
+    if ((more == last) || (last && !rx->decoder.Success())) {
+      rx->handler.Clear();
+      rx->decoder.Clear();
+      rx->id = 0;
+      return RcErrDecoderFormat;
+    }
+    if (!last)
+      return ipc::OnMsgLoopNext;
+    // The slot is only freed afterwards, the handler can receive more pieces meanwhile.
+    RxCost cost = { 0, 0 };
+    size_t rc = DispatchDecoded(top_dispatch, rx->handler, rx->decoder, cost);
+    rx->decoder.Clear();
+    rx->handler.Trim(kMaxRetainedSz);
+    rx->decoder.Trim(kMaxRetainedSz);
+    rx->id = 0;
+    return rc;
+  }
+
+  // A sender that goes past its window is cut off.
+  size_t OnStreamData(unsigned int id, const ByteArray& chunk) {
+    StreamSink* sink = NULL;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = FindStream(in_streams_, id);
+      if (!st)
+        return RcErrBadStreamId;
+      if (chunk.sz_ > st->credit)
+        return RcErrStreamWindow;
+      st->credit -= chunk.sz_;
+      sink = st->sink;
+    }
+    size_t rc = sink->OnStreamData(id, chunk.buf_, chunk.sz_);
+    size_t grant = 0;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = FindStream(in_streams_, id);
+      if (st) {
+        st->consumed += chunk.sz_;
+        if (st->consumed >= (st->window / 2)) {
+          grant = st->consumed;
+          st->credit += grant;
+          st->consumed = 0;
+        }
+      }
+    }
+    if (grant) {
+      size_t src = SendStreamMsg(STREAM_CREDIT, id, WireType(static_cast<unsigned int>(grant)));
+      if (src != RcOK)
+        return src;
+    }
+    return rc;
+  }
+
+  // Credit can arrive after the stream was closed, it is ignored then.
+  size_t OnStreamCredit(unsigned int id, unsigned int grant) {
+    StreamSource* source = NULL;
+    size_t credit = 0;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = FindStream(out_streams_, id);
+      if (!st)
+        return ipc::OnMsgLoopNext;
+      st->credit += grant;
+      credit = st->credit;
+      source = st->source;
+    }
+    return source->OnStreamCredit(id, credit);
+  }
+
+  size_t OnStreamEnd(unsigned int id, int status) {
+    StreamSink* sink = NULL;
+    {
+      AutoSpinLock lock(&streams_lock_);
+      StreamState* st = FindStream(in_streams_, id);
+      if (!st)
+        return RcErrBadStreamId;
+      st->id = 0;
+      sink = st->sink;
+    }
+    return sink->OnStreamEnd(id, status);
+  }
+
   size_t SendNewTransportMsg(void* handle) {
     WireType wt(handle);
     const WireType* const arg[] = { &wt };
     return Send(kMessagePrivNewTransport, arg, 1);
   }
 
+  // ReceiveInto() that spins first if SetReceiveSpin() says so.
+  size_t ReadTransport(char* buf, size_t* size) {
+    if (spin_us_ && PollTransport<TransportT>::kCanPoll) {
+      const size_t max_sz = *size;
+      const unsigned int start = TickCountUs();
+      unsigned int spun;
+      do {
+        *size = max_sz;
+        size_t rc = PollTransport<TransportT>::TryReceiveInto(transport_, buf, size);
+        spun = TickCountUs() - start;
+        if (rc != RcOK)
+          return rc;
+        if (*size) {
+          metrics_.OnSpin(true, spun);
+          return RcOK;
+        }
+        if (spin_yield_)
+          YieldThread();
+        else
+          CpuRelax();
+      } while (spun < spin_us_);
+      metrics_.OnSpin(false, spun);
+      *size = max_sz;
+    }
+    return transport_->ReceiveInto(buf, size);
+  }
+
+  size_t ReadSize(size_t needed) const {
+    if (needed < kMinReadSz)
+      return kMinReadSz;
+    return (needed > max_read_sz_) ? max_read_sz_ : needed;
+  }
+
+  // The arguments of Send() and Call(), one WireType each.
+  struct WireArgs {
+    const WireType* const* args;
+    int n_args;
+
+    WireArgs(const WireType* const* a, int n) : args(a), n_args(n) {}
+
+    int Count() const { return n_args; }
+
+    template <class WriterT>
+    bool Encode(WriterT* writer) const {
+      for (int ix = 0; ix != n_args; ++ix) {
+        if (!writer->OnWire(*args[ix]))
+          return false;
+      }
+      return true;
+    }
+  };
+
+  // Encodes the message with one of the pooled encoders. The message goes to the transport
+  // unless |out| is not null, then it is appended to |out|.
+  template <class ArgsT>
+  size_t EncodeAndSend(IPCCharVector* out, unsigned int call_id, int msg_id,
+                       const ArgsT& args) {
+    for (size_t ix = 0; ix != kEncoderPoolSize; ++ix) {
+      if (AtomicTryAcquire(&enc_busy_[ix])) {
+        size_t rc = SendWith(&encoders_[ix], out, call_id, msg_id, args);
+        encoders_[ix].Trim(kMaxRetainedSz);
+        AtomicRelease(&enc_busy_[ix]);
+        return rc;
+      }
+    }
+    // All the pooled encoders are busy with other threads.
+    EncoderT encoder;
+    return SendWith(&encoder, out, call_id, msg_id, args);
+  }
+
+  // Encodes the message with |encoder| and hands it to the transport or appends it to |out|.
+  // The segments are copied to |out| because they can reference the caller's strings.
+  template <class ArgsT>
+  size_t SendWith(EncoderT* encoder, IPCCharVector* out, unsigned int call_id, int msg_id,
+                  const ArgsT& args) {
+    const unsigned int start = metrics_.Now();
+    encoder->SetCallId(call_id);
+    encoder->Open(args.Count());
+    ArgWriter writer(this, encoder);
+    if (!args.Encode(&writer))
+      return RcErrEncoderType;
+
+    encoder->SetMsgId(msg_id);
+    if (!encoder->Close())
+      return RcErrEncoderClose;
+
+    size_t count;
+    const IOSegment* segs = encoder->GetSegments(&count);
+    if (!segs)
+      return RcErrEncoderBuffer;
+    metrics_.OnEncoded(msg_id, segs, count, start);
+    size_t n_fds;
+    const int* fds = encoder->GetUnixFds(&n_fds);
+    if (!out) {
+      size_t total = 0;
+      if (lane_chunk_sz_ && !n_fds) {
+        for (size_t ix = 0; ix != count; ++ix) {
+          total += segs[ix].sz_;
+        }
+      }
+      if (total <= lane_chunk_sz_)
+        return TransportSend(segs, count, fds, n_fds);
+      // The stream chunks and the pieces themselves are not cut again.
+      if (msg_id == kMessagePrivControl)
+        return TransportSend(segs, count, NULL, 0, true);
+      return SendBulk(segs, count, total);
+    }
+    // The descriptors have to go with the write of their message.
+    if (n_fds)
+      return RcErrEncoderType;
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* buf = static_cast<const char*>(segs[ix].buf_);
+      out->insert(out->end(), buf, buf + segs[ix].sz_);
+    }
+    return RcOK;
+  }
+
+  // The body of Send().
+  size_t SendWithCallId(unsigned int call_id, int msg_id, const WireType* const args[],
+                        int n_args) {
+    return SendArgsWithCallId(call_id, msg_id, WireArgs(args, n_args));
+  }
+
+  template <class ArgsT>
+  size_t SendArgsWithCallId(unsigned int call_id, int msg_id, const ArgsT& args) {
+    if (!batch_max_sz_)
+      return EncodeAndSend(NULL, call_id, msg_id, args);
+
+    {
+      AutoSpinLock lock(&batch_lock_);
+      size_t rc = EncodeAndSend(&batch_, call_id, msg_id, args);
+      if (rc != RcOK)
+        return rc;
+      if (!batch_count_++)
+        batch_start_ms_ = TickCountMs();
+      if ((batch_.size() < batch_max_sz_) &&
+          (!batch_max_ms_ || (ElapsedMs(batch_start_ms_) < batch_max_ms_)))
+        return RcOK;
+    }
+    return Flush();
+  }
+
+  // Sends the encoded message in LANE_DATA pieces of up to |lane_chunk_sz_| bytes that
+  // reference |segs|, the last one is LANE_END. Each piece waits for the previous one to be
+  // written, so the urgent messages queued in the meantime go before the next. If the peer
+  // has kMaxBulkMsgs from this end already the message goes whole.
+  size_t SendBulk(const IOSegment* segs, size_t count, size_t total) {
+    if (AtomicAdd(&bulk_out_, 1) > static_cast<long>(kMaxBulkMsgs)) {
+      AtomicAdd(&bulk_out_, -1);
+      return TransportSend(segs, count, NULL, 0, true);
+    }
+    unsigned int id;
+    do {
+      id = static_cast<unsigned int>(AtomicAdd(&last_bulk_id_, 1));
+    } while (!id);
+
+    WireType wt_id(id);
+    size_t rc = RcOK;
+    size_t sent = 0;
+    for (size_t ix = 0; (ix != count) && (rc == RcOK); ++ix) {
+      const char* buf = static_cast<const char*>(segs[ix].buf_);
+      size_t left = segs[ix].sz_;
+      while (left && (rc == RcOK)) {
+        const size_t sz = (left < lane_chunk_sz_) ? left : lane_chunk_sz_;
+        sent += sz;
+        WireType wt_op(static_cast<unsigned int>((sent == total) ? LANE_END : LANE_DATA));
+        WireType wt_piece(ByteArrayRef(sz, buf));
+        const WireType* const args[] = { &wt_op, &wt_id, &wt_piece };
+        rc = EncodeAndSend(NULL, 0, kMessagePrivControl, WireArgs(args, 3));
+        buf += sz;
+        left -= sz;
+      }
+    }
+    AtomicAdd(&bulk_out_, -1);
+    return rc;
+  }
+
+  // Queues the message and waits until it has been written, by this thread or by the one
+  // that is writing when it was queued. The segments stay valid until then. The messages of
+  // the bulk lane are written after the others queued at the same time. A sender that still
+  // finds its message queued after kSendSpins checks sleeps until the writer is done with it.
+  size_t TransportSend(const IOSegment* segs, size_t count, const int* fds = NULL,
+                       size_t n_fds = 0, bool bulk = false) {
+    SendNode node = { segs, count, fds, n_fds, bulk, RcOK, SEND_PENDING, NULL, NULL };
+    void* head;
+    do {
+      head = AtomicLoadPtr(&send_head_);
+      node.next = static_cast<SendNode*>(head);
+    } while (AtomicCompareExchangePtr(&send_head_, &node, head) != head);
+
+    for (size_t spins = 0; AtomicLoad(&node.done) == SEND_PENDING; ++spins) {
+      if (AtomicTryAcquire(&writer_busy_)) {
+        WriteAll();
+      } else if (spins < kSendSpins) {
+        CpuRelax();
+      } else {
+        Semaphore wake;
+        node.wake = &wake;
+        if (AtomicCompareExchange(&node.done, SEND_BLOCKED, SEND_PENDING) == SEND_PENDING) {
+          // The writer may have let go just before, then nobody else would write it.
+          if (AtomicTryAcquire(&writer_busy_))
+            WriteAll();
+          wake.Wait();
+        }
+        break;
+      }
+    }
+    // The writer sets |rc| before |done|, the acquire load of |done| or the wake up keeps
+    // the reads in that order too.
+    return node.rc;
+  }
+
+  // Writes the queued messages until there are none left. The senders that found the
+  // writer busy may be asleep, so the queue is checked again after |writer_busy_| is let go
+  // and whoever takes it back writes what is there. Called with |writer_busy_| held.
+  void WriteAll() {
+    do {
+      WriteQueued();
+      AtomicRelease(&writer_busy_);
+      MemoryFence();
+    } while (AtomicLoadPtr(&send_head_) && AtomicTryAcquire(&writer_busy_));
+  }
+
+  // Writes the messages queued so far, oldest first, coalescing up to kMaxWriteSegs segments
+  // per write. A message with file descriptors is written on its own so they go with it.
+  // Only called by the thread that holds |writer_busy_|.
+  void WriteQueued() {
+    void* head;
+    do {
+      head = AtomicLoadPtr(&send_head_);
+    } while (AtomicCompareExchangePtr(&send_head_, NULL, head) != head);
+
+    // The list is newest first. The bulk lane goes after the rest.
+    SendNode* node = NULL;
+    SendNode* bulk = NULL;
+    for (SendNode* next = static_cast<SendNode*>(head); next;) {
+      SendNode* rest = next->next;
+      SendNode** list = next->bulk ? &bulk : &node;
+      next->next = *list;
+      *list = next;
+      next = rest;
+    }
+    SendNode** tail = &node;
+    while (*tail) {
+      tail = &(*tail)->next;
+    }
+    *tail = bulk;
+
+    while (node) {
+      SendNode* end = node->next;
+      size_t rc = RcOK;
+      if (node->n_fds) {
+        rc = HandleTransport<TransportT>::SendWithFds(transport_, node->segs, node->count,
+                                                      node->fds, node->n_fds);
+      } else if (node->count > kMaxWriteSegs) {
+        rc = transport_->Send(node->segs, node->count);
+      } else {
+        IOSegment segs[kMaxWriteSegs];
+        size_t n = 0;
+        for (end = node; end && !end->n_fds && (n + end->count <= kMaxWriteSegs);
+             end = end->next) {
+          for (size_t ix = 0; ix != end->count; ++ix) {
+            segs[n++] = end->segs[ix];
+          }
+        }
+        rc = transport_->Send(segs, n);
+      }
+      size_t n_msgs = 0;
+      for (SendNode* written = node; written != end; written = written->next) {
+        ++n_msgs;
+      }
+      metrics_.OnWrite(n_msgs, rc);
+      // A sender can return as soon as it sees |done| so its node is not touched afterwards.
+      // One that went to sleep stays until |wake| is signaled.
+      while (node != end) {
+        SendNode* next = node->next;
+        node->rc = rc;
+        if (AtomicCompareExchange(&node->done, SEND_DONE, SEND_PENDING) == SEND_BLOCKED)
+          node->wake->Signal();
+        node = next;
+      }
+    }
+  }
+
+  // Writes the queued messages in one go. The queue is swapped out under |batch_lock_| and
+  // written after releasing it, so the other senders can keep queuing while the transport
+  // blocks. Only one flush runs at a time, which keeps the queued messages in order.
+  size_t Flush() {
+    flush_gate_.Wait();
+    size_t count;
+    {
+      AutoSpinLock lock(&batch_lock_);
+      batch_out_.swap(batch_);
+      count = batch_count_;
+      batch_count_ = 0;
+    }
+    size_t rc = RcOK;
+    if (count) {
+      IOSegment seg = { &batch_out_[0], batch_out_.size() };
+      rc = TransportSend(&seg, 1);
+    }
+    batch_out_.resize(0);
+    if (batch_out_.capacity() > kMaxRetainedSz)
+      IPCCharVector().swap(batch_out_);
+    flush_gate_.Signal();
+    return rc;
+  }
+
+  // The body of Receive(). On error the state of |handler| and |decoder| is discarded.
+  template <class DispatchT>
+  size_t ReceiveWith(DispatchT* top_dispatch, RxHandler& handler, DecoderT<RxHandler>& decoder) {
+    // There are two do/while nested loops. The inner one runs until a full message
+    // has been decoded and the outer one runs until a dispatcher returns anything
+    // but a 0. The inner loop has two modes, in one it requires more external data
+    // and in the other it can keep processing what has been read so far. They are
+    // required to handle the case of reading less than a full message and when
+    // reading more than one message.
+    handler.SetDispatch(top_dispatch);
+    size_t retv = 0;
+    do {
+      bool more = false;
+      RxCost cost = { 0, 0 };
+      do {
+        unsigned int start;
+        if (decoder.NeedsMoreData()) {
+          // The transport reads straight into the decoder, as much as the current message
+          // still needs within the [kMinReadSz, max_read_sz_] range.
+          size_t received = ReadSize(decoder.BytesNeeded());
+          char* buf = decoder.GetReceiveBuffer(received);
+          if (RcOK != ReadTransport(buf, &received)) {
+            // read failed.
+            handler.Clear();
+            decoder.Clear();
+            return RcErrTransportRead;
+          }
+          metrics_.OnRead(received);
+          ++cost.reads;
+          start = metrics_.Now();
+          more = decoder.OnReceived(received);
+        } else {
+          start = metrics_.Now();
+          more = decoder.OnData(NULL, 0);
+        }
+        cost.decode_us += metrics_.Now() - start;
+      } while (more);
+
+      retv = DispatchDecoded(top_dispatch, handler, decoder, cost);
+    } while(ipc::OnMsgLoopNext == retv);
+
+    return retv;
+  }
+
+  // Dispatches the message that |decoder| just finished, or fails if it could not decode it.
+  // Either way |handler| and |decoder| are ready for the next message afterwards.
+  template <class DispatchT>
+  size_t DispatchDecoded(DispatchT* top_dispatch, RxHandler& handler,
+                         DecoderT<RxHandler>& decoder, const RxCost& cost) {
+    last_msg_id_ = handler.MsgId();
+
+    if(!decoder.Success()) {
+      // The handles that came with the message would be taken by the next one.
+      HandleTransport<TransportT>::Discard(transport_);
+      handler.Clear();
+      decoder.Clear();
+      metrics_.OnDecodeError(RcErrDecoderFormat);
+      return RcErrDecoderFormat;
+    }
+
+    size_t np = handler.GetArgCount();
+    if (np > kMaxNumArgs) {
+      if (handler.ImportHandles(transport_))
+        handler.CloseHandles();
+      handler.Clear();
+      decoder.Clear();
+      metrics_.OnDecodeError(RcErrDecoderArgs);
+      return RcErrDecoderArgs;
+    }
+
+    if (!handler.ImportHandles(transport_)) {
+      handler.Clear();
+      decoder.Clear();
+      return RcErrTransportRead;
+    }
+    metrics_.OnDecoded(handler.MsgId(), cost.reads, cost.decode_us);
+
+    if (handler.Rejected()) {
+      handler.CloseHandles();
+      handler.Clear();
+      decoder.Reset();
+      return RcErrBadMessageId;
+    }
+
+    const WireType* args[kMaxNumArgs];
+    for (size_t ix = 0; ix != np; ++ix) {
+      args[ix] = &handler.GetArg(ix);
+    }
+
+    size_t retv = 0;
+    const unsigned int call_id = handler.CallId();
+    if (call_id & kCallReplyBit) {
+      // The reply to one of our calls.
+      retv = CompleteCall(call_id & ~kCallReplyBit, handler.MsgId(), args, np);
+    } else if ((handler.MsgId() == kMessagePrivNewTransport) &&
+        (np == 1) && (args[0]->GetAsBits() == NULL)) {
+      // Got special rpc to create a new transport. On the receiving side we handle it entirely
+      // here by calling OnNewTransport and then sending the reply, but on the sending side it
+      // is handled by a NewTransportHandler object so it actually uses top_dispatch->MsgHandler().
+      void* handle = top_dispatch->OnNewTransport();
+      retv = handle ? SendNewTransportMsg(handle) : ipc::OnMsgLoopNext;
+    } else if (handler.MsgId() == kMessagePrivControl) {
+      // A piece of one of the streams or of a bulk lane message, or a metrics query. These
+      // carry no handles.
+      retv = OnControlMsg(top_dispatch, args, np, call_id);
+      CloseHandleArgs(args, np);
+    } else {
+      // Got one regular message. Now dispatch it. If it is a call the handler replies by
+      // sending a message from this thread. The entry is added even if it is not a call, so
+      // that a message dispatched while handling a call does not take that call's reply.
+      DetachedReply reply = { CurrentThreadId(), call_id, NULL };
+      PushReply(&reply);
+      const unsigned int start = metrics_.Now();
+      retv = DispatchTo(top_dispatch->MsgHandler(handler.MsgId()), handler.MsgId(), args, np);
+      metrics_.OnDispatched(handler.MsgId(), start);
+      PopReply(&reply);
+    }
+
+    handler.Clear();
+    decoder.Reset();
+    return retv;
+  }
+
+  // Calls the handler returned by DispatchT::MsgHandler(), which is NULL if there is none.
+  template <class HandlerT>
+  size_t DispatchTo(HandlerT* handler, int msg_id, const WireType* const args[], size_t np) {
+    if (!handler) {
+      CloseHandleArgs(args, np);
+      return RcErrBadMessageId;
+    }
+    return handler->OnMsgIn(msg_id, this, args, static_cast<int>(np));
+  }
+
   // Uses |EncoderT| to encode one message element in the outgoing buffer.
   bool AddMsgElement(EncoderT* encoder, const WireType& wtype) {
     switch (wtype.Id()) {
@@ -338,33 +1682,104 @@ private:
       case ipc::TYPE_LONG32:
       case ipc::TYPE_ULONG32:
       case ipc::TYPE_VOIDPTR:
+      case ipc::TYPE_FLOAT32:
           return encoder->OnWord(wtype.GetAsBits(), wtype.Id());
 
+      // The 64-bit values and the typed arrays travel as their raw bytes, so they are the
+      // same size for 32 and 64 bit peers and the arrays take the bulk path of the encoder.
+      case ipc::TYPE_INT64:
+      case ipc::TYPE_UINT64:
+      case ipc::TYPE_FLOAT64:
+      case ipc::TYPE_INT32ARRAY:
+      case ipc::TYPE_UINT32ARRAY:
+      case ipc::TYPE_INT64ARRAY:
+      case ipc::TYPE_UINT64ARRAY: {
+          size_t sz = 0;
+          const char* bytes = wtype.PeekBytes(&sz);
+          return encoder->OnString8(bytes, sz, wtype.Id());
+        }
+
       case ipc::TYPE_STRING8:
       case ipc::TYPE_BARRAY: {
-          IPCString ctemp;
-          wtype.GetString8(&ctemp);
-          return encoder->OnString8(ctemp, wtype.Id());
+          size_t sz = 0;
+          const char* str = wtype.PeekString8(&sz);
+          return encoder->OnString8(str, sz, wtype.Id());
         }
 
       case ipc::TYPE_STRING16: {
-          IPCWString wtemp;
-          wtype.GetString16(&wtemp);
-          return encoder->OnString16(wtemp, wtype.Id());
+          size_t sz = 0;
+          const wchar_t* str = wtype.PeekString16(&sz);
+          return encoder->OnString16(str, sz, wtype.Id());
         }
 
       case ipc::TYPE_NULLSTRING8:
       case ipc::TYPE_NULLSTRING16:
       case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
         return encoder->OnWord(wtype.GetAsBits(), wtype.Id());
 
+      case ipc::TYPE_HANDLE: {
+          OsHandle::Value value;
+          if (!HandleTransport<TransportT>::Export(transport_, wtype.AsHandle().h_, &value))
+            return false;
+#if defined(WIN32)
+          return encoder->OnWinHandle(value, wtype.Id());
+#else
+          return encoder->OnUnixFd(value, wtype.Id());
+#endif
+        }
+
       default:
         return false;
     }
   }
 
   TransportT* transport_;
+  MetricsT metrics_;
   int last_msg_id_;
+  size_t max_read_sz_;
+  unsigned int spin_us_;
+  bool spin_yield_;
+  EncoderT encoders_[kEncoderPoolSize];
+  volatile long enc_busy_[kEncoderPoolSize];
+  RxHandler handler_;
+  DecoderT<RxHandler> decoder_;
+  int rx_depth_;
+  // The messages being dispatched by Receive() and DispatchDetached() on each thread, newest
+  // first, guarded by |calls_lock_|.
+  DetachedReply* volatile replies_;
+  // Calls waiting for their reply, guarded by |calls_lock_|. Free entries have a zero id.
+  SpinLock calls_lock_;
+  PendingCall calls_[kMaxPendingCalls];
+  unsigned int last_call_id_;
+  volatile size_t pending_count_;
+  // Streams being sent and received, guarded by |streams_lock_|.
+  SpinLock streams_lock_;
+  StreamState out_streams_[kMaxStreams];
+  StreamState in_streams_[kMaxStreams];
+  unsigned int last_stream_id_;
+  // Priority lanes. The bulk lane messages being received are only touched by Receive().
+  size_t lane_chunk_sz_;
+  volatile long last_bulk_id_;
+  volatile long bulk_out_;
+  BulkRx bulk_in_[kMaxBulkMsgs];
+  // Batch mode state, guarded by |batch_lock_|. Batch mode is on while |batch_max_sz_| is
+  // not zero.
+  SpinLock batch_lock_;
+  IPCCharVector batch_;
+  // The queue being written by Flush(), and the gate that lets one Flush() in at a time.
+  IPCCharVector batch_out_;
+  Semaphore flush_gate_;
+  size_t batch_max_sz_;
+  unsigned int batch_max_ms_;
+  size_t batch_count_;
+  unsigned int batch_start_ms_;
+  // Messages waiting for the transport, newest first, and the flag of the sender writing them.
+  void* volatile send_head_;
+  volatile long writer_busy_;
 };
 
 }  // namespace ipc.
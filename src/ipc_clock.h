@@ -0,0 +1,64 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_CLOCK_H_
+#define SIMPLE_IPC_CLOCK_H_
+
+#include "os_includes.h"
+
+#if !defined(WIN32)
+#include <time.h>
+#endif
+
+namespace ipc {
+
+// Returns a monotonic time in milliseconds. The starting point is arbitrary and the value wraps
+// around every 49.7 days, so only the difference between two readings is meaningful.
+inline unsigned int TickCountMs() {
+#if defined(WIN32)
+  return ::GetTickCount();
+#else
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<unsigned int>(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
+// Milliseconds elapsed since |start|, a value returned by TickCountMs().
+inline unsigned int ElapsedMs(unsigned int start) {
+  return TickCountMs() - start;
+}
+
+// Like TickCountMs() but in microseconds, so it wraps around every 71.5 minutes.
+inline unsigned int TickCountUs() {
+#if defined(WIN32)
+  static LARGE_INTEGER freq = {0};
+  if (!freq.QuadPart)
+    ::QueryPerformanceFrequency(&freq);
+  LARGE_INTEGER now;
+  ::QueryPerformanceCounter(&now);
+  // Split to avoid overflowing the multiplication.
+  return static_cast<unsigned int>((now.QuadPart / freq.QuadPart) * 1000000 +
+                                   (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart);
+#else
+  timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<unsigned int>(ts.tv_sec) * 1000000u +
+         static_cast<unsigned int>(ts.tv_nsec / 1000);
+#endif
+}
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_CLOCK_H_
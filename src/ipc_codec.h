@@ -16,6 +16,8 @@
 #define SIMPLE_IPC_CODEC_H_
 
 #include "os_includes.h"
+#include "ipc_compress.h"
+#include "ipc_utils.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // This file contains the default encoder & decoder for IPC. It does no compression and every
@@ -27,6 +29,7 @@
 // 4     msg id
 // 8     element count (1 to N)
 // 12    data count (in 4 byte units
+//       call id, only if the header mark is ENC_HEADERC
 // 16    first element tag
 // 20    second element tag
 // +4    .......
@@ -44,6 +47,22 @@
 // so it takes a generic |tag| that in the case of using it with the standard ipc::Channel they
 // would be ipc::TYPE_XXXXX. However, arrays (bytes and strings) are treated differently in which
 // the tag is actually 'enhanced' with an extra bit in the form of ENC_STRN08 or ENC_STRN16.
+//
+// The decoder does not copy arrays out of its buffer. The handler gets a pointer and a length
+// into the decoder's own storage which stays valid until Decoder::Reset() is called.
+//
+// Likewise the encoder does not copy large arrays. The encoded message is exposed as a list of
+// segments, see Encoder::GetSegments(), in which the header and the small values live in the
+// encoder buffer and each large array is referenced in place. The referenced memory must stay
+// valid until the message has been handed to the transport.
+//
+// OS handles are carried as one word each. The file descriptors also go in a side list, see
+// Encoder::GetUnixFds(), which the transport sends out of band.
+//
+// PackingEncoder compresses the large strings and byte arrays, see ipc_compress.h. Their tag
+// also has ENC_PACKED and the value is the character count, the packed size in bytes and
+// then the packed bytes. The decoder expands them into its own storage, so the handler sees
+// the original array and the receiving side needs no change.
 
 namespace ipc {
 
@@ -51,23 +70,42 @@ class Encoder {
 public:
   enum {
     ENC_HEADER = 0x4d4f524b,
+    ENC_HEADERC = 0x4d4f5243,
     ENC_STARTD = 0x4b524f4d,
     ENC_ENDDAT = 0x474e4142,
+    ENC_PACKED = 1<<29,
     ENC_STRN08 = 1<<30,
     ENC_STRN16 = 1<<31
   };
 
-  Encoder() : index_(-1) {}
+  // Strings and byte arrays of this size in bytes or larger are referenced instead of copied.
+  static const size_t kMinRefSz = 1024;
+
+  Encoder() : index_(-1), ref_words_(0), call_id_(0), min_pack_sz_(0) {}
+
+  // When not zero, |call_id| goes in the header of the next message. Must be called before
+  // Open(), which consumes it.
+  void SetCallId(unsigned int call_id) {
+    call_id_ = call_id;
+  }
 
+  // The buffers keep their capacity from one message to the next. See Trim().
   bool Open(int count) {
-    data_.clear();
+    data_.resize(0);
+    refs_.resize(0);
+    ref_pos_.resize(0);
+    fds_.resize(0);
+    ref_words_ = 0;
     data_.reserve(count * 5);
-    data_.resize(count + 5);
+    data_.resize(count + (call_id_ ? 6 : 5));
     index_ = -1;
-    SetHeaderNext(ENC_HEADER);  // 0
+    SetHeaderNext(call_id_ ? ENC_HEADERC : ENC_HEADER);  // 0
     SetHeaderNext(0);           // 1
     SetHeaderNext(count);       // 2
     SetHeaderNext(0);           // 3
+    if (call_id_)
+      SetHeaderNext(static_cast<int>(call_id_));
+    call_id_ = 0;
     return true;
   }
 
@@ -84,41 +122,100 @@ public:
     return true;
   };
 
-  bool OnString8(const IPCString& s, int tag) {
+  bool OnString8(const char* s, size_t sz, int tag) {
+    if (AddPacked(s, sz, sz, tag | ENC_STRN08))
+      return true;
     SetHeaderNext(tag | ENC_STRN08);
-    PushBack(s.size());
-    if (s.size()) AddStr(s);
+    PushBack(sz);
+    if (sz) AddStr(s, sz);
     return true;
   }
 
-  bool OnString16(const IPCWString& s, int tag) {
+  bool OnString16(const wchar_t* s, size_t sz, int tag) {
+    if (AddPacked(s, sz * sizeof(wchar_t), sz, tag | ENC_STRN16))
+      return true;
     SetHeaderNext(tag | ENC_STRN16);
-    PushBack(s.size());
-    if (s.size()) AddStr(s);
+    PushBack(sz);
+    if (sz) AddStr(s, sz);
     return true;
   }
 
-  bool OnUnixFd(int /*fd*/, int tag) {
+  bool OnUnixFd(int fd, int tag) {
+    if (fd < 0)
+      return false;
     SetHeaderNext(tag);
-    // $$ implement
+    PushBack(fd);
+    fds_.push_back(fd);
     return true;
   }
 
-  bool OnWinHandle(void* /*handle*/, int tag) {
-    SetHeaderNext(tag);
-    // $$ implement
-    return true;
+  // |handle| has already been duplicated for the peer process, so it is just a value.
+  bool OnWinHandle(void* handle, int tag) {
+    return OnWord(handle, tag);
   }
 
+  // Returns the file descriptors given to OnUnixFd() for this message, in order, or NULL if
+  // there are none.
+  const int* GetUnixFds(size_t* count) const {
+    *count = fds_.size();
+    return fds_.size() ? &fds_[0] : NULL;
+  }
+
+  // Returns the encoded message as |count| segments that must be written in order.
+  const IOSegment* GetSegments(size_t* count) {
+    segs_.resize(0);
+    size_t start = 0;
+    for (size_t ix = 0; ix != refs_.size(); ++ix) {
+      AddSegment(start, ref_pos_[ix]);
+      segs_.push_back(refs_[ix]);
+      start = ref_pos_[ix];
+    }
+    AddSegment(start, data_.size());
+    *count = segs_.size();
+    return &segs_[0];
+  }
+
+  // Returns the encoded message as a single buffer. If there are referenced arrays
+  // this requires copying all the segments together.
   const void* GetBuffer(size_t* sz) {
-    *sz = data_.size() * sizeof(void*);
-    return &data_[0];
+    if (!refs_.size()) {
+      *sz = data_.size() * sizeof(void*);
+      return &data_[0];
+    }
+    size_t count = 0;
+    const IOSegment* segs = GetSegments(&count);
+    flat_.resize(0);
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* buf = static_cast<const char*>(segs[ix].buf_);
+      flat_.insert(flat_.end(), buf, buf + segs[ix].sz_);
+    }
+    *sz = flat_.size();
+    return &flat_[0];
   }
 
   void SetMsgId(int id) {
     data_[1] = reinterpret_cast<void*>(id);
   }
 
+  // Releases the buffers if together they hold more than |max_bytes| so an unusually large
+  // message does not pin its memory for the lifetime of the encoder.
+  void Trim(size_t max_bytes) {
+    size_t held = data_.capacity() * sizeof(void*) + flat_.capacity() +
+                  (refs_.capacity() + segs_.capacity()) * sizeof(IOSegment);
+    if (held <= max_bytes)
+      return;
+    IPCVoidPtrVector().swap(data_);
+    IPCCharVector().swap(flat_);
+    IPCSegmentVector().swap(refs_);
+    IPCSegmentVector().swap(segs_);
+    IPCIntVector().swap(ref_pos_);
+  }
+
+protected:
+  // Arrays of |min_pack_sz| bytes or more are compressed, 0 turns it off.
+  explicit Encoder(size_t min_pack_sz)
+      : index_(-1), ref_words_(0), call_id_(0), min_pack_sz_(min_pack_sz) {}
+
 private:
 
   void SetHeaderNext(int v) {
@@ -126,35 +223,109 @@ private:
   }
 
   void SetDataSizeHeader() {
-    data_[3] = reinterpret_cast<void*>(data_.size());
+    data_[3] = reinterpret_cast<void*>(data_.size() + ref_words_);
   }
 
   void PushBack(int v) {
     data_.push_back(reinterpret_cast<void*>(v));
   }
 
-  void PushBack(unsigned int v) {
+  void PushBack(size_t v) {
     data_.push_back(reinterpret_cast<void*>(v));
   }
 
-  template <typename StringT> 
-  void AddStr(const StringT& s ) {
+  // Adds the segment for the words of |data_| in the [start, end) range.
+  void AddSegment(size_t start, size_t end) {
+    if (start == end)
+      return;
+    IOSegment seg = { &data_[start], (end - start) * sizeof(void*) };
+    segs_.push_back(seg);
+  }
+
+  // Large strings are split into the whole words, which are referenced, and the
+  // remaining characters which go into |data_| padded with zeros. Referencing relies
+  // on the in-memory layout being the packed layout, so big-endian targets always copy.
+  template <typename Ct>
+  void AddStr(const Ct* s, size_t n) {
+    const size_t chars_per_word = sizeof(void*) / sizeof(Ct);
+#if !defined(IPC_BIG_ENDIAN)
+    if ((n * sizeof(Ct)) >= kMinRefSz) {
+      size_t words = n / chars_per_word;
+      IOSegment seg = { s, words * sizeof(void*) };
+      refs_.push_back(seg);
+      ref_pos_.push_back(static_cast<int>(data_.size()));
+      ref_words_ += words;
+      s += words * chars_per_word;
+      n -= words * chars_per_word;
+      if (!n)
+        return;
+    }
+#endif
+    PackStr(s, n);
+  }
+
+  // Compresses the |bytes| at |s|, which hold |count| characters, straight into |data_|. The
+  // result is kept only if it saves at least an eighth, otherwise returns false and the array
+  // goes as usual. Like referencing it needs the in-memory layout to be the packed layout.
+  bool AddPacked(const void* s, size_t bytes, size_t count, int tag) {
+#if defined(IPC_BIG_ENDIAN)
+    return false;
+#else
+    if (!min_pack_sz_ || (bytes < min_pack_sz_))
+      return false;
+    const size_t start = data_.size();
+    const size_t limit = bytes - bytes / 8;
+    data_.resize(start + 2 + (limit + sizeof(void*) - 1) / sizeof(void*));
+    char* out = reinterpret_cast<char*>(&data_[start + 2]);
+    const size_t packed = FastPack::Pack(static_cast<const char*>(s), bytes, out, limit);
+    if (!packed) {
+      data_.resize(start);
+      return false;
+    }
+    const size_t words = (packed + sizeof(void*) - 1) / sizeof(void*);
+    memset(out + packed, 0, words * sizeof(void*) - packed);
+    data_.resize(start + 2 + words);
+    data_[start] = reinterpret_cast<void*>(count);
+    data_[start + 1] = reinterpret_cast<void*>(packed);
+    SetHeaderNext(tag | ENC_PACKED);
+    return true;
+#endif
+  }
+
+  // On little-endian machines a packed word is just the characters in memory order so the
+  // whole string is copied at once and only the last word needs zero padding.
+  template <typename Ct>
+  void PackStr(const Ct* s, size_t n) {
+#if defined(IPC_BIG_ENDIAN)
+    PackStrSlow(s, n);
+#else
+    const size_t bytes = n * sizeof(Ct);
+    const size_t words = (bytes + sizeof(void*) - 1) / sizeof(void*);
+    const size_t start = data_.size();
+    data_.resize(start + words);
+    data_[start + words - 1] = 0;
+    memcpy(&data_[start], s, bytes);
+#endif
+  }
+
+  template <typename Ct>
+  void PackStrSlow(const Ct* s, size_t n) {
     const int times = sizeof(IPCVoidPtrVector::value_type) / sizeof(s[0]);
     size_t it = 0;
     do {
-      unsigned int v = 0;
+      size_t v = 0;
       for (int ix = 0; ix != times; ++ix) {
-        if (it == s.size())
+        if (it == n)
           break;
         v |= PackChar(s[it], ix);
         ++it;
       }
       PushBack(v);
-    } while (it != s.size());
+    } while (it != n);
   }
 
-  unsigned int PackChar(char c, int offset) const {
-    return static_cast<unsigned char>(c) << (offset * 8);
+  size_t PackChar(char c, int offset) const {
+    return static_cast<size_t>(static_cast<unsigned char>(c)) << (offset * 8);
   }
 
 #if 0
@@ -164,47 +335,141 @@ private:
   }
 #endif
 
-  unsigned int PackChar(wchar_t c, int offset) const {
+  size_t PackChar(wchar_t c, int offset) const {
     const char* t = reinterpret_cast<const char*>(&c);
     return  (PackChar(t[0], 0) | PackChar(t[1], 1)) << (offset * 16);
   }
 
   IPCVoidPtrVector data_;
   int index_;
+  // Referenced arrays and the |data_| word index each one goes before.
+  IPCSegmentVector refs_;
+  IPCIntVector ref_pos_;
+  size_t ref_words_;
+  IPCSegmentVector segs_;
+  IPCCharVector flat_;
+  IPCIntVector fds_;
+  unsigned int call_id_;
+  size_t min_pack_sz_;
+};
+
+// Encoder that compresses the strings and byte arrays of kMinPackSz bytes or more. Any
+// Decoder reads what it writes. Use it when the large arrays are text or other redundant
+// data and the pipe, not the CPU, is the bottleneck:
+//
+//  typedef ipc::Channel<PipeTransport, ipc::PackingEncoder, ipc::Decoder> PackedChannel;
+//
+class PackingEncoder : public Encoder {
+public:
+  static const size_t kMinPackSz = 1024;
+
+  PackingEncoder() : Encoder(kMinPackSz) {}
 };
 
 
 template <typename HandlerT>
 class Decoder {
 public:
-  Decoder(HandlerT* handler) : handler_(handler) {
+  // Messages with more elements are rejected as malformed.
+  static const int kMaxElements = 1024;
+  // Limit on the expanded size of the packed arrays of one message.
+  static const size_t kMaxUnpackedSz = 64 * 1024 * 1024;
+
+  Decoder(HandlerT* handler)
+      : handler_(handler), state_(DEC_S_START), pending_rx_(0), start_(0), next_char_(0),
+        unpacked_sz_(0) {
     Reset();
   }
 
   bool OnData(const char* buff, size_t sz) {
     if (buff) {
+      Compact(sz);
       data_.insert(data_.end(), buff, buff + sz);
-    } else if (!data_.size()) {
+    } else if (data_.size() == start_) {
       return true;
     }
-    if (data_.size() % sizeof(void*) == 0) {
-      return (RunDecoder() == DEC_MOREDATA);
-    }
-    return true;
+    return (RunDecoder() == DEC_MOREDATA);
   }
 
   bool Success() { return state_ == DEC_S_DONE; }
 
   bool NeedsMoreData() const {
-    return (data_.size() == 0) || (res_ == DEC_MOREDATA); 
+    return (data_.size() == start_) || (res_ == DEC_MOREDATA);
   }
 
+  // True between messages with nothing of the next one received yet.
+  bool Idle() const {
+    return (DEC_S_START == state_) && (data_.size() == start_);
+  }
+
+  // Returns how many more bytes are required to complete the current message. Until the
+  // header has been decoded this is just what is missing from the header.
+  size_t BytesNeeded() const {
+    const size_t total = msg_sz_ ? msg_sz_ : (4 * sizeof(void*));
+    const size_t have = data_.size() - start_;
+    return (total > have) ? (total - have) : 0;
+  }
+
+  // Returns a buffer of |sz| bytes at the end of the decoder storage so the transport can
+  // read into it directly. Must be followed by OnReceived() with the number of bytes that
+  // were actually written.
+  char* GetReceiveBuffer(size_t sz) {
+    Compact(sz);
+    const size_t start = data_.size();
+    data_.resize(start + sz);
+    pending_rx_ = sz;
+    return &data_[start];
+  }
+
+  // Like OnData() for the |sz| bytes written to the buffer returned by GetReceiveBuffer().
+  bool OnReceived(size_t sz) {
+    data_.resize(data_.size() - (pending_rx_ - sz));
+    pending_rx_ = 0;
+    return OnData(NULL, 0);
+  }
+
+  // Prepares the decoder for the next message. The array views handed to the handler for the
+  // previous message are invalid after this call. Bytes already received that belong to the
+  // next message are kept, the next message is decoded where it is.
   void Reset() {
+    if (DEC_S_DONE == state_)
+      start_ = next_char_;
+    next_char_ = static_cast<int>(start_);
+    items_.resize(0);
     state_ = DEC_S_START;
     e_count_ = -1;
     d_count_ = static_cast<size_t>(-1);
-    next_char_ = 0;
+    msg_sz_ = 0;
     res_ = DEC_NONE;
+    unpacked_.Reset();
+    unpacked_sz_ = 0;
+  }
+
+  // Like Reset() but also discards any received data. Used after a decoding error since
+  // there is no way to find the start of the next message.
+  void Clear() {
+    data_.resize(0);
+    start_ = 0;
+    next_char_ = 0;
+    state_ = DEC_S_START;
+    Reset();
+  }
+
+  // Releases the buffer if it holds more than |max_bytes| keeping the unprocessed data, if any.
+  // Does nothing in the middle of a message, whose offsets and element tags are still in use.
+  void Trim(size_t max_bytes) {
+    if ((DEC_S_START != state_) || (static_cast<size_t>(next_char_) != start_))
+      return;
+    if (data_.capacity() <= max_bytes)
+      return;
+    IPCCharVector keep;
+    if (data_.size() != start_)
+      keep.insert(keep.end(), &data_[start_], &data_[0] + data_.size());
+    data_.swap(keep);
+    start_ = 0;
+    next_char_ = 0;
+    IPCIntVector().swap(items_);
+    unpacked_.Trim(max_bytes);
   }
 
 private:
@@ -233,6 +498,22 @@ private:
     DEC_ERROR
   };
 
+  // Called before appending |sz| bytes. The messages already decoded stay in the buffer until
+  // nothing else is left, or what is left is not bigger than what was consumed, or the buffer
+  // would have to grow anyway. So on average each byte is moved at most once, and a read that
+  // ends at a message boundary costs nothing. The handler views point into |data_| but they
+  // are all handed out in one StateData() call which needs the whole message to be present.
+  void Compact(size_t sz) {
+    if (!start_ || (DEC_S_DONE == state_))
+      return;
+    const size_t left = data_.size() - start_;
+    if (left && (left > start_) && ((data_.size() + sz) <= data_.capacity()))
+      return;
+    data_.erase(data_.begin(), data_.begin() + start_);
+    next_char_ -= static_cast<int>(start_);
+    start_ = 0;
+  }
+
   Result RunDecoder() {
     do {
       res_ = DecodeStep();
@@ -252,26 +533,36 @@ private:
   }
 
   Result StateStart() {
-    // We need at least the first 4 ints.
+    // We need at least the first 4 ints, or 5 if the message has a call id.
     if (!HasEnoughUnProcessed(4))
       return DEC_MOREDATA;
-    int i0 = ReadNextInt();
-    if (Encoder::ENC_HEADER != i0)
+    int i0 = PeekNextInt();
+    int head_words = 4;
+    if (Encoder::ENC_HEADERC == i0)
+      head_words = 5;
+    else if (Encoder::ENC_HEADER != i0)
       return DEC_ERROR;
+    if (!HasEnoughUnProcessed(head_words))
+      return DEC_MOREDATA;
+    ReadNextInt();
     int msg_id = ReadNextInt();
     if (msg_id < 0)
       return DEC_ERROR;
     e_count_ = ReadNextInt();
-    if ((e_count_ < 1) || (e_count_ > 100))
+    if ((e_count_ < 1) || (e_count_ > kMaxElements))
       return DEC_ERROR;
     d_count_ = ReadNextInt();
-    if ((d_count_ < 5) || (d_count_ > (8 * 1024 * 1024)))
+    if ((d_count_ < static_cast<size_t>(head_words + 1)) || (d_count_ > (8 * 1024 * 1024)))
       return DEC_ERROR;
+    msg_sz_ = d_count_ * sizeof(void*);
+    unsigned int call_id = (head_words == 5) ? static_cast<unsigned int>(ReadNextInt()) : 0;
     // Done with the key header piece.
     if (!handler_->OnMessageStart(msg_id, e_count_))
       return DEC_ERROR;
+    if (call_id)
+      handler_->OnCallId(call_id);
     // The handler is willing to accept the message.
-    d_count_ -= 4;
+    d_count_ -= head_words;
     state_ = DEC_S_HEADSZ;
     if (HasEnoughUnProcessed(1))
       return DEC_LOOPAGAIN;
@@ -288,7 +579,9 @@ private:
     int i0 = ReadNextInt();
     if (i0 != Encoder::ENC_STARTD)
       return DEC_ERROR;
-    // Done with all the header
+    // Done with all the header. What is left has to hold the data and the end mark.
+    if (d_count_ < static_cast<size_t>(e_count_) + 2)
+      return DEC_ERROR;
     d_count_ -= e_count_ + 1;
     if (!items_.size()) {
       // That's it, no data.
@@ -314,21 +607,27 @@ private:
     size_t ix = 0;
     do {
         int tag = items_[ix];
-        if (tag & Encoder::ENC_STRN08) {
+        if (tag & Encoder::ENC_PACKED) {
+          if (!ReadNextPacked(tag & ~Encoder::ENC_PACKED))
+            return DEC_ERROR;
+        } else if (tag & Encoder::ENC_STRN08) {
           tag &= ~Encoder::ENC_STRN08;
-          ReadNextStr8(tag);
+          if (!ReadNextStr8(tag))
+            return DEC_ERROR;
         } else if (tag & Encoder::ENC_STRN16) {
           tag &= ~Encoder::ENC_STRN16;
-          ReadNextStr16(tag);
+          if (!ReadNextStr16(tag))
+            return DEC_ERROR;
         } else {
-          --d_count_;
+          if (!TakeWords(1))
+            return DEC_ERROR;
           if (!handler_->OnWord(ReadNextVoidPtr(), tag)) {
             return DEC_ERROR;
           }
         }
         ++ix;
         if (items_.size() == ix) {
-          items_.clear();
+          items_.resize(0);
           state_ = DEC_S_STOP;
           if (HasEnoughUnProcessed(1))
             return DEC_LOOPAGAIN;
@@ -345,43 +644,82 @@ private:
     int it0 = ReadNextInt();
     if (Encoder::ENC_ENDDAT != it0)
       return DEC_ERROR;
-
-    data_.erase(data_.begin(), data_.begin() + next_char_);
+    // The consumed bytes are discarded in Reset() so the views given to the
+    // handler survive until the message has been dispatched.
     state_ = DEC_S_DONE;
     return DEC_DONE;
   }
 
+  int PeekNextInt() {
+    return *reinterpret_cast<int*>(&data_[next_char_]);
+  }
+
   int ReadNextInt() {
     int v  = *reinterpret_cast<int*>(&data_[next_char_]);
     next_char_ += sizeof(void*);
     return v;
   }
 
+  // Reads the character count of a string or array of |char_sz| characters. The characters
+  // have to fit in what is left of the message, since the handler gets a view of them.
+  bool ReadNextCount(size_t char_sz, size_t* count, size_t* words) {
+    if (!TakeWords(1))
+      return false;
+    *count = static_cast<unsigned int>(ReadNextInt());
+    if (*count > (d_count_ * sizeof(void*)) / char_sz)
+      return false;
+    *words = RoundUpToNextVoidPtr(*count * char_sz);
+    return TakeWords(*words);
+  }
+
   bool ReadNextStr8(int tag) {
-    size_t str_sz = ReadNextInt();
-    size_t sz_rounded = RoundUpToNextVoidPtr(str_sz);
-    if(!HasEnoughUnProcessed(sz_rounded))
+    size_t str_sz;
+    size_t sz_rounded;
+    if (!ReadNextCount(sizeof(char), &str_sz, &sz_rounded))
       return false;
     const char* beg = &data_[next_char_];
-    IPCString str;
-    str.assign(beg, str_sz);
     next_char_ += sz_rounded * sizeof(void*);
-    handler_->OnString8(str, tag);
-    return true;
+    return handler_->OnString8(beg, str_sz, tag);
   }
 
   bool ReadNextStr16(int tag) {
-    size_t str_sz = ReadNextInt();
-    size_t byte_sz = str_sz * sizeof(wchar_t);
-    size_t sz_rounded = RoundUpToNextVoidPtr(byte_sz);
-    if(!HasEnoughUnProcessed(sz_rounded))
+    size_t str_sz;
+    size_t sz_rounded;
+    if (!ReadNextCount(sizeof(wchar_t), &str_sz, &sz_rounded))
       return false;
     const wchar_t* beg = reinterpret_cast<wchar_t*>(&data_[next_char_]);
-    IPCWString str;
-    str.assign(beg, str_sz);
     next_char_ += sz_rounded * sizeof(void*);
-    handler_->OnString16(str, tag);
-    return true;
+    return handler_->OnString16(beg, str_sz, tag);
+  }
+
+  // The arrays from PackingEncoder are expanded into |unpacked_|, which keeps them until
+  // Reset() like the views into |data_|.
+  bool ReadNextPacked(int tag) {
+    size_t char_sz;
+    if (tag & Encoder::ENC_STRN08)
+      char_sz = sizeof(char);
+    else if (tag & Encoder::ENC_STRN16)
+      char_sz = sizeof(wchar_t);
+    else
+      return false;
+    if (!TakeWords(2))
+      return false;
+    const size_t count = static_cast<unsigned int>(ReadNextInt());
+    const size_t packed_sz = static_cast<unsigned int>(ReadNextInt());
+    if (!TakeWords(RoundUpToNextVoidPtr(packed_sz)))
+      return false;
+    if (count > ((kMaxUnpackedSz - unpacked_sz_) / char_sz))
+      return false;
+    const size_t byte_sz = count * char_sz;
+    unpacked_sz_ += byte_sz;
+    char* out = static_cast<char*>(unpacked_.Alloc(byte_sz));
+    if (!FastPack::Unpack(&data_[next_char_], packed_sz, out, byte_sz))
+      return false;
+    next_char_ += RoundUpToNextVoidPtr(packed_sz) * sizeof(void*);
+    if (char_sz == sizeof(char))
+      return handler_->OnString8(out, count, tag & ~Encoder::ENC_STRN08);
+    return handler_->OnString16(reinterpret_cast<const wchar_t*>(out), count,
+                                tag & ~Encoder::ENC_STRN16);
   }
 
   void* ReadNextVoidPtr() {
@@ -398,8 +736,18 @@ private:
     return ((data_.size() - next_char_) >= (ints * sizeof(void*)));
   }
 
-  int RoundUpToNextVoidPtr(int sz) {
-    return (sz + (sizeof(void*)-1))/sizeof(void*);
+  // Done without adding to |sz| so that it does not wrap around.
+  size_t RoundUpToNextVoidPtr(size_t sz) {
+    return (sz / sizeof(void*)) + ((sz % sizeof(void*)) ? 1 : 0);
+  }
+
+  // Consumes |words| of the data of the message, failing if that would leave no room for the
+  // end mark. StateData() only runs with the whole message received, so they are there.
+  bool TakeWords(size_t words) {
+    if (words >= d_count_)
+      return false;
+    d_count_ -= words;
+    return true;
   }        
 
   HandlerT* handler_;
@@ -410,8 +758,16 @@ private:
   State state_;
   int e_count_;
   size_t d_count_;
+  // Size in bytes of the current message once the header is known, otherwise 0.
+  size_t msg_sz_;
+  size_t pending_rx_;
+  // Offset in |data_| of the current message. What comes before has been consumed.
+  size_t start_;
   int next_char_;
   Result res_;
+  Arena unpacked_;
+  // Bytes taken from |unpacked_| by the current message.
+  size_t unpacked_sz_;
 };
 
 
@@ -0,0 +1,656 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_CODEC_COMPACT_H_
+#define SIMPLE_IPC_CODEC_COMPACT_H_
+
+#include "os_includes.h"
+#include "ipc_codec.h"
+#include "ipc_codec_fixed.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// This file contains a compact encoder & decoder pair that can be used instead of the default
+// one in ipc_codec.h, for example Channel<PipeTransport, CompactEncoder, CompactDecoder>. It is
+// byte oriented; nothing is aligned or padded and every number is a varint, that is 7 bits per
+// byte with the high bit set on all but the last byte. The format is:
+//
+// bytes what
+// 1     kMagic
+// 1     kVersion, plus kCallFlag if there is a call id
+// 1-5   body size in bytes
+// ----- body starts here
+// 1-5   msg id
+// 1-2   element count (0 to kMaxElements)
+// 1-5   call id, if kCallFlag is set
+//       first element tag (1 byte)
+//       first element value
+//       second element tag
+//       .......
+//
+// The tag is the element type id in the low 6 bits plus CODEC_STRN08 or CODEC_STRN16 for the
+// arrays. Word values are encoded according to their ipc::TYPE_XXXX type, so unlike the default
+// codec this one needs to know about WireType, but in exchange 32 and 64 bit peers can talk to
+// each other. A value that does not fit in the receiving side, like a 64 bit pointer sent to a
+// 32 bit process, is a decoding error. Signed integers are zigzag encoded, floats are sent as
+// their 32 bits. Byte arrays and 8-bit strings are raw bytes preceded by a varint length, and so
+// are the 64-bit values and the typed arrays, in the byte order of the sender. 16-bit strings
+// are a varint count followed by a varint per character. OS handles are a varint, and like
+// in the default codec the file descriptors also go in a side list for the transport.
+//
+// The first byte of the default codec is never kMagic, so DetectCodec() can tell which codec
+// a peer speaks by looking at the first bytes it sent.
+
+namespace ipc {
+
+enum {
+  CODEC_UNKNOWN,
+  CODEC_WORD,
+  CODEC_COMPACT,
+  CODEC_FIXED
+};
+
+namespace compact {
+
+const unsigned char kMagic = 0xC5;
+const unsigned char kVersion = 1;
+const unsigned char kCallFlag = 0x80;
+const size_t kMaxElements = 1024;
+const size_t kMaxBodySz = 64 * 1024 * 1024;
+
+enum {
+  CODEC_STRN08 = 1 << 6,
+  CODEC_STRN16 = 1 << 7,
+  CODEC_TYPE_MASK = CODEC_STRN08 - 1
+};
+
+inline size_t ZigZag(int v) {
+  return (static_cast<unsigned int>(v) << 1) ^ static_cast<unsigned int>(v >> 31);
+}
+
+inline int UnZigZag(size_t v) {
+  unsigned int u = static_cast<unsigned int>(v);
+  return static_cast<int>((u >> 1) ^ (0u - (u & 1)));
+}
+
+}  // namespace compact.
+
+// Returns CODEC_WORD, CODEC_COMPACT or CODEC_FIXED if the start of a message in |buf| was
+// produced by Encoder, CompactEncoder or FixedEncoder respectively, CODEC_UNKNOWN otherwise.
+// For the compact and fixed codecs |version| gets the version. At least two bytes are needed,
+// eight for the fixed codec.
+inline int DetectCodec(const char* buf, size_t sz, int* version) {
+  if (sz < 2)
+    return CODEC_UNKNOWN;
+  const unsigned char b0 = static_cast<unsigned char>(buf[0]);
+  if (b0 == compact::kMagic) {
+    if (version)
+      *version = static_cast<unsigned char>(buf[1]) & ~compact::kCallFlag;
+    return CODEC_COMPACT;
+  }
+  if ((sz >= 8) && (fixed::GetWord(buf) == fixed::kMark)) {
+    if (version)
+      *version = static_cast<int>(fixed::GetWord(buf + 4) & ~fixed::kCallFlag);
+    return CODEC_FIXED;
+  }
+  if (sz >= sizeof(int)) {
+    int mark;
+    memcpy(&mark, buf, sizeof(mark));
+    if ((mark == Encoder::ENC_HEADER) || (mark == Encoder::ENC_HEADERC))
+      return CODEC_WORD;
+  }
+  return CODEC_UNKNOWN;
+}
+
+
+class CompactEncoder {
+public:
+  // Strings and byte arrays of this size in bytes or larger are referenced instead of copied.
+  static const size_t kMinRefSz = 1024;
+
+  CompactEncoder() : msg_id_(0), count_(0), added_(0), ref_sz_(0), call_id_(0) {}
+
+  // When not zero, |call_id| goes in the header of the next message.
+  void SetCallId(unsigned int call_id) {
+    call_id_ = call_id;
+  }
+
+  bool Open(int count) {
+    if ((count < 0) || (static_cast<size_t>(count) > compact::kMaxElements))
+      return false;
+    body_.resize(0);
+    hdr_.resize(0);
+    refs_.resize(0);
+    ref_pos_.resize(0);
+    fds_.resize(0);
+    ref_sz_ = 0;
+    count_ = count;
+    added_ = 0;
+    msg_id_ = 0;
+    return true;
+  }
+
+  bool Close() {
+    if (added_ != count_)
+      return false;
+    // The body size covers the id and count varints so those are written first to a
+    // scratch buffer and then copied after the size.
+    ids_.resize(0);
+    PutVarint(&ids_, static_cast<unsigned int>(msg_id_));
+    PutVarint(&ids_, count_);
+    unsigned char version = compact::kVersion;
+    if (call_id_) {
+      PutVarint(&ids_, call_id_);
+      version |= compact::kCallFlag;
+      call_id_ = 0;
+    }
+    const size_t body_sz = ids_.size() + body_.size() + ref_sz_;
+    if (body_sz > compact::kMaxBodySz)
+      return false;
+    hdr_.push_back(static_cast<char>(compact::kMagic));
+    hdr_.push_back(static_cast<char>(version));
+    PutVarint(&hdr_, body_sz);
+    hdr_.insert(hdr_.end(), &ids_[0], &ids_[0] + ids_.size());
+    return true;
+  }
+
+  void SetMsgId(int id) {
+    msg_id_ = id;
+  }
+
+  bool OnWord(void* bits, int tag) {
+    if (!AddTag(tag))
+      return false;
+    switch (tag) {
+      case ipc::TYPE_INT32:
+      case ipc::TYPE_LONG32: {
+          int v;
+          memcpy(&v, &bits, sizeof(v));
+          PutVarint(compact::ZigZag(v));
+        }
+        break;
+      case ipc::TYPE_UINT32:
+      case ipc::TYPE_ULONG32:
+      case ipc::TYPE_FLOAT32: {
+          unsigned int v;
+          memcpy(&v, &bits, sizeof(v));
+          PutVarint(v);
+        }
+        break;
+      case ipc::TYPE_CHAR8: {
+          unsigned char v;
+          memcpy(&v, &bits, sizeof(v));
+          PutVarint(v);
+        }
+        break;
+      case ipc::TYPE_CHAR16: {
+          wchar_t v;
+          memcpy(&v, &bits, sizeof(v));
+          PutVarint(static_cast<size_t>(v));
+        }
+        break;
+      case ipc::TYPE_NULLSTRING8:
+      case ipc::TYPE_NULLSTRING16:
+      case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+        break;
+      default:
+        PutVarint(reinterpret_cast<size_t>(bits));
+        break;
+    }
+    return true;
+  }
+
+  bool OnString8(const char* s, size_t sz, int tag) {
+    if (!AddTag(tag | compact::CODEC_STRN08))
+      return false;
+    PutVarint(sz);
+    if (sz >= kMinRefSz) {
+      IOSegment seg = { s, sz };
+      refs_.push_back(seg);
+      ref_pos_.push_back(static_cast<int>(body_.size()));
+      ref_sz_ += sz;
+    } else if (sz) {
+      body_.insert(body_.end(), s, s + sz);
+    }
+    return true;
+  }
+
+  bool OnString16(const wchar_t* s, size_t sz, int tag) {
+    if (!AddTag(tag | compact::CODEC_STRN16))
+      return false;
+    PutVarint(sz);
+    for (size_t ix = 0; ix != sz; ++ix) {
+      PutVarint(static_cast<size_t>(s[ix]));
+    }
+    return true;
+  }
+
+  bool OnUnixFd(int fd, int tag) {
+    if ((fd < 0) || !AddTag(tag))
+      return false;
+    PutVarint(static_cast<size_t>(fd));
+    fds_.push_back(fd);
+    return true;
+  }
+
+  bool OnWinHandle(void* handle, int tag) {
+    return OnWord(handle, tag);
+  }
+
+  // Returns the file descriptors given to OnUnixFd() for this message, in order, or NULL if
+  // there are none.
+  const int* GetUnixFds(size_t* count) const {
+    *count = fds_.size();
+    return fds_.size() ? &fds_[0] : NULL;
+  }
+
+  // Returns the encoded message as |count| segments that must be written in order.
+  const IOSegment* GetSegments(size_t* count) {
+    segs_.resize(0);
+    IOSegment hdr = { &hdr_[0], hdr_.size() };
+    segs_.push_back(hdr);
+    size_t start = 0;
+    for (size_t ix = 0; ix != refs_.size(); ++ix) {
+      AddSegment(start, ref_pos_[ix]);
+      segs_.push_back(refs_[ix]);
+      start = ref_pos_[ix];
+    }
+    AddSegment(start, body_.size());
+    *count = segs_.size();
+    return &segs_[0];
+  }
+
+  // Returns the encoded message as a single buffer, copying the segments together.
+  const void* GetBuffer(size_t* sz) {
+    size_t count = 0;
+    const IOSegment* segs = GetSegments(&count);
+    flat_.resize(0);
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* buf = static_cast<const char*>(segs[ix].buf_);
+      flat_.insert(flat_.end(), buf, buf + segs[ix].sz_);
+    }
+    *sz = flat_.size();
+    return &flat_[0];
+  }
+
+  // Releases the buffers if together they hold more than |max_bytes|.
+  void Trim(size_t max_bytes) {
+    size_t held = body_.capacity() + flat_.capacity() +
+                  (refs_.capacity() + segs_.capacity()) * sizeof(IOSegment);
+    if (held <= max_bytes)
+      return;
+    IPCCharVector().swap(body_);
+    IPCCharVector().swap(flat_);
+    IPCSegmentVector().swap(refs_);
+    IPCSegmentVector().swap(segs_);
+    IPCIntVector().swap(ref_pos_);
+  }
+
+private:
+  bool AddTag(int tag) {
+    if (added_ == count_)
+      return false;
+    ++added_;
+    body_.push_back(static_cast<char>(tag));
+    return true;
+  }
+
+  void PutVarint(size_t v) {
+    PutVarint(&body_, v);
+  }
+
+  static void PutVarint(IPCCharVector* out, size_t v) {
+    while (v >= 0x80) {
+      out->push_back(static_cast<char>((v & 0x7F) | 0x80));
+      v >>= 7;
+    }
+    out->push_back(static_cast<char>(v));
+  }
+
+  void AddSegment(size_t start, size_t end) {
+    if (start == end)
+      return;
+    IOSegment seg = { &body_[start], end - start };
+    segs_.push_back(seg);
+  }
+
+  int msg_id_;
+  size_t count_;
+  size_t added_;
+  size_t ref_sz_;
+  IPCCharVector ids_;
+  IPCCharVector hdr_;
+  IPCCharVector body_;
+  IPCSegmentVector refs_;
+  IPCIntVector ref_pos_;
+  IPCSegmentVector segs_;
+  IPCCharVector flat_;
+  IPCIntVector fds_;
+  unsigned int call_id_;
+};
+
+
+template <typename HandlerT>
+class CompactDecoder {
+public:
+  CompactDecoder(HandlerT* handler)
+      : handler_(handler), state_(DEC_START), hdr_sz_(0), msg_sz_(0), pending_rx_(0),
+        start_(0), has_call_id_(false) {
+    Reset();
+  }
+
+  bool OnData(const char* buff, size_t sz) {
+    if (buff) {
+      Compact(sz);
+      data_.insert(data_.end(), buff, buff + sz);
+    } else if (data_.size() == start_) {
+      return true;
+    }
+    res_ = Run();
+    return (DEC_MOREDATA == res_);
+  }
+
+  bool Success() { return state_ == DEC_DONE; }
+
+  bool NeedsMoreData() const {
+    return (data_.size() == start_) || (res_ == DEC_MOREDATA);
+  }
+
+  bool Idle() const {
+    return (DEC_START == state_) && (data_.size() == start_);
+  }
+
+  size_t BytesNeeded() const {
+    const size_t total = msg_sz_ ? msg_sz_ : 3;
+    const size_t have = data_.size() - start_;
+    return (total > have) ? (total - have) : 0;
+  }
+
+  char* GetReceiveBuffer(size_t sz) {
+    Compact(sz);
+    const size_t start = data_.size();
+    data_.resize(start + sz);
+    pending_rx_ = sz;
+    return &data_[start];
+  }
+
+  bool OnReceived(size_t sz) {
+    data_.resize(data_.size() - (pending_rx_ - sz));
+    pending_rx_ = 0;
+    return OnData(NULL, 0);
+  }
+
+  // Prepares the decoder for the next message. The views handed to the handler for the
+  // previous message are invalid after this call.
+  void Reset() {
+    if (DEC_DONE == state_)
+      start_ += msg_sz_;
+    arena_.Reset();
+    state_ = DEC_START;
+    hdr_sz_ = 0;
+    msg_sz_ = 0;
+    res_ = DEC_NONE;
+  }
+
+  void Clear() {
+    data_.resize(0);
+    start_ = 0;
+    state_ = DEC_START;
+    Reset();
+  }
+
+  void Trim(size_t max_bytes) {
+    arena_.Trim(max_bytes);
+    if (data_.capacity() <= max_bytes)
+      return;
+    IPCCharVector keep;
+    if (data_.size() != start_)
+      keep.insert(keep.end(), &data_[start_], &data_[0] + data_.size());
+    data_.swap(keep);
+    start_ = 0;
+  }
+
+private:
+  enum State {
+    DEC_START,
+    DEC_BODY,
+    DEC_DONE,
+    DEC_FAILED
+  };
+
+  enum Result {
+    DEC_NONE,
+    DEC_MOREDATA,
+    DEC_READY,
+    DEC_ERROR
+  };
+
+  // Same policy as Decoder::Compact(). The whole message is decoded in one go so there is never
+  // a view into |data_| while bytes are being appended.
+  void Compact(size_t sz) {
+    if (!start_ || (DEC_DONE == state_))
+      return;
+    const size_t left = data_.size() - start_;
+    if (left && (left > start_) && ((data_.size() + sz) <= data_.capacity()))
+      return;
+    data_.erase(data_.begin(), data_.begin() + start_);
+    start_ = 0;
+  }
+
+  Result Run() {
+    if (DEC_START == state_) {
+      Result res = ReadHeader();
+      if (DEC_READY != res)
+        return Fail(res);
+      state_ = DEC_BODY;
+    }
+    if (DEC_BODY == state_) {
+      if ((data_.size() - start_) < msg_sz_)
+        return DEC_MOREDATA;
+      if (!ReadBody())
+        return Fail(DEC_ERROR);
+      state_ = DEC_DONE;
+      return DEC_READY;
+    }
+    return DEC_ERROR;
+  }
+
+  Result Fail(Result res) {
+    if (DEC_ERROR == res)
+      state_ = DEC_FAILED;
+    return res;
+  }
+
+  Result ReadHeader() {
+    if ((data_.size() - start_) < 3)
+      return DEC_MOREDATA;
+    if ((static_cast<unsigned char>(data_[start_]) != compact::kMagic) ||
+        ((static_cast<unsigned char>(data_[start_ + 1]) & ~compact::kCallFlag) !=
+         compact::kVersion))
+      return DEC_ERROR;
+    has_call_id_ = (0 != (data_[start_ + 1] & compact::kCallFlag));
+    size_t pos = start_ + 2;
+    size_t body_sz = 0;
+    Result res = ReadVarint(&pos, data_.size(), &body_sz);
+    if (DEC_READY != res)
+      return res;
+    if (body_sz > compact::kMaxBodySz)
+      return DEC_ERROR;
+    hdr_sz_ = pos - start_;
+    msg_sz_ = hdr_sz_ + body_sz;
+    return DEC_READY;
+  }
+
+  bool ReadBody() {
+    const size_t end = start_ + msg_sz_;
+    size_t pos = start_ + hdr_sz_;
+    size_t msg_id = 0;
+    size_t count = 0;
+    if (!Varint(&pos, end, &msg_id) || (msg_id > 0x7FFFFFFF))
+      return false;
+    if (!Varint(&pos, end, &count) || (count > compact::kMaxElements))
+      return false;
+    size_t call_id = 0;
+    if (has_call_id_ && (!Varint(&pos, end, &call_id) || !call_id || (call_id > 0xFFFFFFFF)))
+      return false;
+    if (!handler_->OnMessageStart(static_cast<int>(msg_id), static_cast<int>(count)))
+      return false;
+    if (call_id)
+      handler_->OnCallId(static_cast<unsigned int>(call_id));
+    for (size_t ix = 0; ix != count; ++ix) {
+      if (pos == end)
+        return false;
+      const int tag = static_cast<unsigned char>(data_[pos++]);
+      const int type = tag & compact::CODEC_TYPE_MASK;
+      bool ok;
+      if (tag & compact::CODEC_STRN08) {
+        ok = ReadStr8(&pos, end, type);
+      } else if (tag & compact::CODEC_STRN16) {
+        ok = ReadStr16(&pos, end, type);
+      } else {
+        ok = ReadWord(&pos, end, type);
+      }
+      if (!ok)
+        return false;
+    }
+    return (pos == end);
+  }
+
+  bool ReadWord(size_t* pos, size_t end, int type) {
+    union {
+      int v_int;
+      unsigned int v_uint;
+      long v_long;
+      unsigned long v_ulong;
+      char v_char;
+      wchar_t v_wchar;
+      void* v_pvoid;
+    } store;
+    store.v_pvoid = NULL;
+    size_t v = 0;
+    switch (type) {
+      case ipc::TYPE_NULLSTRING8:
+      case ipc::TYPE_NULLSTRING16:
+      case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+        break;
+      default:
+        if (!Varint(pos, end, &v))
+          return false;
+        break;
+    }
+    switch (type) {
+      case ipc::TYPE_INT32:
+        store.v_int = compact::UnZigZag(v);
+        break;
+      case ipc::TYPE_LONG32:
+        store.v_long = compact::UnZigZag(v);
+        break;
+      case ipc::TYPE_UINT32:
+      case ipc::TYPE_FLOAT32:
+        store.v_uint = static_cast<unsigned int>(v);
+        break;
+      case ipc::TYPE_ULONG32:
+        store.v_ulong = static_cast<unsigned int>(v);
+        break;
+      case ipc::TYPE_CHAR8:
+        store.v_char = static_cast<char>(v);
+        break;
+      case ipc::TYPE_CHAR16:
+        store.v_wchar = static_cast<wchar_t>(v);
+        break;
+      default:
+        store.v_pvoid = reinterpret_cast<void*>(v);
+        break;
+    }
+    return handler_->OnWord(&store, type);
+  }
+
+  bool ReadStr8(size_t* pos, size_t end, int type) {
+    size_t sz = 0;
+    if (!Varint(pos, end, &sz) || (sz > (end - *pos)))
+      return false;
+    const char* beg = &data_[*pos];
+    *pos += sz;
+    return handler_->OnString8(beg, sz, type);
+  }
+
+  // The characters are widened into the arena which lives until Reset().
+  bool ReadStr16(size_t* pos, size_t end, int type) {
+    size_t sz = 0;
+    if (!Varint(pos, end, &sz) || (sz > (end - *pos)))
+      return false;
+    wchar_t* str = static_cast<wchar_t*>(arena_.Alloc((sz + 1) * sizeof(wchar_t)));
+    for (size_t ix = 0; ix != sz; ++ix) {
+      size_t c = 0;
+      if (!Varint(pos, end, &c))
+        return false;
+      str[ix] = static_cast<wchar_t>(c);
+    }
+    str[sz] = 0;
+    return handler_->OnString16(str, sz, type);
+  }
+
+  bool Varint(size_t* pos, size_t end, size_t* v) {
+    return (DEC_READY == ReadVarint(pos, end, v));
+  }
+
+  // Decodes the varint at |*pos|. Returns DEC_MOREDATA if it goes past |end| and DEC_ERROR
+  // if it does not fit in a size_t.
+  Result ReadVarint(size_t* pos, size_t end, size_t* v) {
+    size_t value = 0;
+    size_t shift = 0;
+    for (size_t ix = *pos; ix != end; ++ix) {
+      const size_t b = static_cast<unsigned char>(data_[ix]);
+      if (shift >= (sizeof(size_t) * 8))
+        return DEC_ERROR;
+      const size_t bits = (b & 0x7F) << shift;
+      if ((bits >> shift) != (b & 0x7F))
+        return DEC_ERROR;
+      value |= bits;
+      if (!(b & 0x80)) {
+        *pos = ix + 1;
+        *v = value;
+        return DEC_READY;
+      }
+      shift += 7;
+    }
+    return DEC_MOREDATA;
+  }
+
+  HandlerT* handler_;
+  IPCCharVector data_;
+  Arena arena_;
+  State state_;
+  size_t hdr_sz_;
+  // Size in bytes of the current message once the header is known, otherwise 0.
+  size_t msg_sz_;
+  size_t pending_rx_;
+  // Offset in |data_| of the current message.
+  size_t start_;
+  bool has_call_id_;
+  Result res_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_CODEC_COMPACT_H_
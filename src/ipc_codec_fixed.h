@@ -0,0 +1,692 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_CODEC_FIXED_H_
+#define SIMPLE_IPC_CODEC_FIXED_H_
+
+#include "os_includes.h"
+#include "ipc_codec.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// This file contains a fixed-width encoder & decoder pair for peers of different bitness or
+// byte order, for example a 32-bit worker talking to a 64-bit broker with
+// Channel<PipeTransport, FixedEncoder, FixedDecoder>. Every field is a 32-bit little-endian
+// word, whatever the word size and byte order of the machine, so the decoder reads it in place
+// with no varint loop. The format is:
+//
+// words what
+// 1     kMark
+// 1     kVersion, plus kCallFlag if there is a call id
+// 1     body size in bytes, always a multiple of 4
+// ----- body starts here
+// 1     msg id
+// 1     element count (0 to kMaxElements)
+// 1     call id, if kCallFlag is set
+//       first element tag (1 word)
+//       first element value
+//       second element tag
+//       .......
+//
+// The tag is the element type id plus CODEC_STRN08 or CODEC_STRN16 for the arrays. The 32-bit
+// values take one word. Pointers and OS handles always take a 64-bit slot of two words, low
+// word first, so both ends agree on the layout; a value that does not fit in the receiving side,
+// like a 64 bit pointer sent to a 32 bit process, is a decoding error, and so is a long that
+// does not fit in 32 bits on the sending side. Byte arrays and 8-bit strings are a length word
+// followed by the bytes, padded with zeros to a whole word. The 64-bit values and the typed
+// arrays go the same way but in little-endian order, so big-endian peers swap them. 16-bit
+// strings are a count word followed by a 16-bit unit per character, padded; characters above
+// 0xFFFF cannot be sent. Like in the other codecs the file descriptors also go in a side list
+// for the transport.
+//
+// kMark is neither of the default codec marks nor starts with the compact codec magic, so
+// DetectCodec() tells the three apart. See ipc_hello.h to pick the codec when the channel starts.
+
+namespace ipc {
+
+namespace fixed {
+
+const unsigned int kMark = 0x46504953;  // "SIPF" in memory.
+const unsigned int kVersion = 1;
+const unsigned int kCallFlag = 0x10000;
+const size_t kHeaderSz = 3 * 4;
+const size_t kMaxElements = 1024;
+const size_t kMaxBodySz = 64 * 1024 * 1024;
+
+enum {
+  CODEC_STRN08 = 1 << 8,
+  CODEC_STRN16 = 1 << 9,
+  CODEC_TYPE_MASK = CODEC_STRN08 - 1
+};
+
+inline unsigned int GetWord(const char* p) {
+  const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+  return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<unsigned int>(u[3]) << 24);
+}
+
+inline void SetWord(char* p, unsigned int v) {
+  p[0] = static_cast<char>(v);
+  p[1] = static_cast<char>(v >> 8);
+  p[2] = static_cast<char>(v >> 16);
+  p[3] = static_cast<char>(v >> 24);
+}
+
+inline void PutWord(IPCCharVector* out, unsigned int v) {
+  const size_t at = out->size();
+  out->resize(at + 4);
+  SetWord(&(*out)[at], v);
+}
+
+inline size_t Padded(size_t sz) {
+  return (sz + 3) & ~static_cast<size_t>(3);
+}
+
+// Size of the units that are sent in little-endian order for the raw byte types, 1 for the
+// types that are plain bytes.
+inline size_t UnitSize(int type) {
+  switch (type) {
+    case ipc::TYPE_INT64:
+    case ipc::TYPE_UINT64:
+    case ipc::TYPE_FLOAT64:
+    case ipc::TYPE_INT64ARRAY:
+    case ipc::TYPE_UINT64ARRAY:
+      return 8;
+    case ipc::TYPE_INT32ARRAY:
+    case ipc::TYPE_UINT32ARRAY:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+// Reverses the bytes of each |unit| sized value in |buf|.
+inline void SwapUnits(char* buf, size_t sz, size_t unit) {
+  for (size_t ix = 0; (ix + unit) <= sz; ix += unit) {
+    for (size_t lo = ix, hi = ix + unit - 1; lo < hi; ++lo, --hi) {
+      const char t = buf[lo];
+      buf[lo] = buf[hi];
+      buf[hi] = t;
+    }
+  }
+}
+
+}  // namespace fixed.
+
+
+class FixedEncoder {
+public:
+  // Strings and byte arrays of this size in bytes or larger are referenced instead of copied.
+  static const size_t kMinRefSz = 1024;
+
+  FixedEncoder() : msg_id_(0), count_(0), added_(0), ref_sz_(0), call_id_(0) {}
+
+  // When not zero, |call_id| goes in the header of the next message.
+  void SetCallId(unsigned int call_id) {
+    call_id_ = call_id;
+  }
+
+  bool Open(int count) {
+    if ((count < 0) || (static_cast<size_t>(count) > fixed::kMaxElements))
+      return false;
+    body_.resize(0);
+    hdr_.resize(0);
+    refs_.resize(0);
+    ref_pos_.resize(0);
+    fds_.resize(0);
+    ref_sz_ = 0;
+    count_ = count;
+    added_ = 0;
+    msg_id_ = 0;
+    return true;
+  }
+
+  bool Close() {
+    if (added_ != count_)
+      return false;
+    unsigned int version = fixed::kVersion;
+    const size_t ids_sz = call_id_ ? 12 : 8;
+    const size_t body_sz = ids_sz + body_.size() + ref_sz_;
+    if (body_sz > fixed::kMaxBodySz)
+      return false;
+    if (call_id_)
+      version |= fixed::kCallFlag;
+    hdr_.resize(fixed::kHeaderSz + ids_sz);
+    char* hdr = &hdr_[0];
+    fixed::SetWord(hdr, fixed::kMark);
+    fixed::SetWord(hdr + 4, version);
+    fixed::SetWord(hdr + 8, static_cast<unsigned int>(body_sz));
+    fixed::SetWord(hdr + 12, static_cast<unsigned int>(msg_id_));
+    fixed::SetWord(hdr + 16, static_cast<unsigned int>(count_));
+    if (call_id_) {
+      fixed::SetWord(hdr + 20, call_id_);
+      call_id_ = 0;
+    }
+    return true;
+  }
+
+  void SetMsgId(int id) {
+    msg_id_ = id;
+  }
+
+  bool OnWord(void* bits, int tag) {
+    if (!AddTag(tag))
+      return false;
+    switch (tag) {
+      case ipc::TYPE_INT32:
+      case ipc::TYPE_UINT32:
+      case ipc::TYPE_FLOAT32: {
+          unsigned int v;
+          memcpy(&v, &bits, sizeof(v));
+          PutWord(v);
+        }
+        break;
+      case ipc::TYPE_LONG32: {
+          long v;
+          memcpy(&v, &bits, sizeof(v));
+          if (v != static_cast<int>(v))
+            return false;
+          PutWord(static_cast<unsigned int>(v));
+        }
+        break;
+      case ipc::TYPE_ULONG32: {
+          unsigned long v;
+          memcpy(&v, &bits, sizeof(v));
+          if (v != static_cast<unsigned int>(v))
+            return false;
+          PutWord(static_cast<unsigned int>(v));
+        }
+        break;
+      case ipc::TYPE_CHAR8: {
+          unsigned char v;
+          memcpy(&v, &bits, sizeof(v));
+          PutWord(v);
+        }
+        break;
+      case ipc::TYPE_CHAR16: {
+          wchar_t v;
+          memcpy(&v, &bits, sizeof(v));
+          PutWord(static_cast<unsigned int>(v));
+        }
+        break;
+      case ipc::TYPE_NULLSTRING8:
+      case ipc::TYPE_NULLSTRING16:
+      case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+        break;
+      default:
+        PutSlot(reinterpret_cast<size_t>(bits));
+        break;
+    }
+    return true;
+  }
+
+  bool OnString8(const char* s, size_t sz, int tag) {
+    const size_t unit = fixed::UnitSize(tag);
+    if ((sz > fixed::kMaxBodySz) || (sz % unit) || !AddTag(tag | fixed::CODEC_STRN08))
+      return false;
+    PutWord(static_cast<unsigned int>(sz));
+#if defined(IPC_BIG_ENDIAN)
+    if (unit > 1) {
+      const size_t start = body_.size();
+      body_.insert(body_.end(), s, s + sz);
+      fixed::SwapUnits(&body_[start], sz, unit);
+      Pad(sz);
+      return true;
+    }
+#endif
+    if (sz >= kMinRefSz) {
+      IOSegment seg = { s, sz };
+      refs_.push_back(seg);
+      ref_pos_.push_back(static_cast<int>(body_.size()));
+      ref_sz_ += sz;
+    } else if (sz) {
+      body_.insert(body_.end(), s, s + sz);
+    }
+    Pad(sz);
+    return true;
+  }
+
+  bool OnString16(const wchar_t* s, size_t sz, int tag) {
+    if ((sz > fixed::kMaxBodySz) || !AddTag(tag | fixed::CODEC_STRN16))
+      return false;
+    PutWord(static_cast<unsigned int>(sz));
+    const size_t start = body_.size();
+    body_.resize(start + fixed::Padded(sz * 2));
+    char* out = &body_[start];
+    for (size_t ix = 0; ix != sz; ++ix) {
+      const size_t c = static_cast<size_t>(s[ix]);
+      if (c > 0xFFFF)
+        return false;
+      out[ix * 2] = static_cast<char>(c);
+      out[ix * 2 + 1] = static_cast<char>(c >> 8);
+    }
+    memset(out + sz * 2, 0, fixed::Padded(sz * 2) - sz * 2);
+    return true;
+  }
+
+  bool OnUnixFd(int fd, int tag) {
+    if ((fd < 0) || !AddTag(tag))
+      return false;
+    PutSlot(static_cast<size_t>(fd));
+    fds_.push_back(fd);
+    return true;
+  }
+
+  bool OnWinHandle(void* handle, int tag) {
+    return OnWord(handle, tag);
+  }
+
+  // Returns the file descriptors given to OnUnixFd() for this message, in order, or NULL if
+  // there are none.
+  const int* GetUnixFds(size_t* count) const {
+    *count = fds_.size();
+    return fds_.size() ? &fds_[0] : NULL;
+  }
+
+  // Returns the encoded message as |count| segments that must be written in order.
+  const IOSegment* GetSegments(size_t* count) {
+    segs_.resize(0);
+    IOSegment hdr = { &hdr_[0], hdr_.size() };
+    segs_.push_back(hdr);
+    size_t start = 0;
+    for (size_t ix = 0; ix != refs_.size(); ++ix) {
+      AddSegment(start, ref_pos_[ix]);
+      segs_.push_back(refs_[ix]);
+      start = ref_pos_[ix];
+    }
+    AddSegment(start, body_.size());
+    *count = segs_.size();
+    return &segs_[0];
+  }
+
+  // Returns the encoded message as a single buffer, copying the segments together.
+  const void* GetBuffer(size_t* sz) {
+    size_t count = 0;
+    const IOSegment* segs = GetSegments(&count);
+    flat_.resize(0);
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* buf = static_cast<const char*>(segs[ix].buf_);
+      flat_.insert(flat_.end(), buf, buf + segs[ix].sz_);
+    }
+    *sz = flat_.size();
+    return &flat_[0];
+  }
+
+  // Releases the buffers if together they hold more than |max_bytes|.
+  void Trim(size_t max_bytes) {
+    size_t held = body_.capacity() + flat_.capacity() +
+                  (refs_.capacity() + segs_.capacity()) * sizeof(IOSegment);
+    if (held <= max_bytes)
+      return;
+    IPCCharVector().swap(body_);
+    IPCCharVector().swap(flat_);
+    IPCSegmentVector().swap(refs_);
+    IPCSegmentVector().swap(segs_);
+    IPCIntVector().swap(ref_pos_);
+  }
+
+private:
+  bool AddTag(int tag) {
+    if (added_ == count_)
+      return false;
+    ++added_;
+    PutWord(static_cast<unsigned int>(tag));
+    return true;
+  }
+
+  void PutWord(unsigned int v) {
+    fixed::PutWord(&body_, v);
+  }
+
+  // Pointers and handles always take two words, low word first.
+  void PutSlot(size_t v) {
+    const unsigned long long v64 = v;
+    PutWord(static_cast<unsigned int>(v64));
+    PutWord(static_cast<unsigned int>(v64 >> 32));
+  }
+
+  // Zero fills the array of |sz| bytes up to a whole word.
+  void Pad(size_t sz) {
+    const size_t start = body_.size();
+    body_.resize(start + (fixed::Padded(sz) - sz));
+    memset(&body_[0] + start, 0, body_.size() - start);
+  }
+
+  void AddSegment(size_t start, size_t end) {
+    if (start == end)
+      return;
+    IOSegment seg = { &body_[start], end - start };
+    segs_.push_back(seg);
+  }
+
+  int msg_id_;
+  size_t count_;
+  size_t added_;
+  size_t ref_sz_;
+  IPCCharVector hdr_;
+  IPCCharVector body_;
+  IPCSegmentVector refs_;
+  IPCIntVector ref_pos_;
+  IPCSegmentVector segs_;
+  IPCCharVector flat_;
+  IPCIntVector fds_;
+  unsigned int call_id_;
+};
+
+
+template <typename HandlerT>
+class FixedDecoder {
+public:
+  FixedDecoder(HandlerT* handler)
+      : handler_(handler), state_(DEC_START), msg_sz_(0), pending_rx_(0), start_(0),
+        has_call_id_(false) {
+    Reset();
+  }
+
+  bool OnData(const char* buff, size_t sz) {
+    if (buff) {
+      Compact(sz);
+      data_.insert(data_.end(), buff, buff + sz);
+    } else if (data_.size() == start_) {
+      return true;
+    }
+    res_ = Run();
+    return (DEC_MOREDATA == res_);
+  }
+
+  bool Success() { return state_ == DEC_DONE; }
+
+  bool NeedsMoreData() const {
+    return (data_.size() == start_) || (res_ == DEC_MOREDATA);
+  }
+
+  bool Idle() const {
+    return (DEC_START == state_) && (data_.size() == start_);
+  }
+
+  size_t BytesNeeded() const {
+    const size_t total = msg_sz_ ? msg_sz_ : fixed::kHeaderSz;
+    const size_t have = data_.size() - start_;
+    return (total > have) ? (total - have) : 0;
+  }
+
+  char* GetReceiveBuffer(size_t sz) {
+    Compact(sz);
+    const size_t start = data_.size();
+    data_.resize(start + sz);
+    pending_rx_ = sz;
+    return &data_[start];
+  }
+
+  bool OnReceived(size_t sz) {
+    data_.resize(data_.size() - (pending_rx_ - sz));
+    pending_rx_ = 0;
+    return OnData(NULL, 0);
+  }
+
+  // Prepares the decoder for the next message. The views handed to the handler for the
+  // previous message are invalid after this call.
+  void Reset() {
+    if (DEC_DONE == state_)
+      start_ += msg_sz_;
+    arena_.Reset();
+    state_ = DEC_START;
+    msg_sz_ = 0;
+    res_ = DEC_NONE;
+  }
+
+  void Clear() {
+    data_.resize(0);
+    start_ = 0;
+    state_ = DEC_START;
+    Reset();
+  }
+
+  void Trim(size_t max_bytes) {
+    arena_.Trim(max_bytes);
+    if (data_.capacity() <= max_bytes)
+      return;
+    IPCCharVector keep;
+    if (data_.size() != start_)
+      keep.insert(keep.end(), &data_[start_], &data_[0] + data_.size());
+    data_.swap(keep);
+    start_ = 0;
+  }
+
+private:
+  enum State {
+    DEC_START,
+    DEC_BODY,
+    DEC_DONE,
+    DEC_FAILED
+  };
+
+  enum Result {
+    DEC_NONE,
+    DEC_MOREDATA,
+    DEC_READY,
+    DEC_ERROR
+  };
+
+  // Same policy as CompactDecoder::Compact().
+  void Compact(size_t sz) {
+    if (!start_ || (DEC_DONE == state_))
+      return;
+    const size_t left = data_.size() - start_;
+    if (left && (left > start_) && ((data_.size() + sz) <= data_.capacity()))
+      return;
+    data_.erase(data_.begin(), data_.begin() + start_);
+    start_ = 0;
+  }
+
+  Result Run() {
+    if (DEC_START == state_) {
+      Result res = ReadHeader();
+      if (DEC_READY != res)
+        return Fail(res);
+      state_ = DEC_BODY;
+    }
+    if (DEC_BODY == state_) {
+      if ((data_.size() - start_) < msg_sz_)
+        return DEC_MOREDATA;
+      if (!ReadBody())
+        return Fail(DEC_ERROR);
+      state_ = DEC_DONE;
+      return DEC_READY;
+    }
+    return DEC_ERROR;
+  }
+
+  Result Fail(Result res) {
+    if (DEC_ERROR == res)
+      state_ = DEC_FAILED;
+    return res;
+  }
+
+  Result ReadHeader() {
+    if ((data_.size() - start_) < fixed::kHeaderSz)
+      return DEC_MOREDATA;
+    const unsigned int version = Word(start_ + 4);
+    if ((Word(start_) != fixed::kMark) || ((version & ~fixed::kCallFlag) != fixed::kVersion))
+      return DEC_ERROR;
+    has_call_id_ = (0 != (version & fixed::kCallFlag));
+    const size_t body_sz = Word(start_ + 8);
+    if ((body_sz > fixed::kMaxBodySz) || (body_sz % 4))
+      return DEC_ERROR;
+    msg_sz_ = fixed::kHeaderSz + body_sz;
+    return DEC_READY;
+  }
+
+  bool ReadBody() {
+    const size_t end = start_ + msg_sz_;
+    size_t pos = start_ + fixed::kHeaderSz;
+    const size_t ids_sz = has_call_id_ ? 12 : 8;
+    if ((end - pos) < ids_sz)
+      return false;
+    const unsigned int msg_id = Word(pos);
+    const unsigned int count = Word(pos + 4);
+    const unsigned int call_id = has_call_id_ ? Word(pos + 8) : 0;
+    pos += ids_sz;
+    if ((msg_id > 0x7FFFFFFF) || (count > fixed::kMaxElements) || (has_call_id_ && !call_id))
+      return false;
+    if (!handler_->OnMessageStart(static_cast<int>(msg_id), static_cast<int>(count)))
+      return false;
+    if (call_id)
+      handler_->OnCallId(call_id);
+    for (size_t ix = 0; ix != count; ++ix) {
+      if ((end - pos) < 4)
+        return false;
+      const unsigned int tag = Word(pos);
+      const int type = tag & fixed::CODEC_TYPE_MASK;
+      pos += 4;
+      bool ok;
+      if (tag & fixed::CODEC_STRN08) {
+        ok = ReadStr8(&pos, end, type);
+      } else if (tag & fixed::CODEC_STRN16) {
+        ok = ReadStr16(&pos, end, type);
+      } else {
+        ok = ReadWord(&pos, end, type);
+      }
+      if (!ok)
+        return false;
+    }
+    return (pos == end);
+  }
+
+  bool ReadWord(size_t* pos, size_t end, int type) {
+    union {
+      int v_int;
+      unsigned int v_uint;
+      long v_long;
+      unsigned long v_ulong;
+      char v_char;
+      wchar_t v_wchar;
+      void* v_pvoid;
+    } store;
+    store.v_pvoid = NULL;
+    size_t words = 1;
+    switch (type) {
+      case ipc::TYPE_NULLSTRING8:
+      case ipc::TYPE_NULLSTRING16:
+      case ipc::TYPE_NULLBARRAY:
+      case ipc::TYPE_NULLINT32ARRAY:
+      case ipc::TYPE_NULLUINT32ARRAY:
+      case ipc::TYPE_NULLINT64ARRAY:
+      case ipc::TYPE_NULLUINT64ARRAY:
+        words = 0;
+        break;
+      case ipc::TYPE_VOIDPTR:
+      case ipc::TYPE_HANDLE:
+        words = 2;
+        break;
+    }
+    if ((end - *pos) < (words * 4))
+      return false;
+    const unsigned int v = words ? Word(*pos) : 0;
+    switch (type) {
+      case ipc::TYPE_INT32:
+        store.v_int = static_cast<int>(v);
+        break;
+      case ipc::TYPE_LONG32:
+        store.v_long = static_cast<int>(v);
+        break;
+      case ipc::TYPE_UINT32:
+      case ipc::TYPE_FLOAT32:
+        store.v_uint = v;
+        break;
+      case ipc::TYPE_ULONG32:
+        store.v_ulong = v;
+        break;
+      case ipc::TYPE_CHAR8:
+        store.v_char = static_cast<char>(v);
+        break;
+      case ipc::TYPE_CHAR16:
+        store.v_wchar = static_cast<wchar_t>(v);
+        break;
+      case ipc::TYPE_VOIDPTR:
+      case ipc::TYPE_HANDLE: {
+          const unsigned long long v64 =
+              v | (static_cast<unsigned long long>(Word(*pos + 4)) << 32);
+          if (v64 != static_cast<size_t>(v64))
+            return false;
+          store.v_pvoid = reinterpret_cast<void*>(static_cast<size_t>(v64));
+        }
+        break;
+      default:
+        if (words)
+          return false;
+        break;
+    }
+    *pos += words * 4;
+    return handler_->OnWord(&store, type);
+  }
+
+  // The bytes are handed out in place; big-endian machines swap the multi-byte values first.
+  bool ReadStr8(size_t* pos, size_t end, int type) {
+    if ((end - *pos) < 4)
+      return false;
+    const size_t sz = Word(*pos);
+    *pos += 4;
+    if ((fixed::Padded(sz) > (end - *pos)) || (sz % fixed::UnitSize(type)))
+      return false;
+    char* beg = &data_[*pos];
+#if defined(IPC_BIG_ENDIAN)
+    fixed::SwapUnits(beg, sz, fixed::UnitSize(type));
+#endif
+    *pos += fixed::Padded(sz);
+    return handler_->OnString8(beg, sz, type);
+  }
+
+  // The characters are widened into the arena which lives until Reset().
+  bool ReadStr16(size_t* pos, size_t end, int type) {
+    if ((end - *pos) < 4)
+      return false;
+    const size_t sz = Word(*pos);
+    *pos += 4;
+    if (fixed::Padded(sz * 2) > (end - *pos))
+      return false;
+    wchar_t* str = static_cast<wchar_t*>(arena_.Alloc((sz + 1) * sizeof(wchar_t)));
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(&data_[*pos]);
+    for (size_t ix = 0; ix != sz; ++ix) {
+      str[ix] = static_cast<wchar_t>(src[ix * 2] | (src[ix * 2 + 1] << 8));
+    }
+    str[sz] = 0;
+    *pos += fixed::Padded(sz * 2);
+    return handler_->OnString16(str, sz, type);
+  }
+
+  unsigned int Word(size_t pos) const {
+    return fixed::GetWord(&data_[pos]);
+  }
+
+  HandlerT* handler_;
+  IPCCharVector data_;
+  Arena arena_;
+  State state_;
+  // Size in bytes of the current message once the header is known, otherwise 0.
+  size_t msg_sz_;
+  size_t pending_rx_;
+  // Offset in |data_| of the current message.
+  size_t start_;
+  bool has_call_id_;
+  Result res_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_CODEC_FIXED_H_
@@ -0,0 +1,207 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_COMPRESS_H_
+#define SIMPLE_IPC_COMPRESS_H_
+
+#include "os_includes.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Byte oriented LZ77 compressor for the large arrays of a message, see PackingEncoder in
+// ipc_codec.h. It trades ratio for speed in the way of LZ4: one hash probe per position, no
+// entropy coding, and a decoder that only copies. The packed data is a list of sequences:
+//
+//  token         high 4 bits literal count, low 4 bits match length - 4. A value of 15
+//                means that more length bytes follow, each adds 0 to 255, the last one is < 255
+//  literals      copied as they are
+//  offset        2 bytes little-endian, how far back the match starts. Absent in the last
+//                sequence, which only has literals
+//  match length  the extra length bytes, if any
+//
+// Unpack() checks every length and offset against both buffers so corrupt or hostile data
+// fails instead of writing out of bounds.
+
+namespace ipc {
+
+class FastPack {
+public:
+  // Inputs smaller than this are not worth a hash table.
+  static const size_t kMinInputSz = 64;
+
+  // Compresses the |sz| bytes at |src| into |dst|. Returns the packed size, or 0 if it would
+  // not fit in |dst_sz| bytes, in which case the data should go as it is.
+  static size_t Pack(const char* src, size_t sz, char* dst, size_t dst_sz) {
+    if (sz < kMinInputSz)
+      return 0;
+    unsigned int table[kHashSz];
+    memset(table, 0, sizeof(table));
+
+    const unsigned char* const base = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* const end = base + sz;
+    // The last bytes are always literals so the match loops can read 4 bytes without checks.
+    const unsigned char* const match_end = end - kLastLiterals;
+    const unsigned char* ip = base;
+    const unsigned char* anchor = base;
+    unsigned char* op = reinterpret_cast<unsigned char*>(dst);
+    unsigned char* const op_end = op + dst_sz;
+    size_t misses = 0;
+
+    while (ip < match_end) {
+      const unsigned int h = Hash(Read32(ip));
+      const unsigned char* ref = base + table[h];
+      table[h] = static_cast<unsigned int>(ip - base);
+      if ((ref >= ip) || ((ip - ref) > kMaxOffset) || (Read32(ref) != Read32(ip))) {
+        // Data that does not compress is skipped over faster and faster.
+        ip += 1 + (misses++ >> 5);
+        continue;
+      }
+      misses = 0;
+      const unsigned char* mp = ip + kMinMatch;
+      ref += kMinMatch;
+      while ((mp < match_end) && (*mp == *ref)) {
+        ++mp;
+        ++ref;
+      }
+      op = PutSequence(op, op_end, anchor, ip - anchor, mp - ip, mp - ref);
+      if (!op)
+        return 0;
+      ip = mp;
+      anchor = mp;
+    }
+    op = PutSequence(op, op_end, anchor, end - anchor, 0, 0);
+    if (!op)
+      return 0;
+    return op - reinterpret_cast<unsigned char*>(dst);
+  }
+
+  // Expands the |sz| bytes at |src| into exactly |dst_sz| bytes at |dst|. Returns false if the
+  // packed data is malformed or does not produce |dst_sz| bytes.
+  static bool Unpack(const char* src, size_t sz, char* dst, size_t dst_sz) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* const end = ip + sz;
+    unsigned char* const base = reinterpret_cast<unsigned char*>(dst);
+    unsigned char* op = base;
+    unsigned char* const op_end = op + dst_sz;
+
+    while (ip != end) {
+      const unsigned int token = *ip++;
+      size_t literals = token >> 4;
+      if (!GetLength(&ip, end, &literals))
+        return false;
+      if ((static_cast<size_t>(end - ip) < literals) ||
+          (static_cast<size_t>(op_end - op) < literals))
+        return false;
+      memcpy(op, ip, literals);
+      ip += literals;
+      op += literals;
+      if (ip == end)
+        break;
+
+      if ((end - ip) < 2)
+        return false;
+      const size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (!offset || (offset > static_cast<size_t>(op - base)))
+        return false;
+      size_t match = token & 15;
+      if (!GetLength(&ip, end, &match))
+        return false;
+      match += kMinMatch;
+      if (static_cast<size_t>(op_end - op) < match)
+        return false;
+      // The match can overlap what it writes, which repeats the last |offset| bytes.
+      const unsigned char* ref = op - offset;
+      if (offset >= match) {
+        memcpy(op, ref, match);
+        op += match;
+      } else {
+        for (size_t ix = 0; ix != match; ++ix) {
+          *op++ = *ref++;
+        }
+      }
+    }
+    return op == op_end;
+  }
+
+private:
+  enum {
+    kHashBits = 12,
+    kHashSz = 1 << kHashBits,
+    kMinMatch = 4,
+    kLastLiterals = 8,
+    kMaxOffset = 0xFFFF
+  };
+
+  static unsigned int Read32(const unsigned char* p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static unsigned int Hash(unsigned int v) {
+    return (v * 2654435761u) >> (32 - kHashBits);
+  }
+
+  // Writes |literals| bytes from |lit| followed by a match of |match| bytes at |offset|. A
+  // |match| of 0 ends the data. Returns NULL if it does not fit before |op_end|.
+  static unsigned char* PutSequence(unsigned char* op, unsigned char* op_end,
+                                    const unsigned char* lit, size_t literals, size_t match,
+                                    size_t offset) {
+    const size_t extra = match ? (match - kMinMatch) : 0;
+    const size_t need = 1 + literals + literals / 255 + 1 + (match ? (2 + extra / 255 + 1) : 0);
+    if (static_cast<size_t>(op_end - op) < need)
+      return NULL;
+    unsigned char* token = op++;
+    *token = static_cast<unsigned char>(((literals < 15) ? literals : 15) << 4);
+    op = PutLength(op, literals);
+    memcpy(op, lit, literals);
+    op += literals;
+    if (!match)
+      return op;
+    *token |= static_cast<unsigned char>((extra < 15) ? extra : 15);
+    *op++ = static_cast<unsigned char>(offset & 0xFF);
+    *op++ = static_cast<unsigned char>(offset >> 8);
+    return PutLength(op, extra);
+  }
+
+  // The bytes that follow a nibble of 15.
+  static unsigned char* PutLength(unsigned char* op, size_t len) {
+    if (len < 15)
+      return op;
+    len -= 15;
+    while (len >= 255) {
+      *op++ = 255;
+      len -= 255;
+    }
+    *op++ = static_cast<unsigned char>(len);
+    return op;
+  }
+
+  static bool GetLength(const unsigned char** ip, const unsigned char* end, size_t* len) {
+    if (*len != 15)
+      return true;
+    unsigned int b;
+    do {
+      if (*ip == end)
+        return false;
+      b = *(*ip)++;
+      *len += b;
+    } while (b == 255);
+    return true;
+  }
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_COMPRESS_H_
@@ -31,6 +31,11 @@ const size_t RcErrDecoderFormat     = static_cast<size_t>(-7);
 const size_t RcErrDecoderArgs       = static_cast<size_t>(-8);
 const size_t RcErrNewTransport      = static_cast<size_t>(-9);
 const size_t RcErrBadMessageId      = static_cast<size_t>(-10);
+const size_t RcErrBadCallId         = static_cast<size_t>(-11);
+const size_t RcErrTooManyCalls      = static_cast<size_t>(-12);
+const size_t RcErrBadStreamId       = static_cast<size_t>(-13);
+const size_t RcErrTooManyStreams    = static_cast<size_t>(-14);
+const size_t RcErrStreamWindow      = static_cast<size_t>(-15);
 
 // For the return on obj.OnMsg() when calling Channel::Receive(obj) there
 // are two critical values:
@@ -0,0 +1,571 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_DISPATCH_POOL_H_
+#define SIMPLE_IPC_DISPATCH_POOL_H_
+
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_utils.h"
+#include "ipc_wire_types.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// By default Channel::Receive() calls the message handler on the thread that reads the
+// transport, so a handler that blocks holds back every message behind it. The classes here move
+// the handlers to a pool of threads instead:
+//
+// - DispatchPool runs PoolTask objects on a fixed set of threads. Each thread has its own
+//   queue; idle threads steal from the other queues so the work spreads to all of them.
+// - DispatchStrand runs the tasks posted to it one at a time and in order, on the pool threads.
+// - PooledDispatch is a top level dispatcher for Channel::Receive() that copies each message
+//   and posts it to the pool. Messages whose handler is ordered go to the strand of the
+//   connection, so they are handled in the order they arrived. The others run as soon as a
+//   thread is free.
+//
+// For example, for a broker that serves each connection with its own thread:
+//
+//  ipc::DispatchPool pool;
+//  pool.Start(8);
+//  ...
+//  // For each connection:
+//  BrokerDispatch dispatch;
+//  ipc::PooledDispatch<PipeChannel, BrokerDispatch> pooled(&pool, &dispatch);
+//  channel.Receive(&pooled);
+//  pooled.Drain();
+//
+// A message handler declares itself unordered by implementing IsOrderedMsg(int msg_id) and
+// returning false, MsgIn handlers are ordered otherwise. The replies are sent from the pool
+// threads with the usual Channel::Send(), which can be called from many threads at once, and
+// still get the call id of their call.
+
+namespace ipc {
+
+// A unit of work for DispatchPool. The pool does not delete the tasks; tasks allocated for
+// one run can delete themselves at the end of Run().
+class PoolTask {
+public:
+  virtual ~PoolTask() {}
+  virtual void Run() = 0;
+};
+
+// FIFO of tasks that can also be taken from the back. Not thread safe.
+class TaskQueue {
+public:
+  TaskQueue() : ring_(NULL), cap_(0), head_(0), count_(0) {}
+  ~TaskQueue() { delete[] ring_; }
+
+  void PushBack(PoolTask* task) {
+    if (count_ == cap_)
+      Grow();
+    ring_[(head_ + count_) % cap_] = task;
+    ++count_;
+  }
+
+  PoolTask* PopFront() {
+    if (!count_)
+      return NULL;
+    PoolTask* task = ring_[head_];
+    head_ = (head_ + 1) % cap_;
+    --count_;
+    return task;
+  }
+
+  PoolTask* PopBack() {
+    if (!count_)
+      return NULL;
+    --count_;
+    return ring_[(head_ + count_) % cap_];
+  }
+
+  size_t size() const { return count_; }
+
+private:
+  void Grow() {
+    const size_t cap = cap_ ? cap_ * 2 : 16;
+    PoolTask** ring = new PoolTask*[cap];
+    for (size_t ix = 0; ix != count_; ++ix) {
+      ring[ix] = ring_[(head_ + ix) % cap_];
+    }
+    delete[] ring_;
+    ring_ = ring;
+    cap_ = cap;
+    head_ = 0;
+  }
+
+  PoolTask** ring_;
+  size_t cap_;
+  size_t head_;
+  size_t count_;
+
+  TaskQueue(const TaskQueue&);
+  TaskQueue& operator=(const TaskQueue&);
+};
+
+class DispatchPool {
+public:
+  static const size_t kMaxThreads = 64;
+
+  DispatchPool() : n_threads_(0), next_(0), idle_(0), stop_(0) {}
+
+  ~DispatchPool() {
+    Stop();
+  }
+
+  // Starts |n_threads| threads, at most kMaxThreads.
+  bool Start(size_t n_threads) {
+    if (Threads() || !n_threads || (n_threads > kMaxThreads))
+      return false;
+    AtomicStore(&stop_, 0);
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      workers_[ix].pool = this;
+    }
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      if (!StartThread(&DispatchPool::ThreadMain, &workers_[ix], &workers_[ix].thread)) {
+        Stop();
+        return false;
+      }
+      // CurrentWorker() reads the id, so it has to be in place before the thread counts.
+      started_.Wait();
+      AtomicAdd(&n_threads_, 1);
+    }
+    return true;
+  }
+
+  // Queues |task| to run on one of the threads. Tasks posted from a pool thread go to the
+  // queue of that thread, the others are spread round robin.
+  void Post(PoolTask* task) {
+    const size_t n_threads = Threads();
+    if (!n_threads) {
+      // Not started.
+      task->Run();
+      return;
+    }
+    Worker* worker = CurrentWorker();
+    if (!worker)
+      worker = &workers_[static_cast<unsigned long>(AtomicAdd(&next_, 1)) % n_threads];
+    {
+      AutoSpinLock lock(&worker->lock);
+      worker->queue.PushBack(task);
+      AtomicAdd(&worker->queued, 1);
+    }
+    MemoryFence();
+    if (AtomicLoad(&idle_))
+      wake_.Signal();
+  }
+
+  // Runs the tasks that are queued and then stops the threads. Post() can not be called
+  // afterwards, unless the pool is started again.
+  void Stop() {
+    const size_t n_threads = Threads();
+    if (!n_threads)
+      return;
+    AtomicStore(&stop_, 1);
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      wake_.Signal();
+    }
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      JoinThread(workers_[ix].thread);
+    }
+    AtomicStore(&n_threads_, 0);
+  }
+
+  size_t Threads() const { return static_cast<size_t>(AtomicLoad(&n_threads_)); }
+
+private:
+  struct Worker {
+    Worker() : pool(NULL), queued(0) {}
+
+    DispatchPool* pool;
+    ThreadHandle thread;
+    ThreadId id;
+    SpinLock lock;
+    TaskQueue queue;
+    // Size of |queue|, for the other threads to look at without taking |lock|.
+    volatile long queued;
+  };
+
+  static void ThreadMain(void* ctx) {
+    Worker* worker = static_cast<Worker*>(ctx);
+    DispatchPool* pool = worker->pool;
+    worker->id = CurrentThreadId();
+    pool->started_.Signal();
+    pool->Loop(worker);
+  }
+
+  void Loop(Worker* self) {
+    for (;;) {
+      PoolTask* task = Take(self);
+      if (task) {
+        task->Run();
+        continue;
+      }
+      // Announce that this thread is going to sleep and look once more, a task posted in
+      // between sees |idle_| and signals.
+      AtomicAdd(&idle_, 1);
+      task = Take(self);
+      if (!task && !AtomicLoad(&stop_))
+        wake_.Wait();
+      AtomicAdd(&idle_, -1);
+      if (task) {
+        task->Run();
+      } else if (AtomicLoad(&stop_) && !Pending()) {
+        return;
+      }
+    }
+  }
+
+  // The newest task of |self| or else the oldest task of another thread.
+  PoolTask* Take(Worker* self) {
+    {
+      AutoSpinLock lock(&self->lock);
+      PoolTask* task = self->queue.PopBack();
+      if (task) {
+        AtomicAdd(&self->queued, -1);
+        return task;
+      }
+    }
+    const size_t start = static_cast<size_t>(self - workers_);
+    const size_t n_threads = Threads();
+    for (size_t ix = 1; ix < n_threads; ++ix) {
+      Worker* victim = &workers_[(start + ix) % n_threads];
+      if (!AtomicLoad(&victim->queued))
+        continue;
+      AutoSpinLock lock(&victim->lock);
+      PoolTask* task = victim->queue.PopFront();
+      if (task) {
+        AtomicAdd(&victim->queued, -1);
+        return task;
+      }
+    }
+    return NULL;
+  }
+
+  bool Pending() {
+    const size_t n_threads = Threads();
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      AutoSpinLock lock(&workers_[ix].lock);
+      if (workers_[ix].queue.size())
+        return true;
+    }
+    return false;
+  }
+
+  Worker* CurrentWorker() {
+    const ThreadId self = CurrentThreadId();
+    const size_t n_threads = Threads();
+    for (size_t ix = 0; ix != n_threads; ++ix) {
+      if (SameThread(workers_[ix].id, self))
+        return &workers_[ix];
+    }
+    return NULL;
+  }
+
+  Worker workers_[kMaxThreads];
+  volatile long n_threads_;
+  volatile long next_;
+  volatile long idle_;
+  volatile long stop_;
+  Semaphore wake_;
+  // Signaled by each thread once its id is set.
+  Semaphore started_;
+
+  DispatchPool(const DispatchPool&);
+  DispatchPool& operator=(const DispatchPool&);
+};
+
+// Runs the tasks posted to it on |pool|, one after the other in the order they were posted.
+// Different strands run in parallel.
+class DispatchStrand : private PoolTask {
+public:
+  // Tasks run before the strand gives its thread back to the other work.
+  static const size_t kMaxRunsPerTurn = 32;
+
+  explicit DispatchStrand(DispatchPool* pool)
+      : pool_(pool), scheduled_(false), waiting_(false) {}
+
+  void Post(PoolTask* task) {
+    AutoSpinLock lock(&lock_);
+    queue_.PushBack(task);
+    if (scheduled_)
+      return;
+    scheduled_ = true;
+    pool_->Post(this);
+  }
+
+  // Waits until the strand is off the pool. The last task finishes inside the strand's turn,
+  // so the strand can only be destroyed after this. Call it once no more tasks are posted.
+  void WaitIdle() {
+    for (;;) {
+      {
+        AutoSpinLock lock(&lock_);
+        if (!scheduled_)
+          return;
+        waiting_ = true;
+      }
+      idle_.Wait();
+    }
+  }
+
+private:
+  virtual void Run() {
+    for (size_t ix = 0; ix != kMaxRunsPerTurn; ++ix) {
+      PoolTask* task = NULL;
+      {
+        AutoSpinLock lock(&lock_);
+        task = queue_.PopFront();
+        if (!task) {
+          scheduled_ = false;
+          // Signals with the lock held, WaitIdle() takes it again before it returns.
+          if (waiting_) {
+            waiting_ = false;
+            idle_.Signal();
+          }
+          return;
+        }
+      }
+      task->Run();
+    }
+    // Still scheduled, so tasks posted meanwhile do not post the strand a second time.
+    pool_->Post(this);
+  }
+
+  DispatchPool* pool_;
+  SpinLock lock_;
+  TaskQueue queue_;
+  bool scheduled_;
+  // WaitIdle() sets |waiting_| and waits on |idle_| for Run() to clear |scheduled_|.
+  bool waiting_;
+  Semaphore idle_;
+};
+
+// Dispatcher for Channel::Receive() that runs the message handlers of |dispatch| on |pool|.
+// The messages are copied so Receive() goes on reading while they are handled. The handlers
+// are called with the channel that received the message, and its replies go there.
+//
+// OnMsgIn() returns OnMsgLoopNext so Receive() only returns on errors. The first other value
+// returned by a handler is kept in result() and makes the next messages fail with it.
+// Call Drain() before destroying the object or the channel.
+template <class ChannelT, class DispatchT>
+class PooledDispatch {
+public:
+  PooledDispatch(DispatchPool* pool, DispatchT* dispatch)
+      : pool_(pool), dispatch_(dispatch), strand_(pool), in_flight_(0),
+        result_(static_cast<long>(ipc::OnMsgLoopNext)), draining_(false) {}
+
+  PooledDispatch* MsgHandler(int msg_id) {
+    return dispatch_->MsgHandler(msg_id) ? this : NULL;
+  }
+
+  void* OnNewTransport() {
+    return dispatch_->OnNewTransport();
+  }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    if (ipc::OnMsgLoopNext != result()) {
+      CloseHandleArgs(args, count);
+      return result();
+    }
+    return PostMsg(dispatch_->MsgHandler(msg_id), ch, msg_id, args, count);
+  }
+
+  // Waits until every message posted so far has been handled.
+  void Drain() {
+    bool wait = false;
+    {
+      AutoSpinLock lock(&drain_lock_);
+      if (AtomicLoad(&in_flight_)) {
+        draining_ = true;
+        wait = true;
+      }
+    }
+    if (wait) {
+      drained_.Wait();
+      // Done() signals with the lock held, so once it is ours that thread is done with us.
+      AutoSpinLock lock(&drain_lock_);
+    }
+    // The strand may still be in the turn that ran the last ordered message.
+    strand_.WaitIdle();
+  }
+
+  size_t result() const { return static_cast<size_t>(AtomicLoad(&result_)); }
+
+private:
+  template <class HandlerT>
+  size_t PostMsg(HandlerT* handler, ChannelT* ch, int msg_id, const WireType* const args[],
+                 int count) {
+    if (!handler) {
+      CloseHandleArgs(args, count);
+      return RcErrBadMessageId;
+    }
+    PoolTask* msg =
+        new PooledMsg<HandlerT>(this, handler, ch, ch->DetachCall(), msg_id, args, count);
+    AtomicAdd(&in_flight_, 1);
+    if (handler->IsOrderedMsg(msg_id))
+      strand_.Post(msg);
+    else
+      pool_->Post(msg);
+    return ipc::OnMsgLoopNext;
+  }
+
+  // A copy of a received message. The strings and arrays are copied to a single buffer
+  // owned by the message.
+  template <class HandlerT>
+  class PooledMsg : public PoolTask {
+  public:
+    PooledMsg(PooledDispatch* owner, HandlerT* handler, ChannelT* ch, unsigned int call_id,
+              int msg_id, const WireType* const args[], int count)
+        : owner_(owner), handler_(handler), ch_(ch), call_id_(call_id), msg_id_(msg_id),
+          count_(count), data_(NULL) {
+      size_t total = 0;
+      for (int ix = 0; ix != count; ++ix) {
+        total += Footprint(*args[ix]);
+      }
+      if (total)
+        data_ = new char[total];
+      char* next = data_;
+      for (int ix = 0; ix != count; ++ix) {
+        args_.push_back(Copy(*args[ix], &next));
+      }
+    }
+
+    ~PooledMsg() {
+      delete[] data_;
+    }
+
+    virtual void Run() {
+      const WireType* args[ChannelT::kMaxNumArgs];
+      for (int ix = 0; ix != count_; ++ix) {
+        args[ix] = &args_[ix];
+      }
+      size_t rc = ch_->DispatchDetached(handler_, call_id_, msg_id_, args, count_);
+      owner_->Done(rc);
+      delete this;
+    }
+
+  private:
+    // Bytes used in |data_| by |wt|, rounded up to keep the wide strings and the typed
+    // arrays aligned.
+    static size_t Footprint(const WireType& wt) {
+      size_t sz = 0;
+      switch (wt.Id()) {
+        case ipc::TYPE_INT32ARRAY:
+        case ipc::TYPE_UINT32ARRAY:
+        case ipc::TYPE_INT64ARRAY:
+        case ipc::TYPE_UINT64ARRAY:
+          wt.PeekBytes(&sz);
+          return Align(sz);
+        case ipc::TYPE_STRING8:
+          wt.PeekString8(&sz);
+          return Align(sz + 1);
+        case ipc::TYPE_BARRAY:
+          wt.PeekString8(&sz);
+          return Align(sz);
+        case ipc::TYPE_STRING16:
+          wt.PeekString16(&sz);
+          return Align((sz + 1) * sizeof(wchar_t));
+        default:
+          return 0;
+      }
+    }
+
+    static size_t Align(size_t sz) {
+      return (sz + sizeof(long long) - 1) & ~(sizeof(long long) - 1);
+    }
+
+    template <class ArrayT>
+    static WireType CopyArray(const ArrayT& ta, char** next) {
+      typedef typename ArrayT::ElementType T;
+      T* copy = reinterpret_cast<T*>(*next);
+      memcpy(copy, ta.buf_, ta.sz_ * sizeof(T));
+      *next += Align(ta.sz_ * sizeof(T));
+      return WireType(ArrayT(ta.sz_, copy));
+    }
+
+    static WireType Copy(const WireType& wt, char** next) {
+      size_t sz = 0;
+      switch (wt.Id()) {
+        case ipc::TYPE_STRING8: {
+          const char* str = wt.PeekString8(&sz);
+          char* copy = *next;
+          memcpy(copy, str, sz);
+          copy[sz] = 0;
+          *next += Align(sz + 1);
+          return WireType(String8Ref(sz, copy));
+        }
+        case ipc::TYPE_BARRAY: {
+          const char* buf = wt.PeekString8(&sz);
+          char* copy = *next;
+          memcpy(copy, buf, sz);
+          *next += Align(sz);
+          return WireType(ByteArrayRef(sz, copy));
+        }
+        case ipc::TYPE_STRING16: {
+          const wchar_t* str = wt.PeekString16(&sz);
+          wchar_t* copy = reinterpret_cast<wchar_t*>(*next);
+          memcpy(copy, str, sz * sizeof(wchar_t));
+          copy[sz] = 0;
+          *next += Align((sz + 1) * sizeof(wchar_t));
+          return WireType(String16Ref(sz, copy));
+        }
+        case ipc::TYPE_INT32ARRAY:
+          return CopyArray(wt.AsInt32Array(), next);
+        case ipc::TYPE_UINT32ARRAY:
+          return CopyArray(wt.AsUInt32Array(), next);
+        case ipc::TYPE_INT64ARRAY:
+          return CopyArray(wt.AsInt64Array(), next);
+        case ipc::TYPE_UINT64ARRAY:
+          return CopyArray(wt.AsUInt64Array(), next);
+        default:
+          // Values and null arrays have no storage.
+          return wt;
+      }
+    }
+
+    PooledDispatch* owner_;
+    HandlerT* handler_;
+    ChannelT* ch_;
+    unsigned int call_id_;
+    int msg_id_;
+    int count_;
+    SmallArray<WireType, ChannelT::kInlineArgs> args_;
+    char* data_;
+  };
+
+  void Done(size_t rc) {
+    if (ipc::OnMsgLoopNext != rc)
+      AtomicCompareExchange(&result_, static_cast<long>(rc), static_cast<long>(ipc::OnMsgLoopNext));
+    AutoSpinLock lock(&drain_lock_);
+    if (!AtomicAdd(&in_flight_, -1) && draining_) {
+      draining_ = false;
+      drained_.Signal();
+    }
+  }
+
+  DispatchPool* pool_;
+  DispatchT* dispatch_;
+  DispatchStrand strand_;
+  volatile long in_flight_;
+  volatile long result_;
+  // Drain() sets |draining_| and waits on |drained_| for the last Done().
+  SpinLock drain_lock_;
+  bool draining_;
+  Semaphore drained_;
+
+  PooledDispatch(const PooledDispatch&);
+  PooledDispatch& operator=(const PooledDispatch&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_DISPATCH_POOL_H_
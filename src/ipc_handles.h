@@ -0,0 +1,100 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_HANDLES_H_
+#define SIMPLE_IPC_HANDLES_H_
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+
+#if !defined(WIN32)
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// OS handles can be passed to the peer process as message arguments of type TYPE_HANDLE, so a
+// large file or a shared memory section can be handed over instead of copied through the
+// transport. The receiver gets its own handle to the same object. The message handler owns it
+// and must close it. The handles of a message that no handler takes, because its id is unknown
+// or its arguments do not match, are closed by the library.
+//
+// The transport does the work. On posix the descriptors go as SCM_RIGHTS ancillary data on a
+// unix socket, out of band, and the message only carries a placeholder. On windows the handle
+// is duplicated into the peer process and the message carries the duplicate.
+//
+// The channel talks to the transport with HandleTransport<TransportT>. Transports that can
+// pass handles specialize it, see PipeTransport; a message with a handle argument fails to
+// send over any other transport.
+
+namespace ipc {
+
+// Wrapper for a file descriptor on posix or a HANDLE on windows.
+struct OsHandle {
+#if defined(WIN32)
+  typedef HANDLE Value;
+#else
+  typedef int Value;
+#endif
+
+  Value h_;
+  explicit OsHandle(Value h) : h_(h) {}
+
+  void Close() const {
+#if defined(WIN32)
+    ::CloseHandle(h_);
+#else
+    ::close(h_);
+#endif
+  }
+
+  // The handle from the word-sized value that the codecs carry.
+  static OsHandle FromBits(const void* bits) {
+#if defined(WIN32)
+    return OsHandle(const_cast<void*>(bits));
+#else
+    return OsHandle(static_cast<int>(reinterpret_cast<size_t>(bits)));
+#endif
+  }
+};
+
+template <class TransportT>
+struct HandleTransport {
+  // Sets |*value| to what the message carries for |handle|. Called while the message is
+  // encoded.
+  static bool Export(TransportT* /*transport*/, OsHandle::Value /*handle*/,
+                     OsHandle::Value* /*value*/) {
+    return false;
+  }
+
+  // Writes the message like TransportT::Send() but with the descriptors exported by the
+  // posix encoders, see Encoder::GetUnixFds().
+  static size_t SendWithFds(TransportT* /*transport*/, const IOSegment* /*segs*/,
+                            size_t /*count*/, const int* /*fds*/, size_t /*n_fds*/) {
+    return RcErrTransportWrite;
+  }
+
+  // Replaces |*handle|, what the message carried, with a handle that is valid in this
+  // process. Called for each handle argument in the order they were sent.
+  static bool Import(TransportT* /*transport*/, OsHandle::Value* /*handle*/) {
+    return false;
+  }
+
+  // Closes the handles that arrived out of band and were not imported yet. Called when a
+  // message cannot be decoded, which also drops the data read after it.
+  static void Discard(TransportT* /*transport*/) {}
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_HANDLES_H_
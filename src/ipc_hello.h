@@ -0,0 +1,133 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_HELLO_H_
+#define SIMPLE_IPC_HELLO_H_
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+#include "ipc_codec_compact.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// The codec is a template parameter of the Channel so it cannot change once the channel exists.
+// Instead both ends trade a hello on the raw transport right after connecting, pick the same
+// codec from the two hellos and then build the channel with it:
+//
+//   ipc::Hello local = ipc::LocalHello(ipc::kHelloAllCodecs);
+//   int codec = ipc::CODEC_UNKNOWN;
+//   if (ipc::NegotiateCodec(&transport, is_client, local, &codec) != ipc::RcOK) ...
+//   if (codec == ipc::CODEC_FIXED)
+//     RunWith<ipc::Channel<PipeTransport, ipc::FixedEncoder, ipc::FixedDecoder> >(&transport);
+//   else
+//     RunWith<ipc::Channel<PipeTransport> >(&transport);
+//
+// The hello is four 32-bit little-endian words: kHelloMagic, kHelloVersion, the platform and
+// the mask of codecs the sender speaks, 1 << CODEC_XXXX each. The platform is the pointer and
+// wchar_t sizes in bits plus kHelloBigEndian. Peers on the same platform use the default codec,
+// which is the fastest but lays out words, pointers, handles and 16-bit strings as the machine
+// does; anything else uses the fixed codec, or as a last resort the compact one.
+
+namespace ipc {
+
+const unsigned int kHelloMagic = 0x48504953;  // "SIPH" in memory.
+const unsigned int kHelloVersion = 1;
+const unsigned int kHelloBigEndian = 1 << 16;
+const unsigned int kHelloAllCodecs = (1 << CODEC_WORD) | (1 << CODEC_COMPACT) | (1 << CODEC_FIXED);
+const size_t kHelloSz = 4 * 4;
+
+struct Hello {
+  unsigned int version;
+  unsigned int platform;
+  unsigned int codecs;
+};
+
+// Returns the hello of this process which can speak the |codecs| mask.
+inline Hello LocalHello(unsigned int codecs) {
+  Hello hello;
+  hello.version = kHelloVersion;
+  hello.platform = static_cast<unsigned int>((sizeof(void*) * 8) | ((sizeof(wchar_t) * 8) << 8));
+#if defined(IPC_BIG_ENDIAN)
+  hello.platform |= kHelloBigEndian;
+#endif
+  hello.codecs = codecs;
+  return hello;
+}
+
+// Returns the codec that the two ends use, the same one whichever end calls it, or
+// CODEC_UNKNOWN if they have none in common.
+inline int PickCodec(const Hello& local, const Hello& peer) {
+  const unsigned int common = local.codecs & peer.codecs;
+  if ((common & (1 << CODEC_WORD)) && (local.platform == peer.platform))
+    return CODEC_WORD;
+  if (common & (1 << CODEC_FIXED))
+    return CODEC_FIXED;
+  if (common & (1 << CODEC_COMPACT))
+    return CODEC_COMPACT;
+  return CODEC_UNKNOWN;
+}
+
+template <class TransportT>
+size_t SendHello(TransportT* transport, const Hello& hello) {
+  IPCCharVector buf;
+  fixed::PutWord(&buf, kHelloMagic);
+  fixed::PutWord(&buf, hello.version);
+  fixed::PutWord(&buf, hello.platform);
+  fixed::PutWord(&buf, hello.codecs);
+  IOSegment seg = { &buf[0], buf.size() };
+  return transport->Send(&seg, 1);
+}
+
+// Reads exactly the hello bytes so that the messages which follow stay in the transport for
+// the channel. A peer that does not start with a hello is a RcErrDecoderFormat error.
+template <class TransportT>
+size_t ReceiveHello(TransportT* transport, Hello* hello) {
+  char buf[kHelloSz];
+  size_t got = 0;
+  while (got != kHelloSz) {
+    size_t sz = kHelloSz - got;
+    size_t rv = transport->ReceiveInto(buf + got, &sz);
+    if (RcOK != rv)
+      return rv;
+    got += sz;
+  }
+  if (fixed::GetWord(buf) != kHelloMagic)
+    return RcErrDecoderFormat;
+  hello->version = fixed::GetWord(buf + 4);
+  hello->platform = fixed::GetWord(buf + 8);
+  hello->codecs = fixed::GetWord(buf + 12);
+  return RcOK;
+}
+
+// Trades hellos on |transport| and returns in |codec| the one to build the channel with. The
+// client sends first and the server answers, so it works on transports that block on send.
+// A peer of another hello version, or without a codec in common, is a RcErrTransportConnect
+// error. The server still answers it, so the peer gets the hello and can tell why.
+template <class TransportT>
+size_t NegotiateCodec(TransportT* transport, bool client, const Hello& local, int* codec) {
+  Hello peer;
+  size_t rv = client ? SendHello(transport, local) : ReceiveHello(transport, &peer);
+  if (RcOK != rv)
+    return rv;
+  rv = client ? ReceiveHello(transport, &peer) : SendHello(transport, local);
+  if (RcOK != rv)
+    return rv;
+  if (peer.version != kHelloVersion)
+    return RcErrTransportConnect;
+  *codec = PickCodec(local, peer);
+  return (CODEC_UNKNOWN == *codec) ? RcErrTransportConnect : RcOK;
+}
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_HELLO_H_
@@ -0,0 +1,345 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_METRICS_H_
+#define SIMPLE_IPC_METRICS_H_
+
+#include "os_includes.h"
+#include "ipc_clock.h"
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+#include "ipc_wire_types.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Channel instrumentation. The last template parameter of ipc::Channel is a metrics policy that
+// the channel calls as it sends and receives. The default, NoMetrics, does nothing and compiles
+// away. ChannelMetrics counts the messages, bytes and errors and keeps histograms of the time
+// spent encoding, decoding and in the message handlers, of the transport read sizes, of the
+// reads per message and of how many queued messages each transport write takes:
+//
+//   typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder, ipc::ChannelMetrics> Ch;
+//   ipc::MetricsSnapshot snapshot;
+//   channel.metrics().Snapshot(&snapshot);
+//
+// The other end of the channel can ask for the snapshot with Channel::QueryMetrics(), so a
+// broker can be scraped by a monitoring tool that connects to it like any client.
+//
+// A metrics policy implements:
+//    unsigned int Now()
+//    void OnEncoded(int msg_id, const IOSegment* segs, size_t count, unsigned int start)
+//    void OnWrite(size_t n_msgs, size_t rc)
+//    void OnRead(size_t sz)
+//    void OnDecoded(int msg_id, unsigned int reads, unsigned int decode_us)
+//    void OnDecodeError(size_t rc)
+//    void OnDispatched(int msg_id, unsigned int start)
+//    void OnSpin(bool hit, unsigned int spin_us)
+//    bool Snapshot(MetricsSnapshot* snapshot) const
+// |start| is a value returned by Now() when the work began and the times are in microseconds.
+// OnSpin() is called each time a receive spins, see Channel::SetReceiveSpin(), with |hit| true
+// if the data came before the spin ran out.
+// OnEncoded() is called by every sending thread and OnWrite() by the one that writes, at the
+// same time as the receiving side calls the rest, so the policy must be thread safe.
+//
+// The counters wrap around like TickCountMs() does, so a scraper should look at the difference
+// between two snapshots.
+
+namespace ipc {
+
+// Operation of the kMessagePrivControl message that asks for the metrics snapshot. It follows
+// the stream operations of ipc_stream.h.
+enum {
+  CONTROL_METRICS = 4
+};
+
+// The counts of a histogram. Values are grouped by their highest bit and then in kSubBuckets
+// linear steps, like HdrHistogram does, so a bucket is never wider than 1/kSubBuckets of the
+// values in it and any 32-bit value fits in kBuckets buckets.
+struct HistogramCounts {
+  static const size_t kSubBits = 3;
+  static const size_t kSubBuckets = 1 << kSubBits;
+  static const size_t kBuckets = (32 - kSubBits + 1) * kSubBuckets;
+
+  unsigned int counts[kBuckets];
+
+  static size_t BucketOf(unsigned int v) {
+    if (v < kSubBuckets)
+      return v;
+    const size_t shift = HighBit(v) - kSubBits;
+    return (shift + 1) * kSubBuckets + ((v >> shift) & (kSubBuckets - 1));
+  }
+
+  // The smallest value that goes in bucket |ix|.
+  static unsigned int BucketStart(size_t ix) {
+    if (ix < kSubBuckets)
+      return static_cast<unsigned int>(ix);
+    const size_t shift = ix / kSubBuckets - 1;
+    return static_cast<unsigned int>((kSubBuckets + ix % kSubBuckets) << shift);
+  }
+
+  unsigned int Total() const {
+    unsigned int total = 0;
+    for (size_t ix = 0; ix != kBuckets; ++ix) {
+      total += counts[ix];
+    }
+    return total;
+  }
+
+  // Returns the start of the bucket that holds the |percent| percentile, or 0 if there are no
+  // values.
+  unsigned int Percentile(unsigned int percent) const {
+    const unsigned long long total = Total();
+    unsigned long long seen = 0;
+    for (size_t ix = 0; ix != kBuckets; ++ix) {
+      seen += counts[ix];
+      if (seen && (seen * 100 >= total * percent))
+        return BucketStart(ix);
+    }
+    return 0;
+  }
+
+  // Index of the highest bit set in |v|, which is not 0.
+  static size_t HighBit(unsigned int v) {
+#if defined(_MSC_VER)
+    unsigned long ix;
+    _BitScanReverse(&ix, v);
+    return ix;
+#elif defined(__GNUC__)
+    return 31 - __builtin_clz(v);
+#else
+    size_t ix = 0;
+    while (v >>= 1) {
+      ++ix;
+    }
+    return ix;
+#endif
+  }
+};
+
+// A histogram that any thread can record into without taking a lock.
+class Histogram {
+public:
+  Histogram() {
+    for (size_t ix = 0; ix != HistogramCounts::kBuckets; ++ix) {
+      counts_[ix] = 0;
+    }
+  }
+
+  void Record(unsigned int v) {
+    AtomicAdd(&counts_[HistogramCounts::BucketOf(v)], 1);
+  }
+
+  void CopyTo(HistogramCounts* out) const {
+    for (size_t ix = 0; ix != HistogramCounts::kBuckets; ++ix) {
+      out->counts[ix] = static_cast<unsigned int>(counts_[ix]);
+    }
+  }
+
+private:
+  volatile long counts_[HistogramCounts::kBuckets];
+};
+
+// What ChannelMetrics has recorded. All the fields are unsigned int so that it can travel as a
+// UInt32Array, see Channel::QueryMetrics().
+struct MetricsSnapshot {
+  // Messages with ids up to kMsgIds - 2 are counted on their own, the rest share the last slot.
+  static const size_t kMsgIds = 64;
+
+  unsigned int msgs_sent;
+  unsigned int bytes_sent;
+  unsigned int writes;
+  unsigned int write_errors;
+  unsigned int msgs_received;
+  unsigned int bytes_received;
+  unsigned int reads;
+  unsigned int decode_errors;
+  // Receives that got their data while spinning and those that had to block after all.
+  unsigned int spin_hits;
+  unsigned int spin_misses;
+  unsigned int sent_by_id[kMsgIds];
+  unsigned int received_by_id[kMsgIds];
+  HistogramCounts encode_us;
+  HistogramCounts decode_us;
+  HistogramCounts dispatch_us;
+  HistogramCounts read_sz;
+  HistogramCounts reads_per_msg;
+  // The depth of the send queue: how many messages each transport write took.
+  HistogramCounts msgs_per_write;
+  // How long the spin hits waited for their data.
+  HistogramCounts spin_us;
+
+  static size_t IdSlot(int msg_id) {
+    if ((msg_id < 0) || (static_cast<size_t>(msg_id) >= kMsgIds - 1))
+      return kMsgIds - 1;
+    return static_cast<size_t>(msg_id);
+  }
+};
+
+// The default metrics policy, it records nothing.
+class NoMetrics {
+public:
+  unsigned int Now() const { return 0; }
+  void OnEncoded(int, const IOSegment*, size_t, unsigned int) {}
+  void OnWrite(size_t, size_t) {}
+  void OnRead(size_t) {}
+  void OnDecoded(int, unsigned int, unsigned int) {}
+  void OnDecodeError(size_t) {}
+  void OnDispatched(int, unsigned int) {}
+  void OnSpin(bool, unsigned int) {}
+  bool Snapshot(MetricsSnapshot*) const { return false; }
+};
+
+class ChannelMetrics {
+public:
+  ChannelMetrics()
+      : msgs_sent_(0), bytes_sent_(0), writes_(0), write_errors_(0), msgs_received_(0),
+        bytes_received_(0), reads_(0), decode_errors_(0), spin_hits_(0), spin_misses_(0) {
+    for (size_t ix = 0; ix != MetricsSnapshot::kMsgIds; ++ix) {
+      sent_by_id_[ix] = 0;
+      received_by_id_[ix] = 0;
+    }
+  }
+
+  unsigned int Now() const { return TickCountUs(); }
+
+  void OnEncoded(int msg_id, const IOSegment* segs, size_t count, unsigned int start) {
+    encode_us_.Record(TickCountUs() - start);
+    size_t sz = 0;
+    for (size_t ix = 0; ix != count; ++ix) {
+      sz += segs[ix].sz_;
+    }
+    AtomicAdd(&msgs_sent_, 1);
+    AtomicAdd(&bytes_sent_, static_cast<long>(sz));
+    AtomicAdd(&sent_by_id_[MetricsSnapshot::IdSlot(msg_id)], 1);
+  }
+
+  void OnWrite(size_t n_msgs, size_t rc) {
+    AtomicAdd(&writes_, 1);
+    if (rc != RcOK)
+      AtomicAdd(&write_errors_, 1);
+    msgs_per_write_.Record(static_cast<unsigned int>(n_msgs));
+  }
+
+  void OnRead(size_t sz) {
+    AtomicAdd(&reads_, 1);
+    AtomicAdd(&bytes_received_, static_cast<long>(sz));
+    read_sz_.Record(static_cast<unsigned int>(sz));
+  }
+
+  void OnDecoded(int msg_id, unsigned int reads, unsigned int decode_us) {
+    AtomicAdd(&msgs_received_, 1);
+    AtomicAdd(&received_by_id_[MetricsSnapshot::IdSlot(msg_id)], 1);
+    reads_per_msg_.Record(reads);
+    decode_us_.Record(decode_us);
+  }
+
+  void OnDecodeError(size_t /*rc*/) {
+    AtomicAdd(&decode_errors_, 1);
+  }
+
+  void OnDispatched(int /*msg_id*/, unsigned int start) {
+    dispatch_us_.Record(TickCountUs() - start);
+  }
+
+  void OnSpin(bool hit, unsigned int spin_us) {
+    if (!hit) {
+      AtomicAdd(&spin_misses_, 1);
+      return;
+    }
+    AtomicAdd(&spin_hits_, 1);
+    spin_us_.Record(spin_us);
+  }
+
+  // The values are read one at a time while other threads may be recording, so they can be
+  // slightly out of step with each other.
+  bool Snapshot(MetricsSnapshot* snapshot) const {
+    snapshot->msgs_sent = static_cast<unsigned int>(msgs_sent_);
+    snapshot->bytes_sent = static_cast<unsigned int>(bytes_sent_);
+    snapshot->writes = static_cast<unsigned int>(writes_);
+    snapshot->write_errors = static_cast<unsigned int>(write_errors_);
+    snapshot->msgs_received = static_cast<unsigned int>(msgs_received_);
+    snapshot->bytes_received = static_cast<unsigned int>(bytes_received_);
+    snapshot->reads = static_cast<unsigned int>(reads_);
+    snapshot->decode_errors = static_cast<unsigned int>(decode_errors_);
+    snapshot->spin_hits = static_cast<unsigned int>(spin_hits_);
+    snapshot->spin_misses = static_cast<unsigned int>(spin_misses_);
+    for (size_t ix = 0; ix != MetricsSnapshot::kMsgIds; ++ix) {
+      snapshot->sent_by_id[ix] = static_cast<unsigned int>(sent_by_id_[ix]);
+      snapshot->received_by_id[ix] = static_cast<unsigned int>(received_by_id_[ix]);
+    }
+    encode_us_.CopyTo(&snapshot->encode_us);
+    decode_us_.CopyTo(&snapshot->decode_us);
+    dispatch_us_.CopyTo(&snapshot->dispatch_us);
+    read_sz_.CopyTo(&snapshot->read_sz);
+    reads_per_msg_.CopyTo(&snapshot->reads_per_msg);
+    msgs_per_write_.CopyTo(&snapshot->msgs_per_write);
+    spin_us_.CopyTo(&snapshot->spin_us);
+    return true;
+  }
+
+private:
+  volatile long msgs_sent_;
+  volatile long bytes_sent_;
+  volatile long writes_;
+  volatile long write_errors_;
+  volatile long msgs_received_;
+  volatile long bytes_received_;
+  volatile long reads_;
+  volatile long decode_errors_;
+  volatile long spin_hits_;
+  volatile long spin_misses_;
+  volatile long sent_by_id_[MetricsSnapshot::kMsgIds];
+  volatile long received_by_id_[MetricsSnapshot::kMsgIds];
+  Histogram encode_us_;
+  Histogram decode_us_;
+  Histogram dispatch_us_;
+  Histogram read_sz_;
+  Histogram reads_per_msg_;
+  Histogram msgs_per_write_;
+  Histogram spin_us_;
+};
+
+// Gets the reply of Channel::QueryMetrics(). ok() is false if the reply did not have a
+// snapshot, which happens when the other end uses NoMetrics or a different MetricsSnapshot.
+class MetricsQuery {
+public:
+  MetricsQuery() : ok_(false) {}
+
+  template <class ChannelT>
+  size_t OnMsgIn(int msg_id, ChannelT* /*ch*/, const WireType* const args[], int count) {
+    ok_ = false;
+    if ((msg_id != kMessagePrivControl) || (count != 3) || args[2]->CheckUInt32Array())
+      return RcErrDecoderArgs;
+    const UInt32Array words = args[2]->AsUInt32Array();
+    if (words.sz_ * sizeof(unsigned int) == sizeof(snapshot_)) {
+      memcpy(&snapshot_, words.buf_, sizeof(snapshot_));
+      ok_ = true;
+    }
+    return OnMsgReady;
+  }
+
+  bool ok() const { return ok_; }
+  const MetricsSnapshot& snapshot() const { return snapshot_; }
+
+private:
+  bool ok_;
+  MetricsSnapshot snapshot_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_METRICS_H_
@@ -28,6 +28,24 @@ template<int MsgId>
 class MsgParamConverter;
 
 namespace ipc {
+
+// Selects the argument |n| of a converter, see the p() and c() functions that the
+// IPC_MSG_Pn macros define.
+template <int n> struct ArgIx {
+  enum { value = n };
+};
+
+#if defined(IPC_USE_VARIADIC)
+// The argument indexes 0 to n-1 as a pack: MakeArgIxList<3>::Type is ArgIxList<0, 1, 2>.
+template <int... I> struct ArgIxList {};
+
+template <int n, int... I> struct MakeArgIxList : MakeArgIxList<n - 1, n - 1, I...> {};
+
+template <int... I> struct MakeArgIxList<0, I...> {
+  typedef ArgIxList<I...> Type;
+};
+#endif
+
 //
 // Receives a message with id=|MsgId| and calls the appropiate overload of
 // OnMsg on the derived |DerivedT| class. To use this class you need to define
@@ -51,15 +69,32 @@ public:
 
   size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
     if (MsgId != msg_id) {
+      CloseHandleArgs(args, count);
       return static_cast<size_t>(ipc::RcErrBadMessageId);
     }
-    if (count != PC::kNumParams)
+    return DispatchMsg(ch, args, count);
+  }
+
+  // Same as OnMsgIn() for callers that already know the message id is MsgId, like MsgTable.
+  // The argument types are all checked first, so the conversions in DispatchImpl() are plain
+  // loads. A mismatch calls OnMsgArgConvertError() with the type id that the first wrong
+  // argument should have had. The handle arguments of a rejected message are closed.
+  size_t DispatchMsg(ChannelT* ch, const WireType* const args[], int count) {
+    if (count != PC::kNumParams) {
+      CloseHandleArgs(args, count);
       return static_cast<DerivedT*>(this)->OnMsgArgCountError(count);
-    try {
-      return DispatchImpl(Int2Type<PC::kNumParams>(), ch, args);
-    } catch(int& code) {
+    }
+#if defined(IPC_USE_VARIADIC)
+    typedef typename MakeArgIxList<PC::kNumParams>::Type Indexes;
+#else
+    typedef Int2Type<PC::kNumParams> Indexes;
+#endif
+    const int code = CheckArgs(Indexes(), args);
+    if (code) {
+      CloseHandleArgs(args, count);
       return static_cast<DerivedT*>(this)->OnMsgArgConvertError(code);
     }
+    return DispatchImpl(Indexes(), ch, args);
   }
 
   // This function is meant simplify the scope specifier when calling OnMsgIn.
@@ -72,7 +107,55 @@ public:
     return (MsgId == msg_id) ? static_cast<DerivedT*>(this) : NULL;
   }
 
+  // PooledDispatch runs the handlers that return false in parallel, instead of one at a time
+  // in the order the messages arrived.
+  bool IsOrderedMsg(int /*msg_id*/) const {
+    return true;
+  }
+
 protected:
+#if defined(IPC_USE_VARIADIC)
+  // Returns the error of the first argument that does not match the converter. Every
+  // argument is checked so there is only one branch in the common case.
+  template <int... I>
+  static int CheckArgs(const ArgIxList<I...>&, const WireType* const args[]) {
+    const int codes[] = { 0, PC::c(ArgIx<I>(), args[I])... };
+    for (size_t ix = 1; ix != countof(codes); ++ix) {
+      if (codes[ix])
+        return codes[ix];
+    }
+    return 0;
+  }
+
+  template <int... I>
+  size_t DispatchImpl(const ArgIxList<I...>&, ChannelT* ch, const WireType* const args[]) {
+    (void)args;
+    return static_cast<DerivedT*>(this)->OnMsg(ch, PC(args[I]).p(ArgIx<I>())...);
+  }
+
+#else
+  // Returns the error of the first of the |n| arguments that does not match the converter.
+  // Every argument is checked so there is only one branch in the common case.
+  template <int n>
+  static int CheckArgs(const Int2Type<n>&, const WireType* const args[]) {
+    const int before = CheckArgs(Int2Type<n - 1>(), args);
+    const int last = CheckArg(Int2Type<n - 1>(), args);
+    return before ? before : last;
+  }
+
+  static int CheckArgs(const Int2Type<0>&, const WireType* const /*args*/[]) { return 0; }
+
+  static int CheckArg(const Int2Type<0>&, const WireType* const args[]) { return PC::c0(args[0]); }
+  static int CheckArg(const Int2Type<1>&, const WireType* const args[]) { return PC::c1(args[1]); }
+  static int CheckArg(const Int2Type<2>&, const WireType* const args[]) { return PC::c2(args[2]); }
+  static int CheckArg(const Int2Type<3>&, const WireType* const args[]) { return PC::c3(args[3]); }
+  static int CheckArg(const Int2Type<4>&, const WireType* const args[]) { return PC::c4(args[4]); }
+  static int CheckArg(const Int2Type<5>&, const WireType* const args[]) { return PC::c5(args[5]); }
+  static int CheckArg(const Int2Type<6>&, const WireType* const args[]) { return PC::c6(args[6]); }
+  static int CheckArg(const Int2Type<7>&, const WireType* const args[]) { return PC::c7(args[7]); }
+  static int CheckArg(const Int2Type<8>&, const WireType* const args[]) { return PC::c8(args[8]); }
+  static int CheckArg(const Int2Type<9>&, const WireType* const args[]) { return PC::c9(args[9]); }
+
   size_t DispatchImpl(const Int2Type<0>&, ChannelT* ch, const WireType* const args[]) {
     return static_cast<DerivedT*>(this)->OnMsg(ch);
   }
@@ -128,7 +211,7 @@ protected:
                                                PC(args[6]).p6(), PC(args[7]).p7(), PC(args[8]).p8(),
                                                PC(args[9]).p9());
   }
-
+#endif  // defined(IPC_USE_VARIADIC)
 };
 
 // Sends a message with id=|msg_id|. Basically wraps the tedious task of creating the
@@ -140,6 +223,44 @@ class MsgOut {
     return ch->Send(msg_id, NULL, 0);
   }
 
+#if defined(IPC_USE_VARIADIC)
+  // Each argument is converted to a WireType temporary that lives until Send() returns.
+  template <typename... ArgsT>
+  size_t SendMsg(int msg_id, ChannelT* ch, const ArgsT&... args) {
+    return SendWires<ArgsT...>(msg_id, ch, args...);
+  }
+
+  // Same as SendMsg() but the message is sent with ChannelT::Call() so its reply goes to
+  // |reply| instead of the dispatcher. See Channel::Call().
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply)  {
+    return ch->Call(msg_id, NULL, 0, reply);
+  }
+
+  template <class ReplyT, typename... ArgsT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const ArgsT&... args) {
+    return CallWires<ReplyT, ArgsT...>(msg_id, ch, reply, args...);
+  }
+
+ private:
+  template <typename T> struct WireRef {
+    typedef const WireType& Type;
+  };
+
+  template <typename... ArgsT>
+  size_t SendWires(int msg_id, ChannelT* ch, typename WireRef<ArgsT>::Type... wts) {
+    const WireType* const args[] = { &wts... };
+    return ch->Send(msg_id, args, static_cast<int>(sizeof...(wts)));
+  }
+
+  template <class ReplyT, typename... ArgsT>
+  size_t CallWires(int msg_id, ChannelT* ch, ReplyT* reply,
+                   typename WireRef<ArgsT>::Type... wts) {
+    const WireType* const args[] = { &wts... };
+    return ch->Call(msg_id, args, static_cast<int>(sizeof...(wts)), reply);
+  }
+
+#else
   size_t SendMsg(int msg_id, ChannelT* ch, const WireType& a0) {
     const WireType* const args[] = { &a0 };
     return ch->Send(msg_id, args, 1);
@@ -201,7 +322,121 @@ class MsgOut {
     return ch->Send(msg_id, args, 10);
   }
 
+  // Same as SendMsg() but the message is sent with ChannelT::Call() so its reply goes to
+  // |reply| instead of the dispatcher. See Channel::Call().
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply)  {
+    return ch->Call(msg_id, NULL, 0, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0) {
+    const WireType* const args[] = { &a0 };
+    return ch->Call(msg_id, args, 1, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1) {
+    const WireType* const args[] = { &a0, &a1 };
+    return ch->Call(msg_id, args, 2, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2) {
+    const WireType* const args[] = { &a0, &a1, &a2 };
+    return ch->Call(msg_id, args, 3, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3 };
+    return ch->Call(msg_id, args, 4, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4 };
+    return ch->Call(msg_id, args, 5, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4, const WireType& a5) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5 };
+    return ch->Call(msg_id, args, 6, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4, const WireType& a5,
+      const WireType& a6) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6 };
+    return ch->Call(msg_id, args, 7, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4, const WireType& a5,
+      const WireType& a6, const WireType& a7) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7 };
+    return ch->Call(msg_id, args, 8, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4, const WireType& a5,
+      const WireType& a6, const WireType& a7, const WireType& a8) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8 };
+    return ch->Call(msg_id, args, 9, reply);
+  }
+
+  template <class ReplyT>
+  size_t CallMsg(int msg_id, ChannelT* ch, ReplyT* reply, const WireType& a0, const WireType& a1,
+      const WireType& a2, const WireType& a3, const WireType& a4, const WireType& a5,
+      const WireType& a6, const WireType& a7, const WireType& a8, const WireType& a9) {
+    const WireType* const args[] = { &a0, &a1, &a2, &a3, &a4, &a5, &a6, &a7, &a8, &a9 };
+    return ch->Call(msg_id, args, 10, reply);
+  }
+
   // Note: If you are adding more SendMsg() functions, update Channel::kMaxNumArgs accordingly.
+#endif  // defined(IPC_USE_VARIADIC)
+};
+
+// Puts |ch| in batch mode for the lifetime of the object so that the messages sent with
+// MsgOut::SendMsg() in the meantime go out in as few transport writes as possible.
+// For example:
+//
+//  {
+//    ipc::ScopedMsgBatch<Chan> batch(&channel, 32 * 1024, 5);
+//    for (int ix = 0; ix != count; ++ix)
+//      log_msg.DoSend(&channel, ix, lines[ix]);
+//  }  // The remaining messages are sent here.
+//
+template <typename ChannelT>
+class ScopedMsgBatch {
+ public:
+  ScopedMsgBatch(ChannelT* ch, size_t max_bytes, unsigned int max_ms) : ch_(ch) {
+    ch_->BeginBatch(max_bytes, max_ms);
+  }
+
+  ~ScopedMsgBatch() {
+    ch_->EndBatch();
+  }
+
+  // Sends what has been queued so far and stays in batch mode.
+  size_t Flush() {
+    return ch_->FlushBatch();
+  }
+
+ private:
+  ChannelT* ch_;
+
+  ScopedMsgBatch(const ScopedMsgBatch&);
+  ScopedMsgBatch& operator=(const ScopedMsgBatch&);
 };
 
 template <bool>
@@ -210,6 +445,99 @@ struct CompileCheck;
 template<>
 struct CompileCheck<true> {};
 
+// Top level dispatcher that finds the handler of a message with a single array lookup, instead
+// of a chain of MsgHandler() calls or a switch. Each handler is a MsgIn<> object registered with
+// Add(), the slot is given by its MSG_ID. Ids outside [kFirstId, kLastId] or without a handler
+// are rejected before their arguments are looked at. Derive from it and add the handlers in
+// the constructor:
+//
+//  class BrokerDispatch : public ipc::MsgTable<PipeChannel, kLastMsgId> {
+//  public:
+//    BrokerDispatch() {
+//      Add(&open_svc_);
+//      Add(&close_svc_);
+//    }
+//
+//  private:
+//    OpenSvc open_svc_;
+//    CloseSvc close_svc_;
+//  };
+//
+//  channel.Receive(&broker_dispatch);
+//
+// The handlers do not need a common base class or virtual functions; each slot keeps the
+// handler object and a function that calls its MsgIn::DispatchMsg().
+template <typename ChannelT, int kLastId, int kFirstId = kMessagePrivLastId>
+class MsgTable {
+public:
+  MsgTable() {
+    for (size_t ix = 0; ix != kSize; ++ix) {
+      table_[ix].handler = NULL;
+      table_[ix].fn = NULL;
+      table_[ix].ordered = true;
+    }
+  }
+
+  // Registers |handler| for HandlerT::MSG_ID, replacing the previous handler if any.
+  template <class HandlerT>
+  void Add(HandlerT* handler) {
+    CompileCheck<(HandlerT::MSG_ID >= kFirstId) && (HandlerT::MSG_ID <= kLastId)>();
+    Slot& slot = table_[HandlerT::MSG_ID - kFirstId];
+    slot.handler = handler;
+    slot.fn = &Thunk<HandlerT>;
+    slot.ordered = handler->IsOrderedMsg(HandlerT::MSG_ID);
+  }
+
+  // Returns NULL for the ids without a handler, which Channel::Receive() reports as
+  // RcErrBadMessageId.
+  MsgTable* MsgHandler(int msg_id) {
+    return Find(msg_id) ? this : NULL;
+  }
+
+  size_t OnMsgIn(int msg_id, ChannelT* ch, const WireType* const args[], int count) {
+    const Slot* slot = Find(msg_id);
+    if (!slot) {
+      CloseHandleArgs(args, count);
+      return static_cast<size_t>(ipc::RcErrBadMessageId);
+    }
+    return slot->fn(slot->handler, ch, args, count);
+  }
+
+  bool IsOrderedMsg(int msg_id) const {
+    const Slot* slot = Find(msg_id);
+    return slot ? slot->ordered : true;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  enum { kSize = kLastId - kFirstId + 1 };
+
+  typedef size_t (*DispatchFn)(void* handler, ChannelT* ch, const WireType* const args[],
+                               int count);
+
+  struct Slot {
+    void* handler;
+    DispatchFn fn;
+    bool ordered;
+  };
+
+  template <class HandlerT>
+  static size_t Thunk(void* handler, ChannelT* ch, const WireType* const args[], int count) {
+    return static_cast<HandlerT*>(handler)->DispatchMsg(ch, args, count);
+  }
+
+  const Slot* Find(int msg_id) const {
+    // Ids below kFirstId wrap around to large values.
+    const unsigned int ix = static_cast<unsigned int>(msg_id - kFirstId);
+    if (ix >= static_cast<unsigned int>(kSize))
+      return NULL;
+    return table_[ix].fn ? &table_[ix] : NULL;
+  }
+
+  Slot table_[kSize];
+};
+
 
 }  // namespace ipc.
 
@@ -237,10 +565,25 @@ struct CompileCheck<true> {};
 //   public:
 //    enum { kNumParams = 2 };
 //    MsgParamConverter(const ipc::WireType* wt) : wt_(wt) {}
-//    int  p0() const { return wt_->RecoverInt32() }
-//    char p1() const { return wt_->RecoverChar8() }
+//    static int c0(const ipc::WireType* wt) { return wt->CheckInt32(); }
+//    int  p0() const { return wt_->AsInt32() }
+//    static int c1(const ipc::WireType* wt) { return wt->CheckChar8(); }
+//    char p1() const { return wt_->AsChar8() }
 //  };
 //
+// The cN() functions check the type of each argument, MsgIn calls them all before the pN()
+// conversions. Each pair is also defined as p(ArgIx<N>) and c(ArgIx<N>, wt), which is what
+// the variadic MsgIn uses. With IPC_USE_VARIADIC the parameters past the tenth are declared
+// with IPC_MSG_PARAM(), which takes the zero-based index:
+//
+// DEFINE_IPC_MSG_CONV(6, 12) {
+//   IPC_MSG_P1(int, Int32)
+//   ....
+//   IPC_MSG_P10(int, Int32)
+//   IPC_MSG_PARAM(10, const char*, String8)
+//   IPC_MSG_PARAM(11, unsigned int, UInt32)
+// };
+//
 
 #define DEFINE_IPC_MSG_CONV(msg_id, n_params)               \
 template<>                                                  \
@@ -251,65 +594,104 @@ class MsgParamConverter<msg_id> {                           \
   enum { kNumParams = n_params };                           \
   MsgParamConverter(const ipc::WireType* wt) : wt_(wt)
 
+#define IPC_MSG_PARAM(ix, rt, tname)                        \
+  rt p(ipc::ArgIx<ix>) const {                              \
+    COMPILE_CHK(ix < kNumParams);                           \
+    return wt_->As##tname();                                \
+  }                                                         \
+  static int c(ipc::ArgIx<ix>, const ipc::WireType* wt) {   \
+    return wt->Check##tname();                              \
+  }
+
 #define IPC_MSG_P1(rt, tname)                               \
   }                                                         \
   rt p0() const {                                           \
-    COMPILE_CHK(1 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<0>());                              \
+  }                                                         \
+  static int c0(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<0>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(0, rt, tname)
 
 #define IPC_MSG_P2(rt, tname)                               \
   rt p1() const {                                           \
-    COMPILE_CHK(2 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<1>());                              \
+  }                                                         \
+  static int c1(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<1>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(1, rt, tname)
 
 #define IPC_MSG_P3(rt, tname)                               \
   rt p2() const {                                           \
-    COMPILE_CHK(3 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<2>());                              \
+  }                                                         \
+  static int c2(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<2>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(2, rt, tname)
 
 #define IPC_MSG_P4(rt, tname)                               \
   rt p3() const {                                           \
-    COMPILE_CHK(4 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<3>());                              \
+  }                                                         \
+  static int c3(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<3>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(3, rt, tname)
 
 #define IPC_MSG_P5(rt, tname)                               \
   rt p4() const {                                           \
-    COMPILE_CHK(5 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<4>());                              \
+  }                                                         \
+  static int c4(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<4>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(4, rt, tname)
 
 #define IPC_MSG_P6(rt, tname)                               \
   rt p5() const {                                           \
-    COMPILE_CHK(6 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<5>());                              \
+  }                                                         \
+  static int c5(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<5>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(5, rt, tname)
 
 #define IPC_MSG_P7(rt, tname)                               \
   rt p6() const {                                           \
-    COMPILE_CHK(7 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<6>());                              \
+  }                                                         \
+  static int c6(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<6>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(6, rt, tname)
 
 #define IPC_MSG_P8(rt, tname)                               \
   rt p7() const {                                           \
-    COMPILE_CHK(8 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<7>());                              \
+  }                                                         \
+  static int c7(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<7>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(7, rt, tname)
 
 #define IPC_MSG_P9(rt, tname)                               \
   rt p8() const {                                           \
-    COMPILE_CHK(9 <= kNumParams);                           \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<8>());                              \
+  }                                                         \
+  static int c8(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<8>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(8, rt, tname)
 
 #define IPC_MSG_P10(rt, tname)                              \
   rt p9() const {                                           \
-    COMPILE_CHK(10 <= kNumParams);                          \
-    return wt_->Recover##tname();                           \
-  }
+    return p(ipc::ArgIx<9>());                              \
+  }                                                         \
+  static int c9(const ipc::WireType* wt) {                  \
+    return c(ipc::ArgIx<9>(), wt);                          \
+  }                                                         \
+  IPC_MSG_PARAM(9, rt, tname)
 
 #endif  // SIMPLE_IPC_MSG_DISPATCH_H_
@@ -0,0 +1,499 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MSG_SCHEMA_H_
+#define SIMPLE_IPC_MSG_SCHEMA_H_
+
+#include "ipc_msg_dispatch.h"
+
+// The IPC_MSG_DEFn macros at the end of this file declare a message once, with its id, a name
+// and the c++ type and the WireType name of each argument. They generate the converter, so
+// that MsgIn can receive the message, and a struct of that name for the sending side:
+//
+//  IPC_MSG_DEF2(kOpenMsg, OpenMsg, const char*, String8, unsigned int, UInt32);
+//  IPC_MSG_DEF2(kOpenReplyMsg, OpenReplyMsg, int, Int32, void*, VoidPtr);
+//
+//  // The client waits for the reply in a OpenReplyMsg::In<OpenReply, PipeChannel>.
+//  OpenMsg::Call(&channel, &open_reply, "data.txt", flags);
+//
+//  // The server.
+//  class OpenSvc : public OpenMsg::In<OpenSvc, PipeChannel> {
+//   public:
+//    size_t OnMsg(PipeChannel* ch, const char* name, unsigned int flags) {
+//      void* file = Open(name, flags);
+//      return OpenReplyMsg::Send(ch, file ? 0 : Error(), file);
+//    }
+//    bool OnMsgArgCountError(int count) { ... }
+//    bool OnMsgArgConvertError(int code) { ... }
+//  };
+//
+// Send() and Call() encode the arguments with Channel::SendArgs() and CallArgs(), straight
+// from the types declared, so there is no WireType per argument, no array of them and the
+// strings are not copied before being encoded. The message is the same as the one sent by
+// MsgOut::SendMsg() with those types, so each side can be moved to the macros on its own.
+//
+// The WireType name of an argument selects both the AsXxx() and CheckXxx() of the receiving
+// side, like in IPC_MSG_Pn, and the WireArgXxx struct below that encodes it. The macros take
+// one to ten arguments, the decoder rejects messages without any. Longer messages still need
+// DEFINE_IPC_MSG_CONV and IPC_MSG_PARAM.
+
+namespace ipc {
+
+// The bits of a word sized argument as WireType::GetAsBits() returns them, with the unused
+// bytes zeroed.
+template <typename T>
+void* WireWordBits(T v) {
+  void* bits = NULL;
+  memcpy(&bits, &v, sizeof(v));
+  return bits;
+}
+
+template <typename T, int kType>
+struct WireArgWord {
+  template <class WriterT>
+  static bool Put(WriterT* writer, T v) {
+    return writer->OnWord(WireWordBits(v), kType);
+  }
+};
+
+// The 64-bit values go as their bytes, see Channel::AddMsgElement(). They are shorter than
+// what the encoders reference in place, so |v| only needs to live until Put() returns.
+template <typename T, int kType>
+struct WireArgBytes {
+  template <class WriterT>
+  static bool Put(WriterT* writer, T v) {
+    return writer->OnString8(reinterpret_cast<const char*>(&v), sizeof(v), kType);
+  }
+};
+
+template <class ArrayT>
+struct WireArgArray {
+  template <class WriterT>
+  static bool Put(WriterT* writer, const ArrayT& ta) {
+    if (!ta.buf_)
+      return writer->OnWord(WireWordBits(-1), ArrayT::kNullTypeId);
+    return writer->OnString8(reinterpret_cast<const char*>(ta.buf_),
+                             ta.sz_ * sizeof(typename ArrayT::ElementType), ArrayT::kTypeId);
+  }
+};
+
+struct WireArgInt32 : public WireArgWord<int, TYPE_INT32> {};
+struct WireArgUInt32 : public WireArgWord<unsigned int, TYPE_UINT32> {};
+struct WireArgLong32 : public WireArgWord<long, TYPE_LONG32> {};
+struct WireArgULong32 : public WireArgWord<unsigned long, TYPE_ULONG32> {};
+struct WireArgChar8 : public WireArgWord<char, TYPE_CHAR8> {};
+struct WireArgChar16 : public WireArgWord<wchar_t, TYPE_CHAR16> {};
+struct WireArgVoidPtr : public WireArgWord<const void*, TYPE_VOIDPTR> {};
+struct WireArgFloat32 : public WireArgWord<float, TYPE_FLOAT32> {};
+struct WireArgInt64 : public WireArgBytes<long long, TYPE_INT64> {};
+struct WireArgUInt64 : public WireArgBytes<unsigned long long, TYPE_UINT64> {};
+struct WireArgFloat64 : public WireArgBytes<double, TYPE_FLOAT64> {};
+struct WireArgInt32Array : public WireArgArray<Int32Array> {};
+struct WireArgUInt32Array : public WireArgArray<UInt32Array> {};
+struct WireArgInt64Array : public WireArgArray<Int64Array> {};
+struct WireArgUInt64Array : public WireArgArray<UInt64Array> {};
+
+struct WireArgString8 {
+  template <class WriterT>
+  static bool Put(WriterT* writer, const char* str) {
+    if (!str)
+      return writer->OnWord(WireWordBits(-1), TYPE_NULLSTRING8);
+    return writer->OnString8(str, strlen(str), TYPE_STRING8);
+  }
+};
+
+struct WireArgString16 {
+  template <class WriterT>
+  static bool Put(WriterT* writer, const wchar_t* str) {
+    if (!str)
+      return writer->OnWord(WireWordBits(-1), TYPE_NULLSTRING16);
+    return writer->OnString16(str, wcslen(str), TYPE_STRING16);
+  }
+};
+
+struct WireArgByteArray {
+  template <class WriterT>
+  static bool Put(WriterT* writer, const ByteArray& ba) {
+    if (!ba.buf_)
+      return writer->OnWord(WireWordBits(-1), TYPE_NULLBARRAY);
+    return writer->OnString8(ba.buf_, ba.sz_, TYPE_BARRAY);
+  }
+};
+
+// The handles have to be exported to the peer by the channel.
+struct WireArgHandle {
+  template <class WriterT>
+  static bool Put(WriterT* writer, const OsHandle& h) {
+    return writer->OnWire(WireType(h));
+  }
+};
+
+}  // namespace ipc.
+
+// The part of the IPC_MSG_DEFn structs that does not depend on the arguments. In<> is the
+// MsgIn base of the receiving side; SendTo() and CallTo() send the values of an instance,
+// which is what Send() and Call() do with a temporary one.
+#define IPC_MSG_DEF_COMMON(msg_id, n_params)                                                \
+  enum { MSG_ID = msg_id, kNumParams = n_params };                                          \
+  template <class DerivedT, class ChannelT>                                                 \
+  class In : public ipc::MsgIn<msg_id, DerivedT, ChannelT> {};                              \
+  int Count() const { return kNumParams; }                                                  \
+  template <class ChannelT>                                                                 \
+  size_t SendTo(ChannelT* ch) const {                                                       \
+    return ch->SendArgs(msg_id, *this);                                                     \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  size_t CallTo(ChannelT* ch, ReplyT* reply) const {                                        \
+    return ch->CallArgs(msg_id, *this, reply);                                              \
+  }
+
+#define IPC_MSG_DEF1(msg_id, name, t0, w0)                                                  \
+DEFINE_IPC_MSG_CONV(msg_id, 1) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 1)                                                             \
+  t0 a0;                                                                                    \
+  name(t0 v0)                                                                               \
+      : a0(v0) {}                                                                           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0) {                                                 \
+    return name(v0).SendTo(ch);                                                             \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0) {                                  \
+    return name(v0).CallTo(ch, reply);                                                      \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF2(msg_id, name, t0, w0, t1, w1)                                          \
+DEFINE_IPC_MSG_CONV(msg_id, 2) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 2)                                                             \
+  t0 a0; t1 a1;                                                                             \
+  name(t0 v0, t1 v1)                                                                        \
+      : a0(v0), a1(v1) {}                                                                   \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1) {                                          \
+    return name(v0, v1).SendTo(ch);                                                         \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1) {                           \
+    return name(v0, v1).CallTo(ch, reply);                                                  \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF3(msg_id, name, t0, w0, t1, w1, t2, w2)                                  \
+DEFINE_IPC_MSG_CONV(msg_id, 3) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 3)                                                             \
+  t0 a0; t1 a1; t2 a2;                                                                      \
+  name(t0 v0, t1 v1, t2 v2)                                                                 \
+      : a0(v0), a1(v1), a2(v2) {}                                                           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2) {                                   \
+    return name(v0, v1, v2).SendTo(ch);                                                     \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2) {                    \
+    return name(v0, v1, v2).CallTo(ch, reply);                                              \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF4(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3)                          \
+DEFINE_IPC_MSG_CONV(msg_id, 4) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 4)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3;                                                               \
+  name(t0 v0, t1 v1, t2 v2, t3 v3)                                                          \
+      : a0(v0), a1(v1), a2(v2), a3(v3) {}                                                   \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3) {                            \
+    return name(v0, v1, v2, v3).SendTo(ch);                                                 \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3) {             \
+    return name(v0, v1, v2, v3).CallTo(ch, reply);                                          \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF5(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4)                  \
+DEFINE_IPC_MSG_CONV(msg_id, 5) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 5)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4)                                                   \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4) {}                                           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4) {                     \
+    return name(v0, v1, v2, v3, v4).SendTo(ch);                                             \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4) {      \
+    return name(v0, v1, v2, v3, v4).CallTo(ch, reply);                                      \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF6(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4, t5, w5)          \
+DEFINE_IPC_MSG_CONV(msg_id, 6) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+  IPC_MSG_P6(t5, w5)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 6)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  t5 a5;                                                                                    \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5)                                            \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4), a5(v5) {}                                   \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4) &&                                                  \
+           ipc::WireArg##w5::Put(w, a5);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5) {              \
+    return name(v0, v1, v2, v3, v4, v5).SendTo(ch);                                         \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4,        \
+                     t5 v5) {                                                               \
+    return name(v0, v1, v2, v3, v4, v5).CallTo(ch, reply);                                  \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF7(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4, t5, w5,          \
+                    t6, w6)                                                                 \
+DEFINE_IPC_MSG_CONV(msg_id, 7) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+  IPC_MSG_P6(t5, w5)                                                                        \
+  IPC_MSG_P7(t6, w6)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 7)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  t5 a5; t6 a6;                                                                             \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6)                                     \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4), a5(v5), a6(v6) {}                           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4) &&                                                  \
+           ipc::WireArg##w5::Put(w, a5) &&                                                  \
+           ipc::WireArg##w6::Put(w, a6);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6) {       \
+    return name(v0, v1, v2, v3, v4, v5, v6).SendTo(ch);                                     \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4,        \
+                     t5 v5, t6 v6) {                                                        \
+    return name(v0, v1, v2, v3, v4, v5, v6).CallTo(ch, reply);                              \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF8(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4, t5, w5,          \
+                    t6, w6, t7, w7)                                                         \
+DEFINE_IPC_MSG_CONV(msg_id, 8) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+  IPC_MSG_P6(t5, w5)                                                                        \
+  IPC_MSG_P7(t6, w6)                                                                        \
+  IPC_MSG_P8(t7, w7)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 8)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  t5 a5; t6 a6; t7 a7;                                                                      \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6, t7 v7)                              \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4), a5(v5), a6(v6), a7(v7) {}                   \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4) &&                                                  \
+           ipc::WireArg##w5::Put(w, a5) &&                                                  \
+           ipc::WireArg##w6::Put(w, a6) &&                                                  \
+           ipc::WireArg##w7::Put(w, a7);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6,         \
+                     t7 v7) {                                                               \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7).SendTo(ch);                                 \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4,        \
+                     t5 v5, t6 v6, t7 v7) {                                                 \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7).CallTo(ch, reply);                          \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF9(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4, t5, w5,          \
+                    t6, w6, t7, w7, t8, w8)                                                 \
+DEFINE_IPC_MSG_CONV(msg_id, 9) {                                                            \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+  IPC_MSG_P6(t5, w5)                                                                        \
+  IPC_MSG_P7(t6, w6)                                                                        \
+  IPC_MSG_P8(t7, w7)                                                                        \
+  IPC_MSG_P9(t8, w8)                                                                        \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 9)                                                             \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  t5 a5; t6 a6; t7 a7; t8 a8;                                                               \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6, t7 v7, t8 v8)                       \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4), a5(v5), a6(v6), a7(v7), a8(v8) {}           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4) &&                                                  \
+           ipc::WireArg##w5::Put(w, a5) &&                                                  \
+           ipc::WireArg##w6::Put(w, a6) &&                                                  \
+           ipc::WireArg##w7::Put(w, a7) &&                                                  \
+           ipc::WireArg##w8::Put(w, a8);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6,         \
+                     t7 v7, t8 v8) {                                                        \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7, v8).SendTo(ch);                             \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4,        \
+                     t5 v5, t6 v6, t7 v7, t8 v8) {                                          \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7, v8).CallTo(ch, reply);                      \
+  }                                                                                         \
+}
+
+#define IPC_MSG_DEF10(msg_id, name, t0, w0, t1, w1, t2, w2, t3, w3, t4, w4, t5, w5,         \
+                    t6, w6, t7, w7, t8, w8, t9, w9)                                         \
+DEFINE_IPC_MSG_CONV(msg_id, 10) {                                                           \
+  IPC_MSG_P1(t0, w0)                                                                        \
+  IPC_MSG_P2(t1, w1)                                                                        \
+  IPC_MSG_P3(t2, w2)                                                                        \
+  IPC_MSG_P4(t3, w3)                                                                        \
+  IPC_MSG_P5(t4, w4)                                                                        \
+  IPC_MSG_P6(t5, w5)                                                                        \
+  IPC_MSG_P7(t6, w6)                                                                        \
+  IPC_MSG_P8(t7, w7)                                                                        \
+  IPC_MSG_P9(t8, w8)                                                                        \
+  IPC_MSG_P10(t9, w9)                                                                       \
+};                                                                                          \
+struct name {                                                                               \
+  IPC_MSG_DEF_COMMON(msg_id, 10)                                                            \
+  t0 a0; t1 a1; t2 a2; t3 a3; t4 a4;                                                        \
+  t5 a5; t6 a6; t7 a7; t8 a8; t9 a9;                                                        \
+  name(t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6, t7 v7, t8 v8, t9 v9)                \
+      : a0(v0), a1(v1), a2(v2), a3(v3), a4(v4), a5(v5), a6(v6), a7(v7), a8(v8),             \
+        a9(v9) {}                                                                           \
+  template <class WriterT>                                                                  \
+  bool Encode(WriterT* w) const {                                                           \
+    return ipc::WireArg##w0::Put(w, a0) &&                                                  \
+           ipc::WireArg##w1::Put(w, a1) &&                                                  \
+           ipc::WireArg##w2::Put(w, a2) &&                                                  \
+           ipc::WireArg##w3::Put(w, a3) &&                                                  \
+           ipc::WireArg##w4::Put(w, a4) &&                                                  \
+           ipc::WireArg##w5::Put(w, a5) &&                                                  \
+           ipc::WireArg##w6::Put(w, a6) &&                                                  \
+           ipc::WireArg##w7::Put(w, a7) &&                                                  \
+           ipc::WireArg##w8::Put(w, a8) &&                                                  \
+           ipc::WireArg##w9::Put(w, a9);                                                    \
+  }                                                                                         \
+  template <class ChannelT>                                                                 \
+  static size_t Send(ChannelT* ch, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4, t5 v5, t6 v6,         \
+                     t7 v7, t8 v8, t9 v9) {                                                 \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9).SendTo(ch);                         \
+  }                                                                                         \
+  template <class ChannelT, class ReplyT>                                                   \
+  static size_t Call(ChannelT* ch, ReplyT* reply, t0 v0, t1 v1, t2 v2, t3 v3, t4 v4,        \
+                     t5 v5, t6 v6, t7 v7, t8 v8, t9 v9) {                                   \
+    return name(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9).CallTo(ch, reply);                  \
+  }                                                                                         \
+}
+
+#endif  // SIMPLE_IPC_MSG_SCHEMA_H_
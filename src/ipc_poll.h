@@ -0,0 +1,57 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_POLL_H_
+#define SIMPLE_IPC_POLL_H_
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A channel that has to answer fast can poll its transport for a while before it blocks, see
+// Channel::SetReceiveSpin(). Waking up a thread that sleeps in the kernel costs more than a
+// small round trip, so when the reply comes within a few microseconds the spinning thread gets
+// it sooner, at the price of one busy core while it spins.
+//
+// The channel talks to the transport with PollTransport<TransportT>. Transports that have a
+// TryReceiveInto() that does not block specialize it, see PipeTransport and ShmTransport; the
+// others never spin.
+
+namespace ipc {
+
+template <class TransportT>
+struct PollTransport {
+  static const bool kCanPoll = false;
+
+  // Reads what is available into |buf| without waiting, like ReceiveInto(). If there is
+  // nothing to read it returns RcOK with |*size| set to 0.
+  static size_t TryReceiveInto(TransportT* /*transport*/, char* /*buf*/, size_t* size) {
+    *size = 0;
+    return RcOK;
+  }
+};
+
+// The specialization for a transport with TryReceiveInto().
+template <class TransportT>
+struct PollByTryReceive {
+  static const bool kCanPoll = true;
+
+  static size_t TryReceiveInto(TransportT* transport, char* buf, size_t* size) {
+    return transport->TryReceiveInto(buf, size);
+  }
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_POLL_H_
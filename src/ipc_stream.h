@@ -0,0 +1,78 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_STREAM_H_
+#define SIMPLE_IPC_STREAM_H_
+
+#include "os_includes.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Streams carry a payload of any size over a channel as a sequence of chunks, with bounded
+// memory on both ends. This header defines what the application implements; the protocol
+// lives in ipc::Channel, see Channel::OpenStream() and Channel::AcceptStream().
+//
+// A stream goes one way. The sending side opens it and gets its id, which it hands to the
+// receiving side in a regular message, for example the reply to the call that asked for the
+// data. The receiving side accepts it with a window: the most bytes that can be in flight.
+// Then the sender writes as much as the window allows and gets called back when the receiver
+// has consumed enough of it to make room for more:
+//
+//  sender                                    receiver
+//  id = ch.OpenStream(&source)
+//  reply to the request, with |id|  ------>  ch.AcceptStream(id, &sink, 256 * 1024)
+//                                   <------  credit (256K)
+//  source.OnStreamCredit()
+//    ch.WriteStream(id, ...)        ------>  data chunks, to sink.OnStreamData()
+//                                   <------  credit, once half of the window is consumed
+//  ...
+//  ch.CloseStream(id, status)       ------>  sink.OnStreamEnd()
+//
+// The chunks and the credits are kMessagePrivControl messages that the channel handles on its
+// own, they interleave with the regular messages and never reach the dispatcher.
+
+namespace ipc {
+
+// Operations of the kMessagePrivControl messages, their first argument. The second argument is
+// the stream id and the third one is the chunk, the credit in bytes or the end status.
+enum {
+  STREAM_DATA = 1,
+  STREAM_CREDIT = 2,
+  STREAM_END = 3
+};
+
+// Receives the data of a stream. The return values are treated like the return value of a
+// message handler, so OnMsgLoopNext keeps Channel::Receive() going.
+class StreamSink {
+public:
+  virtual ~StreamSink() {}
+
+  // |data| points into the channel receive buffer and is only valid during the call. Once the
+  // call returns the bytes count as consumed and can be credited back to the sender.
+  virtual size_t OnStreamData(unsigned int id, const char* data, size_t sz) = 0;
+  // Last call for the stream, |status| is the one given to Channel::CloseStream().
+  virtual size_t OnStreamEnd(unsigned int id, int status) = 0;
+};
+
+// Gets told when a stream can be written. Same return values as StreamSink.
+class StreamSource {
+public:
+  virtual ~StreamSource() {}
+
+  // |credit| is the number of bytes that Channel::WriteStream() can send now.
+  virtual size_t OnStreamCredit(unsigned int id, size_t credit) = 0;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_STREAM_H_
@@ -0,0 +1,347 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SYNC_H_
+#define SIMPLE_IPC_SYNC_H_
+
+#include "os_includes.h"
+
+#if !defined(WIN32)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Minimal set of atomic operations used by the library. They are implemented with the compiler
+// or OS intrinsics so no threading library is required. The threads and the semaphore at
+// the end are only used by the optional parts that run their own threads, like DispatchPool.
+
+namespace ipc {
+
+#if defined(WIN32)
+
+// Sets |*flag| to 1 if it was 0. Returns true if this call changed it.
+inline bool AtomicTryAcquire(volatile long* flag) {
+  return (0 == ::InterlockedCompareExchange(flag, 1, 0));
+}
+
+// Sets |*flag| back to 0.
+inline void AtomicRelease(volatile long* flag) {
+  ::InterlockedExchange(flag, 0);
+}
+
+// Sets |*dest| to |exchange| if it is equal to |comparand|. Returns the previous value.
+inline long AtomicCompareExchange(volatile long* dest, long exchange, long comparand) {
+  return ::InterlockedCompareExchange(dest, exchange, comparand);
+}
+
+// Adds |value| to |*dest|. Returns the new value.
+inline long AtomicAdd(volatile long* dest, long value) {
+  return ::InterlockedExchangeAdd(dest, value) + value;
+}
+
+// Like AtomicCompareExchange() but for pointers.
+inline void* AtomicCompareExchangePtr(void* volatile* dest, void* exchange, void* comparand) {
+  return ::InterlockedCompareExchangePointer(dest, exchange, comparand);
+}
+
+// Reads |*src|, the loads and stores after it are not done before it. For values that other
+// threads change with the functions above.
+inline long AtomicLoad(const volatile long* src) {
+  const long value = *src;
+  ::MemoryBarrier();
+  return value;
+}
+
+// Like AtomicLoad() but for pointers.
+inline void* AtomicLoadPtr(void* const volatile* src) {
+  void* const value = *src;
+  ::MemoryBarrier();
+  return value;
+}
+
+// Sets |*dest| to |value|, the loads and stores before it are done before it.
+inline void AtomicStore(volatile long* dest, long value) {
+  ::InterlockedExchange(dest, value);
+}
+
+// Like AtomicStore() but for pointers.
+inline void AtomicStorePtr(void* volatile* dest, void* value) {
+  ::InterlockedExchangePointer(dest, value);
+}
+
+// Full memory barrier, loads and stores are not reordered across it.
+inline void MemoryFence() {
+  ::MemoryBarrier();
+}
+
+// Gives the rest of the time slice to another ready thread.
+inline void YieldThread() {
+  ::SwitchToThread();
+}
+
+// Tells the CPU that this is a busy wait loop, which saves power and lets the other hardware
+// thread of the core run.
+inline void CpuRelax() {
+  YieldProcessor();
+}
+
+// Number of processors that the threads of this process can run on.
+inline size_t CpuCount() {
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+}
+
+typedef DWORD ThreadId;
+
+inline ThreadId CurrentThreadId() {
+  return ::GetCurrentThreadId();
+}
+
+inline bool SameThread(ThreadId a, ThreadId b) {
+  return (a == b);
+}
+
+typedef HANDLE ThreadHandle;
+
+namespace internal {
+struct ThreadStart {
+  void (*fn)(void*);
+  void* ctx;
+};
+
+inline DWORD WINAPI ThreadTrampoline(void* p) {
+  ThreadStart start = *static_cast<ThreadStart*>(p);
+  delete static_cast<ThreadStart*>(p);
+  start.fn(start.ctx);
+  return 0;
+}
+}  // namespace internal.
+
+// Runs |fn(ctx)| in a new thread. The thread must be joined with JoinThread().
+inline bool StartThread(void (*fn)(void*), void* ctx, ThreadHandle* thread) {
+  internal::ThreadStart* start = new internal::ThreadStart;
+  start->fn = fn;
+  start->ctx = ctx;
+  *thread = ::CreateThread(NULL, 0, &internal::ThreadTrampoline, start, 0, NULL);
+  if (*thread)
+    return true;
+  delete start;
+  return false;
+}
+
+inline void JoinThread(ThreadHandle thread) {
+  ::WaitForSingleObject(thread, INFINITE);
+  ::CloseHandle(thread);
+}
+
+// Counting semaphore. Wait() blocks until the count is above zero and then decrements it.
+class Semaphore {
+public:
+  Semaphore() : sem_(::CreateSemaphoreW(NULL, 0, 0x7fffffff, NULL)) {}
+  ~Semaphore() { ::CloseHandle(sem_); }
+
+  void Signal() { ::ReleaseSemaphore(sem_, 1, NULL); }
+  void Wait() { ::WaitForSingleObject(sem_, INFINITE); }
+
+private:
+  HANDLE sem_;
+
+  Semaphore(const Semaphore&);
+  Semaphore& operator=(const Semaphore&);
+};
+
+#else
+
+inline bool AtomicTryAcquire(volatile long* flag) {
+  return __sync_bool_compare_and_swap(flag, 0, 1);
+}
+
+inline void AtomicRelease(volatile long* flag) {
+  __sync_lock_release(flag);
+}
+
+inline long AtomicCompareExchange(volatile long* dest, long exchange, long comparand) {
+  return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+inline long AtomicAdd(volatile long* dest, long value) {
+  return __sync_add_and_fetch(dest, value);
+}
+
+inline void* AtomicCompareExchangePtr(void* volatile* dest, void* exchange, void* comparand) {
+  return __sync_val_compare_and_swap(dest, comparand, exchange);
+}
+
+inline long AtomicLoad(const volatile long* src) {
+  return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+}
+
+inline void* AtomicLoadPtr(void* const volatile* src) {
+  return __atomic_load_n(src, __ATOMIC_ACQUIRE);
+}
+
+inline void AtomicStore(volatile long* dest, long value) {
+  __atomic_store_n(dest, value, __ATOMIC_RELEASE);
+}
+
+inline void AtomicStorePtr(void* volatile* dest, void* value) {
+  __atomic_store_n(dest, value, __ATOMIC_RELEASE);
+}
+
+inline void MemoryFence() {
+  __sync_synchronize();
+}
+
+inline void YieldThread() {
+  ::sched_yield();
+}
+
+inline void CpuRelax() {
+#if defined(__i386__) || defined(__x86_64__)
+  __asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+inline size_t CpuCount() {
+  const long count = ::sysconf(_SC_NPROCESSORS_ONLN);
+  return (count > 0) ? static_cast<size_t>(count) : 1;
+}
+
+typedef pthread_t ThreadId;
+
+inline ThreadId CurrentThreadId() {
+  return ::pthread_self();
+}
+
+inline bool SameThread(ThreadId a, ThreadId b) {
+  return (0 != ::pthread_equal(a, b));
+}
+
+typedef pthread_t ThreadHandle;
+
+namespace internal {
+struct ThreadStart {
+  void (*fn)(void*);
+  void* ctx;
+};
+
+inline void* ThreadTrampoline(void* p) {
+  ThreadStart start = *static_cast<ThreadStart*>(p);
+  delete static_cast<ThreadStart*>(p);
+  start.fn(start.ctx);
+  return NULL;
+}
+}  // namespace internal.
+
+inline bool StartThread(void (*fn)(void*), void* ctx, ThreadHandle* thread) {
+  internal::ThreadStart* start = new internal::ThreadStart;
+  start->fn = fn;
+  start->ctx = ctx;
+  if (0 == ::pthread_create(thread, NULL, &internal::ThreadTrampoline, start))
+    return true;
+  delete start;
+  return false;
+}
+
+inline void JoinThread(ThreadHandle thread) {
+  ::pthread_join(thread, NULL);
+}
+
+class Semaphore {
+public:
+  Semaphore() : count_(0) {
+    ::pthread_mutex_init(&mutex_, NULL);
+    ::pthread_cond_init(&cond_, NULL);
+  }
+
+  ~Semaphore() {
+    ::pthread_cond_destroy(&cond_);
+    ::pthread_mutex_destroy(&mutex_);
+  }
+
+  void Signal() {
+    ::pthread_mutex_lock(&mutex_);
+    ++count_;
+    ::pthread_cond_signal(&cond_);
+    ::pthread_mutex_unlock(&mutex_);
+  }
+
+  void Wait() {
+    ::pthread_mutex_lock(&mutex_);
+    while (!count_) {
+      ::pthread_cond_wait(&cond_, &mutex_);
+    }
+    --count_;
+    ::pthread_mutex_unlock(&mutex_);
+  }
+
+private:
+  pthread_mutex_t mutex_;
+  pthread_cond_t cond_;
+  size_t count_;
+
+  Semaphore(const Semaphore&);
+  Semaphore& operator=(const Semaphore&);
+};
+
+#endif  // defined(WIN32)
+
+// Lock for short critical sections, like appending to a buffer. Waiters yield instead of
+// sleeping on a kernel object so it should not be held across blocking calls for long.
+class SpinLock {
+public:
+  SpinLock() : flag_(0) {}
+
+  void Acquire() {
+    while (!AtomicTryAcquire(&flag_)) {
+      YieldThread();
+    }
+  }
+
+  void Release() {
+    AtomicRelease(&flag_);
+  }
+
+private:
+  volatile long flag_;
+
+  SpinLock(const SpinLock&);
+  SpinLock& operator=(const SpinLock&);
+};
+
+class AutoSpinLock {
+public:
+  explicit AutoSpinLock(SpinLock* lock) : lock_(lock) {
+    lock_->Acquire();
+  }
+
+  ~AutoSpinLock() {
+    lock_->Release();
+  }
+
+private:
+  SpinLock* lock_;
+
+  AutoSpinLock(const AutoSpinLock&);
+  AutoSpinLock& operator=(const AutoSpinLock&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SYNC_H_
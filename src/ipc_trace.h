@@ -0,0 +1,358 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_TRACE_H_
+#define SIMPLE_IPC_TRACE_H_
+
+#include "os_includes.h"
+#include "ipc_clock.h"
+#include "ipc_constants.h"
+#include "ipc_handles.h"
+#include "ipc_poll.h"
+#include "ipc_sync.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Capture and replay of channel traffic. A TeeTransport wraps the transport of a channel and
+// appends what goes through it to a trace: each write and each read, with the time it
+// happened. The trace lives in a block of memory, normally a file mapped with MappedFile (see
+// mapped_file_unix.h and mapped_file_win.h), so recording is a copy under a spin lock and the
+// OS writes the file on its own time. For example:
+//
+//  MappedFile file;
+//  file.Create("broker.trace", 64 * 1024 * 1024);
+//  ipc::TraceWriter trace;
+//  trace.Init(file.base(), file.size());
+//  ipc::TeeTransport<PipeTransport> transport;
+//  transport.SetTrace(&trace);
+//  ipc::Channel<ipc::TeeTransport<PipeTransport>, ipc::Encoder, ipc::Decoder> ch(&transport);
+//
+// ReplayTrace() feeds the bytes of one direction to another channel and its dispatcher, as
+// fast as they are taken or at the recorded pace. That channel can use a ReplayTransport,
+// which drops the replies. The same trace then gives a reproducible load, or a way to compare
+// decoders against a real mix of messages.
+//
+// The records are what the transport moved and not messages: a write can carry several
+// messages and a read can end in the middle of one. The decoder of the replaying channel
+// frames them again. Once the trace is full recording stops so that a trace is always a whole
+// prefix of the traffic; TraceHeader::dropped counts the records that did not fit.
+//
+// The layout is a TraceHeader followed by the records, each a TraceRecord and its bytes
+// padded to 4 bytes. Times are in microseconds since TraceWriter::Init() and wrap around
+// after 71 minutes like TickCountUs() does.
+
+namespace ipc {
+
+enum TraceDirection {
+  TRACE_SENT = 1,
+  TRACE_RECEIVED = 2
+};
+
+struct TraceHeader {
+  static const unsigned int kMagic = 0x54504953;  // "SIPT" in memory order.
+  static const unsigned int kVersion = 1;
+
+  unsigned int magic;
+  unsigned int version;
+  // Bytes after the header that can hold records, and how many of them are in use.
+  unsigned int capacity;
+  unsigned int used;
+  unsigned int records;
+  unsigned int dropped;
+};
+
+struct TraceRecord {
+  unsigned int time_us;
+  unsigned int direction;
+  unsigned int size;
+
+  // Bytes taken by a record of |sz| bytes. |sz| is less than 4GB.
+  static size_t Footprint(size_t sz) {
+    return sizeof(TraceRecord) + ((sz + 3) & ~static_cast<size_t>(3));
+  }
+};
+
+// One record as TraceReader returns it. |data| points inside the trace.
+struct TraceEvent {
+  unsigned int time_us;
+  TraceDirection direction;
+  const char* data;
+  size_t size;
+};
+
+// Appends records to a trace. Any thread can call Record(), the sending threads and the
+// receiving one are serialized by a spin lock that is held for the copy.
+class TraceWriter {
+public:
+  TraceWriter() : hdr_(NULL), data_(NULL), start_us_(0) {}
+
+  // Formats the |sz| bytes at |mem| as an empty trace and starts the clock. Returns false if
+  // they cannot hold the header.
+  bool Init(void* mem, size_t sz) {
+    if (sz < sizeof(TraceHeader))
+      return false;
+    size_t capacity = sz - sizeof(TraceHeader);
+    if (capacity > 0xFFFFFFF0u)
+      capacity = 0xFFFFFFF0u;
+    hdr_ = static_cast<TraceHeader*>(mem);
+    data_ = reinterpret_cast<char*>(hdr_ + 1);
+    hdr_->magic = TraceHeader::kMagic;
+    hdr_->version = TraceHeader::kVersion;
+    hdr_->capacity = static_cast<unsigned int>(capacity & ~static_cast<size_t>(3));
+    hdr_->used = 0;
+    hdr_->records = 0;
+    hdr_->dropped = 0;
+    start_us_ = TickCountUs();
+    return true;
+  }
+
+  // Appends the bytes of |segs| as one record.
+  void Record(TraceDirection direction, const IOSegment* segs, size_t count) {
+    if (!hdr_)
+      return;
+    size_t sz = 0;
+    for (size_t ix = 0; ix != count; ++ix) {
+      sz += segs[ix].sz_;
+    }
+    const size_t need = TraceRecord::Footprint(sz);
+    AutoSpinLock lock(&lock_);
+    if (hdr_->dropped || (need > (hdr_->capacity - hdr_->used))) {
+      ++hdr_->dropped;
+      return;
+    }
+    char* at = data_ + hdr_->used;
+    TraceRecord rec = { TickCountUs() - start_us_, direction, static_cast<unsigned int>(sz) };
+    memcpy(at, &rec, sizeof(rec));
+    at += sizeof(rec);
+    for (size_t ix = 0; ix != count; ++ix) {
+      memcpy(at, segs[ix].buf_, segs[ix].sz_);
+      at += segs[ix].sz_;
+    }
+    // A reader in another process only looks at the records before |used|.
+    MemoryFence();
+    hdr_->used += static_cast<unsigned int>(need);
+    ++hdr_->records;
+  }
+
+  void Record(TraceDirection direction, const void* buf, size_t sz) {
+    IOSegment seg = { buf, sz };
+    Record(direction, &seg, 1);
+  }
+
+  const TraceHeader* header() const { return hdr_; }
+
+private:
+  TraceHeader* hdr_;
+  char* data_;
+  unsigned int start_us_;
+  SpinLock lock_;
+
+  TraceWriter(const TraceWriter&);
+  TraceWriter& operator=(const TraceWriter&);
+};
+
+// Walks the records of a trace, which can still be growing.
+class TraceReader {
+public:
+  TraceReader() : hdr_(NULL), data_(NULL), pos_(0) {}
+
+  // Reads the trace in the |sz| bytes at |mem|. Returns false if it is not a trace or if it
+  // does not fit in |sz|.
+  bool Attach(const void* mem, size_t sz) {
+    if (sz < sizeof(TraceHeader))
+      return false;
+    const TraceHeader* hdr = static_cast<const TraceHeader*>(mem);
+    if ((hdr->magic != TraceHeader::kMagic) || (hdr->version != TraceHeader::kVersion) ||
+        (hdr->capacity > (sz - sizeof(TraceHeader))) || (hdr->used > hdr->capacity))
+      return false;
+    hdr_ = hdr;
+    data_ = reinterpret_cast<const char*>(hdr + 1);
+    pos_ = 0;
+    return true;
+  }
+
+  // Gets the next record. Returns false at the end of the trace and if the record does not
+  // fit in it.
+  bool Next(TraceEvent* ev) {
+    const size_t used = hdr_->used;
+    MemoryFence();
+    if ((pos_ > used) || ((used - pos_) < sizeof(TraceRecord)))
+      return false;
+    TraceRecord rec;
+    memcpy(&rec, data_ + pos_, sizeof(rec));
+    if (rec.size > (used - pos_ - sizeof(rec)))
+      return false;
+    ev->time_us = rec.time_us;
+    ev->direction = static_cast<TraceDirection>(rec.direction);
+    ev->data = data_ + pos_ + sizeof(rec);
+    ev->size = rec.size;
+    pos_ += TraceRecord::Footprint(rec.size);
+    return true;
+  }
+
+  void Rewind() { pos_ = 0; }
+
+  const TraceHeader* header() const { return hdr_; }
+
+private:
+  const TraceHeader* hdr_;
+  const char* data_;
+  size_t pos_;
+};
+
+// Wraps |TransportT| and records what it sends and receives to the trace given to
+// SetTrace(), until it is set back to NULL. Everything else is the wrapped transport, so
+// it is opened the same way.
+template <class TransportT>
+class TeeTransport : public TransportT {
+public:
+  TeeTransport() : trace_(NULL) {}
+
+  void SetTrace(TraceWriter* trace) { trace_ = trace; }
+  TraceWriter* trace() const { return trace_; }
+
+  size_t Send(const IOSegment* segs, size_t count) {
+    size_t rc = TransportT::Send(segs, count);
+    if ((rc == RcOK) && trace_)
+      trace_->Record(TRACE_SENT, segs, count);
+    return rc;
+  }
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    size_t rc = TransportT::ReceiveInto(buf, size);
+    if ((rc == RcOK) && trace_)
+      trace_->Record(TRACE_RECEIVED, buf, *size);
+    return rc;
+  }
+
+  // Only for the transports that have it, like ReactorChannel needs.
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    size_t rc = TransportT::TryReceiveInto(buf, size);
+    if ((rc == RcOK) && *size && trace_)
+      trace_->Record(TRACE_RECEIVED, buf, *size);
+    return rc;
+  }
+
+private:
+  TraceWriter* trace_;
+};
+
+// The handles go like with the wrapped transport, and the messages that carry them are
+// recorded without them.
+template <class TransportT>
+struct HandleTransport<TeeTransport<TransportT> > {
+  static bool Export(TeeTransport<TransportT>* transport, OsHandle::Value handle,
+                     OsHandle::Value* value) {
+    return HandleTransport<TransportT>::Export(transport, handle, value);
+  }
+
+  static size_t SendWithFds(TeeTransport<TransportT>* transport, const IOSegment* segs,
+                            size_t count, const int* fds, size_t n_fds) {
+    size_t rc = HandleTransport<TransportT>::SendWithFds(transport, segs, count, fds, n_fds);
+    if ((rc == RcOK) && transport->trace())
+      transport->trace()->Record(TRACE_SENT, segs, count);
+    return rc;
+  }
+
+  static bool Import(TeeTransport<TransportT>* transport, OsHandle::Value* handle) {
+    return HandleTransport<TransportT>::Import(transport, handle);
+  }
+
+  static void Discard(TeeTransport<TransportT>* transport) {
+    HandleTransport<TransportT>::Discard(transport);
+  }
+};
+
+template <class TransportT>
+struct PollTransport<TeeTransport<TransportT> > {
+  static const bool kCanPoll = PollTransport<TransportT>::kCanPoll;
+
+  static size_t TryReceiveInto(TeeTransport<TransportT>* transport, char* buf, size_t* size) {
+    size_t rc = PollTransport<TransportT>::TryReceiveInto(transport, buf, size);
+    if ((rc == RcOK) && *size && transport->trace())
+      transport->trace()->Record(TRACE_RECEIVED, buf, *size);
+    return rc;
+  }
+};
+
+// Transport for a channel that replays a trace. What the channel sends is counted and
+// dropped, and there is never anything to read.
+class ReplayTransport {
+public:
+  ReplayTransport() : bytes_sent_(0) {}
+
+  size_t Send(const IOSegment* segs, size_t count) {
+    for (size_t ix = 0; ix != count; ++ix) {
+      bytes_sent_ += segs[ix].sz_;
+    }
+    return RcOK;
+  }
+
+  size_t ReceiveInto(char* /*buf*/, size_t* /*size*/) {
+    return RcErrTransportRead;
+  }
+
+  size_t bytes_sent() const { return bytes_sent_; }
+
+private:
+  size_t bytes_sent_;
+};
+
+// Feeds the |direction| records of |reader|, from where it is, to |channel| which decodes
+// them and dispatches the messages to |dispatch|, see Channel::OnReceived(). With |paced| each
+// record waits until as much time has passed since the first one as when it was recorded,
+// yielding the thread in the meantime. Otherwise they go as fast as the channel takes them.
+// Returns OnMsgLoopNext at the end of the trace or the first other value returned by a
+// message handler.
+template <class ChannelT, class DispatchT>
+size_t ReplayTrace(TraceReader* reader, TraceDirection direction, ChannelT* channel,
+                   DispatchT* dispatch, bool paced = false) {
+  bool first = true;
+  unsigned int first_us = 0;
+  unsigned int start = 0;
+  TraceEvent ev;
+  while (reader->Next(&ev)) {
+    if (ev.direction != direction)
+      continue;
+    if (paced) {
+      if (first) {
+        first_us = ev.time_us;
+        start = TickCountUs();
+        first = false;
+      }
+      while ((TickCountUs() - start) < (ev.time_us - first_us)) {
+        YieldThread();
+      }
+    }
+    const char* data = ev.data;
+    size_t left = ev.size;
+    while (left) {
+      size_t sz = 0;
+      char* buf = channel->GetReceiveBuffer(&sz);
+      if (sz > left)
+        sz = left;
+      memcpy(buf, data, sz);
+      data += sz;
+      left -= sz;
+      size_t rc = channel->OnReceived(dispatch, sz);
+      if (rc != OnMsgLoopNext)
+        return rc;
+    }
+  }
+  channel->TrimReceive();
+  return OnMsgLoopNext;
+}
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_TRACE_H_
@@ -0,0 +1,159 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_TRANSPORT_POOL_H_
+#define SIMPLE_IPC_TRANSPORT_POOL_H_
+
+#include "ipc_sync.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A broker answers Channel::InitNewTransport() with one end of a newly connected pair and keeps
+// the other end. Making the pair is several system calls, a named pipe on Windows, and it sits
+// between the request of a new worker and its first call. TransportPool keeps a few pairs
+// ready so Take() only has to pick one, and makes the replacements in its own thread:
+//
+//  ipc::TransportPool<PipePair> pool;
+//  pool.Start(4);
+//  ...
+//  void* BrokerDispatch::OnNewTransport() {
+//    PipePair* pair = pool_->Take();
+//    if (!pair)
+//      return NULL;
+//    // Serve pair->fd1() in another thread, which deletes |pair| when done.
+//    ...
+//    return pair->fd2();
+//  }
+//
+// PairT must be default constructible and have IsValid(), false when the constructor failed,
+// and Close(), which closes both ends. The pool closes the pairs that are never taken.
+
+namespace ipc {
+
+template <class PairT>
+class TransportPool {
+public:
+  static const size_t kMaxReady = 16;
+
+  TransportPool() : target_(0), ready_count_(0), stop_(0), started_(false) {}
+
+  ~TransportPool() {
+    Stop();
+  }
+
+  // Makes |n_ready| pairs, at most kMaxReady, and starts the thread that replaces the ones
+  // that are taken.
+  bool Start(size_t n_ready) {
+    if (started_ || !n_ready || (n_ready > kMaxReady))
+      return false;
+    target_ = n_ready;
+    stop_ = 0;
+    Fill();
+    if (!StartThread(&TransportPool::ThreadMain, this, &thread_))
+      return false;
+    started_ = true;
+    return true;
+  }
+
+  // Returns a ready pair, or makes one now if there is none. The caller owns it. Returns NULL
+  // if the pair can not be made.
+  PairT* Take() {
+    PairT* pair = NULL;
+    {
+      AutoSpinLock lock(&lock_);
+      if (ready_count_)
+        pair = ready_[--ready_count_];
+    }
+    if (pair) {
+      if (started_)
+        refill_.Signal();
+      return pair;
+    }
+    return MakePair();
+  }
+
+  // Pairs that Take() can return right away.
+  size_t Ready() const {
+    AutoSpinLock lock(&lock_);
+    return ready_count_;
+  }
+
+  // Stops the thread and closes the pairs that are ready. Take() still works afterwards but
+  // makes every pair when it is called.
+  void Stop() {
+    if (started_) {
+      AtomicStore(&stop_, 1);
+      refill_.Signal();
+      JoinThread(thread_);
+      started_ = false;
+    }
+    AutoSpinLock lock(&lock_);
+    while (ready_count_) {
+      PairT* pair = ready_[--ready_count_];
+      pair->Close();
+      delete pair;
+    }
+  }
+
+private:
+  static void ThreadMain(void* ctx) {
+    TransportPool* pool = static_cast<TransportPool*>(ctx);
+    for (;;) {
+      pool->refill_.Wait();
+      if (AtomicLoad(&pool->stop_))
+        return;
+      pool->Fill();
+    }
+  }
+
+  static PairT* MakePair() {
+    PairT* pair = new PairT;
+    if (pair->IsValid())
+      return pair;
+    delete pair;
+    return NULL;
+  }
+
+  // Only one thread at a time fills: Start() before the thread runs and then the thread. The
+  // pairs are made outside of the lock so Take() never waits for them.
+  void Fill() {
+    for (;;) {
+      {
+        AutoSpinLock lock(&lock_);
+        if (ready_count_ >= target_)
+          return;
+      }
+      PairT* pair = MakePair();
+      if (!pair)
+        return;
+      AutoSpinLock lock(&lock_);
+      ready_[ready_count_++] = pair;
+    }
+  }
+
+  PairT* ready_[kMaxReady];
+  size_t target_;
+  size_t ready_count_;
+  volatile long stop_;
+  bool started_;
+  mutable SpinLock lock_;
+  Semaphore refill_;
+  ThreadHandle thread_;
+
+  TransportPool(const TransportPool&);
+  TransportPool& operator=(const TransportPool&);
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_TRANSPORT_POOL_H_
@@ -40,6 +40,17 @@ template <typename T> void delete_impl(T* o) {
   delete[] o;
 }
 
+// The allocation policy of the containers below. A policy provides New<T>(n) and Delete<T>(p)
+// and can carry state, since each container holds its own copy.
+struct DefaultAlloc {
+  template <typename T> T* New(size_t n) {
+    return new_impl<T>(n);
+  }
+
+  template <typename T> void Delete(T* o) {
+    delete_impl(o);
+  }
+};
 
 }  // namespace memdet
 
@@ -98,6 +109,71 @@ private:
 };
 
 
+// Same as FixedArray but without the size limit. The first N elements live in the object
+// itself, past that all of them move to a heap block which is kept until the object is
+// destroyed, so reusing the array for sizes up to N never allocates.
+template <typename T, size_t N>
+class SmallArray {
+public:
+  SmallArray() : index_(0), capa_(N), heap_(0) {}
+
+  ~SmallArray() {
+    clear();
+    memdet::delete_impl(heap_);
+  }
+
+  bool push_back(const T& ob) {
+    if (index_ != capa_) {
+      new(as_obj(index_)) T(ob);
+      ++index_;
+      return true;
+    }
+    // |ob| can be one of our own elements so it is copied before they are destroyed.
+    const size_t capa = capa_ * 2;
+    char* heap = memdet::new_impl<char>(capa * sizeof(T));
+    new(&heap[index_ * sizeof(T)]) T(ob);
+    for (size_t ix = 0; ix != index_; ++ix) {
+      new(&heap[ix * sizeof(T)]) T(*as_obj(ix));
+      as_obj(ix)->~T();
+    }
+    memdet::delete_impl(heap_);
+    heap_ = heap;
+    capa_ = capa;
+    ++index_;
+    return true;
+  }
+
+  T& operator[](size_t ix) {
+    return *as_obj(ix);
+  }
+
+  size_t size() const { return index_; }
+
+  // Number of elements that fit before the next allocation.
+  size_t capacity() const { return capa_; }
+
+  void clear() {
+    for (size_t ix = 0; ix != index_; ++ix) {
+      as_obj(ix)->~T();
+    }
+    index_ = 0;
+  }
+
+private:
+  T* as_obj(size_t ix) {
+    return reinterpret_cast<T*>(heap_ ? &heap_[ix * sizeof(T)] : &v_[ix * sizeof(T)]);
+  }
+
+  size_t index_;
+  size_t capa_;
+  char* heap_;
+  char v_[N * sizeof(T)];
+
+  SmallArray(const SmallArray&);
+  SmallArray& operator=(const SmallArray&);
+};
+
+
 // We don't support generic iterators but we define this magic two
 // types to support insertion to the end and erasure at the beggining.
 class IteratorEnd {};
@@ -111,14 +187,16 @@ T operator+(const IteratorBegin&, T d) {
 // This container is the backing store of HoldeString and a generic
 // vector of plain-old-data. Caveat: Don't use this if your PoD does
 // not have an aceptable default value of 0 as in all bytes equal to
-// zero.
-template <typename T>
-class PodVector {
+// zero. The memory comes from |AllocT|, see memdet::DefaultAlloc.
+template <typename T, typename AllocT = memdet::DefaultAlloc>
+class PodVector : private AllocT {
 public:
   typedef T value_type;
 
   PodVector() : capa_(0), size_(0), buf_(0) {}
 
+  explicit PodVector(const AllocT& alloc) : AllocT(alloc), capa_(0), size_(0), buf_(0) {}
+
   ~PodVector() {
     clear();
   }
@@ -133,6 +211,8 @@ public:
 
   size_t capacity() const { return capa_; }
 
+  const AllocT& get_allocator() const { return *this; }
+
   T& operator[](size_t ix) {
     return buf_[ix];
   }
@@ -142,7 +222,7 @@ public:
   }
 
   void clear() {
-    memdet::delete_impl(buf_);
+    this->template Delete<T>(buf_);
     size_ = 0;
     capa_ = 0;
     buf_ = 0;
@@ -188,7 +268,7 @@ public:
     T* newb = NewAlloc(n);
     if (newb) {
       memcpy(newb, buf_, size_ * sizeof(T));
-      memdet::delete_impl(buf_);
+      this->template Delete<T>(buf_);
       buf_ = newb;
     }
     if (inp) {
@@ -203,7 +283,7 @@ public:
     if ((0 == size_) || (n > size_))
       return;
     size_t newsz = size_ - n;
-    memmove(buf_, &buf_[n], newsz);
+    memmove(buf_, &buf_[n], newsz * sizeof(T));
     size_ = newsz;
   }
 
@@ -212,14 +292,21 @@ public:
     Add(inp, n);
   }
 
-  void Set(const PodVector<T>& other) {
+  void Set(const PodVector<T, AllocT>& other) {
     Set(other.buf_, other.size_);
   }
 
-  void Swap(PodVector<T>& other) {
-    swap(buf_, other.buf_);
-    swap(size_, other.size_);
-    swap(capa_, other.capa_);
+  // The allocators are exchanged along with the buffers they own.
+  void Swap(PodVector<T, AllocT>& other) {
+    ::swap(buf_, other.buf_);
+    ::swap(size_, other.size_);
+    ::swap(capa_, other.capa_);
+    ::swap(static_cast<AllocT&>(*this), static_cast<AllocT&>(other));
+  }
+
+  // Same as Swap(), spelled like std::vector::swap so generic code can use either.
+  void swap(PodVector<T, AllocT>& other) {
+    Swap(other);
   }
 
   void DecSize() {
@@ -234,7 +321,7 @@ private:
     }
     size_t new_a = n + (size_ * 2) + 1;
     capa_ = (new_a < 16)? 16 : new_a;
-    return memdet::new_impl<T>(capa_);
+    return this->template New<T>(capa_);
   }
 
   PodVector(const PodVector&);
@@ -249,23 +336,23 @@ private:
 // One trick one should be aware on this class is that leverages the fact that
 // PodVector overallocates always. So it is safe to write to str_[size_] for
 // example to null terminate.
-template <typename Ct, typename Derived>
+template <typename Ct, typename Derived, typename AllocT>
 class StringBase {
 public:
   typedef Ct value_type;
 
-  StringBase(const StringBase& rhs) {
+  StringBase(const StringBase& rhs) : str_(rhs.str_.get_allocator()) {
     assign(rhs.str_.get(), rhs.str_.size());
   }
 
-  StringBase<Ct, Derived>& operator=(const StringBase<Ct, Derived>& rhs) {
+  StringBase& operator=(const StringBase& rhs) {
     assign(rhs.str_.get(), rhs.str_.size());
     return *this;
   }
 
   void assign(const Ct* str, size_t size) {
     str_.Set(str, size);
-    if (size)
+    if (str_.get())
       str_[size] = Ct(0);
   }
 
@@ -273,7 +360,7 @@ public:
     return str_.size();
   }
 
-  void swap(StringBase<Ct, Derived>& other) {
+  void swap(StringBase& other) {
     str_.Swap(other.str_);
   }
 
@@ -295,40 +382,48 @@ public:
 
   size_t capacity() const { return str_.capacity(); }
 
+  const AllocT& get_allocator() const { return str_.get_allocator(); }
+
 protected:
   StringBase() {}
 
-  PodVector<Ct> str_;
+  explicit StringBase(const AllocT& alloc) : str_(alloc) {}
+
+  PodVector<Ct, AllocT> str_;
 };
 
-template <typename Ct>
+template <typename Ct, typename AllocT = memdet::DefaultAlloc>
 class HolderString;
 
 // Two specializations of HolderString for char and wchar_t that
 // have enough functionality to replace (if desired) the use of the
 // standard basic_string.
-template <>
-class HolderString<char> : public StringBase<char, HolderString<char> > {
+template <typename AllocT>
+class HolderString<char, AllocT>
+    : public StringBase<char, HolderString<char, AllocT>, AllocT> {
 public:
   HolderString() {}
 
+  explicit HolderString(const AllocT& alloc)
+      : StringBase<char, HolderString<char, AllocT>, AllocT>(alloc) {}
+
   HolderString(const char* str) {
     operator=(str);
   }
 
   void operator=(const char* str) {
-    assign(str, strlen(str));
+    this->assign(str, strlen(str));
   }
 
   void append(const char* str) {
-    str_.Add(str, strlen(str) + 1);
-    str_.DecSize();
+    this->str_.Add(str, strlen(str) + 1);
+    this->str_.DecSize();
   }
 
   const char* c_str() const {
-    if (!str_.get())
+    if (!this->str_.get())
       return "";
-    return str_.get(); 
+    return this->str_.get(); 
   }
 
   int Compare(const char* str) const {
@@ -337,28 +432,32 @@ public:
   
 };
 
-template <>
-class HolderString<wchar_t> : public StringBase<wchar_t, HolderString<wchar_t> > {
+template <typename AllocT>
+class HolderString<wchar_t, AllocT>
+    : public StringBase<wchar_t, HolderString<wchar_t, AllocT>, AllocT> {
 public:
   HolderString() {}
 
+  explicit HolderString(const AllocT& alloc)
+      : StringBase<wchar_t, HolderString<wchar_t, AllocT>, AllocT>(alloc) {}
+
   HolderString(const wchar_t* str) {
     operator=(str);
   }
 
   void operator=(const wchar_t* str) {
-    assign(str, wcslen(str));
+    this->assign(str, wcslen(str));
   }
 
   void append(const wchar_t* str) {
-    str_.Add(str, wcslen(str) + 1);
-    str_.DecSize();
+    this->str_.Add(str, wcslen(str) + 1);
+    this->str_.DecSize();
   }
 
   const wchar_t* c_str() const {
-    if (!str_.get())
+    if (!this->str_.get())
       return L"";
-    return str_.get(); 
+    return this->str_.get(); 
   }
 
   int Compare(const wchar_t* str) const {
@@ -366,6 +465,120 @@ public:
   }
 };
 
+// Bump allocator for memory that has the same lifetime, for example the strings of one
+// received message. Individual allocations are never freed; Reset() recycles all of them at
+// once and keeps the blocks for the next round so that in steady state there are no heap calls.
+class Arena {
+public:
+  static const size_t kBlockSz = 4 * 1024;
+
+  Arena() : head_(0), cur_(0), used_(0) {}
+
+  ~Arena() {
+    Free(head_);
+  }
+
+  // Returns |sz| bytes aligned to the machine word size.
+  void* Alloc(size_t sz) {
+    sz = (sz + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    if (!cur_ || (cur_->sz_ - used_) < sz)
+      NextBlock(sz);
+    void* p = cur_->data() + used_;
+    used_ += sz;
+    return p;
+  }
+
+  // All the memory returned by Alloc() becomes invalid.
+  void Reset() {
+    cur_ = head_;
+    used_ = 0;
+  }
+
+  // Frees the blocks past the first one if all of them hold more than |max_bytes|, and the
+  // first one too if it alone is still over. Call only after Reset().
+  void Trim(size_t max_bytes) {
+    if (!head_ || (Held() <= max_bytes))
+      return;
+    Free(head_->next_);
+    head_->next_ = 0;
+    if (head_->sz_ <= max_bytes)
+      return;
+    Free(head_);
+    head_ = 0;
+    cur_ = 0;
+    used_ = 0;
+  }
+
+  // Total size of the blocks owned by the arena.
+  size_t Held() const {
+    size_t held = 0;
+    for (Block* b = head_; b; b = b->next_) {
+      held += b->sz_;
+    }
+    return held;
+  }
+
+private:
+  struct Block {
+    Block* next_;
+    size_t sz_;
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+  };
+
+  // Moves to the next retained block if it is big enough, otherwise allocates one
+  // and links it after the current block.
+  void NextBlock(size_t sz) {
+    Block* next = cur_ ? cur_->next_ : head_;
+    if (!next || (next->sz_ < sz)) {
+      size_t bsz = (sz < kBlockSz) ? kBlockSz : sz;
+      Block* nb = reinterpret_cast<Block*>(memdet::new_impl<char>(sizeof(Block) + bsz));
+      nb->next_ = next;
+      nb->sz_ = bsz;
+      if (cur_)
+        cur_->next_ = nb;
+      else
+        head_ = nb;
+      next = nb;
+    }
+    cur_ = next;
+    used_ = 0;
+  }
+
+  static void Free(Block* b) {
+    while (b) {
+      Block* next = b->next_;
+      memdet::delete_impl(reinterpret_cast<char*>(b));
+      b = next;
+    }
+  }
+
+  Block* head_;
+  Block* cur_;
+  size_t used_;
+
+  Arena(const Arena&);
+  Arena& operator=(const Arena&);
+};
+
+// Allocation policy that takes the memory from an Arena. Delete() is a no-op, the memory is
+// reclaimed by Arena::Reset(). Containers using it must not outlive the arena's current round.
+class ArenaAlloc {
+public:
+  ArenaAlloc() : arena_(0) {}
+  explicit ArenaAlloc(Arena* arena) : arena_(arena) {}
+
+  template <typename T> T* New(size_t n) {
+    return static_cast<T*>(arena_->Alloc(n * sizeof(T)));
+  }
+
+  template <typename T> void Delete(T*) {}
+
+  Arena* arena() const { return arena_; }
+
+private:
+  Arena* arena_;
+};
+
 }  // namespace ipc.
 
 #endif // SIMPLE_IPC_UTLIS_H_
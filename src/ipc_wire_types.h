@@ -16,6 +16,8 @@
 #define SIMPLE_IPC_WIRE_TYPES_H_
 
 #include "os_includes.h"
+#include "ipc_handles.h"
+#include "ipc_utils.h"
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // This header defines the basic c++ types that can be transported via IPC.
@@ -40,25 +42,25 @@ enum {
   TYPE_NULLBARRAY,      // like TYPE_BARRAY but its value is NULL.
 
   TYPE_CHAR32,          // not used.
-  TYPE_INT64,           // not used.
-  TYPE_UINT64,          // not used.
-  TYPE_FLOAT32,         // not used.
-  TYPE_FLOAT64,         // not used.
-  TYPE_LONG64,          // not used.
+  TYPE_INT64,           // 64-bit integer, the same size for 32 and 64 bit peers.
+  TYPE_UINT64,          // 64-bit unsigned integer.
+  TYPE_FLOAT32,         // float.
+  TYPE_FLOAT64,         // double.
+  TYPE_HANDLE,          // OS handle passed to the peer process, see ipc_handles.h.
   TYPE_ULONG64,         // not used.
-  TYPE_NULLINT32ARRAY,  // not used.
-  TYPE_NULLUINT32ARRAY, // not used.
-  TYPE_NULLINT64ARRAY,  // not used.
-  TYPE_NULLUINT64ARRAY, // not used.
+  TYPE_NULLINT32ARRAY,  // like TYPE_INT32ARRAY but its value is NULL.
+  TYPE_NULLUINT32ARRAY, // like TYPE_UINT32ARRAY but its value is NULL.
+  TYPE_NULLINT64ARRAY,  // like TYPE_INT64ARRAY but its value is NULL.
+  TYPE_NULLUINT64ARRAY, // like TYPE_UINT64ARRAY but its value is NULL.
 
   TYPE_STRING8,         // 8-bit string any encoding.
   TYPE_STRING16,        // 16-bit string any encoding.
   TYPE_BARRAY,          // counted byte array.
 
-  TYPE_INT32ARRAY,      // not used.
-  TYPE_UINT32ARRAY,     // not used.
-  TYPE_INT64ARRAY,      // not used.
-  TYPE_UINT64ARRAY,     // not used.
+  TYPE_INT32ARRAY,      // counted array of int.
+  TYPE_UINT32ARRAY,     // counted array of unsigned int.
+  TYPE_INT64ARRAY,      // counted array of long long.
+  TYPE_UINT64ARRAY,     // counted array of unsigned long long.
 
   TYPE_LAST
 };
@@ -70,12 +72,75 @@ struct ByteArray {
   ByteArray(size_t sz, const char* buf) : sz_(sz), buf_(buf) {}
 };
 
+// Same as ByteArray but a WireType constructed from it references the bytes instead of
+// copying them, so the buffer must outlive the WireType.
+struct ByteArrayRef : public ByteArray {
+  ByteArrayRef(size_t sz, const char* buf) : ByteArray(sz, buf) {}
+};
+
+// Strings that a WireType references instead of copying. The characters must be null
+// terminated at |sz_| and outlive the WireType.
+struct String8Ref {
+  size_t sz_;
+  const char* str_;
+  String8Ref(size_t sz, const char* str) : sz_(sz), str_(str) {}
+};
+
+struct String16Ref {
+  size_t sz_;
+  const wchar_t* str_;
+  String16Ref(size_t sz, const wchar_t* str) : sz_(sz), str_(str) {}
+};
+
+// Like String8Ref and String16Ref but the characters do not need a null terminator. The
+// string is copied to |arena_|, with the terminator, only if it is read as a C string. Until
+// then the WireType costs the same as a ByteArrayRef. The characters and the arena must
+// outlive the WireType.
+struct String8LazyRef {
+  size_t sz_;
+  const char* str_;
+  Arena* arena_;
+  String8LazyRef(size_t sz, const char* str, Arena* arena) : sz_(sz), str_(str), arena_(arena) {}
+};
+
+struct String16LazyRef {
+  size_t sz_;
+  const wchar_t* str_;
+  Arena* arena_;
+  String16LazyRef(size_t sz, const wchar_t* str, Arena* arena)
+      : sz_(sz), str_(str), arena_(arena) {}
+};
+
+// Wrapper for an array of |sz_| integers. A WireType constructed from it references the
+// elements, which must outlive the WireType, so a large array costs one WireType and is
+// encoded with one copy, or none if the codec can reference it in place.
+template <typename T, int kType, int kNullType>
+struct TypedArray {
+  typedef T ElementType;
+  enum {
+    kTypeId = kType,
+    kNullTypeId = kNullType
+  };
+
+  size_t sz_;
+  const T* buf_;
+  TypedArray(size_t sz, const T* buf) : sz_(sz), buf_(buf) {}
+};
+
+typedef TypedArray<int, TYPE_INT32ARRAY, TYPE_NULLINT32ARRAY> Int32Array;
+typedef TypedArray<unsigned int, TYPE_UINT32ARRAY, TYPE_NULLUINT32ARRAY> UInt32Array;
+typedef TypedArray<long long, TYPE_INT64ARRAY, TYPE_NULLINT64ARRAY> Int64Array;
+typedef TypedArray<unsigned long long, TYPE_UINT64ARRAY, TYPE_NULLUINT64ARRAY> UInt64Array;
+
 // Variant-like structure without the ownership madness.
 class MultiType {
  public:
-  MultiType(int id) : id_(id) {}
+  MultiType(int id) : ref_(NULL), ref_sz_(0), lazy_(NULL), id_(id) {}
   int Id() const { return id_; }
 
+  // True if the string or array value is borrowed rather than owned.
+  bool IsRef() const { return (NULL != ref_); }
+
  protected:
   void SetId(int id) { id_ = id; }
 
@@ -87,11 +152,23 @@ class MultiType {
     char v_char;
     wchar_t v_wchar;
     void* v_pvoid;
+    long long v_int64;
+    unsigned long long v_uint64;
+    float v_float;
+    double v_double;
+    OsHandle::Value v_handle;
   } store;
 
   mutable IPCString store_str8;
   mutable IPCWString store_str16;
 
+  // Set instead of store_str8 or store_str16 when the value is borrowed. For the 16-bit
+  // strings it points to wchar_t characters and for the typed arrays |ref_sz_| is in bytes.
+  // |lazy_| is set while |ref_| still has to be copied to get its null terminator.
+  mutable const char* ref_;
+  size_t ref_sz_;
+  mutable Arena* lazy_;
+
  private:
   int id_;
 };
@@ -124,8 +201,36 @@ class WireType : public MultiType {
 
   WireType(const ByteArray& ba) : MultiType(ipc::TYPE_BARRAY) { Set(ba); }
 
+  WireType(const ByteArrayRef& ba) : MultiType(ipc::TYPE_BARRAY) { SetRef(ba); }
+
+  WireType(const String8Ref& sr) : MultiType(ipc::TYPE_STRING8) { SetRef(sr); }
+
+  WireType(const String16Ref& sr) : MultiType(ipc::TYPE_STRING16) { SetRef(sr); }
+
+  WireType(const String8LazyRef& sr) : MultiType(ipc::TYPE_STRING8) { SetRef(sr); }
+
+  WireType(const String16LazyRef& sr) : MultiType(ipc::TYPE_STRING16) { SetRef(sr); }
+
+  // Counted strings, they don't need to be null terminated. The characters are copied.
+  WireType(const char* pc, size_t len) : MultiType(ipc::TYPE_STRING8) { Set(pc, len); }
+
+  WireType(const wchar_t* pc, size_t len) : MultiType(ipc::TYPE_STRING16) { Set(pc, len); }
+
   WireType(const void* vp) : MultiType(ipc::TYPE_VOIDPTR) { Set(vp); }
 
+  WireType(long long v) : MultiType(ipc::TYPE_INT64) { Set(v); }
+
+  WireType(unsigned long long v) : MultiType(ipc::TYPE_UINT64) { Set(v); }
+
+  WireType(float v) : MultiType(ipc::TYPE_FLOAT32) { Set(v); }
+
+  WireType(double v) : MultiType(ipc::TYPE_FLOAT64) { Set(v); }
+
+  template <typename T, int kType, int kNullType>
+  WireType(const TypedArray<T, kType, kNullType>& ta) : MultiType(kType) { SetRef(ta); }
+
+  WireType(const OsHandle& h) : MultiType(ipc::TYPE_HANDLE) { Set(h); }
+
   ////////////////////////////////////////////////////////////////////////
   // Getters: these are used by the sending side of the channel.
   //
@@ -134,24 +239,131 @@ class WireType : public MultiType {
   }
 
   void GetString8(IPCString* out) const {
+    if (ref_) {
+      out->assign(ref_, ref_sz_);
+      return;
+    }
     out->swap(store_str8);
   }
 
   void GetString16(IPCWString* out) const {
+    if (ref_) {
+      out->assign(Ref16(), ref_sz_);
+      return;
+    }
     out->swap(store_str16);
   }
+
+  // These two return the string or byte array without copying it. The pointer is valid
+  // while the WireType is alive.
+  const char* PeekString8(size_t* sz) const {
+    if (ref_) {
+      *sz = ref_sz_;
+      return ref_;
+    }
+    *sz = store_str8.size();
+    return store_str8.c_str();
+  }
+
+  const wchar_t* PeekString16(size_t* sz) const {
+    if (ref_) {
+      *sz = ref_sz_;
+      return Ref16();
+    }
+    *sz = store_str16.size();
+    return store_str16.c_str();
+  }
   
+  // Returns the raw bytes of the 64-bit values and of the typed arrays.
+  const char* PeekBytes(size_t* sz) const {
+    if (ref_) {
+      *sz = ref_sz_;
+      return ref_;
+    }
+    *sz = sizeof(store.v_int64);
+    return reinterpret_cast<const char*>(&store.v_int64);
+  }
+
   bool IsNullArray() const {
     return (store.v_int < 0);
   }
 
   ///////////////////////////////////////////////////////////////////////////
-  // Recoverers: these are used by the receiving side of the channel.
+  // Checkers and unchecked getters: these are used by the receiving side of the channel.
   //
-  // These functions throw. Why you ask? well, because the type inference used
-  // elsewhere in the code requires that the error checking to be done at type
-  // conversion time and there is no way to insert a callback there.
-  // This exception does not propagate as it is catched by the callback processor.
+  // MsgIn checks every argument of a message with the CheckXxx() functions before calling the
+  // handler, and then converts them with the AsXxx() functions which do not check the type.
+  // CheckXxx() returns 0 if the type matches or else the expected type id.
+
+  int CheckInt32() const { return (Id() == ipc::TYPE_INT32) ? 0 : ipc::TYPE_INT32; }
+  int CheckUInt32() const { return (Id() == ipc::TYPE_UINT32) ? 0 : ipc::TYPE_UINT32; }
+  int CheckLong32() const { return (Id() == ipc::TYPE_LONG32) ? 0 : ipc::TYPE_LONG32; }
+  int CheckULong32() const { return (Id() == ipc::TYPE_ULONG32) ? 0 : ipc::TYPE_ULONG32; }
+  int CheckChar8() const { return (Id() == ipc::TYPE_CHAR8) ? 0 : ipc::TYPE_CHAR8; }
+  int CheckChar16() const { return (Id() == ipc::TYPE_CHAR16) ? 0 : ipc::TYPE_CHAR16; }
+  int CheckVoidPtr() const { return (Id() == ipc::TYPE_VOIDPTR) ? 0 : ipc::TYPE_VOIDPTR; }
+  int CheckInt64() const { return (Id() == ipc::TYPE_INT64) ? 0 : ipc::TYPE_INT64; }
+  int CheckUInt64() const { return (Id() == ipc::TYPE_UINT64) ? 0 : ipc::TYPE_UINT64; }
+  int CheckFloat32() const { return (Id() == ipc::TYPE_FLOAT32) ? 0 : ipc::TYPE_FLOAT32; }
+  int CheckFloat64() const { return (Id() == ipc::TYPE_FLOAT64) ? 0 : ipc::TYPE_FLOAT64; }
+  int CheckHandle() const { return (Id() == ipc::TYPE_HANDLE) ? 0 : ipc::TYPE_HANDLE; }
+
+  int CheckString8() const {
+    return ((Id() == ipc::TYPE_STRING8) || (Id() == ipc::TYPE_NULLSTRING8)) ? 0 : ipc::TYPE_STRING8;
+  }
+
+  int CheckString16() const {
+    return ((Id() == ipc::TYPE_STRING16) || (Id() == ipc::TYPE_NULLSTRING16)) ?
+        0 : ipc::TYPE_STRING16;
+  }
+
+  int CheckByteArray() const {
+    return ((Id() == ipc::TYPE_BARRAY) || (Id() == ipc::TYPE_NULLBARRAY)) ? 0 : ipc::TYPE_BARRAY;
+  }
+
+  int CheckInt32Array() const { return CheckArray<Int32Array>(); }
+  int CheckUInt32Array() const { return CheckArray<UInt32Array>(); }
+  int CheckInt64Array() const { return CheckArray<Int64Array>(); }
+  int CheckUInt64Array() const { return CheckArray<UInt64Array>(); }
+
+  int AsInt32() const { return store.v_int; }
+  unsigned int AsUInt32() const { return store.v_uint; }
+  long AsLong32() const { return store.v_long; }
+  unsigned long AsULong32() const { return store.v_ulong; }
+  char AsChar8() const { return store.v_char; }
+  wchar_t AsChar16() const { return store.v_wchar; }
+  void* AsVoidPtr() const { return store.v_pvoid; }
+  long long AsInt64() const { return store.v_int64; }
+  unsigned long long AsUInt64() const { return store.v_uint64; }
+  float AsFloat32() const { return store.v_float; }
+  double AsFloat64() const { return store.v_double; }
+  const OsHandle AsHandle() const { return OsHandle(store.v_handle); }
+
+  const char* AsString8() const {
+    if (Id() == ipc::TYPE_NULLSTRING8) return NULL;
+    return ref_ ? Terminated<char>() : store_str8.c_str();
+  }
+
+  const wchar_t* AsString16() const {
+    if (Id() == ipc::TYPE_NULLSTRING16) return NULL;
+    return ref_ ? Terminated<wchar_t>() : store_str16.c_str();
+  }
+
+  const ByteArray AsByteArray() const {
+    if (Id() == ipc::TYPE_NULLBARRAY) return ByteArray(0, NULL);
+    if (ref_) return ByteArray(ref_sz_, ref_);
+    return ByteArray(store_str8.size(), store_str8.c_str());
+  }
+
+  const Int32Array AsInt32Array() const { return AsArray<Int32Array>(); }
+  const UInt32Array AsUInt32Array() const { return AsArray<UInt32Array>(); }
+  const Int64Array AsInt64Array() const { return AsArray<Int64Array>(); }
+  const UInt64Array AsUInt64Array() const { return AsArray<UInt64Array>(); }
+
+#if !defined(IPC_NO_EXCEPTIONS)
+  ///////////////////////////////////////////////////////////////////////////
+  // Recoverers: checked getters that throw the expected type id on a mismatch. The library
+  // does not use them, they are kept for the code that reads WireTypes directly.
 
   int RecoverInt32() const {
     if (Id() != ipc::TYPE_INT32) throw int(ipc::TYPE_INT32);
@@ -189,22 +401,26 @@ class WireType : public MultiType {
   }
 
   const char* RecoverString8() const {
-    if (Id() == ipc::TYPE_STRING8) return store_str8.c_str(); 
+    if (Id() == ipc::TYPE_STRING8) return ref_ ? Terminated<char>() : store_str8.c_str();
     else if (Id() == ipc::TYPE_NULLSTRING8) return NULL;
     else throw int(ipc::TYPE_STRING8);
   }
   
   const wchar_t* RecoverString16() const {
-    if (Id() == ipc::TYPE_STRING16) return store_str16.c_str(); 
+    if (Id() == ipc::TYPE_STRING16) return ref_ ? Terminated<wchar_t>() : store_str16.c_str();
     else if (Id() == ipc::TYPE_NULLSTRING16) return NULL;
     else throw int(ipc::TYPE_STRING16);
   }
 
   const ByteArray RecoverByteArray() const {
-    if (Id() == ipc::TYPE_BARRAY) return ByteArray(store_str8.size(), store_str8.c_str());
+    if (Id() == ipc::TYPE_BARRAY) {
+      if (ref_) return ByteArray(ref_sz_, ref_);
+      return ByteArray(store_str8.size(), store_str8.c_str());
+    }
     else if (Id() == ipc::TYPE_NULLBARRAY) return ByteArray(0, NULL);
     else throw int(ipc::TYPE_BARRAY);
   }
+#endif  // !defined(IPC_NO_EXCEPTIONS)
 
  private:
   void Set(int v) { store.v_int = v; }
@@ -214,6 +430,11 @@ class WireType : public MultiType {
   void Set(char v) { store.v_int = 0; store.v_char = v; }
   void Set(wchar_t v) { store.v_int = 0; store.v_wchar = v; }
   void Set(const void* v) { store.v_pvoid = const_cast<void*>(v); }
+  void Set(long long v) { store.v_int64 = v; }
+  void Set(unsigned long long v) { store.v_uint64 = v; }
+  void Set(float v) { store.v_pvoid = NULL; store.v_float = v; }
+  void Set(double v) { store.v_double = v; }
+  void Set(const OsHandle& h) { store.v_pvoid = NULL; store.v_handle = h.h_; }
   
   void Set(const char* pc) { 
     if (!pc) {
@@ -233,6 +454,22 @@ class WireType : public MultiType {
     store_str16 = pc;
   }
 
+  void Set(const char* pc, size_t len) {
+    if (!pc) {
+      Set(static_cast<const char*>(NULL));
+      return;
+    }
+    store_str8.assign(pc, len);
+  }
+
+  void Set(const wchar_t* pc, size_t len) {
+    if (!pc) {
+      Set(static_cast<const wchar_t*>(NULL));
+      return;
+    }
+    store_str16.assign(pc, len);
+  }
+
   void Set(const ByteArray& ba) {
     if (!ba.buf_) {
       store.v_int = -1;
@@ -242,8 +479,95 @@ class WireType : public MultiType {
     store_str8.assign(ba.buf_, ba.sz_);
   }
 
+  void SetRef(const ByteArray& ba) {
+    if (!ba.buf_) {
+      Set(ba);
+      return;
+    }
+    ref_ = ba.buf_;
+    ref_sz_ = ba.sz_;
+  }
+
+  void SetRef(const String8Ref& sr) {
+    if (!sr.str_) {
+      Set(static_cast<const char*>(NULL));
+      return;
+    }
+    ref_ = sr.str_;
+    ref_sz_ = sr.sz_;
+  }
+
+  void SetRef(const String16Ref& sr) {
+    if (!sr.str_) {
+      Set(static_cast<const wchar_t*>(NULL));
+      return;
+    }
+    ref_ = reinterpret_cast<const char*>(sr.str_);
+    ref_sz_ = sr.sz_;
+  }
+
+  void SetRef(const String8LazyRef& sr) {
+    SetRef(String8Ref(sr.sz_, sr.str_));
+    if (ref_)
+      lazy_ = sr.arena_;
+  }
+
+  void SetRef(const String16LazyRef& sr) {
+    SetRef(String16Ref(sr.sz_, sr.str_));
+    if (ref_)
+      lazy_ = sr.arena_;
+  }
+
+  template <typename T, int kType, int kNullType>
+  void SetRef(const TypedArray<T, kType, kNullType>& ta) {
+    if (!ta.buf_) {
+      store.v_int = -1;
+      SetId(kNullType);
+      return;
+    }
+    ref_ = reinterpret_cast<const char*>(ta.buf_);
+    ref_sz_ = ta.sz_ * sizeof(T);
+  }
+
+  template <class ArrayT>
+  int CheckArray() const {
+    return ((Id() == ArrayT::kTypeId) || (Id() == ArrayT::kNullTypeId)) ? 0 : ArrayT::kTypeId;
+  }
+
+  template <class ArrayT>
+  const ArrayT AsArray() const {
+    typedef typename ArrayT::ElementType T;
+    if (Id() == ArrayT::kNullTypeId) return ArrayT(0, NULL);
+    return ArrayT(ref_sz_ / sizeof(T), reinterpret_cast<const T*>(ref_));
+  }
+
+  const wchar_t* Ref16() const {
+    return reinterpret_cast<const wchar_t*>(ref_);
+  }
+
+  // Returns |ref_| as a null terminated string, copying it first if it is a lazy reference.
+  template <typename Ct>
+  const Ct* Terminated() const {
+    if (lazy_) {
+      Ct* copy = static_cast<Ct*>(lazy_->Alloc((ref_sz_ + 1) * sizeof(Ct)));
+      memcpy(copy, ref_, ref_sz_ * sizeof(Ct));
+      copy[ref_sz_] = Ct(0);
+      ref_ = reinterpret_cast<const char*>(copy);
+      lazy_ = NULL;
+    }
+    return reinterpret_cast<const Ct*>(ref_);
+  }
+
 };
 
+// Closes the handle arguments of a message that is rejected, since no handler takes them.
+inline void CloseHandleArgs(const WireType* const args[], size_t count) {
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (args[ix]->Id() == ipc::TYPE_HANDLE)
+      args[ix]->AsHandle().Close();
+  }
+}
+
 }  // namespace ipc.
 
 #endif  // SIMPLE_IPC_WIRE_TYPES_H_
@@ -0,0 +1,79 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_file_unix.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+MappedFile::MappedFile() : base_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Create(const char* path, size_t sz) {
+  Close();
+  if (!sz) {
+    return false;
+  }
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    return false;
+  }
+  void* base = MAP_FAILED;
+  if (0 == ftruncate(fd, sz)) {
+    base = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  // The mapping keeps the file open.
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  base_ = base;
+  size_ = sz;
+  return true;
+}
+
+bool MappedFile::Open(const char* path) {
+  Close();
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat st;
+  void* base = MAP_FAILED;
+  if ((0 == fstat(fd, &st)) && (st.st_size > 0)) {
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  base_ = base;
+  size_ = st.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (base_) {
+    munmap(base_, size_);
+  }
+  base_ = NULL;
+  size_ = 0;
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_MAPPED_FILE_UNIX_H_
+#define SIMPLE_IPC_MAPPED_FILE_UNIX_H_
+
+#include "os_includes.h"
+
+// A file mapped in memory, the backing store of a trace, see ipc_trace.h. The mapping is
+// shared, so what is written to it ends up in the file even if the process crashes.
+class MappedFile {
+public:
+  MappedFile();
+  // Unmaps the file.
+  ~MappedFile();
+
+  // Creates |path|, or truncates it, to |sz| bytes of zeros and maps it for writing.
+  bool Create(const char* path, size_t sz);
+  // Maps the whole of the existing |path| for reading.
+  bool Open(const char* path);
+  void Close();
+
+  void* base() const { return base_; }
+  size_t size() const { return size_; }
+
+private:
+  void* base_;
+  size_t size_;
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+};
+
+#endif  // SIMPLE_IPC_MAPPED_FILE_UNIX_H_
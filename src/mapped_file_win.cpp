@@ -0,0 +1,74 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_file_win.h"
+
+
+MappedFile::MappedFile() : base_(NULL), size_(0) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Create(const wchar_t* path, size_t sz) {
+  Close();
+  if (!sz)
+    return false;
+  HANDLE file = ::CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                              CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == file)
+    return false;
+  bool ok = Map(file, sz, true);
+  ::CloseHandle(file);
+  return ok;
+}
+
+bool MappedFile::Open(const wchar_t* path) {
+  Close();
+  HANDLE file = ::CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == file)
+    return false;
+  LARGE_INTEGER sz;
+  bool ok = ::GetFileSizeEx(file, &sz) && (sz.QuadPart > 0) &&
+            Map(file, static_cast<size_t>(sz.QuadPart), false);
+  ::CloseHandle(file);
+  return ok;
+}
+
+// The view keeps the file and the mapping alive, so their handles are closed right away.
+// Mapping a new file with a larger size grows it.
+bool MappedFile::Map(HANDLE file, size_t sz, bool writable) {
+  const unsigned long long sz64 = sz;
+  HANDLE mapping = ::CreateFileMappingW(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                        static_cast<DWORD>(sz64 >> 32),
+                                        static_cast<DWORD>(sz64), NULL);
+  if (NULL == mapping)
+    return false;
+  void* base = ::MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, sz);
+  ::CloseHandle(mapping);
+  if (NULL == base)
+    return false;
+  base_ = base;
+  size_ = sz;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (base_)
+    ::UnmapViewOfFile(base_);
+  base_ = NULL;
+  size_ = 0;
+}
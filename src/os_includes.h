@@ -26,12 +26,46 @@
 #else
 //////////////////////////////// Other OS /////////////////////////////////////////////////////////
 #include <stdlib.h>
+#include <string.h>
+
+// The codec packs strings faster when the machine is little-endian. Define IPC_BIG_ENDIAN
+// to use the portable character by character packing.
+#if !defined(IPC_BIG_ENDIAN) && defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define IPC_BIG_ENDIAN
+#endif
+#endif
 
 #endif  // defined(WIN32)
 
 //////////////////////////////// Every OS /////////////////////////////////////////////////////////
 //#define IPC_USE_STL
 
+// The library does not throw or catch. IPC_NO_EXCEPTIONS only removes the WireType::RecoverXxx()
+// getters and it is defined on its own when building without exceptions.
+#if !defined(IPC_NO_EXCEPTIONS)
+#if (defined(__GNUC__) && !defined(__EXCEPTIONS)) || (defined(_MSC_VER) && !defined(_CPPUNWIND))
+#define IPC_NO_EXCEPTIONS
+#endif
+#endif
+
+// With a C++11 compiler MsgIn and MsgOut are variadic templates and messages can have up to
+// Channel::kMaxNumArgs arguments instead of 10. Define IPC_NO_VARIADIC to keep the C++98 code.
+#if !defined(IPC_USE_VARIADIC) && !defined(IPC_NO_VARIADIC)
+#if (__cplusplus >= 201103L) || (defined(_MSC_VER) && (_MSC_VER >= 1800))
+#define IPC_USE_VARIADIC
+#endif
+#endif
+
+namespace ipc {
+// A contiguous run of bytes. Outgoing messages are handed to the transport as an array of
+// segments so that large payloads can be written without being copied first.
+struct IOSegment {
+  const void* buf_;
+  size_t sz_;
+};
+}  // namespace ipc.
+
 #if defined(IPC_USE_STL)
   #include <string>
   #include <vector>
@@ -40,6 +74,7 @@
   typedef std::vector<char> IPCCharVector;
   typedef std::vector<void*> IPCVoidPtrVector;
   typedef std::vector<int> IPCIntVector;
+  typedef std::vector<ipc::IOSegment> IPCSegmentVector;
 #else
   #include "ipc_utils.h"
   typedef ipc::HolderString<char> IPCString;
@@ -47,6 +82,7 @@
   typedef ipc::PodVector<char> IPCCharVector;
   typedef ipc::PodVector<void*> IPCVoidPtrVector;
   typedef ipc::PodVector<int> IPCIntVector;
+  typedef ipc::PodVector<ipc::IOSegment> IPCSegmentVector;
 #endif
 
 
@@ -15,7 +15,9 @@
 #include "pipe_unix.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define HANDLE_EINTR(x) ({ \
 typeof(x) __eintr_result__; \
@@ -39,9 +41,54 @@ bool SilenceSocket(int fd) {
   return true;
 }
 
-size_t ReadFromFD(int fd, char* buffer, size_t bytes) {
-  ssize_t bytes_read =
-  HANDLE_EINTR(read(fd, buffer, bytes));
+// Room for the SCM_RIGHTS ancillary data of one write.
+union FdControl {
+  struct cmsghdr align;
+  char buf[CMSG_SPACE(sizeof(int) * PipeUnix::kMaxFds)];
+};
+
+// Reads with recvmsg() so the descriptors that come with the bytes are kept, they are
+// appended to |fds|. A plain pipe has no ancillary data so it falls back to read().
+ssize_t ReceiveFromFD(int fd, char* buffer, size_t bytes, int flags, IPCIntVector* fds) {
+  struct iovec iov = { buffer, bytes };
+  FdControl control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+#if defined(MSG_CMSG_CLOEXEC)
+  flags |= MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t bytes_read = HANDLE_EINTR(recvmsg(fd, &msg, flags));
+  if (bytes_read < 0) {
+    if ((errno == ENOTSOCK) && !(flags & MSG_DONTWAIT)) {
+      return HANDLE_EINTR(read(fd, buffer, bytes));
+    }
+    return -1;
+  }
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)) {
+      continue;
+    }
+    const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t ix = 0; ix != count; ++ix) {
+      int rx_fd;
+      memcpy(&rx_fd, CMSG_DATA(cmsg) + ix * sizeof(int), sizeof(rx_fd));
+      fds->push_back(rx_fd);
+    }
+  }
+  if (msg.msg_flags & MSG_CTRUNC) {
+    // Some descriptors were dropped so the ones kept would not match their messages.
+    errno = EMSGSIZE;
+    return -1;
+  }
+  return bytes_read;
+}
+
+size_t ReadFromFD(int fd, char* buffer, size_t bytes, IPCIntVector* fds) {
+  ssize_t bytes_read = ReceiveFromFD(fd, buffer, bytes, 0, fds);
   if (bytes_read < 0) {
     return -1;
   }
@@ -61,6 +108,63 @@ size_t WriteToFD(int fd, const char* data, size_t size) {
   return written_total;
 }
 
+// Like writev() but it sends |fds| along with the bytes.
+ssize_t SendWithFds(int fd, struct iovec* iov, size_t n, const int* fds, size_t n_fds) {
+  FdControl control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = n;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * n_fds);
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n_fds);
+  return HANDLE_EINTR(sendmsg(fd, &msg, 0));
+}
+
+// The descriptors, if any, go with the first write. The receiver gets them along with the
+// first byte of that write.
+size_t WriteToFDV(int fd, const ipc::IOSegment* segs, size_t count,
+                  const int* fds, size_t n_fds) {
+  const size_t kMaxIov = 64;
+  size_t written_total = 0;
+  // |ix| is the first segment not fully written and |offset| how much of it was.
+  size_t ix = 0;
+  size_t offset = 0;
+  while (ix != count) {
+    struct iovec iov[kMaxIov];
+    size_t n = 0;
+    for (size_t jx = ix; (jx != count) && (n != kMaxIov); ++jx, ++n) {
+      size_t skip = (jx == ix) ? offset : 0;
+      iov[n].iov_base = const_cast<char*>(static_cast<const char*>(segs[jx].buf_) + skip);
+      iov[n].iov_len = segs[jx].sz_ - skip;
+    }
+    ssize_t written_partial;
+    if (n_fds) {
+      written_partial = SendWithFds(fd, iov, n, fds, n_fds);
+      n_fds = 0;
+    } else {
+      written_partial = HANDLE_EINTR(writev(fd, iov, n));
+    }
+    if (written_partial < 0) {
+      return -1;
+    }
+    written_total += written_partial;
+    // Allow for partial writes.
+    size_t left = written_partial;
+    while ((ix != count) && (left >= (segs[ix].sz_ - offset))) {
+      left -= segs[ix].sz_ - offset;
+      offset = 0;
+      ++ix;
+    }
+    offset += left;
+  }
+  return written_total;
+}
+
 }  // namespace
 
 
@@ -73,7 +177,19 @@ PipePair::PipePair() {
   }
 };
 
-PipeUnix::PipeUnix() : fd_(-1) {
+void PipePair::Close() {
+  for (size_t ix = 0; ix != 2; ++ix) {
+    if (fd_[ix] != -1)
+      close(fd_[ix]);
+    fd_[ix] = -1;
+  }
+}
+
+PipeUnix::PipeUnix() : fd_(-1), rx_fds_next_(0) {
+}
+
+PipeUnix::~PipeUnix() {
+  DropFds();
 }
 
 bool PipeUnix::OpenClient(int fd) {
@@ -101,8 +217,28 @@ bool PipeUnix::Write(const void* buf, size_t sz) {
   return (sz == written);
 }
 
+bool PipeUnix::WriteV(const ipc::IOSegment* segs, size_t count) {
+  return WriteV(segs, count, NULL, 0);
+}
+
+bool PipeUnix::WriteV(const ipc::IOSegment* segs, size_t count, const int* fds,
+                      size_t n_fds) {
+  if (n_fds > kMaxFds) {
+    return false;
+  }
+  size_t sz = 0;
+  for (size_t ix = 0; ix != count; ++ix) {
+    sz += segs[ix].sz_;
+  }
+  if (n_fds && !sz) {
+    return false;
+  }
+  size_t written = WriteToFDV(fd_, segs, count, fds, n_fds);
+  return (sz == written);
+}
+
 bool PipeUnix::Read(void* buf, size_t* sz) {
-  size_t read = ReadFromFD(fd_, static_cast<char*> (buf), *sz);
+  size_t read = ReadFromFD(fd_, static_cast<char*> (buf), *sz, &rx_fds_);
   if (read == -1) {
     return false;
   }
@@ -110,6 +246,41 @@ bool PipeUnix::Read(void* buf, size_t* sz) {
   return true;
 }
 
+bool PipeUnix::TryRead(void* buf, size_t* sz) {
+  ssize_t read = ReceiveFromFD(fd_, static_cast<char*> (buf), *sz, MSG_DONTWAIT, &rx_fds_);
+  if (read < 0) {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+      return false;
+    }
+    read = 0;
+  } else if (read == 0) {
+    // The other end closed.
+    return false;
+  }
+  *sz = read;
+  return true;
+}
+
+bool PipeUnix::TakeFd(int* fd) {
+  if (rx_fds_next_ == rx_fds_.size()) {
+    return false;
+  }
+  *fd = rx_fds_[rx_fds_next_++];
+  if (rx_fds_next_ == rx_fds_.size()) {
+    rx_fds_.resize(0);
+    rx_fds_next_ = 0;
+  }
+  return true;
+}
+
+void PipeUnix::DropFds() {
+  for (size_t ix = rx_fds_next_; ix != rx_fds_.size(); ++ix) {
+    close(rx_fds_[ix]);
+  }
+  rx_fds_.resize(0);
+  rx_fds_next_ = 0;
+}
+
 
 char* PipeTransport::Receive(size_t* size) {
   if (buf_.size() < kBufferSz) {
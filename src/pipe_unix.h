@@ -18,6 +18,8 @@
 
 #include "os_includes.h"
 #include "ipc_constants.h"
+#include "ipc_handles.h"
+#include "ipc_poll.h"
 
 class PipePair {
 public:
@@ -25,6 +27,11 @@ public:
   
   int fd1() const { return fd_[0]; }
   int fd2() const { return fd_[1]; }
+
+  // False if the socket pair could not be created.
+  bool IsValid() const { return fd_[0] != -1; }
+  // Closes both ends, for a pair that nobody opened.
+  void Close();
   
 private:
   int fd_[2];
@@ -33,18 +40,41 @@ private:
 
 class PipeUnix {
 public:
+  // Most file descriptors that can go with one write.
+  static const size_t kMaxFds = 16;
+
   PipeUnix();
+  // Closes the received descriptors that nobody took.
+  ~PipeUnix();
 
   bool OpenClient(int fd);
   bool OpenServer(int fd);
 
   bool Write(const void* buf, size_t sz);
+  bool WriteV(const ipc::IOSegment* segs, size_t count);
+  // Like WriteV() but |fds| go along with the bytes as SCM_RIGHTS ancillary data. The other
+  // end gets its own descriptors for them, see TakeFd().
+  bool WriteV(const ipc::IOSegment* segs, size_t count, const int* fds, size_t n_fds);
   bool Read(void* buf, size_t* sz);
+  // Reads what is available without waiting, which can be nothing. Returns false on error and
+  // when the other end has closed.
+  bool TryRead(void* buf, size_t* sz);
+
+  // Gets the oldest descriptor received so far. It arrives no later than the first byte
+  // written with it. The caller owns it. Returns false if there is none.
+  bool TakeFd(int* fd);
+
+  // Closes the descriptors received so far that have not been taken.
+  void DropFds();
 
   bool IsConnected() const { return fd_ != -1; }
+  int fd() const { return fd_; }
 
 private:
   int fd_;
+  // Received descriptors, the ones before |rx_fds_next_| have been taken.
+  IPCIntVector rx_fds_;
+  size_t rx_fds_next_;
 };
 
 
@@ -55,12 +85,59 @@ public:
   size_t Send(const void* buf, size_t sz) {
     return Write(buf, sz) ? ipc::RcOK : ipc::RcErrTransportWrite;
   }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    return WriteV(segs, count) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count, const int* fds, size_t n_fds) {
+    return WriteV(segs, count, fds, n_fds) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
   
   char* Receive(size_t* size);
 
+  size_t ReceiveInto(char* buf, size_t* size) {
+    return (Read(buf, size) && *size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+  // Like ReceiveInto() but it does not block. If there is nothing to read it returns RcOK
+  // with |*size| set to 0.
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    return TryRead(buf, size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
 private:
   IPCCharVector buf_;
 };
 
+namespace ipc {
+
+template <>
+struct PollTransport<PipeTransport> : public PollByTryReceive<PipeTransport> {};
+
+// The descriptors go out of band, so the message carries them unchanged.
+template <>
+struct HandleTransport<PipeTransport> {
+  static bool Export(PipeTransport* /*transport*/, int fd, int* value) {
+    *value = fd;
+    return true;
+  }
+
+  static size_t SendWithFds(PipeTransport* transport, const IOSegment* segs, size_t count,
+                            const int* fds, size_t n_fds) {
+    return transport->Send(segs, count, fds, n_fds);
+  }
+
+  static bool Import(PipeTransport* transport, int* fd) {
+    return transport->TakeFd(fd);
+  }
+
+  static void Discard(PipeTransport* transport) {
+    transport->DropFds();
+  }
+};
+
+}  // namespace ipc.
+
 
 #endif  // SIMPLE_IPC_PIPE_UNIX_H_
@@ -19,7 +19,22 @@
 
 namespace {
 const wchar_t kPipePrefix[] = L"\\\\.\\pipe\\";
-const int kPipeBufferSz = 4 * 1024;
+
+// GetNamedPipeClientProcessId() and GetNamedPipeServerProcessId() are not in XP so they are
+// looked up at runtime.
+typedef BOOL (WINAPI *PipeProcessIdFn)(HANDLE pipe, ULONG* process_id);
+
+HANDLE OpenPipePeerProcess(HANDLE pipe, bool server) {
+  PipeProcessIdFn fn = reinterpret_cast<PipeProcessIdFn>(::GetProcAddress(
+      ::GetModuleHandleW(L"kernel32.dll"),
+      server ? "GetNamedPipeClientProcessId" : "GetNamedPipeServerProcessId"));
+  ULONG pid = 0;
+  if (!fn || !fn(pipe, &pid)) {
+    return NULL;
+  }
+  return ::OpenProcess(PROCESS_DUP_HANDLE, FALSE, pid);
+}
+
 }  // namespace
 
 bool checkIntegritySupport() {
@@ -34,7 +49,7 @@ bool checkIntegritySupport() {
 
 LONG g_pipe_seq = 0;
 
-HANDLE PipePair::OpenPipeServer(const wchar_t* name, bool low_integrity) {
+HANDLE PipePair::OpenPipeServer(const wchar_t* name, bool low_integrity, size_t buffer_sz) {
   SECURITY_ATTRIBUTES sa = {0};
   SECURITY_ATTRIBUTES *psa = 0;
 
@@ -53,7 +68,8 @@ HANDLE PipePair::OpenPipeServer(const wchar_t* name, bool low_integrity) {
   pipename.append(name);
   return ::CreateNamedPipeW(pipename.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_FIRST_PIPE_INSTANCE,
                             PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT,
-                            1, kPipeBufferSz, kPipeBufferSz, 200, psa);
+                            1, static_cast<DWORD>(buffer_sz), static_cast<DWORD>(buffer_sz),
+                            200, psa);
 }
 
 HANDLE PipePair::OpenPipeClient(const wchar_t* name, bool inherit, bool impersonate) {
@@ -65,27 +81,32 @@ HANDLE PipePair::OpenPipeClient(const wchar_t* name, bool inherit, bool imperson
     DWORD attributes = impersonate ? 0 : SECURITY_SQOS_PRESENT | SECURITY_IDENTIFICATION;
     HANDLE pipe = ::CreateFileW(pipename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, &sa,
                                 OPEN_EXISTING, attributes, NULL);
-    if (INVALID_HANDLE_VALUE == pipe) {
-      if (ERROR_PIPE_BUSY != ::GetLastError()) {
-        return pipe;
-      }
-      // wait and retry.
-      ::Sleep(25);
-    } else {
+    if (INVALID_HANDLE_VALUE != pipe) {
       // success.
       return pipe;
     }
+    if (ERROR_PIPE_BUSY != ::GetLastError()) {
+      return pipe;
+    }
+    // The system wakes us up when an instance is free, instead of polling for it. Another
+    // client can still get there first so it retries.
+    if (!::WaitNamedPipeW(pipename.c_str(), NMPWAIT_WAIT_FOREVER)) {
+      if (ERROR_SEM_TIMEOUT != ::GetLastError()) {
+        // The server is gone.
+        return INVALID_HANDLE_VALUE;
+      }
+    }
   }
 }
 
 
-PipePair::PipePair(bool inherit_fd2) : srv_(NULL), cln_(NULL) {
+PipePair::PipePair(bool inherit_fd2, size_t buffer_sz) : srv_(NULL), cln_(NULL) {
   // Come up with a reasonable unique name.
   const wchar_t kPipePattern[] = L"ko.%x.%x.%x";
   wchar_t name[8*3 + sizeof(kPipePattern)];
   ::wsprintfW(name, kPipePattern, ::GetCurrentProcessId(), ::GetTickCount(), 
               ::InterlockedIncrement(&g_pipe_seq));
-  HANDLE server = OpenPipeServer(name);
+  HANDLE server = OpenPipeServer(name, true, buffer_sz);
   if (INVALID_HANDLE_VALUE == server) {
     return;
   }
@@ -107,8 +128,19 @@ PipePair::PipePair(bool inherit_fd2) : srv_(NULL), cln_(NULL) {
   cln_ = client;
 }
 
+void PipePair::Close() {
+  if (srv_) {
+    ::CloseHandle(srv_);
+    srv_ = NULL;
+  }
+  if (cln_) {
+    ::CloseHandle(cln_);
+    cln_ = NULL;
+  }
+}
+
 
-PipeWin::PipeWin() : pipe_(INVALID_HANDLE_VALUE) {
+PipeWin::PipeWin() : pipe_(INVALID_HANDLE_VALUE), peer_(NULL), server_(false) {
 }
 
 PipeWin::~PipeWin() {
@@ -116,15 +148,20 @@ PipeWin::~PipeWin() {
     ::DisconnectNamedPipe(pipe_);  // $$$ disconect is valid on the server side.
     ::CloseHandle(pipe_);
   }
+  if (peer_) {
+    ::CloseHandle(peer_);
+  }
 }
 
 bool PipeWin::OpenClient(HANDLE pipe) {
   pipe_ = pipe;  
+  server_ = false;
   return true;
 }
 
 bool PipeWin::OpenServer(HANDLE pipe, bool connect) {
   pipe_ = pipe;
+  server_ = true;
 
   if (connect) {
     if (!::ConnectNamedPipe(pipe, NULL)) {
@@ -141,10 +178,49 @@ bool PipeWin::Write(const void* buf, size_t sz) {
   return (TRUE == ::WriteFile(pipe_, buf, sz, &written, NULL));
 }
 
+// WriteFileGather() only works on files opened without buffering and with page sized
+// buffers so for pipes we just write the segments in sequence.
+bool PipeWin::WriteV(const ipc::IOSegment* segs, size_t count) {
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (!Write(segs[ix].buf_, segs[ix].sz_))
+      return false;
+  }
+  return true;
+}
+
 bool PipeWin::Read(void* buf, size_t* sz) {
   return (TRUE == ::ReadFile(pipe_, buf, *sz, reinterpret_cast<DWORD*>(sz), NULL));
 }
 
+bool PipeWin::TryRead(void* buf, size_t* sz) {
+  DWORD avail = 0;
+  if (!::PeekNamedPipe(pipe_, NULL, 0, NULL, &avail, NULL))
+    return false;
+  if (!avail) {
+    *sz = 0;
+    return true;
+  }
+  if (avail < *sz)
+    *sz = avail;
+  return Read(buf, sz);
+}
+
+bool PipeWin::DuplicateToPeer(HANDLE handle, HANDLE* peer_handle) {
+  if (!peer_) {
+    peer_ = OpenPipePeerProcess(pipe_, server_);
+    if (!peer_)
+      return false;
+  }
+  return (TRUE == ::DuplicateHandle(::GetCurrentProcess(), handle, peer_, peer_handle, 0,
+                                    FALSE, DUPLICATE_SAME_ACCESS));
+}
+
+void PipeWin::SetPeerProcess(HANDLE process) {
+  if (peer_)
+    ::CloseHandle(peer_);
+  peer_ = process;
+}
+
 
 char* PipeTransport::Receive(size_t* size) {
   if (buf_.size() < kBufferSz)
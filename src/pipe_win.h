@@ -17,14 +17,26 @@
 
 #include "os_includes.h"
 #include "ipc_constants.h"
+#include "ipc_handles.h"
+#include "ipc_poll.h"
 
 class PipePair {
 public:
-  PipePair(bool inherit_fd2 = false);
+  // Size of the pipe buffers in each direction. Larger buffers let a writer get ahead of the
+  // reader and let the reader get large messages with fewer reads.
+  static const size_t kPipeBufferSz = 4 * 1024;
+
+  PipePair(bool inherit_fd2 = false, size_t buffer_sz = kPipeBufferSz);
   HANDLE fd1() const { return srv_; }
   HANDLE fd2() const { return cln_; }
 
-  static HANDLE OpenPipeServer(const wchar_t* name, bool low_integrity = true);
+  // False if the pipe could not be created.
+  bool IsValid() const { return srv_ != NULL; }
+  // Closes both ends, for a pair that nobody opened.
+  void Close();
+
+  static HANDLE OpenPipeServer(const wchar_t* name, bool low_integrity = true,
+                               size_t buffer_sz = kPipeBufferSz);
   static HANDLE OpenPipeClient(const wchar_t* name, bool inherit, bool impersonate);
 
 private:
@@ -41,12 +53,26 @@ public:
   bool OpenServer(HANDLE pipe, bool connect = false);
 
   bool Write(const void* buf, size_t sz);
+  bool WriteV(const ipc::IOSegment* segs, size_t count);
   bool Read(void* buf, size_t* sz);
+  // Reads what is available without waiting, which can be nothing. Returns false on error and
+  // when the other end has closed.
+  bool TryRead(void* buf, size_t* sz);
+
+  // Duplicates |handle| into the process at the other end of the pipe. |*peer_handle| is only
+  // valid in that process, which owns it.
+  bool DuplicateToPeer(HANDLE handle, HANDLE* peer_handle);
+  // Sets the process that DuplicateToPeer() copies handles into, which needs PROCESS_DUP_HANDLE
+  // access. The pipe takes ownership of |process|. Without it the process is found from the
+  // pipe, which requires Vista or later.
+  void SetPeerProcess(HANDLE process);
 
   bool IsConnected() const { return INVALID_HANDLE_VALUE != pipe_; }
 
 private:
   HANDLE pipe_;
+  HANDLE peer_;
+  bool server_;
 };
 
 
@@ -58,10 +84,52 @@ public:
     return Write(buf, sz) ? ipc::RcOK : ipc::RcErrTransportWrite;
   }
 
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    return WriteV(segs, count) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
   char* Receive(size_t* size);
 
+  size_t ReceiveInto(char* buf, size_t* size) {
+    return (Read(buf, size) && *size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+  // Like ReceiveInto() but it does not block. If there is nothing to read it returns RcOK
+  // with |*size| set to 0.
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    return TryRead(buf, size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
 private:
   IPCCharVector buf_;
 };
 
+namespace ipc {
+
+template <>
+struct PollTransport<PipeTransport> : public PollByTryReceive<PipeTransport> {};
+
+// The message carries a duplicate of the handle made for the peer, so there is nothing to
+// send out of band and nothing to do on arrival.
+template <>
+struct HandleTransport<PipeTransport> {
+  static bool Export(PipeTransport* transport, HANDLE handle, HANDLE* value) {
+    return transport->DuplicateToPeer(handle, value);
+  }
+
+  static size_t SendWithFds(PipeTransport* /*transport*/, const IOSegment* /*segs*/,
+                            size_t /*count*/, const int* /*fds*/, size_t /*n_fds*/) {
+    return RcErrTransportWrite;
+  }
+
+  static bool Import(PipeTransport* /*transport*/, HANDLE* /*handle*/) {
+    return true;
+  }
+
+  // The duplicates were in the message bytes, which are gone.
+  static void Discard(PipeTransport* /*transport*/) {}
+};
+
+}  // namespace ipc.
+
 #endif  // SIMPLE_IPC_PIPE_WIN_H_
@@ -0,0 +1,164 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "reactor_unix.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include "ipc_sync.h"
+
+namespace ipc {
+
+Reactor::Reactor() : poll_fd_(-1), stop_(0), clients_(0), n_threads_(0) {
+  wake_[0] = -1;
+  wake_[1] = -1;
+}
+
+Reactor::~Reactor() {
+  Stop();
+}
+
+bool Reactor::Start(size_t n_threads) {
+  if (n_threads_ || !n_threads || (n_threads > kMaxThreads))
+    return false;
+  if (0 != pipe(wake_))
+    return false;
+#if defined(__linux__)
+  poll_fd_ = epoll_create(16);
+  if (poll_fd_ < 0)
+    return false;
+  // The wake up pipe is level triggered and never read, so once written it wakes all threads.
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (0 != epoll_ctl(poll_fd_, EPOLL_CTL_ADD, wake_[0], &ev))
+    return false;
+#else
+  poll_fd_ = kqueue();
+  if (poll_fd_ < 0)
+    return false;
+  struct kevent ev;
+  EV_SET(&ev, wake_[0], EVFILT_READ, EV_ADD, 0, 0, NULL);
+  if (0 != kevent(poll_fd_, &ev, 1, NULL, 0, NULL))
+    return false;
+#endif
+  stop_ = 0;
+  for (; n_threads_ != n_threads; ++n_threads_) {
+    if (0 != pthread_create(&threads_[n_threads_], NULL, &Reactor::ThreadMain, this)) {
+      Stop();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Reactor::Add(ReactorClient* client) {
+  if (!Watch(client, true))
+    return false;
+  AtomicAdd(&clients_, 1);
+  return true;
+}
+
+void Reactor::Stop() {
+  if (wake_[1] != -1) {
+    AtomicStore(&stop_, 1);
+    char c = 0;
+    while ((write(wake_[1], &c, 1) < 0) && (errno == EINTR)) {}
+  }
+  for (size_t ix = 0; ix != n_threads_; ++ix) {
+    pthread_join(threads_[ix], NULL);
+  }
+  n_threads_ = 0;
+  if (poll_fd_ != -1)
+    close(poll_fd_);
+  if (wake_[0] != -1)
+    close(wake_[0]);
+  if (wake_[1] != -1)
+    close(wake_[1]);
+  poll_fd_ = wake_[0] = wake_[1] = -1;
+}
+
+void* Reactor::ThreadMain(void* ctx) {
+  static_cast<Reactor*>(ctx)->Loop();
+  return NULL;
+}
+
+void Reactor::Loop() {
+  while (!AtomicLoad(&stop_)) {
+    ReactorClient* client = NULL;
+#if defined(__linux__)
+    epoll_event ev;
+    int n = epoll_wait(poll_fd_, &ev, 1, -1);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    client = static_cast<ReactorClient*>(ev.data.ptr);
+#else
+    struct kevent ev;
+    int n = kevent(poll_fd_, NULL, 0, &ev, 1, NULL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    client = static_cast<ReactorClient*>(ev.udata);
+#endif
+    if (!n || !client)
+      continue;
+    // The client is disarmed until Watch() is called again so no other thread can get it.
+    // One that cannot be armed again would never be heard of, so it goes away too.
+    if (!client->OnReadable() || !Watch(client, false))
+      Remove(client);
+  }
+}
+
+// Arms |client| for one notification.
+bool Reactor::Watch(ReactorClient* client, bool add) {
+#if defined(__linux__)
+  epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = client;
+  return (0 == epoll_ctl(poll_fd_, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, client->fd(), &ev));
+#else
+  struct kevent ev;
+  EV_SET(&ev, client->fd(), EVFILT_READ, (add ? EV_ADD : EV_ENABLE) | EV_DISPATCH, 0, 0, client);
+  return (0 == kevent(poll_fd_, &ev, 1, NULL, 0, NULL));
+#endif
+}
+
+void Reactor::Remove(ReactorClient* client) {
+#if defined(__linux__)
+  epoll_event ev = {};
+  epoll_ctl(poll_fd_, EPOLL_CTL_DEL, client->fd(), &ev);
+#else
+  struct kevent ev;
+  EV_SET(&ev, client->fd(), EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  kevent(poll_fd_, &ev, 1, NULL, 0, NULL);
+#endif
+  AtomicAdd(&clients_, -1);
+  client->OnDetach();
+}
+
+}  // namespace ipc.
@@ -0,0 +1,154 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_REACTOR_UNIX_H_
+#define SIMPLE_IPC_REACTOR_UNIX_H_
+
+#include <pthread.h>
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+#include "ipc_sync.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// A Reactor serves many connections with a few threads. Instead of a thread blocked in
+// Channel::Receive() for each pipe, the reactor waits on all the pipes at once (epoll on Linux,
+// kqueue elsewhere) and a fixed number of threads take turns handling the ones that are ready.
+// A connection is handled by one thread at a time, so the messages of each channel are still
+// dispatched in order and the channel decoder is never shared. For example:
+//
+//  ipc::Reactor reactor;
+//  reactor.Start(4);
+//  ...
+//  // For each new worker:
+//  PipeTransport* transport = new PipeTransport;
+//  transport->OpenServer(fd);
+//  ServerChannel* channel = new ServerChannel(transport);
+//  reactor.Add(new ipc::ReactorChannel<ServerChannel, Dispatcher>(channel, &dispatcher));
+//
+// With a reactor, DispatchT::OnNewTransport() can Add() the new connection instead of starting
+// a thread for it.
+
+namespace ipc {
+
+// An object that the reactor waits on.
+class ReactorClient {
+public:
+  virtual ~ReactorClient() {}
+
+  virtual int fd() const = 0;
+
+  // Called on one of the reactor threads when fd() is readable, has been closed or has an
+  // error. It is never called on two threads at once for the same client. Returning false
+  // removes the client from the reactor, as does a failure to watch fd() again after it.
+  virtual bool OnReadable() = 0;
+
+  // Called once when the client is removed, after the last OnReadable(). For example to
+  // delete it.
+  virtual void OnDetach() {}
+};
+
+
+class Reactor {
+public:
+  static const size_t kMaxThreads = 64;
+
+  Reactor();
+  ~Reactor();
+
+  // Starts |n_threads| threads, at most kMaxThreads, that wait on the clients.
+  bool Start(size_t n_threads);
+
+  // Starts watching |client|. Can be called from any thread, including from OnReadable().
+  bool Add(ReactorClient* client);
+
+  // Stops and joins the threads. Clients that are still added are not detached and belong
+  // to the caller again.
+  void Stop();
+
+  // Number of clients added and not removed yet.
+  size_t Clients() const { return AtomicLoad(&clients_); }
+
+private:
+  static void* ThreadMain(void* ctx);
+  void Loop();
+  bool Watch(ReactorClient* client, bool add);
+  void Remove(ReactorClient* client);
+
+  int poll_fd_;
+  int wake_[2];
+  volatile long stop_;
+  volatile long clients_;
+  pthread_t threads_[kMaxThreads];
+  size_t n_threads_;
+
+  Reactor(const Reactor&);
+  Reactor& operator=(const Reactor&);
+};
+
+
+// Connects a Channel to a Reactor. Each time the channel transport is readable it reads what
+// is there, without blocking, and dispatches the complete messages to |dispatch|. The
+// transport needs to implement fd() and TryReceiveInto(), like PipeTransport.
+//
+// A dispatcher return value other than OnMsgLoopNext, or a transport error, ends the
+// connection. result() then has the value that ended it.
+template <class ChannelT, class DispatchT>
+class ReactorChannel : public ReactorClient {
+public:
+  // Reads done per wake up before giving the thread to the other clients.
+  static const size_t kMaxReadsPerWake = 16;
+
+  ReactorChannel(ChannelT* channel, DispatchT* dispatch)
+      : channel_(channel), dispatch_(dispatch), result_(RcOK) {}
+
+  virtual int fd() const {
+    return channel_->transport()->fd();
+  }
+
+  virtual bool OnReadable() {
+    for (size_t ix = 0; ix != kMaxReadsPerWake; ++ix) {
+      size_t received = 0;
+      char* buf = channel_->GetReceiveBuffer(&received);
+      if (RcOK != channel_->transport()->TryReceiveInto(buf, &received)) {
+        AtomicStore(&result_, static_cast<long>(RcErrTransportRead));
+        return false;
+      }
+      size_t rc = channel_->OnReceived(dispatch_, received);
+      if (rc != ipc::OnMsgLoopNext) {
+        AtomicStore(&result_, static_cast<long>(rc));
+        return false;
+      }
+      if (!received) {
+        // Only trims if no message is half received.
+        channel_->TrimReceive();
+        return true;
+      }
+    }
+    return true;
+  }
+
+  ChannelT* channel() const { return channel_; }
+  size_t result() const { return static_cast<size_t>(AtomicLoad(&result_)); }
+
+private:
+  ChannelT* channel_;
+  DispatchT* dispatch_;
+  // Set by the reactor thread, read by any other.
+  volatile long result_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_REACTOR_UNIX_H_
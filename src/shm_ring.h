@@ -0,0 +1,201 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SHM_RING_H_
+#define SIMPLE_IPC_SHM_RING_H_
+
+#include "os_includes.h"
+#include "ipc_sync.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Single producer, single consumer byte ring that lives in shared memory. The shared memory
+// transports use two of them, one per direction. The ring itself never blocks; it just tells
+// the caller when the other side has to be woken up or when the caller can go to sleep. The
+// actual sleeping is done by the OS specific transport, see shm_unix.h and shm_win.h.
+//
+// The memory layout is a ShmRingHeader followed by the ring bytes. |head_| is only written by
+// the producer and |tail_| only by the consumer and both only grow, so the used space is always
+// head_ - tail_ and the position in the ring is the counter modulo the ring size.
+//
+// The peer can write the shared header at any time, so each end keeps the ring size and its
+// own counter in the ShmRing object and only reads the peer's counter from shared memory. A
+// peer counter that puts the used space outside of 0 to the ring size breaks the ring: Put()
+// and Get() return 0 from then on and Broken() returns true.
+
+namespace ipc {
+
+struct ShmRingHeader {
+  enum { kCacheLineSz = 64 };
+
+  volatile size_t head_;
+  char pad0_[kCacheLineSz - sizeof(size_t)];
+  volatile size_t tail_;
+  char pad1_[kCacheLineSz - sizeof(size_t)];
+  // Set by the consumer when it goes to sleep waiting for data.
+  volatile long rx_waiting_;
+  // Set by the producer when it goes to sleep waiting for space.
+  volatile long tx_waiting_;
+  // Size in bytes of the ring, a power of two.
+  size_t sz_;
+  char pad2_[kCacheLineSz - (2 * sizeof(long)) - sizeof(size_t)];
+};
+
+class ShmRing {
+public:
+  ShmRing() : hdr_(NULL), data_(NULL), sz_(0), head_(0), tail_(0), broken_(false) {}
+
+  // Shared memory size required by a ring of |sz| bytes. Use RoundSize() first.
+  static size_t BytesNeeded(size_t sz) {
+    return sizeof(ShmRingHeader) + sz;
+  }
+
+  // Rounds |sz| up to the next power of two.
+  static size_t RoundSize(size_t sz) {
+    size_t rs = 64;
+    while (rs < sz) {
+      rs <<= 1;
+    }
+    return rs;
+  }
+
+  // Formats |mem| as an empty ring of |sz| bytes. Done once by the side that creates the
+  // shared memory, before the two ends attach.
+  static void Init(void* mem, size_t sz) {
+    memset(mem, 0, sizeof(ShmRingHeader));
+    static_cast<ShmRingHeader*>(mem)->sz_ = sz;
+  }
+
+  // Uses the ring at |mem| which was formatted with Init(). Returns false if the header
+  // does not make sense for |avail| bytes of memory.
+  bool Attach(void* mem, size_t avail) {
+    ShmRingHeader* hdr = static_cast<ShmRingHeader*>(mem);
+    const size_t sz = hdr->sz_;
+    if (!sz || (sz & (sz - 1)) || (BytesNeeded(sz) > avail))
+      return false;
+    const size_t head = hdr->head_;
+    const size_t tail = hdr->tail_;
+    if ((head - tail) > sz)
+      return false;
+    hdr_ = hdr;
+    data_ = reinterpret_cast<char*>(hdr + 1);
+    sz_ = sz;
+    head_ = head;
+    tail_ = tail;
+    broken_ = false;
+    return true;
+  }
+
+  // Total memory used by the attached ring.
+  size_t Footprint() const { return BytesNeeded(sz_); }
+
+  // True once the peer wrote a counter that does not make sense.
+  bool Broken() const { return broken_; }
+
+  // Producer side. Copies as much of |buf| as it fits and returns how many bytes that was.
+  size_t Put(const char* buf, size_t sz) {
+    const size_t tail = hdr_->tail_;
+    MemoryFence();
+    const size_t used = head_ - tail;
+    if (broken_ || (used > sz_))
+      return Break();
+    size_t n = sz_ - used;
+    if (n > sz)
+      n = sz;
+    if (!n)
+      return 0;
+    const size_t pos = head_ & (sz_ - 1);
+    const size_t first = (n < (sz_ - pos)) ? n : (sz_ - pos);
+    memcpy(&data_[pos], buf, first);
+    memcpy(data_, buf + first, n - first);
+    MemoryFence();
+    head_ += n;
+    hdr_->head_ = head_;
+    return n;
+  }
+
+  // Consumer side. Copies up to |sz| bytes to |buf| and returns how many bytes that was.
+  size_t Get(char* buf, size_t sz) {
+    const size_t head = hdr_->head_;
+    MemoryFence();
+    size_t n = head - tail_;
+    if (broken_ || (n > sz_))
+      return Break();
+    if (n > sz)
+      n = sz;
+    if (!n)
+      return 0;
+    const size_t pos = tail_ & (sz_ - 1);
+    const size_t first = (n < (sz_ - pos)) ? n : (sz_ - pos);
+    memcpy(buf, &data_[pos], first);
+    memcpy(buf + first, data_, n - first);
+    MemoryFence();
+    tail_ += n;
+    hdr_->tail_ = tail_;
+    return n;
+  }
+
+  // The consumer calls this before sleeping. Returns false if data arrived in the meantime
+  // so it should not sleep. The producer sees the flag in WakeConsumer().
+  bool PrepareWaitData() {
+    hdr_->rx_waiting_ = 1;
+    MemoryFence();
+    if (broken_ || (hdr_->head_ != tail_)) {
+      hdr_->rx_waiting_ = 0;
+      return false;
+    }
+    return true;
+  }
+
+  // The producer calls this before sleeping. Returns false if space was freed in the meantime.
+  bool PrepareWaitSpace() {
+    hdr_->tx_waiting_ = 1;
+    MemoryFence();
+    if (broken_ || ((head_ - hdr_->tail_) != sz_)) {
+      hdr_->tx_waiting_ = 0;
+      return false;
+    }
+    return true;
+  }
+
+  // Called by the producer after Put(). Returns true if the consumer is sleeping and has to
+  // be woken up. Only one caller gets true for each sleep.
+  bool WakeConsumer() {
+    MemoryFence();
+    return hdr_->rx_waiting_ && (1 == AtomicCompareExchange(&hdr_->rx_waiting_, 0, 1));
+  }
+
+  // Called by the consumer after Get(). Returns true if the producer has to be woken up.
+  bool WakeProducer() {
+    MemoryFence();
+    return hdr_->tx_waiting_ && (1 == AtomicCompareExchange(&hdr_->tx_waiting_, 0, 1));
+  }
+
+private:
+  size_t Break() {
+    broken_ = true;
+    return 0;
+  }
+
+  ShmRingHeader* hdr_;
+  char* data_;
+  // Ring size and our own counter, the copies in |hdr_| are not trusted.
+  size_t sz_;
+  size_t head_;
+  size_t tail_;
+  bool broken_;
+};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SHM_RING_H_
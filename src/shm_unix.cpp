@@ -0,0 +1,226 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shm_unix.h"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define HANDLE_EINTR(x) ({ \
+typeof(x) __eintr_result__; \
+do { \
+__eintr_result__ = x; \
+} while (__eintr_result__ == -1 && errno == EINTR); \
+__eintr_result__;\
+})
+
+
+namespace {
+
+long g_shm_seq = 0;
+
+bool SilenceSocket(int fd) {
+  int nosigpipe = 1;
+  // See pipe_unix.cpp.
+  if (0 != setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE,
+                      &nosigpipe, sizeof nosigpipe)) {
+    return false;
+  }
+  return true;
+}
+
+// Returns an unlinked shared memory object of |sz| bytes or -1.
+int CreateShm(size_t sz) {
+  char name[64];
+  snprintf(name, sizeof(name), "/sipc.%d.%ld", static_cast<int>(getpid()),
+           __sync_add_and_fetch(&g_shm_seq, 1));
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd == -1) {
+    return -1;
+  }
+  shm_unlink(name);
+  if (0 != ftruncate(fd, sz)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Blocks until the other side sends a wake up byte over |fd|. Several pending wake ups are
+// consumed at once; a spurious wake up is harmless because the callers check the ring again.
+bool WaitFD(int fd) {
+  char bytes[16];
+  ssize_t rv = HANDLE_EINTR(read(fd, bytes, sizeof(bytes)));
+  return (rv > 0);
+}
+
+bool WakeFD(int fd) {
+  const char byte = 0;
+  return (1 == HANDLE_EINTR(write(fd, &byte, 1)));
+}
+
+}  // namespace
+
+
+ShmPair::ShmPair(size_t ring_sz) : shm_fd_(-1) {
+  fd_[0][0] = fd_[0][1] = -1;
+  fd_[1][0] = fd_[1][1] = -1;
+
+  ring_sz = ipc::ShmRing::RoundSize(ring_sz);
+  const size_t one = ipc::ShmRing::BytesNeeded(ring_sz);
+  int shm = CreateShm(one * 2);
+  if (shm == -1) {
+    return;
+  }
+  void* base = mmap(NULL, one * 2, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+  if (base == MAP_FAILED) {
+    close(shm);
+    return;
+  }
+  ipc::ShmRing::Init(base, ring_sz);
+  ipc::ShmRing::Init(static_cast<char*>(base) + one, ring_sz);
+  munmap(base, one * 2);
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd_[0]) != 0) {
+    close(shm);
+    return;
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd_[1]) != 0) {
+    close(shm);
+    close(fd_[0][0]);
+    close(fd_[0][1]);
+    fd_[0][0] = fd_[0][1] = -1;
+    fd_[1][0] = fd_[1][1] = -1;
+    return;
+  }
+  shm_fd_ = shm;
+}
+
+ShmUnix::ShmUnix() : base_(NULL), map_sz_(0), tx_fd_(-1), rx_fd_(-1) {
+}
+
+ShmUnix::~ShmUnix() {
+  if (base_) {
+    munmap(base_, map_sz_);
+  }
+}
+
+bool ShmUnix::OpenClient(int shm_fd, int tx_fd, int rx_fd) {
+  return Open(shm_fd, tx_fd, rx_fd, false);
+}
+
+bool ShmUnix::OpenServer(int shm_fd, int tx_fd, int rx_fd) {
+  return Open(shm_fd, tx_fd, rx_fd, true);
+}
+
+// The server sends on the first ring and receives on the second one.
+bool ShmUnix::Open(int shm_fd, int tx_fd, int rx_fd, bool server) {
+  struct stat st;
+  if (0 != fstat(shm_fd, &st)) {
+    return false;
+  }
+  const size_t sz = st.st_size;
+  void* base = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+  if (base == MAP_FAILED) {
+    return false;
+  }
+  ipc::ShmRing first;
+  ipc::ShmRing second;
+  if (!first.Attach(base, sz) ||
+      !second.Attach(static_cast<char*>(base) + first.Footprint(), sz - first.Footprint()) ||
+      !SilenceSocket(tx_fd) || !SilenceSocket(rx_fd)) {
+    munmap(base, sz);
+    return false;
+  }
+  tx_ = server ? first : second;
+  rx_ = server ? second : first;
+  base_ = base;
+  map_sz_ = sz;
+  tx_fd_ = tx_fd;
+  rx_fd_ = rx_fd;
+  return true;
+}
+
+bool ShmUnix::Push(const char* buf, size_t sz) {
+  while (sz) {
+    size_t n = tx_.Put(buf, sz);
+    if (n) {
+      buf += n;
+      sz -= n;
+      if (tx_.WakeConsumer() && !WakeFD(tx_fd_)) {
+        return false;
+      }
+    } else if (tx_.Broken()) {
+      return false;
+    } else if (tx_.PrepareWaitSpace() && !WaitFD(tx_fd_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShmUnix::Write(const void* buf, size_t sz) {
+  return Push(static_cast<const char*>(buf), sz);
+}
+
+bool ShmUnix::WriteV(const ipc::IOSegment* segs, size_t count) {
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (!Push(static_cast<const char*>(segs[ix].buf_), segs[ix].sz_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShmUnix::Read(void* buf, size_t* sz) {
+  for (;;) {
+    size_t n = rx_.Get(static_cast<char*>(buf), *sz);
+    if (n) {
+      *sz = n;
+      return (!rx_.WakeProducer() || WakeFD(rx_fd_));
+    }
+    if (rx_.Broken()) {
+      return false;
+    }
+    if (rx_.PrepareWaitData() && !WaitFD(rx_fd_)) {
+      return false;
+    }
+  }
+}
+
+bool ShmUnix::TryRead(void* buf, size_t* sz) {
+  *sz = rx_.Get(static_cast<char*>(buf), *sz);
+  if (!*sz) {
+    return !rx_.Broken();
+  }
+  return (!rx_.WakeProducer() || WakeFD(rx_fd_));
+}
+
+
+char* ShmTransport::Receive(size_t* size) {
+  if (buf_.size() < kBufferSz) {
+    buf_.resize(kBufferSz);
+  }
+
+  *size = kBufferSz;
+  if (!Read(&buf_[0], size)) {
+    return NULL;
+  }
+  return &buf_[0];
+}
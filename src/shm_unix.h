@@ -0,0 +1,115 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SHM_UNIX_H_
+#define SIMPLE_IPC_SHM_UNIX_H_
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+#include "ipc_poll.h"
+#include "shm_ring.h"
+
+// Creates the shared memory for two rings plus a socket pair per ring. Each end of the
+// transport needs shm_fd() and its two sockets, which can be given to another process by
+// fork() or exec() inheritance. The sockets only carry wake up bytes when one side sleeps on
+// an empty or full ring, the messages do not go through them. Having one socket per ring
+// means that a thread blocked in Read() and a thread blocked in Write() never steal each
+// other's wake ups.
+class ShmPair {
+public:
+  static const size_t kRingSz = 64 * 1024;
+
+  explicit ShmPair(size_t ring_sz = kRingSz);
+
+  int shm_fd() const { return shm_fd_; }
+  // The server end.
+  int tx1() const { return fd_[0][0]; }
+  int rx1() const { return fd_[1][0]; }
+  // The client end.
+  int tx2() const { return fd_[1][1]; }
+  int rx2() const { return fd_[0][1]; }
+
+private:
+  int shm_fd_;
+  int fd_[2][2];
+};
+
+
+class ShmUnix {
+public:
+  ShmUnix();
+  ~ShmUnix();
+
+  // The server uses ShmPair::tx1() and rx1(), the client ShmPair::tx2() and rx2().
+  bool OpenClient(int shm_fd, int tx_fd, int rx_fd);
+  bool OpenServer(int shm_fd, int tx_fd, int rx_fd);
+
+  bool Write(const void* buf, size_t sz);
+  bool WriteV(const ipc::IOSegment* segs, size_t count);
+  bool Read(void* buf, size_t* sz);
+  // Copies what is in the ring without waiting, which can be nothing.
+  bool TryRead(void* buf, size_t* sz);
+
+  bool IsConnected() const { return tx_fd_ != -1; }
+
+private:
+  bool Open(int shm_fd, int tx_fd, int rx_fd, bool server);
+  bool Push(const char* buf, size_t sz);
+
+  ipc::ShmRing tx_;
+  ipc::ShmRing rx_;
+  void* base_;
+  size_t map_sz_;
+  int tx_fd_;
+  int rx_fd_;
+};
+
+
+class ShmTransport : public ShmUnix {
+public:
+  static const size_t kBufferSz = 4096;
+
+  size_t Send(const void* buf, size_t sz) {
+    return Write(buf, sz) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    return WriteV(segs, count) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
+  char* Receive(size_t* size);
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    return (Read(buf, size) && *size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+  // Like ReceiveInto() but it does not block. If there is nothing to read it returns RcOK
+  // with |*size| set to 0.
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    return TryRead(buf, size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+private:
+  IPCCharVector buf_;
+};
+
+namespace ipc {
+
+template <>
+struct PollTransport<ShmTransport> : public PollByTryReceive<ShmTransport> {};
+
+}  // namespace ipc.
+
+
+#endif  // SIMPLE_IPC_SHM_UNIX_H_
@@ -0,0 +1,208 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shm_win.h"
+
+// The events for ring N are at 2N (data) and 2N + 1 (space). The server sends on ring 0.
+
+ShmPair::ShmPair(bool inheritable, size_t ring_sz) : mapping_(NULL) {
+  for (size_t ix = 0; ix != kEventCount; ++ix) {
+    events_[ix] = NULL;
+  }
+
+  SECURITY_ATTRIBUTES sa = {sizeof(sa), NULL, inheritable ? TRUE : FALSE};
+  ring_sz = ipc::ShmRing::RoundSize(ring_sz);
+  const size_t one = ipc::ShmRing::BytesNeeded(ring_sz);
+  HANDLE mapping = ::CreateFileMappingW(INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE,
+                                        0, static_cast<DWORD>(one * 2), NULL);
+  if (NULL == mapping)
+    return;
+
+  void* base = ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (NULL == base) {
+    ::CloseHandle(mapping);
+    return;
+  }
+  ipc::ShmRing::Init(base, ring_sz);
+  ipc::ShmRing::Init(static_cast<char*>(base) + one, ring_sz);
+  ::UnmapViewOfFile(base);
+
+  for (size_t ix = 0; ix != kEventCount; ++ix) {
+    events_[ix] = ::CreateEventW(&sa, FALSE, FALSE, NULL);
+    if (NULL == events_[ix]) {
+      for (size_t jx = 0; jx != ix; ++jx) {
+        ::CloseHandle(events_[jx]);
+        events_[jx] = NULL;
+      }
+      ::CloseHandle(mapping);
+      return;
+    }
+  }
+  mapping_ = mapping;
+}
+
+// Each ShmWin keeps its own view and duplicates of the handles, so the pair can go away once
+// both ends are open.
+ShmPair::~ShmPair() {
+  if (NULL == mapping_)
+    return;
+  ::CloseHandle(mapping_);
+  for (size_t ix = 0; ix != kEventCount; ++ix) {
+    ::CloseHandle(events_[ix]);
+  }
+}
+
+
+namespace {
+
+HANDLE DupHandle(HANDLE h) {
+  HANDLE dup = NULL;
+  HANDLE process = ::GetCurrentProcess();
+  if (!::DuplicateHandle(process, h, process, &dup, 0, FALSE, DUPLICATE_SAME_ACCESS))
+    return NULL;
+  return dup;
+}
+
+}  // namespace
+
+
+ShmWin::ShmWin()
+    : base_(NULL), tx_data_(NULL), tx_space_(NULL), rx_data_(NULL), rx_space_(NULL) {
+}
+
+ShmWin::~ShmWin() {
+  if (NULL == base_)
+    return;
+  ::UnmapViewOfFile(base_);
+  ::CloseHandle(tx_data_);
+  ::CloseHandle(tx_space_);
+  ::CloseHandle(rx_data_);
+  ::CloseHandle(rx_space_);
+}
+
+bool ShmWin::OpenClient(HANDLE mapping, const HANDLE* events) {
+  return Open(mapping, events, false);
+}
+
+bool ShmWin::OpenServer(HANDLE mapping, const HANDLE* events) {
+  return Open(mapping, events, true);
+}
+
+bool ShmWin::Open(HANDLE mapping, const HANDLE* events, bool server) {
+  void* base = ::MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (NULL == base)
+    return false;
+
+  MEMORY_BASIC_INFORMATION mbi = {0};
+  ::VirtualQuery(base, &mbi, sizeof(mbi));
+  const size_t sz = mbi.RegionSize;
+
+  ipc::ShmRing first;
+  ipc::ShmRing second;
+  if (!first.Attach(base, sz) ||
+      !second.Attach(static_cast<char*>(base) + first.Footprint(), sz - first.Footprint())) {
+    ::UnmapViewOfFile(base);
+    return false;
+  }
+
+  const size_t tx = server ? 0 : 2;
+  const size_t rx = server ? 2 : 0;
+  HANDLE dups[ShmPair::kEventCount] = {
+    DupHandle(events[tx]), DupHandle(events[tx + 1]),
+    DupHandle(events[rx]), DupHandle(events[rx + 1])
+  };
+  for (size_t ix = 0; ix != ShmPair::kEventCount; ++ix) {
+    if (NULL == dups[ix]) {
+      for (size_t jx = 0; jx != ShmPair::kEventCount; ++jx) {
+        if (dups[jx])
+          ::CloseHandle(dups[jx]);
+      }
+      ::UnmapViewOfFile(base);
+      return false;
+    }
+  }
+
+  tx_ = server ? first : second;
+  rx_ = server ? second : first;
+  tx_data_ = dups[0];
+  tx_space_ = dups[1];
+  rx_data_ = dups[2];
+  rx_space_ = dups[3];
+  base_ = base;
+  return true;
+}
+
+bool ShmWin::Push(const char* buf, size_t sz) {
+  while (sz) {
+    size_t n = tx_.Put(buf, sz);
+    if (n) {
+      buf += n;
+      sz -= n;
+      if (tx_.WakeConsumer() && !::SetEvent(tx_data_))
+        return false;
+    } else if (tx_.Broken()) {
+      return false;
+    } else if (tx_.PrepareWaitSpace()) {
+      if (WAIT_OBJECT_0 != ::WaitForSingleObject(tx_space_, INFINITE))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ShmWin::Write(const void* buf, size_t sz) {
+  return Push(static_cast<const char*>(buf), sz);
+}
+
+bool ShmWin::WriteV(const ipc::IOSegment* segs, size_t count) {
+  for (size_t ix = 0; ix != count; ++ix) {
+    if (!Push(static_cast<const char*>(segs[ix].buf_), segs[ix].sz_))
+      return false;
+  }
+  return true;
+}
+
+bool ShmWin::Read(void* buf, size_t* sz) {
+  for (;;) {
+    size_t n = rx_.Get(static_cast<char*>(buf), *sz);
+    if (n) {
+      *sz = n;
+      return (!rx_.WakeProducer() || (TRUE == ::SetEvent(rx_space_)));
+    }
+    if (rx_.Broken())
+      return false;
+    if (rx_.PrepareWaitData()) {
+      if (WAIT_OBJECT_0 != ::WaitForSingleObject(rx_data_, INFINITE))
+        return false;
+    }
+  }
+}
+
+bool ShmWin::TryRead(void* buf, size_t* sz) {
+  *sz = rx_.Get(static_cast<char*>(buf), *sz);
+  if (!*sz)
+    return !rx_.Broken();
+  return (!rx_.WakeProducer() || (TRUE == ::SetEvent(rx_space_)));
+}
+
+
+char* ShmTransport::Receive(size_t* size) {
+  if (buf_.size() < kBufferSz)
+    buf_.resize(kBufferSz);
+
+  *size = kBufferSz;
+  if (!Read(&buf_[0], size))
+    return NULL;
+  return &buf_[0];
+}
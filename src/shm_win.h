@@ -0,0 +1,112 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMPLE_IPC_SHM_WIN_H_
+#define SIMPLE_IPC_SHM_WIN_H_
+
+#include "os_includes.h"
+#include "ipc_constants.h"
+#include "ipc_poll.h"
+#include "shm_ring.h"
+
+// Creates a pagefile backed section for two rings plus two auto-reset events per ring, one
+// signaled when data arrives and one when space is freed. Both ends of the transport use the
+// same handles, which can be given to another process by inheritance or DuplicateHandle().
+// The events are only signaled when one side sleeps on an empty or full ring.
+class ShmPair {
+public:
+  static const size_t kRingSz = 64 * 1024;
+  static const size_t kEventCount = 4;
+
+  explicit ShmPair(bool inheritable = false, size_t ring_sz = kRingSz);
+  ~ShmPair();
+
+  HANDLE mapping() const { return mapping_; }
+  const HANDLE* events() const { return events_; }
+
+private:
+  HANDLE mapping_;
+  HANDLE events_[kEventCount];
+};
+
+
+class ShmWin {
+public:
+  ShmWin();
+  ~ShmWin();
+
+  // |events| points to the ShmPair::kEventCount events created along with |mapping|.
+  bool OpenClient(HANDLE mapping, const HANDLE* events);
+  bool OpenServer(HANDLE mapping, const HANDLE* events);
+
+  bool Write(const void* buf, size_t sz);
+  bool WriteV(const ipc::IOSegment* segs, size_t count);
+  bool Read(void* buf, size_t* sz);
+  // Copies what is in the ring without waiting, which can be nothing.
+  bool TryRead(void* buf, size_t* sz);
+
+  bool IsConnected() const { return NULL != base_; }
+
+private:
+  bool Open(HANDLE mapping, const HANDLE* events, bool server);
+  bool Push(const char* buf, size_t sz);
+
+  ipc::ShmRing tx_;
+  ipc::ShmRing rx_;
+  void* base_;
+  // Signaled by us when there is data in |tx_| and we wait on it for space.
+  HANDLE tx_data_;
+  HANDLE tx_space_;
+  // Waited by us for data in |rx_| and signaled when we free space.
+  HANDLE rx_data_;
+  HANDLE rx_space_;
+};
+
+
+class ShmTransport : public ShmWin {
+public:
+  static const size_t kBufferSz = 4096;
+
+  size_t Send(const void* buf, size_t sz) {
+    return Write(buf, sz) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    return WriteV(segs, count) ? ipc::RcOK : ipc::RcErrTransportWrite;
+  }
+
+  char* Receive(size_t* size);
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    return (Read(buf, size) && *size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+  // Like ReceiveInto() but it does not block. If there is nothing to read it returns RcOK
+  // with |*size| set to 0.
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    return TryRead(buf, size) ? ipc::RcOK : ipc::RcErrTransportRead;
+  }
+
+private:
+  IPCCharVector buf_;
+};
+
+namespace ipc {
+
+template <>
+struct PollTransport<ShmTransport> : public PollByTryReceive<ShmTransport> {};
+
+}  // namespace ipc.
+
+#endif  // SIMPLE_IPC_SHM_WIN_H_
@@ -0,0 +1,223 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_codec_compact.h"
+
+typedef ipc::Channel<TestTransport, ipc::CompactEncoder, ipc::CompactDecoder> CompactChannel;
+
+DEFINE_IPC_MSG_CONV(40, 5) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(unsigned int, UInt32)
+  IPC_MSG_P3(const char*, String8)
+  IPC_MSG_P4(const wchar_t*, String16)
+  IPC_MSG_P5(ipc::ByteArray, ByteArray)
+};
+
+class CompactMessage40 : public ipc::MsgOut<CompactChannel> {
+public:
+  size_t DoSend(CompactChannel* ch, int a, unsigned int b, const char* c, const wchar_t* d,
+                const char e[], size_t len) {
+    ipc::ByteArray arr(len, e);
+    return SendMsg(40, ch, a, b, c, d, arr);
+  }
+};
+
+class DispCompactMsg40 : public DispTestMsg,
+                         public ipc::MsgIn<40, DispCompactMsg40, CompactChannel> {
+public:
+  DispCompactMsg40(const char* expected, size_t sz) : expected_(expected), sz_(sz) {}
+
+  size_t OnMsg(CompactChannel*, int a, unsigned int b, const char* c, const wchar_t* d,
+               ipc::ByteArray e) {
+    if ((a != -70000) || (b != 0xF0000001))
+      return 2;
+    if ((IPCString(c) != "compact") || (IPCWString(d) != L"wide \x263A"))
+      return 3;
+    if (e.sz_ != sz_)
+      return 4;
+    return (0 == memcmp(e.buf_, expected_, sz_)) ? ipc::OnMsgReady : 5;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  const char* expected_;
+  size_t sz_;
+};
+
+int TestCodecCompactRoundTrip() {
+  static char big[5000];
+  for (size_t ix = 0; ix != sizeof(big); ++ix) {
+    big[ix] = static_cast<char>(ix % 251);
+  }
+
+  TestTransport transport;
+  CompactChannel channel(&transport);
+  CompactMessage40 msg40;
+
+  // Small array, copied into the body.
+  DispCompactMsg40 disp_small(big, 10);
+  msg40.DoSend(&channel, -70000, 0xF0000001, "compact", L"wide \x263A", big, 10);
+  if (channel.Receive(&disp_small) != ipc::OnMsgReady)
+    return 1;
+
+  // Big array, sent by reference in its own segment.
+  DispCompactMsg40 disp_big(big, sizeof(big));
+  msg40.DoSend(&channel, -70000, 0xF0000001, "compact", L"wide \x263A", big, sizeof(big));
+  if (channel.Receive(&disp_big) != ipc::OnMsgReady)
+    return 2;
+
+  // The transport hands out a few bytes at a time.
+  transport.set_max_read(3);
+  msg40.DoSend(&channel, -70000, 0xF0000001, "compact", L"wide \x263A", big, sizeof(big));
+  if (channel.Receive(&disp_big) != ipc::OnMsgReady)
+    return 3;
+  if (disp_big.HasConvertError() || disp_big.HasArgCountError())
+    return 4;
+
+  return 0;
+}
+
+int TestCodecCompactFormat() {
+  // One small int and one short string: a few bytes instead of the word codec's dozens.
+  ipc::CompactEncoder enc;
+  if (!enc.Open(2))
+    return 1;
+  enc.SetMsgId(7);
+  if (!enc.OnWord(reinterpret_cast<void*>(static_cast<size_t>(static_cast<unsigned int>(-1))),
+                  ipc::TYPE_INT32))
+    return 2;
+  if (!enc.OnString8("ab", 2, ipc::TYPE_STRING8))
+    return 3;
+  // One element too many.
+  if (enc.OnWord(NULL, ipc::TYPE_INT32))
+    return 4;
+  if (!enc.Close())
+    return 5;
+
+  size_t sz = 0;
+  const char* buf = static_cast<const char*>(enc.GetBuffer(&sz));
+  const unsigned char expected[] = {
+    0xC5, 0x01, 0x08,                       // magic, version, body size.
+    0x07, 0x02,                             // msg id, count.
+    ipc::TYPE_INT32, 0x01,                  // -1 zigzagged.
+    ipc::TYPE_STRING8 | 0x40, 0x02, 'a', 'b'
+  };
+  if (sz != sizeof(expected))
+    return 6;
+  if (0 != memcmp(buf, expected, sz))
+    return 7;
+
+  int version = 0;
+  if (ipc::DetectCodec(buf, sz, &version) != ipc::CODEC_COMPACT)
+    return 8;
+  if (version != ipc::compact::kVersion)
+    return 9;
+
+  // The default codec is detected as such.
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage3 msg3;
+  msg3.DoSend(&channel, 1, "x");
+  size_t wsz = 0;
+  const char* wbuf = transport.Receive(&wsz);
+  if (ipc::DetectCodec(wbuf, wsz, NULL) != ipc::CODEC_WORD)
+    return 10;
+  if (ipc::DetectCodec(wbuf, 1, NULL) != ipc::CODEC_UNKNOWN)
+    return 11;
+
+  // A corrupted element count is a decoding error.
+  std::vector<char> bad(buf, buf + sz);
+  bad[4] = 9;
+  CompactChannel::RxHandler rx;
+  ipc::CompactDecoder<CompactChannel::RxHandler> dec(&rx);
+  dec.OnData(&bad[0], bad.size());
+  if (dec.Success())
+    return 12;
+
+  // The call id goes in the header and the version byte says it is there.
+  enc.SetCallId(0x12345);
+  enc.Open(0);
+  enc.SetMsgId(7);
+  enc.Close();
+  buf = static_cast<const char*>(enc.GetBuffer(&sz));
+  if (ipc::DetectCodec(buf, sz, &version) != ipc::CODEC_COMPACT)
+    return 13;
+  if (version != ipc::compact::kVersion)
+    return 14;
+  CompactChannel::RxHandler rx2;
+  ipc::CompactDecoder<CompactChannel::RxHandler> dec2(&rx2);
+  dec2.OnData(buf, sz);
+  if (!dec2.Success() || (rx2.CallId() != 0x12345) || (rx2.MsgId() != 7))
+    return 15;
+
+  // The extremes of int zigzag to the extremes of unsigned int and back.
+  if ((ipc::compact::ZigZag(-0x7FFFFFFF - 1) != 0xFFFFFFFF) ||
+      (ipc::compact::ZigZag(0x7FFFFFFF) != 0xFFFFFFFE))
+    return 16;
+  if ((ipc::compact::UnZigZag(0xFFFFFFFF) != (-0x7FFFFFFF - 1)) ||
+      (ipc::compact::UnZigZag(0xFFFFFFFE) != 0x7FFFFFFF))
+    return 17;
+
+  return 0;
+}
+
+DEFINE_IPC_MSG_CONV(49, 4) {
+  IPC_MSG_P1(char, Char8)
+  IPC_MSG_P2(long long, Int64)
+  IPC_MSG_P3(float, Float32)
+  IPC_MSG_P4(ipc::Int32Array, Int32Array)
+};
+
+class CompactMessage49 : public ipc::MsgOut<CompactChannel> {
+public:
+  size_t DoSend(CompactChannel* ch, char a, long long b, float c, const int d[], size_t len) {
+    return SendMsg(49, ch, a, b, c, ipc::Int32Array(len, d));
+  }
+};
+
+class DispCompactMsg49 : public DispTestMsg,
+                         public ipc::MsgIn<49, DispCompactMsg49, CompactChannel> {
+public:
+  explicit DispCompactMsg49(const int* expected) : expected_(expected) {}
+
+  size_t OnMsg(CompactChannel*, char a, long long b, float c, ipc::Int32Array d) {
+    if ((a != 'q') || (b != -0x7000000000000001LL) || (c != -3.75f))
+      return 2;
+    if ((d.sz_ != 5) || (reinterpret_cast<size_t>(d.buf_) % sizeof(int)))
+      return 3;
+    return (0 == memcmp(d.buf_, expected_, 5 * sizeof(int))) ? ipc::OnMsgReady : 4;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  const int* expected_;
+};
+
+int TestCodecCompactWideTypes() {
+  // The compact body is not aligned so the array elements are copied to aligned storage.
+  const int arr[] = { -1, 0, 1, 0x7FFFFFFF, -0x7FFFFFFF };
+  TestTransport transport;
+  CompactChannel channel(&transport);
+  CompactMessage49 msg49;
+  DispCompactMsg49 disp(arr);
+  msg49.DoSend(&channel, 'q', -0x7000000000000001LL, -3.75f, arr, 5);
+  if (channel.Receive(&disp) != ipc::OnMsgReady)
+    return 1;
+  if (disp.HasConvertError() || disp.HasArgCountError())
+    return 2;
+  return 0;
+}
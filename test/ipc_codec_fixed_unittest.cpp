@@ -0,0 +1,293 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_hello.h"
+
+typedef ipc::Channel<TestTransport, ipc::FixedEncoder, ipc::FixedDecoder> FixedChannel;
+
+DEFINE_IPC_MSG_CONV(61, 5) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(unsigned int, UInt32)
+  IPC_MSG_P3(const char*, String8)
+  IPC_MSG_P4(const wchar_t*, String16)
+  IPC_MSG_P5(ipc::ByteArray, ByteArray)
+};
+
+class FixedMessage61 : public ipc::MsgOut<FixedChannel> {
+public:
+  size_t DoSend(FixedChannel* ch, int a, unsigned int b, const char* c, const wchar_t* d,
+                const char e[], size_t len) {
+    ipc::ByteArray arr(len, e);
+    return SendMsg(61, ch, a, b, c, d, arr);
+  }
+};
+
+class DispFixedMsg61 : public DispTestMsg,
+                       public ipc::MsgIn<61, DispFixedMsg61, FixedChannel> {
+public:
+  DispFixedMsg61(const char* expected, size_t sz) : expected_(expected), sz_(sz) {}
+
+  size_t OnMsg(FixedChannel*, int a, unsigned int b, const char* c, const wchar_t* d,
+               ipc::ByteArray e) {
+    if ((a != -70000) || (b != 0xF0000001))
+      return 2;
+    if ((IPCString(c) != "fixed") || (IPCWString(d) != L"wide \x263A"))
+      return 3;
+    if (e.sz_ != sz_)
+      return 4;
+    return (0 == memcmp(e.buf_, expected_, sz_)) ? ipc::OnMsgReady : 5;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  const char* expected_;
+  size_t sz_;
+};
+
+DEFINE_IPC_MSG_CONV(62, 5) {
+  IPC_MSG_P1(void*, VoidPtr)
+  IPC_MSG_P2(long, Long32)
+  IPC_MSG_P3(long long, Int64)
+  IPC_MSG_P4(double, Float64)
+  IPC_MSG_P5(ipc::Int64Array, Int64Array)
+};
+
+class FixedMessage62 : public ipc::MsgOut<FixedChannel> {
+public:
+  size_t DoSend(FixedChannel* ch, void* a, long b, long long c, double d, const long long e[],
+                size_t len) {
+    return SendMsg(62, ch, a, b, c, d, ipc::Int64Array(len, e));
+  }
+};
+
+class DispFixedMsg62 : public DispTestMsg,
+                       public ipc::MsgIn<62, DispFixedMsg62, FixedChannel> {
+public:
+  DispFixedMsg62(void* ptr, const long long* expected) : ptr_(ptr), expected_(expected) {}
+
+  size_t OnMsg(FixedChannel*, void* a, long b, long long c, double d, ipc::Int64Array e) {
+    if ((a != ptr_) || (b != -5))
+      return 2;
+    if ((c != -0x123456789LL) || (d != -2.25e100))
+      return 3;
+    if ((e.sz_ != 3) || (0 != memcmp(e.buf_, expected_, 3 * sizeof(long long))))
+      return 4;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  void* ptr_;
+  const long long* expected_;
+};
+
+int TestCodecFixedRoundTrip() {
+  static char big[5000];
+  for (size_t ix = 0; ix != sizeof(big); ++ix) {
+    big[ix] = static_cast<char>(ix % 251);
+  }
+
+  TestTransport transport;
+  FixedChannel channel(&transport);
+  FixedMessage61 msg61;
+
+  // Odd sized array, copied into the body and padded.
+  DispFixedMsg61 disp_small(big, 10);
+  msg61.DoSend(&channel, -70000, 0xF0000001, "fixed", L"wide \x263A", big, 10);
+  if (channel.Receive(&disp_small) != ipc::OnMsgReady)
+    return 1;
+
+  // Big array, sent by reference in its own segment.
+  DispFixedMsg61 disp_big(big, sizeof(big) - 1);
+  msg61.DoSend(&channel, -70000, 0xF0000001, "fixed", L"wide \x263A", big, sizeof(big) - 1);
+  if (channel.Receive(&disp_big) != ipc::OnMsgReady)
+    return 2;
+
+  // The transport hands out a few bytes at a time.
+  transport.set_max_read(3);
+  msg61.DoSend(&channel, -70000, 0xF0000001, "fixed", L"wide \x263A", big, sizeof(big) - 1);
+  if (channel.Receive(&disp_big) != ipc::OnMsgReady)
+    return 3;
+  if (disp_big.HasConvertError() || disp_big.HasArgCountError())
+    return 4;
+
+  // Pointers and the 64-bit values.
+  const long long arr[] = { -1, 0x7FFFFFFFFFFFFFFFLL, 42 };
+  FixedMessage62 msg62;
+  DispFixedMsg62 disp62(&disp62, arr);
+  msg62.DoSend(&channel, &disp62, -5, -0x123456789LL, -2.25e100, arr, 3);
+  if (channel.Receive(&disp62) != ipc::OnMsgReady)
+    return 5;
+  if (disp62.HasConvertError() || disp62.HasArgCountError())
+    return 6;
+
+  return 0;
+}
+
+int TestCodecFixedFormat() {
+  // Every field is a little-endian word and the pointer takes a 64-bit slot.
+  ipc::FixedEncoder enc;
+  if (!enc.Open(3))
+    return 1;
+  enc.SetMsgId(7);
+  if (!enc.OnWord(reinterpret_cast<void*>(static_cast<size_t>(static_cast<unsigned int>(-2))),
+                  ipc::TYPE_INT32))
+    return 2;
+  if (!enc.OnWord(reinterpret_cast<void*>(static_cast<size_t>(0x12345678)), ipc::TYPE_VOIDPTR))
+    return 3;
+  if (!enc.OnString8("abcde", 5, ipc::TYPE_STRING8))
+    return 4;
+  // One element too many.
+  if (enc.OnWord(NULL, ipc::TYPE_INT32))
+    return 5;
+  if (!enc.Close())
+    return 6;
+
+  size_t sz = 0;
+  const char* buf = static_cast<const char*>(enc.GetBuffer(&sz));
+  const unsigned char expected[] = {
+    'S', 'I', 'P', 'F',  0x01, 0, 0, 0,  0x2C, 0, 0, 0,        // mark, version, body size.
+    0x07, 0, 0, 0,  0x03, 0, 0, 0,                             // msg id, count.
+    ipc::TYPE_INT32, 0, 0, 0,  0xFE, 0xFF, 0xFF, 0xFF,
+    ipc::TYPE_VOIDPTR, 0, 0, 0,  0x78, 0x56, 0x34, 0x12,  0, 0, 0, 0,
+    ipc::TYPE_STRING8, 0x01, 0, 0,  0x05, 0, 0, 0,  'a', 'b', 'c', 'd',  'e', 0, 0, 0
+  };
+  if (sz != sizeof(expected))
+    return 7;
+  if (0 != memcmp(buf, expected, sz))
+    return 8;
+
+  int version = 0;
+  if (ipc::DetectCodec(buf, sz, &version) != ipc::CODEC_FIXED)
+    return 9;
+  if (version != static_cast<int>(ipc::fixed::kVersion))
+    return 10;
+
+  FixedChannel::RxHandler rx;
+  ipc::FixedDecoder<FixedChannel::RxHandler> dec(&rx);
+  dec.OnData(buf, sz);
+  if (!dec.Success() || (rx.MsgId() != 7))
+    return 11;
+
+  // A corrupted element count is a decoding error.
+  std::vector<char> bad(buf, buf + sz);
+  bad[16] = 9;
+  FixedChannel::RxHandler rx2;
+  ipc::FixedDecoder<FixedChannel::RxHandler> dec2(&rx2);
+  dec2.OnData(&bad[0], bad.size());
+  if (dec2.Success())
+    return 12;
+
+  // A pointer with the high word set only fits in a 64-bit process.
+  bad.assign(buf, buf + sz);
+  bad[36] = 1;
+  FixedChannel::RxHandler rx3;
+  ipc::FixedDecoder<FixedChannel::RxHandler> dec3(&rx3);
+  dec3.OnData(&bad[0], bad.size());
+  if (dec3.Success() != (sizeof(void*) == 8))
+    return 13;
+
+  // The call id goes after the count and the version word says it is there.
+  enc.SetCallId(0x12345);
+  enc.Open(0);
+  enc.SetMsgId(7);
+  enc.Close();
+  buf = static_cast<const char*>(enc.GetBuffer(&sz));
+  if ((sz != 24) || (ipc::DetectCodec(buf, sz, &version) != ipc::CODEC_FIXED))
+    return 14;
+  if (version != static_cast<int>(ipc::fixed::kVersion))
+    return 15;
+  FixedChannel::RxHandler rx4;
+  ipc::FixedDecoder<FixedChannel::RxHandler> dec4(&rx4);
+  dec4.OnData(buf, sz);
+  if (!dec4.Success() || (rx4.CallId() != 0x12345) || (rx4.MsgId() != 7))
+    return 16;
+
+  return 0;
+}
+
+int TestHelloNegotiation() {
+  const ipc::Hello local = ipc::LocalHello(ipc::kHelloAllCodecs);
+  if (ipc::PickCodec(local, local) != ipc::CODEC_WORD)
+    return 1;
+
+  // A peer of the other bitness gets the fixed codec, or the compact one if that is all
+  // both have.
+  ipc::Hello other = local;
+  other.platform ^= (32 | 64);
+  if ((ipc::PickCodec(local, other) != ipc::CODEC_FIXED) ||
+      (ipc::PickCodec(other, local) != ipc::CODEC_FIXED))
+    return 2;
+  other.codecs = 1 << ipc::CODEC_COMPACT;
+  if (ipc::PickCodec(local, other) != ipc::CODEC_COMPACT)
+    return 3;
+  other.codecs = 1 << ipc::CODEC_WORD;
+  if (ipc::PickCodec(local, other) != ipc::CODEC_UNKNOWN)
+    return 4;
+
+  // The hello is read exactly, the message behind it stays for the channel.
+  LinkTransport client;
+  LinkTransport server;
+  LinkTransport::Connect(&client, &server);
+  if (ipc::SendHello(&client, local) != ipc::RcOK)
+    return 5;
+  ipc::IOSegment tail = { "xyz", 3 };
+  client.Send(&tail, 1);
+  ipc::Hello peer;
+  if (ipc::ReceiveHello(&server, &peer) != ipc::RcOK)
+    return 6;
+  if ((peer.version != ipc::kHelloVersion) || (peer.platform != local.platform) ||
+      (peer.codecs != local.codecs))
+    return 7;
+  if (server.Pending() != 3)
+    return 8;
+
+  // The server side answers the client that already said hello.
+  ipc::SendHello(&client, local);
+  int codec = ipc::CODEC_UNKNOWN;
+  const ipc::Hello fixed_only = ipc::LocalHello(1 << ipc::CODEC_FIXED);
+  char skip[3];
+  size_t skip_sz = sizeof(skip);
+  server.ReceiveInto(skip, &skip_sz);
+  if (ipc::NegotiateCodec(&server, false, fixed_only, &codec) != ipc::RcOK)
+    return 9;
+  if ((codec != ipc::CODEC_FIXED) || (ipc::ReceiveHello(&client, &peer) != ipc::RcOK))
+    return 10;
+  if (ipc::PickCodec(local, peer) != codec)
+    return 11;
+
+  // Anything else is not a hello.
+  client.Send(&tail, 1);
+  ipc::SendHello(&client, local);
+  if (ipc::ReceiveHello(&server, &peer) != ipc::RcErrDecoderFormat)
+    return 12;
+
+  // A peer of another version is turned down, after it gets the answer.
+  LinkTransport client2;
+  LinkTransport server2;
+  LinkTransport::Connect(&client2, &server2);
+  ipc::Hello newer = local;
+  newer.version = ipc::kHelloVersion + 1;
+  ipc::SendHello(&client2, newer);
+  codec = ipc::CODEC_UNKNOWN;
+  if (ipc::NegotiateCodec(&server2, false, local, &codec) != ipc::RcErrTransportConnect)
+    return 13;
+  if ((codec != ipc::CODEC_UNKNOWN) || (ipc::ReceiveHello(&client2, &peer) != ipc::RcOK))
+    return 14;
+
+  return 0;
+}
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "ipc_test_helpers.h"
+#include <stdio.h>
 
 namespace {
 
@@ -505,4 +506,580 @@ int TestCodecRaw8() {
     return -1;
 
   return 0;
-}
\ No newline at end of file
+}
+int TestCodecZeroCopy() {
+  char arr[300];
+  for (size_t ix = 0; ix != sizeof(arr); ++ix) {
+    arr[ix] = static_cast<char>(ix * 7);
+  }
+
+  // A WireType built from a ByteArrayRef references the caller's buffer.
+  ipc::WireType wt(ipc::ByteArrayRef(sizeof(arr), arr));
+  if (!wt.IsRef())
+    return 1;
+  if (wt.AsByteArray().buf_ != arr)
+    return 2;
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage12 msg12;
+  msg12.DoSend(&channel, arr, sizeof(arr), 5);
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+
+  if (!dec.Success())
+    return 3;
+  if (rx.GetArgCount() != 2)
+    return 4;
+  // The received byte array is a view into the decoder buffer, not a copy.
+  if (!rx.GetArg(0).IsRef())
+    return 5;
+  ipc::ByteArray ba = rx.GetArg(0).AsByteArray();
+  if (ba.sz_ != sizeof(arr))
+    return 6;
+  if (0 != memcmp(ba.buf_, arr, sizeof(arr)))
+    return 7;
+  if (rx.GetArg(1).AsInt32() != 5)
+    return 8;
+
+  return 0;
+}
+
+// The length of a byte array comes from the peer. A negative one or one that goes past the
+// end of the message is a decoding error, even if the buffer has the bytes.
+int TestCodecBadLength() {
+  char arr[16];
+  memset(arr, 'x', sizeof(arr));
+  // The words are the header, two tags, the start mark and then the array length.
+  const size_t kLengthWord = 7;
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage12 msg12;
+  size_t size = 0;
+
+  // With an empty array the rest of the message still decodes if the length rounds to
+  // nothing, so only the check on the length can catch it.
+  msg12.DoSend(&channel, arr, 0, 5);
+  const char* data = transport.Receive(&size);
+  std::vector<char> bad(data, data + size);
+  reinterpret_cast<void**>(&bad[0])[kLengthWord] = reinterpret_cast<void*>(-1);
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> neg_dec(&rx);
+  neg_dec.OnData(&bad[0], bad.size());
+  if (neg_dec.Success())
+    return 1;
+  rx.Clear();
+
+  // Two messages back to back, so the bytes after the first one belong to the second.
+  msg12.DoSend(&channel, arr, sizeof(arr), 5);
+  data = transport.Receive(&size);
+  std::vector<char> good(data, data + size);
+  good.insert(good.end(), data, data + size);
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(&good[0], good.size());
+  if (!dec.Success())
+    return 2;
+  if (rx.GetArg(0).AsByteArray().sz_ != sizeof(arr))
+    return 3;
+  rx.Clear();
+
+#if !defined(IPC_BIG_ENDIAN)
+  bad = good;
+  reinterpret_cast<void**>(&bad[0])[kLengthWord] = reinterpret_cast<void*>(sizeof(arr) * 3);
+  ipc::Decoder<TestChannel::RxHandler> long_dec(&rx);
+  long_dec.OnData(&bad[0], bad.size());
+  if (long_dec.Success())
+    return 4;
+  rx.Clear();
+#endif
+  return 0;
+}
+
+int TestCodecLazyString() {
+  // A lazy string is only copied when it is read as a C string.
+  const char chars[] = "abcdXYZ";
+  ipc::Arena arena;
+  ipc::WireType wt(ipc::String8LazyRef(4, chars, &arena));
+  size_t sz = 0;
+  if ((wt.PeekString8(&sz) != chars) || (sz != 4))
+    return 1;
+  if (arena.Held() != 0)
+    return 2;
+  const char* str = wt.AsString8();
+  if ((str == chars) || (IPCString(str) != "abcd") || (arena.Held() == 0))
+    return 3;
+  if (wt.AsString8() != str)
+    return 4;
+
+  ipc::WireType null_wt(ipc::String16LazyRef(0, NULL, &arena));
+  if ((null_wt.Id() != ipc::TYPE_NULLSTRING16) || (null_wt.AsString16() != NULL))
+    return 5;
+
+  // The channel receive handler keeps the decoded strings as lazy references.
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage3 msg3;
+  msg3.DoSend(&channel, 56789, "1234");
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+  if (!dec.Success() || (rx.GetArgCount() != 2))
+    return 6;
+  const char* view = rx.GetArg(1).PeekString8(&sz);
+  if ((sz != 4) || (0 != memcmp(view, "1234", 4)))
+    return 7;
+  str = rx.GetArg(1).AsString8();
+  if ((str == view) || (IPCString(str) != "1234"))
+    return 8;
+  return 0;
+}
+
+DEFINE_IPC_MSG_CONV(48, 6) {
+  IPC_MSG_P1(long long, Int64)
+  IPC_MSG_P2(unsigned long long, UInt64)
+  IPC_MSG_P3(float, Float32)
+  IPC_MSG_P4(double, Float64)
+  IPC_MSG_P5(ipc::Int64Array, Int64Array)
+  IPC_MSG_P6(ipc::UInt32Array, UInt32Array)
+};
+
+class TestMessage48 : public ipc::MsgOut<TestChannel> {
+public:
+  size_t DoSend(TestChannel* ch, long long a, unsigned long long b, float c, double d,
+                const long long e[], size_t len, const unsigned int* f) {
+    return SendMsg(48, ch, a, b, c, d, ipc::Int64Array(len, e), ipc::UInt32Array(2, f));
+  }
+};
+
+class DispTestMsg48 : public DispTestMsg,
+                      public ipc::MsgIn<48, DispTestMsg48, TestChannel> {
+public:
+  DispTestMsg48(const long long* expected, size_t sz) : expected_(expected), sz_(sz) {}
+
+  size_t OnMsg(TestChannel*, long long a, unsigned long long b, float c, double d,
+               ipc::Int64Array e, ipc::UInt32Array f) {
+    if ((a != -0x123456789LL) || (b != 0xFEDCBA9876543210ULL))
+      return 2;
+    if ((c != 1.5f) || (d != -2.25e100))
+      return 3;
+    if ((e.sz_ != sz_) || (0 != memcmp(e.buf_, expected_, sz_ * sizeof(long long))))
+      return 4;
+    if ((f.buf_ != NULL) || (f.sz_ != 0))
+      return 5;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  const long long* expected_;
+  size_t sz_;
+};
+
+int TestCodecWideTypes() {
+  ipc::WireType wt64(0x100000000LL);
+  if ((wt64.Id() != ipc::TYPE_INT64) || (wt64.CheckInt64() != 0) ||
+      (wt64.AsInt64() != 0x100000000LL))
+    return 1;
+  if ((wt64.CheckUInt64() != ipc::TYPE_UINT64) || (wt64.CheckInt64Array() != ipc::TYPE_INT64ARRAY))
+    return 2;
+  ipc::WireType wtf(0.5f);
+  if ((wtf.Id() != ipc::TYPE_FLOAT32) || (wtf.AsFloat32() != 0.5f))
+    return 3;
+
+  // A big offset table is one WireType that references the elements.
+  static long long offsets[10000];
+  for (size_t ix = 0; ix != 10000; ++ix) {
+    offsets[ix] = static_cast<long long>(ix) << 33;
+  }
+  ipc::WireType wta(ipc::Int64Array(10000, offsets));
+  if (!wta.IsRef() || (wta.AsInt64Array().buf_ != offsets) || (wta.AsInt64Array().sz_ != 10000))
+    return 4;
+  ipc::WireType wtn(ipc::UInt32Array(5, NULL));
+  if ((wtn.Id() != ipc::TYPE_NULLUINT32ARRAY) || (wtn.CheckUInt32Array() != 0))
+    return 5;
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage48 msg48;
+  DispTestMsg48 disp(offsets, 10000);
+  msg48.DoSend(&channel, -0x123456789LL, 0xFEDCBA9876543210ULL, 1.5f, -2.25e100,
+               offsets, 10000, NULL);
+  if (channel.Receive(&disp) != ipc::OnMsgReady)
+    return 6;
+
+  // The received array is a view into the decoder buffer.
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+  if (!dec.Success() || (rx.GetArgCount() != 6))
+    return 7;
+  ipc::Int64Array view = rx.GetArg(4).AsInt64Array();
+  if ((view.sz_ != 10000) || (view.buf_[9999] != offsets[9999]))
+    return 8;
+  if (!rx.GetArg(4).IsRef() || (rx.GetArg(5).Id() != ipc::TYPE_NULLUINT32ARRAY))
+    return 9;
+
+  // A small array goes with the rest of the message.
+  transport.set_max_read(7);
+  DispTestMsg48 disp_small(offsets, 3);
+  msg48.DoSend(&channel, -0x123456789LL, 0xFEDCBA9876543210ULL, 1.5f, -2.25e100,
+               offsets, 3, NULL);
+  if (channel.Receive(&disp_small) != ipc::OnMsgReady)
+    return 10;
+  return 0;
+}
+
+int TestCodecGather() {
+  char arr[3001];
+  for (size_t ix = 0; ix != sizeof(arr); ++ix) {
+    arr[ix] = static_cast<char>(ix * 3);
+  }
+  const size_t whole = (sizeof(arr) / sizeof(void*)) * sizeof(void*);
+
+  ipc::Encoder encoder;
+  encoder.Open(2);
+  encoder.OnString8(arr, sizeof(arr), ipc::TYPE_BARRAY);
+  encoder.OnWord(NULL, ipc::TYPE_NULLBARRAY);
+  encoder.SetMsgId(13);
+  encoder.Close();
+
+#if !defined(IPC_BIG_ENDIAN)
+  // The header, the referenced array and then its tail plus the rest of the message.
+  size_t count = 0;
+  const ipc::IOSegment* segs = encoder.GetSegments(&count);
+  if (count != 3)
+    return 1;
+  if (segs[1].buf_ != arr)
+    return 2;
+  if (segs[1].sz_ != whole)
+    return 3;
+  size_t total = segs[0].sz_ + segs[1].sz_ + segs[2].sz_;
+  if (total % sizeof(void*))
+    return 4;
+#endif
+
+  // The same message through the channel arrives intact.
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage12 msg12;
+  msg12.DoSend(&channel, arr, sizeof(arr), 9);
+
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+
+  if (!dec.Success())
+    return 5;
+  if (rx.GetArgCount() != 2)
+    return 6;
+  ipc::ByteArray ba = rx.GetArg(0).AsByteArray();
+  if (ba.sz_ != sizeof(arr))
+    return 7;
+  if (0 != memcmp(ba.buf_, arr, sizeof(arr)))
+    return 8;
+  if (rx.GetArg(1).AsInt32() != 9)
+    return 9;
+
+  return 0;
+}
+
+namespace {
+
+// The character by character packing the encoder originally used.
+std::vector<void*> RefPackStr8(const char* s, size_t n) {
+  std::vector<void*> words;
+  size_t it = 0;
+  do {
+    size_t v = 0;
+    for (size_t ix = 0; ix != sizeof(void*); ++ix) {
+      if (it == n)
+        break;
+      v |= static_cast<size_t>(static_cast<unsigned char>(s[it])) << (ix * 8);
+      ++it;
+    }
+    words.push_back(reinterpret_cast<void*>(v));
+  } while (it != n);
+  return words;
+}
+
+}  // namespace
+
+int TestCodecPackStr() {
+  char str[64];
+  for (size_t ix = 0; ix != sizeof(str); ++ix) {
+    str[ix] = static_cast<char>(0x41 + ix * 37);
+  }
+
+  for (size_t n = 1; n != sizeof(str); ++n) {
+    ipc::Encoder encoder;
+    encoder.Open(1);
+    encoder.OnString8(str, n, ipc::TYPE_STRING8);
+    encoder.Close();
+
+    size_t sz = 0;
+    void* const* buf = static_cast<void* const*>(encoder.GetBuffer(&sz));
+    std::vector<void*> expected = RefPackStr8(str, n);
+
+    // 6 header words, the string size, the string words and the end mark.
+    if (sz != (6 + 1 + expected.size() + 1) * sizeof(void*))
+      return 1;
+    if (reinterpret_cast<size_t>(buf[6]) != n)
+      return 2;
+    if (0 != memcmp(&buf[7], &expected[0], expected.size() * sizeof(void*)))
+      return 3;
+    if (reinterpret_cast<size_t>(buf[7 + expected.size()]) != ipc::Encoder::ENC_ENDDAT)
+      return 4;
+  }
+  return 0;
+}
+
+int TestCodecInPlaceDecode() {
+  char arr[20];
+  for (size_t ix = 0; ix != sizeof(arr); ++ix) {
+    arr[ix] = static_cast<char>(ix + 1);
+  }
+
+  // Three messages of different sizes in a single buffer, as if read all at once.
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage12 msg12;
+  std::vector<char> stream;
+  size_t sizes[3];
+  for (size_t ix = 0; ix != 3; ++ix) {
+    msg12.DoSend(&channel, arr, 4 + ix * 8, static_cast<int>(ix));
+    size_t size = 0;
+    const char* data = transport.Receive(&size);
+    stream.insert(stream.end(), data, data + size);
+    sizes[ix] = size;
+  }
+
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(&stream[0], stream.size());
+
+  // The messages are decoded where they are, one after the other, nothing is moved.
+  const char* first = NULL;
+  size_t offset = 0;
+  for (size_t ix = 0; ix != 3; ++ix) {
+    if (ix) {
+      if (dec.NeedsMoreData())
+        return 1;
+      dec.OnData(NULL, 0);
+    }
+    if (!dec.Success())
+      return 2;
+    if (rx.GetArg(1).AsInt32() != static_cast<int>(ix))
+      return 3;
+    ipc::ByteArray ba = rx.GetArg(0).AsByteArray();
+    if ((ba.sz_ != 4 + ix * 8) || (0 != memcmp(ba.buf_, arr, ba.sz_)))
+      return 4;
+    if (!ix)
+      first = ba.buf_;
+    else if (ba.buf_ != first + offset)
+      return 5;
+    offset += sizes[ix];
+    rx.Clear();
+    dec.Reset();
+  }
+  if (!dec.NeedsMoreData())
+    return 6;
+
+  // One byte at a time, the decoder makes progress without waiting for whole words.
+  int done = 0;
+  for (size_t ix = 0; ix != stream.size(); ++ix) {
+    if (dec.OnData(&stream[ix], 1))
+      continue;
+    if (!dec.Success())
+      return 7;
+    if (rx.GetArg(1).AsInt32() != done)
+      return 8;
+    ++done;
+    rx.Clear();
+    dec.Reset();
+  }
+  if (done != 3)
+    return 9;
+
+  return 0;
+}
+
+namespace {
+
+// Something like the HTML that the workers send back, which compresses well.
+std::vector<char> MakeHtml(size_t sz) {
+  std::vector<char> html;
+  char row[64];
+  for (int ix = 0; html.size() < sz; ++ix) {
+    int len = sprintf(row, "<tr><td>row %d</td><td class=\"v\">%d</td></tr>\n", ix, ix * 7);
+    html.insert(html.end(), row, row + len);
+  }
+  html.resize(sz);
+  return html;
+}
+
+std::vector<char> MakeNoise(size_t sz) {
+  std::vector<char> noise(sz);
+  unsigned int seed = 12345;
+  for (size_t ix = 0; ix != sz; ++ix) {
+    seed = seed * 1103515245 + 12345;
+    noise[ix] = static_cast<char>(seed >> 24);
+  }
+  return noise;
+}
+
+bool PackRoundTrip(const std::vector<char>& in, size_t* packed_sz) {
+  std::vector<char> packed(in.size() * 2 + 16);
+  *packed_sz = ipc::FastPack::Pack(&in[0], in.size(), &packed[0], packed.size());
+  if (!*packed_sz)
+    return false;
+  std::vector<char> out(in.size());
+  if (!ipc::FastPack::Unpack(&packed[0], *packed_sz, &out[0], out.size()))
+    return false;
+  return (out == in);
+}
+
+}  // namespace
+
+int TestCodecFastPack() {
+  size_t packed_sz = 0;
+  std::vector<char> html = MakeHtml(8000);
+  if (!PackRoundTrip(html, &packed_sz) || (packed_sz > html.size() / 3))
+    return 1;
+
+  // Long runs need the extra length bytes.
+  std::vector<char> run(100000, 'x');
+  if (!PackRoundTrip(run, &packed_sz) || (packed_sz > 1000))
+    return 2;
+
+  // Every size from the smallest accepted, compressible or not.
+  for (size_t sz = ipc::FastPack::kMinInputSz; sz != 300; ++sz) {
+    if (!PackRoundTrip(MakeHtml(sz), &packed_sz))
+      return 3;
+    if (!PackRoundTrip(MakeNoise(sz), &packed_sz))
+      return 4;
+  }
+  std::vector<char> small = MakeHtml(ipc::FastPack::kMinInputSz - 1);
+  char dst[256];
+  if (ipc::FastPack::Pack(&small[0], small.size(), dst, sizeof(dst)))
+    return 5;
+
+  // Noise does not fit in less space than it takes.
+  std::vector<char> noise = MakeNoise(4096);
+  std::vector<char> packed(noise.size());
+  if (ipc::FastPack::Pack(&noise[0], noise.size(), &packed[0], noise.size() - noise.size() / 8))
+    return 6;
+
+  // Malformed data is rejected.
+  packed.resize(html.size());
+  packed_sz = ipc::FastPack::Pack(&html[0], html.size(), &packed[0], packed.size());
+  std::vector<char> out(html.size() + 1);
+  if (ipc::FastPack::Unpack(&packed[0], packed_sz, &out[0], html.size() - 1))
+    return 7;
+  if (ipc::FastPack::Unpack(&packed[0], packed_sz, &out[0], html.size() + 1))
+    return 8;
+  if (ipc::FastPack::Unpack(&packed[0], packed_sz - 1, &out[0], html.size()))
+    return 9;
+  // A match before the start of the output.
+  const char far_back[] = { 0x10, 'a', 0x05, 0x00 };
+  if (ipc::FastPack::Unpack(far_back, sizeof(far_back), &out[0], 5))
+    return 10;
+  const char no_offset[] = { 0x10, 'a', 0x00, 0x00 };
+  if (ipc::FastPack::Unpack(no_offset, sizeof(no_offset), &out[0], 5))
+    return 11;
+  // A literal count that runs past the end.
+  const char long_literal[] = { static_cast<char>(0xF0), static_cast<char>(0xFF) };
+  if (ipc::FastPack::Unpack(long_literal, sizeof(long_literal), &out[0], 300))
+    return 12;
+  return 0;
+}
+
+int TestCodecPacked() {
+  std::vector<char> html = MakeHtml(8000);
+  std::vector<wchar_t> wide(html.begin(), html.begin() + 3000);
+  std::vector<char> noise = MakeNoise(2000);
+
+  ipc::PackingEncoder encoder;
+  encoder.Open(4);
+  encoder.OnString8(&html[0], html.size(), ipc::TYPE_BARRAY);
+  encoder.OnString16(&wide[0], wide.size(), ipc::TYPE_STRING16);
+  encoder.OnString8(&noise[0], noise.size(), ipc::TYPE_BARRAY);
+  encoder.OnString8("small", 5, ipc::TYPE_STRING8);
+  encoder.SetMsgId(13);
+  encoder.Close();
+
+  size_t size = 0;
+  const char* data = static_cast<const char*>(encoder.GetBuffer(&size));
+#if !defined(IPC_BIG_ENDIAN)
+  // Only the arrays that are large enough and compress are packed. The tags are ints widened
+  // to a word the way the encoder stores them.
+  void* const* words = reinterpret_cast<void* const*>(data);
+  const int strn08 = ipc::Encoder::ENC_STRN08;
+  const int strn16 = ipc::Encoder::ENC_STRN16;
+  const int packed = ipc::Encoder::ENC_PACKED;
+  if (words[4] != reinterpret_cast<void*>(ipc::TYPE_BARRAY | strn08 | packed))
+    return 1;
+  if (words[5] != reinterpret_cast<void*>(ipc::TYPE_STRING16 | strn16 | packed))
+    return 2;
+  if (words[6] != reinterpret_cast<void*>(ipc::TYPE_BARRAY | strn08))
+    return 3;
+  if (words[7] != reinterpret_cast<void*>(ipc::TYPE_STRING8 | strn08))
+    return 4;
+  if (size > (html.size() + wide.size() * sizeof(wchar_t)) / 3 + noise.size() + 128)
+    return 5;
+#endif
+
+  // A plain decoder expands them.
+  TestChannel::RxHandler rx;
+  ipc::Decoder<TestChannel::RxHandler> dec(&rx);
+  dec.OnData(data, size);
+  if (!dec.Success() || (rx.GetArgCount() != 4))
+    return 6;
+  ipc::ByteArray ba = rx.GetArg(0).AsByteArray();
+  if ((ba.sz_ != html.size()) || (0 != memcmp(ba.buf_, &html[0], html.size())))
+    return 7;
+  size_t wsz = 0;
+  const wchar_t* ws = rx.GetArg(1).PeekString16(&wsz);
+  if (wsz != wide.size())
+    return 8;
+#if defined(IPC_BIG_ENDIAN)
+  // The big-endian packing keeps 16 bits per character.
+  if ((sizeof(wchar_t) == 2) && (0 != memcmp(ws, &wide[0], wsz * sizeof(wchar_t))))
+    return 8;
+#else
+  if (0 != memcmp(ws, &wide[0], wsz * sizeof(wchar_t)))
+    return 8;
+#endif
+  ba = rx.GetArg(2).AsByteArray();
+  if ((ba.sz_ != noise.size()) || (0 != memcmp(ba.buf_, &noise[0], noise.size())))
+    return 9;
+  if (IPCString(rx.GetArg(3).AsString8()) != "small")
+    return 10;
+  rx.Clear();
+  dec.Reset();
+
+  // A character count that does not match the packed data is a decoding error.
+#if !defined(IPC_BIG_ENDIAN)
+  std::vector<char> bad(data, data + size);
+  reinterpret_cast<void**>(&bad[0])[9] = reinterpret_cast<void*>(html.size() + 1);
+  ipc::Decoder<TestChannel::RxHandler> bad_dec(&rx);
+  bad_dec.OnData(&bad[0], bad.size());
+  if (bad_dec.Success())
+    return 11;
+#endif
+  return 0;
+}
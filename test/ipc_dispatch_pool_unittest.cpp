@@ -0,0 +1,698 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_dispatch_pool.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests of DispatchPool, DispatchStrand and PooledDispatch, and of one channel shared by many
+// sending threads.
+
+namespace {
+
+class CountTask : public ipc::PoolTask {
+public:
+  CountTask() : counter_(NULL), runs_(0) {}
+
+  void set_counter(volatile long* counter) { counter_ = counter; }
+  long runs() const { return runs_; }
+
+  virtual void Run() {
+    ++runs_;
+    ipc::AtomicAdd(counter_, 1);
+  }
+
+private:
+  volatile long* counter_;
+  long runs_;
+};
+
+// Checks that the tasks of a strand run one at a time and in order.
+class SeqTask : public ipc::PoolTask {
+public:
+  SeqTask() : seq_(0), inside_(NULL), next_(NULL), errors_(NULL) {}
+
+  void Init(long seq, volatile long* inside, volatile long* next, volatile long* errors) {
+    seq_ = seq;
+    inside_ = inside;
+    next_ = next;
+    errors_ = errors;
+  }
+
+  virtual void Run() {
+    if (ipc::AtomicAdd(inside_, 1) != 1)
+      ipc::AtomicAdd(errors_, 1);
+    if (*next_ != seq_)
+      ipc::AtomicAdd(errors_, 1);
+    *next_ = seq_ + 1;
+    ipc::AtomicAdd(inside_, -1);
+  }
+
+private:
+  long seq_;
+  volatile long* inside_;
+  volatile long* next_;
+  volatile long* errors_;
+};
+
+// Keeps everything sent, in order, and reads back what was given to SetInput().
+class QueueTransport {
+public:
+  QueueTransport() : read_pos_(0), writes_(0) {}
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    ++writes_;
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* cb = reinterpret_cast<const char*>(segs[ix].buf_);
+      out_.insert(out_.end(), cb, cb + segs[ix].sz_);
+    }
+    return ipc::RcOK;
+  }
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    size_t sz = in_.size() - read_pos_;
+    if (sz > *size)
+      sz = *size;
+    if (!sz)
+      return ipc::RcErrTransportRead;
+    memcpy(buf, &in_[read_pos_], sz);
+    read_pos_ += sz;
+    *size = sz;
+    return ipc::RcOK;
+  }
+
+  void SetInput(const std::vector<char>& in) { in_ = in; read_pos_ = 0; }
+  const std::vector<char>& output() const { return out_; }
+  size_t writes() const { return writes_; }
+
+private:
+  std::vector<char> in_;
+  std::vector<char> out_;
+  size_t read_pos_;
+  size_t writes_;
+};
+
+typedef ipc::Channel<QueueTransport, ipc::Encoder, ipc::Decoder> QueueChannel;
+
+}  // namespace
+
+DEFINE_IPC_MSG_CONV(45, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(46, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(47, 2) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(const char*, String8)
+};
+
+namespace {
+
+// Handlers of different messages behind a common type, like in a broker.
+class PoolSvcBase : public DispTestMsg {
+public:
+  virtual ~PoolSvcBase() {}
+  virtual size_t OnMsgIn(int msg_id, QueueChannel* ch, const ipc::WireType* const args[],
+                         int count) = 0;
+  virtual bool IsOrderedMsg(int msg_id) const = 0;
+};
+
+// Message 45 is an ordered call, its reply 46 carries twice the value.
+class PoolSvc45 : public PoolSvcBase,
+                  public ipc::MsgIn<45, PoolSvc45, QueueChannel>,
+                  public ipc::MsgOut<QueueChannel> {
+public:
+  PoolSvc45() : next_(1), errors_(0) {}
+
+  virtual size_t OnMsgIn(int msg_id, QueueChannel* ch, const ipc::WireType* const args[],
+                         int count) {
+    return OnMsgInX(msg_id, ch, args, count);
+  }
+
+  virtual bool IsOrderedMsg(int) const { return true; }
+
+  size_t OnMsg(QueueChannel* ch, int v) {
+    if (v != next_)
+      ++errors_;
+    next_ = v + 1;
+    ipc::YieldThread();
+    return SendMsg(46, ch, v * 2);
+  }
+
+  int next_;
+  int errors_;
+};
+
+// Message 47 is unordered and not a call.
+class PoolSvc47 : public PoolSvcBase,
+                  public ipc::MsgIn<47, PoolSvc47, QueueChannel> {
+public:
+  PoolSvc47() : count_(0), errors_(0) {}
+
+  virtual size_t OnMsgIn(int msg_id, QueueChannel* ch, const ipc::WireType* const args[],
+                         int count) {
+    return OnMsgInX(msg_id, ch, args, count);
+  }
+
+  virtual bool IsOrderedMsg(int) const { return false; }
+
+  size_t OnMsg(QueueChannel*, int v, const char* str) {
+    if (IPCString(str) != "pooled")
+      ipc::AtomicAdd(&errors_, 1);
+    ipc::AtomicAdd(&count_, v);
+    return ipc::OnMsgLoopNext;
+  }
+
+  volatile long count_;
+  volatile long errors_;
+};
+
+class PoolSvc {
+public:
+  PoolSvcBase* MsgHandler(int msg_id) {
+    if (msg_id == 45)
+      return &svc45_;
+    if (msg_id == 47)
+      return &svc47_;
+    return NULL;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  PoolSvc45 svc45_;
+  PoolSvc47 svc47_;
+};
+
+class PoolCli46 : public DispTestMsg,
+                  public ipc::MsgIn<46, PoolCli46, QueueChannel>,
+                  public ipc::MsgOut<QueueChannel> {
+public:
+  PoolCli46() : value_(0) {}
+
+  size_t DoCall(QueueChannel* ch, int v) {
+    return CallMsg(45, ch, this, v);
+  }
+
+  size_t DoSend(QueueChannel* ch, int v) {
+    return SendMsg(47, ch, v, "pooled");
+  }
+
+  size_t OnMsg(QueueChannel*, int v) {
+    value_ = v;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int value_;
+};
+
+}  // namespace
+
+int TestDispatchPool() {
+  const size_t kTasks = 2000;
+  static CountTask tasks[kTasks];
+  static SeqTask seq[kTasks];
+  volatile long counter = 0;
+  volatile long inside = 0;
+  volatile long next = 0;
+  volatile long errors = 0;
+
+  ipc::DispatchPool pool;
+  if (!pool.Start(4))
+    return 1;
+  if (pool.Start(4))
+    return 2;
+
+  ipc::DispatchStrand strand(&pool);
+  for (size_t ix = 0; ix != kTasks; ++ix) {
+    tasks[ix].set_counter(&counter);
+    seq[ix].Init(static_cast<long>(ix), &inside, &next, &errors);
+    pool.Post(&tasks[ix]);
+    strand.Post(&seq[ix]);
+  }
+
+  // Stop() runs what is queued.
+  pool.Stop();
+  if (counter != static_cast<long>(kTasks))
+    return 3;
+  for (size_t ix = 0; ix != kTasks; ++ix) {
+    if (tasks[ix].runs() != 1)
+      return 4;
+  }
+  if (next != static_cast<long>(kTasks))
+    return 5;
+  if (errors != 0)
+    return 6;
+
+  // A pool that is not running runs the tasks on the caller.
+  pool.Post(&tasks[0]);
+  if (tasks[0].runs() != 2)
+    return 7;
+  return 0;
+}
+
+int TestPooledDispatch() {
+  const int kCalls = 20;
+  const int kNotices = 100;
+
+  QueueTransport client_transport;
+  QueueChannel client(&client_transport);
+  PoolCli46 replies[kCalls];
+  for (int ix = 0; ix != kCalls; ++ix) {
+    if (replies[ix].DoCall(&client, ix + 1) != ipc::RcOK)
+      return 1;
+    if (replies[0].DoSend(&client, ix) != ipc::RcOK)
+      return 2;
+  }
+  for (int ix = kCalls; ix != kNotices; ++ix) {
+    if (replies[0].DoSend(&client, ix) != ipc::RcOK)
+      return 3;
+  }
+
+  ipc::DispatchPool pool;
+  if (!pool.Start(4))
+    return 4;
+
+  // The server reads everything and the handlers run on the pool. Receive() only returns
+  // when the input runs out.
+  QueueTransport server_transport;
+  server_transport.SetInput(client_transport.output());
+  QueueChannel server(&server_transport);
+  PoolSvc svc;
+  ipc::PooledDispatch<QueueChannel, PoolSvc> pooled(&pool, &svc);
+  if (server.Receive(&pooled) != ipc::RcErrTransportRead)
+    return 5;
+  pooled.Drain();
+  if (pooled.result() != ipc::OnMsgLoopNext)
+    return 6;
+  if ((svc.svc45_.errors_ != 0) || (svc.svc45_.next_ != kCalls + 1))
+    return 7;
+  if ((svc.svc47_.errors_ != 0) || (svc.svc47_.count_ != (kNotices * (kNotices - 1)) / 2))
+    return 8;
+
+  // The replies were sent from the pool threads and still complete their calls.
+  client_transport.SetInput(server_transport.output());
+  PoolCli46 other;
+  if (client.WaitCalls(&other) != ipc::OnMsgReady)
+    return 9;
+  for (int ix = 0; ix != kCalls; ++ix) {
+    if (replies[ix].value_ != (ix + 1) * 2)
+      return 10;
+  }
+  if (other.value_ != 0)
+    return 11;
+  return 0;
+}
+
+// The last ordered message finishes inside the strand's turn, so Drain() has to wait for the
+// strand too before the dispatcher can go away.
+int TestPooledDispatchDrain() {
+  const int kCalls = 3;
+  const int kRounds = 2000;
+
+  QueueTransport client_transport;
+  QueueChannel client(&client_transport);
+  PoolCli46 replies[kCalls];
+  for (int ix = 0; ix != kCalls; ++ix) {
+    if (replies[ix].DoCall(&client, ix + 1) != ipc::RcOK)
+      return 1;
+  }
+
+  ipc::DispatchPool pool;
+  if (!pool.Start(4))
+    return 2;
+
+  for (int round = 0; round != kRounds; ++round) {
+    QueueTransport server_transport;
+    server_transport.SetInput(client_transport.output());
+    QueueChannel server(&server_transport);
+    PoolSvc svc;
+    ipc::PooledDispatch<QueueChannel, PoolSvc>* pooled =
+        new ipc::PooledDispatch<QueueChannel, PoolSvc>(&pool, &svc);
+    if (server.Receive(pooled) != ipc::RcErrTransportRead)
+      return 3;
+    pooled->Drain();
+    delete pooled;
+    if ((svc.svc45_.errors_ != 0) || (svc.svc45_.next_ != kCalls + 1))
+      return 4;
+  }
+  return 0;
+}
+
+namespace {
+
+const int kSendThreads = 8;
+const int kSendsPerThread = 300;
+
+struct SenderCtx {
+  QueueChannel* channel;
+  int thread;
+  volatile long* go;
+  volatile long* errors;
+};
+
+void SenderThread(void* p) {
+  SenderCtx* ctx = static_cast<SenderCtx*>(p);
+  while (!ipc::AtomicLoad(ctx->go)) {
+    ipc::YieldThread();
+  }
+  PoolCli46 sender;
+  for (int ix = 0; ix != kSendsPerThread; ++ix) {
+    if (sender.DoSend(ctx->channel, ctx->thread * kSendsPerThread + ix) != ipc::RcOK)
+      ipc::AtomicAdd(ctx->errors, 1);
+  }
+}
+
+// Checks that the messages of each thread arrive whole and in the order they were sent.
+class SeqCheck47 : public DispTestMsg,
+                   public ipc::MsgIn<47, SeqCheck47, QueueChannel> {
+public:
+  SeqCheck47() : count_(0), errors_(0) {
+    for (int ix = 0; ix != kSendThreads; ++ix) {
+      next_[ix] = 0;
+    }
+  }
+
+  size_t OnMsg(QueueChannel*, int v, const char* str) {
+    const int thread = v / kSendsPerThread;
+    if ((thread >= kSendThreads) || (next_[thread] != v % kSendsPerThread) ||
+        (IPCString(str) != "pooled")) {
+      ++errors_;
+    } else {
+      ++next_[thread];
+    }
+    ++count_;
+    return ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int next_[kSendThreads];
+  int count_;
+  int errors_;
+};
+
+}  // namespace
+
+int TestChannelConcurrentSend() {
+  QueueTransport transport;
+  QueueChannel channel(&transport);
+  volatile long go = 0;
+  volatile long errors = 0;
+
+  SenderCtx ctx[kSendThreads];
+  ipc::ThreadHandle threads[kSendThreads];
+  for (int ix = 0; ix != kSendThreads; ++ix) {
+    SenderCtx c = { &channel, ix, &go, &errors };
+    ctx[ix] = c;
+    if (!ipc::StartThread(&SenderThread, &ctx[ix], &threads[ix]))
+      return 1;
+  }
+  ipc::AtomicStore(&go, 1);
+  for (int ix = 0; ix != kSendThreads; ++ix) {
+    ipc::JoinThread(threads[ix]);
+  }
+  if (errors != 0)
+    return 2;
+
+  const int total = kSendThreads * kSendsPerThread;
+  if (transport.writes() > static_cast<size_t>(total))
+    return 3;
+
+  QueueTransport rx_transport;
+  rx_transport.SetInput(transport.output());
+  QueueChannel rx(&rx_transport);
+  SeqCheck47 check;
+  if (rx.Receive(&check) != ipc::RcErrTransportRead)
+    return 4;
+  if ((check.count_ != total) || (check.errors_ != 0))
+    return 5;
+  for (int ix = 0; ix != kSendThreads; ++ix) {
+    if (check.next_[ix] != kSendsPerThread)
+      return 6;
+  }
+  return 0;
+}
+
+DEFINE_IPC_MSG_CONV(59, 2) {
+  IPC_MSG_P1(ipc::ByteArray, ByteArray)
+  IPC_MSG_P2(int, Int32)
+};
+
+namespace {
+
+const size_t kBulkSz = 256 * 1024;
+const size_t kLaneChunkSz = 8 * 1024;
+
+// Holds the first write back until another thread is sending, like a pipe that is busy with
+// the first piece of a large transfer, and then long enough for that message to be queued.
+class BusyTransport : public QueueTransport {
+public:
+  BusyTransport() : writing_(NULL), sending_(NULL) {}
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    if (writing_ && !writes()) {
+      ipc::AtomicStore(writing_, 1);
+      while (!ipc::AtomicLoad(sending_)) {
+        ipc::YieldThread();
+      }
+      const unsigned int start = ipc::TickCountMs();
+      while (ipc::ElapsedMs(start) < 50) {
+        ipc::YieldThread();
+      }
+    }
+    return QueueTransport::Send(segs, count);
+  }
+
+  volatile long* writing_;
+  volatile long* sending_;
+};
+
+typedef ipc::Channel<BusyTransport, ipc::Encoder, ipc::Decoder> BusyChannel;
+
+class LaneCli : public ipc::MsgOut<BusyChannel> {
+public:
+  size_t SendBulk(BusyChannel* ch, const std::vector<char>& data) {
+    return SendMsg(59, ch, ipc::ByteArrayRef(data.size(), &data[0]), 59);
+  }
+
+  size_t SendUrgent(BusyChannel* ch, int v) {
+    return SendMsg(47, ch, v, "pooled");
+  }
+};
+
+struct UrgentCtx {
+  BusyChannel* channel;
+  volatile long* writing;
+  volatile long* sending;
+  size_t rc;
+};
+
+void UrgentThread(void* p) {
+  UrgentCtx* ctx = static_cast<UrgentCtx*>(p);
+  while (!ipc::AtomicLoad(ctx->writing)) {
+    ipc::YieldThread();
+  }
+  ipc::AtomicStore(ctx->sending, 1);
+  LaneCli cli;
+  ctx->rc = cli.SendUrgent(ctx->channel, 47);
+}
+
+// Both record the order in which the messages are dispatched.
+class LaneSvc47 : public DispTestMsg,
+                  public ipc::MsgIn<47, LaneSvc47, QueueChannel> {
+public:
+  explicit LaneSvc47(std::vector<int>* order) : order_(order) {}
+
+  size_t OnMsg(QueueChannel*, int v, const char* /*str*/) {
+    order_->push_back(v);
+    return ipc::OnMsgLoopNext;
+  }
+
+  std::vector<int>* order_;
+};
+
+class LaneSvc59 : public DispTestMsg,
+                  public ipc::MsgIn<59, LaneSvc59, QueueChannel> {
+public:
+  LaneSvc59(std::vector<int>* order, const std::vector<char>* expected)
+      : order_(order), expected_(expected) {}
+
+  size_t OnMsg(QueueChannel*, ipc::ByteArray ba, int v) {
+    const bool same = (ba.sz_ == expected_->size()) &&
+                      (0 == memcmp(ba.buf_, &(*expected_)[0], ba.sz_));
+    order_->push_back(same ? v : -v);
+    return ipc::OnMsgLoopNext;
+  }
+
+  std::vector<int>* order_;
+  const std::vector<char>* expected_;
+};
+
+class LaneDispatch : public ipc::MsgTable<QueueChannel, 59> {
+public:
+  LaneDispatch(std::vector<int>* order, const std::vector<char>* expected)
+      : svc47_(order), svc59_(order, expected) {
+    Add(&svc47_);
+    Add(&svc59_);
+  }
+
+private:
+  LaneSvc47 svc47_;
+  LaneSvc59 svc59_;
+};
+
+}  // namespace
+
+int TestChannelLanes() {
+  std::vector<char> data(kBulkSz);
+  for (size_t ix = 0; ix != data.size(); ++ix) {
+    data[ix] = static_cast<char>(ix * 7);
+  }
+
+  // Another thread sends a small message while the first piece of the large one is being
+  // written. It goes in right after that piece.
+  volatile long writing = 0;
+  volatile long sending = 0;
+  BusyTransport transport;
+  transport.writing_ = &writing;
+  transport.sending_ = &sending;
+  BusyChannel channel(&transport);
+  channel.SetLaneChunkSize(kLaneChunkSz);
+  UrgentCtx ctx = { &channel, &writing, &sending, ipc::RcErrTransportWrite };
+  ipc::ThreadHandle thread;
+  if (!ipc::StartThread(&UrgentThread, &ctx, &thread))
+    return 1;
+  LaneCli cli;
+  const size_t rc = cli.SendBulk(&channel, data);
+  ipc::JoinThread(thread);
+  if ((rc != ipc::RcOK) || (ctx.rc != ipc::RcOK))
+    return 2;
+  if (transport.writes() <= (kBulkSz / kLaneChunkSz))
+    return 3;
+
+  // The receiver puts the pieces back together but dispatches the small message first.
+  std::vector<int> order;
+  LaneDispatch dispatch(&order, &data);
+  QueueTransport rx_transport;
+  rx_transport.SetInput(transport.output());
+  QueueChannel rx(&rx_transport);
+  if (rx.Receive(&dispatch) != ipc::RcErrTransportRead)
+    return 4;
+  if ((order.size() != 2) || (order[0] != 47) || (order[1] != 59))
+    return 5;
+
+  // Without the lanes it is one message, and the same for the receiver.
+  BusyTransport whole_transport;
+  BusyChannel whole(&whole_transport);
+  if (cli.SendBulk(&whole, data) != ipc::RcOK)
+    return 6;
+  if (whole_transport.writes() != 1)
+    return 7;
+  order.clear();
+  rx_transport.SetInput(whole_transport.output());
+  if (rx.Receive(&dispatch) != ipc::RcErrTransportRead)
+    return 8;
+  if ((order.size() != 1) || (order[0] != 59))
+    return 9;
+  return 0;
+}
+
+namespace {
+
+// Holds every write back until |release_| is set, like a full pipe, or gives up after two
+// seconds and records that it did.
+class GateTransport : public QueueTransport {
+public:
+  GateTransport() : writing_(0), release_(0), timed_out_(false) {}
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    ipc::AtomicStore(&writing_, 1);
+    const unsigned int start = ipc::TickCountMs();
+    while (!ipc::AtomicLoad(&release_)) {
+      if (ipc::ElapsedMs(start) > 2000) {
+        timed_out_ = true;
+        break;
+      }
+      ipc::YieldThread();
+    }
+    return QueueTransport::Send(segs, count);
+  }
+
+  volatile long writing_;
+  volatile long release_;
+  bool timed_out_;
+};
+
+typedef ipc::Channel<GateTransport, ipc::Encoder, ipc::Decoder> GateChannel;
+
+class GateCli : public ipc::MsgOut<GateChannel> {
+public:
+  size_t Send47(GateChannel* ch, int v) {
+    return SendMsg(47, ch, v, "pooled");
+  }
+};
+
+struct FlushCtx {
+  GateChannel* channel;
+  size_t rc;
+};
+
+void FlushThread(void* p) {
+  FlushCtx* ctx = static_cast<FlushCtx*>(p);
+  ctx->rc = ctx->channel->FlushBatch();
+}
+
+}  // namespace
+
+int TestChannelBatchFlush() {
+  // While one thread flushes into a blocked transport another one can still queue.
+  GateTransport transport;
+  GateChannel channel(&transport);
+  GateCli cli;
+  channel.BeginBatch(64 * 1024, 0);
+  if (cli.Send47(&channel, 0) != ipc::RcOK)
+    return 1;
+  FlushCtx ctx = { &channel, ipc::RcErrTransportWrite };
+  ipc::ThreadHandle thread;
+  if (!ipc::StartThread(&FlushThread, &ctx, &thread))
+    return 2;
+  while (!ipc::AtomicLoad(&transport.writing_)) {
+    ipc::YieldThread();
+  }
+  const size_t rc = cli.Send47(&channel, 1);
+  ipc::AtomicStore(&transport.release_, 1);
+  ipc::JoinThread(thread);
+  if ((rc != ipc::RcOK) || (ctx.rc != ipc::RcOK))
+    return 3;
+  if (transport.timed_out_)
+    return 4;
+  if ((channel.EndBatch() != ipc::RcOK) || (transport.writes() != 2))
+    return 5;
+
+  // Both arrive, in order.
+  QueueTransport rx_transport;
+  rx_transport.SetInput(transport.output());
+  QueueChannel rx(&rx_transport);
+  SeqCheck47 check;
+  if (rx.Receive(&check) != ipc::RcErrTransportRead)
+    return 6;
+  if ((check.count_ != 2) || (check.errors_ != 0))
+    return 7;
+  return 0;
+}
@@ -45,6 +45,73 @@ public:
   void* OnNewTransport() { return NULL; }
 };
 
+DEFINE_IPC_MSG_CONV(12, 2) {
+  IPC_MSG_P1(ipc::ByteArray, ByteArray)
+  IPC_MSG_P2(int, Int32)
+};
+
+class DispTestMsg12 : public DispTestMsg,
+                      public ipc::MsgIn<12, DispTestMsg12, TestChannel> {
+public:
+  DispTestMsg12(const char* expected, size_t sz) : expected_(expected), sz_(sz) {}
+
+  size_t OnMsg(TestChannel*, ipc::ByteArray ba, int ix) {
+    if ((ba.sz_ != sz_) || (ix != 12))
+      return 2;
+    return (0 == memcmp(ba.buf_, expected_, sz_)) ? ipc::OnMsgReady : 3;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+private:
+  const char* expected_;
+  size_t sz_;
+};
+
+DEFINE_IPC_MSG_CONV(41, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(42, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+// Answers each message 41 with a message 42 carrying twice the value.
+class DispTestMsg41 : public DispTestMsg,
+                      public ipc::MsgIn<41, DispTestMsg41, TestChannel>,
+                      public ipc::MsgOut<TestChannel> {
+public:
+  size_t OnMsg(TestChannel* ch, int v) {
+    SendMsg(42, ch, v * 2);
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+class DispTestMsg42 : public DispTestMsg,
+                      public ipc::MsgIn<42, DispTestMsg42, TestChannel>,
+                      public ipc::MsgOut<TestChannel> {
+public:
+  DispTestMsg42() : value_(0) {}
+
+  size_t DoCall(TestChannel* ch, int v) {
+    return CallMsg(41, ch, this, v);
+  }
+
+  size_t OnMsg(TestChannel*, int v) {
+    value_ = v;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int value() const { return value_; }
+
+private:
+  int value_;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Test the rx dispatch only
 
@@ -65,6 +132,13 @@ int TestForwardDispatch() {
     return 1;
   if (disp5.HasConvertError() || disp5.HasArgCountError())
     return 2;
+
+  // The second and third arguments have the wrong type, the first one is reported.
+  const ipc::WireType* const bad_args[] = { &a1, &a3, &a2 };
+  if (disp5.OnMsgIn(5, &ch, bad_args, 3))
+    return 3;
+  if (disp5.ConvertError() != ipc::TYPE_CHAR8)
+    return 4;
   return 0;
 }
 
@@ -92,3 +166,365 @@ int TestDispatchRoundTrip() {
   return 0;
 }
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test the table dispatcher
+
+class TestMsgTable : public ipc::MsgTable<TestChannel, 41, 3> {
+public:
+  TestMsgTable() {
+    Add(&disp3_);
+    Add(&disp41_);
+  }
+
+  DispTestMsg3 disp3_;
+  DispTestMsg41 disp41_;
+};
+
+int TestMsgTableDispatch() {
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMsgTable table;
+
+  // Found without asking the handlers.
+  if ((table.MsgHandler(3) != &table) || (table.MsgHandler(41) != &table))
+    return 1;
+  if (table.MsgHandler(2) || table.MsgHandler(12) || table.MsgHandler(42) ||
+      table.MsgHandler(-1))
+    return 2;
+
+  TestMessage3 msg3;
+  msg3.DoSend(&channel, 56789, "1234");
+  if (channel.Receive(&table) != 77)
+    return 3;
+
+  // There is no handler for 12, the channel drops it and can go on.
+  TestMessage12 msg12;
+  msg12.DoSend(&channel, "abc", 3, 1);
+  if (channel.Receive(&table) != ipc::RcErrBadMessageId)
+    return 4;
+  msg3.DoSend(&channel, 56789, "1234");
+  if (channel.Receive(&table) != 77)
+    return 5;
+
+  // Direct calls check the id too.
+  ipc::WireType a0(7);
+  const ipc::WireType* const args[] = { &a0 };
+  if (table.OnMsgIn(40, &channel, args, 1) != ipc::RcErrBadMessageId)
+    return 6;
+  if (table.OnMsgIn(41, &channel, args, 1) != ipc::OnMsgReady)
+    return 7;
+  if (!table.IsOrderedMsg(41))
+    return 8;
+
+  // The arguments of an unknown id are skipped as they are decoded, but not those of a reply.
+  TestChannel::RxHandler rx;
+  rx.SetDispatch(&table);
+  const int one = 1;
+  if (!rx.OnMessageStart(12, 2) || !rx.OnString8("abc", 3, ipc::TYPE_BARRAY) ||
+      !rx.OnWord(&one, ipc::TYPE_INT32))
+    return 9;
+  if (!rx.Rejected() || rx.GetArgCount())
+    return 10;
+  rx.Clear();
+  rx.OnMessageStart(12, 1);
+  rx.OnCallId(5 | TestChannel::kCallReplyBit);
+  rx.OnWord(&one, ipc::TYPE_INT32);
+  if (rx.Rejected() || (rx.GetArgCount() != 1))
+    return 11;
+  rx.Clear();
+  rx.OnMessageStart(41, 1);
+  rx.OnWord(&one, ipc::TYPE_INT32);
+  if (rx.Rejected() || (rx.GetArgCount() != 1))
+    return 12;
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test that the channel recovers the decoder state after a bad message
+
+int TestChannelReuse() {
+  const int ix  = 56789;
+  const char tx[] = "1234";
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage3 msg3;
+  DispTestMsg3 disp3;
+
+  for (int it = 0; it != 3; ++it) {
+    msg3.DoSend(&channel, ix, tx);
+    if (channel.Receive(&disp3) != 77)
+      return 1;
+  }
+
+  char garbage[64];
+  memset(garbage, 'x', sizeof(garbage));
+  transport.Send(garbage, sizeof(garbage));
+  if (channel.Receive(&disp3) != ipc::RcErrDecoderFormat)
+    return 2;
+
+  msg3.DoSend(&channel, ix, tx);
+  if (channel.Receive(&disp3) != 77)
+    return 3;
+  if (disp3.HasConvertError() || disp3.HasArgCountError())
+    return 4;
+
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test that large messages are received with few reads and that short reads work
+
+int TestChannelLargeRead() {
+  static char big[300000];
+  for (size_t ix = 0; ix != sizeof(big); ++ix) {
+    big[ix] = static_cast<char>(ix % 253);
+  }
+
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage12 msg12;
+  DispTestMsg12 disp12(big, sizeof(big));
+
+  // The first read gets the header, the second one the rest.
+  msg12.DoSend(&channel, big, sizeof(big), 12);
+  if (channel.Receive(&disp12) != ipc::OnMsgReady)
+    return 1;
+  if (transport.reads() != 2)
+    return 2;
+
+  // Now the reads are capped at 64KB.
+  channel.SetMaxReadSize(64 * 1024);
+  msg12.DoSend(&channel, big, sizeof(big), 12);
+  if (channel.Receive(&disp12) != ipc::OnMsgReady)
+    return 3;
+  if (transport.reads() != (2 + 1 + 5))
+    return 4;
+
+  // And the transport returns less than asked for, not even whole words.
+  transport.set_max_read(1001);
+  msg12.DoSend(&channel, big, sizeof(big), 12);
+  if (channel.Receive(&disp12) != ipc::OnMsgReady)
+    return 5;
+  if (disp12.HasConvertError() || disp12.HasArgCountError())
+    return 6;
+
+  return 0;
+}
+
+int TestChannelBatch() {
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage3 msg3;
+  DispTestMsg3 disp3;
+
+  // Three messages queued, one write when the batch ends.
+  {
+    ipc::ScopedMsgBatch<TestChannel> batch(&channel, 64 * 1024, 0);
+    for (int ix = 0; ix != 3; ++ix) {
+      if (msg3.DoSend(&channel, 56789, "1234") != ipc::RcOK)
+        return 1;
+    }
+    if (transport.sends() != 0)
+      return 2;
+  }
+  if (transport.sends() != 1)
+    return 3;
+  for (int ix = 0; ix != 3; ++ix) {
+    if (channel.Receive(&disp3) != 77)
+      return 4;
+  }
+
+  // A batch that fills up is written right away.
+  channel.BeginBatch(1, 0);
+  msg3.DoSend(&channel, 56789, "1234");
+  if (transport.sends() != 2)
+    return 5;
+  if (channel.Receive(&disp3) != 77)
+    return 6;
+
+  // Receive() flushes the queue before reading.
+  channel.BeginBatch(64 * 1024, 0);
+  msg3.DoSend(&channel, 56789, "1234");
+  if (transport.sends() != 2)
+    return 7;
+  if (channel.Receive(&disp3) != 77)
+    return 8;
+  if (transport.sends() != 3)
+    return 9;
+  channel.EndBatch();
+  if (transport.sends() != 3)
+    return 10;
+
+  // Explicit batch, still one write.
+  ipc::WireType a0(56789);
+  ipc::WireType a1("1234");
+  const ipc::WireType* const args[] = { &a0, &a1 };
+  TestChannel::BatchMsg msgs[] = { { 3, args, 2 }, { 3, args, 2 } };
+  if (channel.SendBatch(msgs, 2) != ipc::RcOK)
+    return 11;
+  if (transport.sends() != 4)
+    return 12;
+  for (int ix = 0; ix != 2; ++ix) {
+    if (channel.Receive(&disp3) != 77)
+      return 13;
+  }
+
+  return 0;
+}
+
+// Moves the last message sent on |from| to a buffer of messages for the other side.
+void TakeSent(TestTransport* from, std::vector<char>* to) {
+  size_t size = 0;
+  const char* data = from->Receive(&size);
+  to->insert(to->end(), data, data + size);
+}
+
+int TestChannelCalls() {
+  TestTransport client_transport;
+  TestChannel client(&client_transport);
+  TestTransport server_transport;
+  TestChannel server(&server_transport);
+  DispTestMsg41 server_disp;
+
+  // Three calls in flight, with three different reply objects.
+  DispTestMsg42 replies[3];
+  std::vector<char> requests;
+  for (int ix = 0; ix != 3; ++ix) {
+    if (replies[ix].DoCall(&client, ix + 1) != ipc::RcOK)
+      return 1;
+    TakeSent(&client_transport, &requests);
+  }
+  if (client.PendingCalls() != 3)
+    return 2;
+
+  // The server reads the three requests at once and answers them one by one. The replies
+  // carry the call ids back.
+  std::vector<char> answers[3];
+  server_transport.Send(&requests[0], requests.size());
+  for (int ix = 0; ix != 3; ++ix) {
+    if (server.Receive(&server_disp) != ipc::OnMsgReady)
+      return 3;
+    TakeSent(&server_transport, &answers[ix]);
+  }
+
+  // The replies arrive out of order and each one completes its own call.
+  std::vector<char> stream(answers[2]);
+  stream.insert(stream.end(), answers[0].begin(), answers[0].end());
+  stream.insert(stream.end(), answers[1].begin(), answers[1].end());
+  client_transport.Send(&stream[0], stream.size());
+  DispTestMsg42 other;
+  if (client.WaitCalls(&other) != ipc::OnMsgReady)
+    return 4;
+  if (client.PendingCalls() != 0)
+    return 5;
+  for (int ix = 0; ix != 3; ++ix) {
+    if (replies[ix].value() != (ix + 1) * 2)
+      return 6;
+  }
+  if (other.value() != 0)
+    return 7;
+
+  // A reply nobody is waiting for is an error.
+  client_transport.Send(&answers[1][0], answers[1].size());
+  if (client.Receive(&other) != ipc::RcErrBadCallId)
+    return 8;
+
+  // Messages sent outside of a handler are not replies.
+  TestMessage3 msg3;
+  DispTestMsg3 disp3;
+  msg3.DoSend(&server, 56789, "1234");
+  std::vector<char> notice;
+  TakeSent(&server_transport, &notice);
+  client_transport.Send(&notice[0], notice.size());
+  if (client.Receive(&disp3) != 77)
+    return 9;
+
+  return 0;
+}
+
+#if defined(IPC_USE_VARIADIC)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Test a message with more arguments than the C++98 MsgIn and MsgOut support
+
+DEFINE_IPC_MSG_CONV(50, 14) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(int, Int32)
+  IPC_MSG_P3(int, Int32)
+  IPC_MSG_P4(int, Int32)
+  IPC_MSG_P5(int, Int32)
+  IPC_MSG_P6(int, Int32)
+  IPC_MSG_P7(int, Int32)
+  IPC_MSG_P8(int, Int32)
+  IPC_MSG_P9(int, Int32)
+  IPC_MSG_P10(int, Int32)
+  IPC_MSG_PARAM(10, const char*, String8)
+  IPC_MSG_PARAM(11, unsigned int, UInt32)
+  IPC_MSG_PARAM(12, const char*, String8)
+  IPC_MSG_PARAM(13, long long, Int64)
+};
+
+class TestMessage50 : public ipc::MsgOut<TestChannel> {
+public:
+  size_t DoSend(TestChannel* ch, int base, const char* name) {
+    return SendMsg(50, ch, base, base + 1, base + 2, base + 3, base + 4, base + 5, base + 6,
+                   base + 7, base + 8, base + 9, name, 0xCAFEu, "context", -1LL);
+  }
+};
+
+class DispTestMsg50 : public DispTestMsg,
+                      public ipc::MsgIn<50, DispTestMsg50, TestChannel> {
+public:
+  size_t OnMsg(TestChannel*, int a0, int a1, int a2, int a3, int a4, int a5, int a6, int a7,
+               int a8, int a9, const char* name, unsigned int flags, const char* ctx,
+               long long big) {
+    const int ints[] = { a0, a1, a2, a3, a4, a5, a6, a7, a8, a9 };
+    for (int ix = 0; ix != 10; ++ix) {
+      if (ints[ix] != (100 + ix))
+        return 2;
+    }
+    if ((IPCString(name) != "host") || (flags != 0xCAFEu))
+      return 3;
+    if ((IPCString(ctx) != "context") || (big != -1LL))
+      return 4;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+int TestVariadicDispatch() {
+  TestTransport transport;
+  TestChannel channel(&transport);
+  TestMessage50 msg50;
+  DispTestMsg50 disp50;
+  msg50.DoSend(&channel, 100, "host");
+  if (channel.Receive(&disp50) != ipc::OnMsgReady)
+    return 1;
+  if (disp50.HasConvertError() || disp50.HasArgCountError())
+    return 2;
+
+  // A wrong type past the tenth argument is found before OnMsg() is called.
+  ipc::WireType wts[14] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, "a", 1u, "b", 1 };
+  const ipc::WireType* args[14];
+  for (int ix = 0; ix != 14; ++ix) {
+    args[ix] = &wts[ix];
+  }
+  if (disp50.OnMsgIn(50, &channel, args, 14))
+    return 3;
+  if (disp50.ConvertError() != ipc::TYPE_INT64)
+    return 4;
+
+  // The receiving channel rejects more than kMaxNumArgs arguments.
+  ipc::WireType one(1);
+  const ipc::WireType* many[TestChannel::kMaxNumArgs + 1];
+  for (size_t ix = 0; ix != TestChannel::kMaxNumArgs + 1; ++ix) {
+    many[ix] = &one;
+  }
+  channel.Send(50, many, TestChannel::kMaxNumArgs + 1);
+  if (channel.Receive(&disp50) != ipc::RcErrDecoderFormat)
+    return 5;
+  return 0;
+}
+#endif  // defined(IPC_USE_VARIADIC)
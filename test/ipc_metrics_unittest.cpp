@@ -0,0 +1,234 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_metrics.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests of the channel metrics, see ipc_metrics.h. One thread drives both ends of a
+// LinkTransport.
+
+namespace {
+
+typedef ipc::Channel<LinkTransport, ipc::Encoder, ipc::Decoder, ipc::ChannelMetrics>
+    MetricsChannel;
+typedef ipc::Channel<LinkTransport, ipc::Encoder, ipc::Decoder> PlainChannel;
+
+// A LinkTransport that can be polled, so the channel can spin on it.
+class PollLinkTransport : public LinkTransport {
+public:
+  size_t TryReceiveInto(char* buf, size_t* size) {
+    if (!Pending()) {
+      *size = 0;
+      return ipc::RcOK;
+    }
+    return ReceiveInto(buf, size);
+  }
+};
+
+typedef ipc::Channel<PollLinkTransport, ipc::Encoder, ipc::Decoder, ipc::ChannelMetrics>
+    SpinChannel;
+
+}  // namespace
+
+namespace ipc {
+
+template <>
+struct PollTransport<PollLinkTransport> : public PollByTryReceive<PollLinkTransport> {};
+
+}  // namespace ipc.
+
+DEFINE_IPC_MSG_CONV(55, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+namespace {
+
+template <class ChannelT>
+class MetricsSvc : public DispTestMsg,
+                   public ipc::MsgIn<55, MetricsSvc<ChannelT>, ChannelT>,
+                   public ipc::MsgOut<ChannelT> {
+public:
+  MetricsSvc() : last_(0) {}
+
+  size_t Ping(ChannelT* ch, int v) {
+    return this->SendMsg(55, ch, v);
+  }
+
+  size_t OnMsg(ChannelT*, int v) {
+    last_ = v;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int last_;
+};
+
+}  // namespace
+
+int TestMetricsHistogram() {
+  typedef ipc::HistogramCounts HC;
+  // Every value lands in a bucket that starts at most 1/kSubBuckets below it.
+  unsigned int values[] = { 0, 1, 7, 8, 9, 15, 16, 17, 100, 1000, 4095, 4096, 65537,
+                            1234567, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF };
+  size_t last = 0;
+  for (size_t ix = 0; ix != sizeof(values) / sizeof(values[0]); ++ix) {
+    const size_t bucket = HC::BucketOf(values[ix]);
+    if (bucket >= HC::kBuckets)
+      return 1;
+    if (bucket < last)
+      return 2;
+    last = bucket;
+    const unsigned int start = HC::BucketStart(bucket);
+    if ((start > values[ix]) || ((values[ix] - start) > values[ix] / HC::kSubBuckets))
+      return 3;
+  }
+  if (HC::BucketOf(0xFFFFFFFF) != HC::kBuckets - 1)
+    return 4;
+
+  ipc::Histogram histogram;
+  for (unsigned int v = 1; v <= 1000; ++v) {
+    histogram.Record(v);
+  }
+  HC counts;
+  histogram.CopyTo(&counts);
+  if (counts.Total() != 1000)
+    return 5;
+  const unsigned int p50 = counts.Percentile(50);
+  if ((p50 > 500) || (p50 < 500 - 500 / HC::kSubBuckets))
+    return 6;
+  const unsigned int p99 = counts.Percentile(99);
+  if ((p99 > 990) || (p99 < 990 - 990 / HC::kSubBuckets))
+    return 7;
+  if (counts.Percentile(0) != 1)
+    return 8;
+  HC empty;
+  ipc::Histogram().CopyTo(&empty);
+  if (empty.Percentile(50) != 0)
+    return 9;
+  return 0;
+}
+
+int TestChannelMetrics() {
+  LinkTransport tr1;
+  LinkTransport tr2;
+  LinkTransport::Connect(&tr1, &tr2);
+  MetricsChannel ch1(&tr1);
+  MetricsChannel ch2(&tr2);
+  MetricsSvc<MetricsChannel> svc;
+
+  for (int ix = 0; ix != 3; ++ix) {
+    if (ipc::RcOK != svc.Ping(&ch1, ix))
+      return 1;
+  }
+  for (int ix = 0; ix != 3; ++ix) {
+    if ((ch2.Receive(&svc) != ipc::OnMsgReady) || (svc.last_ != ix))
+      return 2;
+  }
+
+  ipc::MetricsSnapshot sent;
+  ipc::MetricsSnapshot received;
+  if (!ch1.metrics().Snapshot(&sent) || !ch2.metrics().Snapshot(&received))
+    return 3;
+  if ((sent.msgs_sent != 3) || (sent.sent_by_id[55] != 3) || (sent.writes != 3) ||
+      (sent.write_errors != 0) || (sent.encode_us.Total() != 3) ||
+      (sent.msgs_per_write.Total() != 3) || (sent.msgs_per_write.Percentile(100) != 1))
+    return 4;
+  if ((received.msgs_received != 3) || (received.received_by_id[55] != 3) ||
+      (received.bytes_received != sent.bytes_sent) || (received.reads_per_msg.Total() != 3) ||
+      (received.decode_us.Total() != 3) || (received.dispatch_us.Total() != 3) ||
+      (received.read_sz.Total() != received.reads) || (received.decode_errors != 0))
+    return 5;
+  // The messages were all waiting so the first read took them all.
+  if ((received.reads != 1) || (received.reads_per_msg.counts[0] != 2))
+    return 6;
+
+  // The other end asks for the snapshot. It comes back as the reply of a call.
+  ipc::MetricsQuery query;
+  if (ipc::RcOK != ch2.QueryMetrics(&query))
+    return 7;
+  if (ch1.Receive(&svc) != ipc::RcErrTransportRead)
+    return 8;
+  if ((ch2.WaitCalls(&svc) != ipc::OnMsgReady) || !query.ok())
+    return 9;
+  if ((query.snapshot().msgs_sent != 3) || (query.snapshot().msgs_received != 1) ||
+      (query.snapshot().received_by_id[ipc::kMessagePrivControl] != 1))
+    return 10;
+
+  // A channel without metrics answers with no snapshot.
+  LinkTransport tr3;
+  LinkTransport tr4;
+  LinkTransport::Connect(&tr3, &tr4);
+  MetricsChannel ch3(&tr3);
+  PlainChannel ch4(&tr4);
+  MetricsSvc<PlainChannel> plain_svc;
+  if (ipc::RcOK != ch3.QueryMetrics(&query))
+    return 11;
+  if (ch4.Receive(&plain_svc) != ipc::RcErrTransportRead)
+    return 12;
+  if ((ch3.WaitCalls(&svc) != ipc::OnMsgReady) || query.ok())
+    return 13;
+
+  // Garbage is a decode error.
+  const char junk[64] = { 'x' };
+  ipc::IOSegment seg = { junk, sizeof(junk) };
+  tr1.Send(&seg, 1);
+  if (ch2.Receive(&svc) != ipc::RcErrDecoderFormat)
+    return 14;
+  if (!ch2.metrics().Snapshot(&received) || (received.decode_errors != 1))
+    return 15;
+  return 0;
+}
+
+int TestChannelReceiveSpin() {
+  PollLinkTransport tr1;
+  PollLinkTransport tr2;
+  LinkTransport::Connect(&tr1, &tr2);
+  SpinChannel ch1(&tr1);
+  SpinChannel ch2(&tr2);
+  MetricsSvc<SpinChannel> svc;
+  ch2.SetReceiveSpin(1000);
+
+  // The message is already there, so the spin gets it.
+  if (ipc::RcOK != svc.Ping(&ch1, 7))
+    return 1;
+  if ((ch2.Receive(&svc) != ipc::OnMsgReady) || (svc.last_ != 7))
+    return 2;
+  ipc::MetricsSnapshot snapshot;
+  if (!ch2.metrics().Snapshot(&snapshot))
+    return 3;
+  if ((snapshot.spin_hits != 1) || (snapshot.spin_misses != 0) ||
+      (snapshot.spin_us.Total() != 1))
+    return 4;
+
+  // Nothing comes, so after spinning it blocks, which a LinkTransport cannot do.
+  const unsigned int start = ipc::TickCountUs();
+  if (ch2.Receive(&svc) != ipc::RcErrTransportRead)
+    return 5;
+  if (ipc::TickCountUs() - start < 1000)
+    return 6;
+  ch2.metrics().Snapshot(&snapshot);
+  if ((snapshot.spin_hits != 1) || (snapshot.spin_misses != 1))
+    return 7;
+
+  // Turned off it goes straight to the blocking read.
+  ch2.SetReceiveSpin(0);
+  if (ch2.Receive(&svc) != ipc::RcErrTransportRead)
+    return 8;
+  ch2.metrics().Snapshot(&snapshot);
+  if ((snapshot.spin_hits != 1) || (snapshot.spin_misses != 1))
+    return 9;
+  return 0;
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_codec_compact.h"
+#include "ipc_msg_schema.h"
+
+typedef ipc::Channel<TestTransport, ipc::CompactEncoder, ipc::CompactDecoder> SchemaChannel;
+
+IPC_MSG_DEF10(56, SchemaMsg56,
+              int, Int32,
+              unsigned int, UInt32,
+              char, Char8,
+              const char*, String8,
+              const char*, String8,
+              const wchar_t*, String16,
+              ipc::ByteArray, ByteArray,
+              long long, Int64,
+              double, Float64,
+              ipc::UInt32Array, UInt32Array);
+
+IPC_MSG_DEF2(57, SchemaAddMsg, int, Int32, int, Int32);
+
+IPC_MSG_DEF1(58, SchemaSumMsg, long long, Int64);
+
+const char kSchemaBytes[] = "\x01\x02\x03\x04\x05";
+const unsigned int kSchemaWords[] = { 7, 0xFFFFFFFF, 9 };
+
+// Sends what SchemaMsg56 sends but with WireType arguments.
+class SchemaMessage56 : public ipc::MsgOut<SchemaChannel> {
+public:
+  size_t DoSend(SchemaChannel* ch) {
+    return SendMsg(56, ch, -3, 4000000000u, 'x', "str", static_cast<const char*>(NULL),
+                   L"wide", ipc::ByteArray(sizeof(kSchemaBytes), kSchemaBytes),
+                   -1234567890123LL, 0.25, ipc::UInt32Array(3, kSchemaWords));
+  }
+};
+
+template <class ChannelT>
+class SchemaSvc56 : public DispTestMsg,
+                    public SchemaMsg56::In<SchemaSvc56<ChannelT>, ChannelT> {
+public:
+  size_t OnMsg(ChannelT*, int a, unsigned int b, char c, const char* d, const char* e,
+               const wchar_t* f, ipc::ByteArray g, long long h, double i, ipc::UInt32Array j) {
+    if ((a != -3) || (b != 4000000000u) || (c != 'x') || (IPCString(d) != "str") || e)
+      return 2;
+#if defined(IPC_BIG_ENDIAN)
+    // The big-endian packing keeps 16 bits per character.
+    if ((sizeof(wchar_t) == 2) && (IPCWString(f) != L"wide"))
+      return 3;
+#else
+    if (IPCWString(f) != L"wide")
+      return 3;
+#endif
+    if ((g.sz_ != sizeof(kSchemaBytes)) || memcmp(g.buf_, kSchemaBytes, g.sz_))
+      return 3;
+    if ((h != -1234567890123LL) || (i != 0.25) || (j.sz_ != 3) ||
+        memcmp(j.buf_, kSchemaWords, sizeof(kSchemaWords)))
+      return 4;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+// Answers each SchemaAddMsg with the sum.
+class SchemaAddSvc : public DispTestMsg,
+                     public SchemaAddMsg::In<SchemaAddSvc, TestChannel> {
+public:
+  size_t OnMsg(TestChannel* ch, int a, int b) {
+    if (SchemaSumMsg::Send(ch, static_cast<long long>(a) + b) != ipc::RcOK)
+      return 2;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+class SchemaSumReply : public DispTestMsg,
+                       public SchemaSumMsg::In<SchemaSumReply, TestChannel> {
+public:
+  SchemaSumReply() : sum_(0) {}
+
+  size_t OnMsg(TestChannel*, long long sum) {
+    sum_ = sum;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  long long sum() const { return sum_; }
+
+private:
+  long long sum_;
+};
+
+int TestMsgSchemaEncoding() {
+  // The compact codec only writes the bytes the value uses, so both messages must be equal.
+  TestTransport transport;
+  SchemaChannel channel(&transport);
+  SchemaMessage56 msg56;
+  if (msg56.DoSend(&channel) != ipc::RcOK)
+    return 1;
+  size_t size = 0;
+  const char* data = transport.Receive(&size);
+  std::vector<char> expected(data, data + size);
+
+  if (SchemaMsg56::Send(&channel, -3, 4000000000u, 'x', "str", NULL, L"wide",
+                        ipc::ByteArray(sizeof(kSchemaBytes), kSchemaBytes), -1234567890123LL,
+                        0.25, ipc::UInt32Array(3, kSchemaWords)) != ipc::RcOK)
+    return 2;
+  transport.Receive(&size);
+  if ((size != expected.size()) || !transport.Compare(expected, 0))
+    return 3;
+
+  SchemaSvc56<SchemaChannel> compact_svc;
+  if (channel.Receive(&compact_svc) != ipc::OnMsgReady)
+    return 4;
+
+  // And the plain codec decodes them too.
+  TestTransport plain_transport;
+  TestChannel plain(&plain_transport);
+  SchemaMsg56 values(-3, 4000000000u, 'x', "str", NULL, L"wide",
+                     ipc::ByteArray(sizeof(kSchemaBytes), kSchemaBytes), -1234567890123LL,
+                     0.25, ipc::UInt32Array(3, kSchemaWords));
+  if (values.SendTo(&plain) != ipc::RcOK)
+    return 5;
+  SchemaSvc56<TestChannel> plain_svc;
+  if (plain.Receive(&plain_svc) != ipc::OnMsgReady)
+    return 6;
+  if (plain_svc.HasConvertError() || plain_svc.HasArgCountError())
+    return 7;
+  return 0;
+}
+
+int TestMsgSchemaCall() {
+  TestTransport client_transport;
+  TestChannel client(&client_transport);
+  TestTransport server_transport;
+  TestChannel server(&server_transport);
+
+  SchemaSumReply reply;
+  if (SchemaAddMsg::Call(&client, &reply, 2000000000, 2000000000) != ipc::RcOK)
+    return 1;
+  if (client.PendingCalls() != 1)
+    return 2;
+
+  size_t size = 0;
+  const char* data = client_transport.Receive(&size);
+  server_transport.Send(data, size);
+  SchemaAddSvc svc;
+  if (server.Receive(&svc) != ipc::OnMsgReady)
+    return 3;
+
+  // The reply sent from the handler carries the call id.
+  data = server_transport.Receive(&size);
+  client_transport.Send(data, size);
+  SchemaSumReply other;
+  if (client.WaitCalls(&other) != ipc::OnMsgReady)
+    return 4;
+  if ((reply.sum() != 4000000000LL) || (other.sum() != 0))
+    return 5;
+  return 0;
+}
@@ -0,0 +1,231 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests of the streams, see ipc_stream.h. One thread drives both ends of a LinkTransport.
+
+namespace {
+
+typedef ipc::Channel<LinkTransport, ipc::Encoder, ipc::Decoder> LinkChannel;
+
+}  // namespace
+
+DEFINE_IPC_MSG_CONV(51, 2) {
+  IPC_MSG_P1(unsigned int, UInt32)
+  IPC_MSG_P2(unsigned int, UInt32)
+};
+
+DEFINE_IPC_MSG_CONV(52, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+namespace {
+
+const unsigned int kStreamSz = 1000 * 1000 + 7;
+const unsigned int kWindow = 64 * 1024;
+
+char StreamByte(size_t ix) {
+  return static_cast<char>((ix * 13) ^ (ix >> 9));
+}
+
+// The sending side. Offers the stream with message 51 and writes it as credit comes; a ping
+// (message 52) goes after each write to show that regular messages interleave with the data.
+class StreamWriter : public ipc::StreamSource, public ipc::MsgOut<LinkChannel> {
+public:
+  StreamWriter(LinkChannel* ch, const char* data, size_t sz)
+      : ch_(ch), data_(data), sz_(sz), pos_(0), id_(0), pings_(0), error_(0) {}
+
+  size_t Offer() {
+    id_ = ch_->OpenStream(this);
+    if (!id_)
+      return ipc::RcErrTooManyStreams;
+    return SendMsg(51, ch_, id_, static_cast<unsigned int>(sz_));
+  }
+
+  virtual size_t OnStreamCredit(unsigned int id, size_t /*credit*/) {
+    if (id != id_)
+      error_ = 1;
+    size_t written = 0;
+    size_t rc = ch_->WriteStream(id, data_ + pos_, sz_ - pos_, &written);
+    if (rc != ipc::RcOK)
+      return rc;
+    pos_ += written;
+    SendMsg(52, ch_, pings_++);
+    if (pos_ == sz_)
+      return ch_->CloseStream(id, 7);
+    return ipc::OnMsgLoopNext;
+  }
+
+  size_t id() const { return id_; }
+  int pings() const { return pings_; }
+  int error() const { return error_; }
+
+private:
+  LinkChannel* ch_;
+  const char* data_;
+  size_t sz_;
+  size_t pos_;
+  unsigned int id_;
+  int pings_;
+  int error_;
+};
+
+// Nothing but stream credits ever reaches the sending side.
+class WriterDispatch {
+public:
+  WriterDispatch* MsgHandler(int /*msg_id*/) { return NULL; }
+  size_t OnMsgIn(int, LinkChannel*, const ipc::WireType* const[], int) { return 0; }
+  void* OnNewTransport() { return NULL; }
+};
+
+}  // namespace
+
+// The receiving side. Accepts the stream offered by message 51 and checks every byte.
+class StreamReader : public DispTestMsg,
+                     public ipc::StreamSink,
+                     public ipc::MsgIn<51, StreamReader, LinkChannel> {
+public:
+  StreamReader() : sz_(0), pos_(0), ended_(false), status_(0), error_(0) {}
+
+  size_t OnMsg(LinkChannel* ch, unsigned int id, unsigned int sz) {
+    sz_ = sz;
+    return ch->AcceptStream(id, this, kWindow);
+  }
+
+  virtual size_t OnStreamData(unsigned int /*id*/, const char* data, size_t sz) {
+    if (sz > LinkChannel::kStreamChunkSz)
+      error_ = 1;
+    for (size_t ix = 0; ix != sz; ++ix) {
+      if (data[ix] != StreamByte(pos_ + ix))
+        error_ = 2;
+    }
+    pos_ += sz;
+    return ipc::OnMsgLoopNext;
+  }
+
+  virtual size_t OnStreamEnd(unsigned int /*id*/, int status) {
+    if (pos_ != sz_)
+      error_ = 3;
+    ended_ = true;
+    status_ = status;
+    return ipc::OnMsgReady;
+  }
+
+  size_t pos() const { return pos_; }
+  bool ended() const { return ended_; }
+  int status() const { return status_; }
+  int error() const { return error_; }
+
+private:
+  size_t sz_;
+  size_t pos_;
+  bool ended_;
+  int status_;
+  int error_;
+};
+
+class PingCounter : public DispTestMsg,
+                    public ipc::MsgIn<52, PingCounter, LinkChannel> {
+public:
+  PingCounter() : next_(0) {}
+
+  size_t OnMsg(LinkChannel*, int seq) {
+    return (seq == next_++) ? ipc::OnMsgLoopNext : 2;
+  }
+
+  int count() const { return next_; }
+
+private:
+  int next_;
+};
+
+// A stream source that never writes.
+class IdleSource : public ipc::StreamSource {
+public:
+  virtual size_t OnStreamCredit(unsigned int /*id*/, size_t /*credit*/) {
+    return ipc::OnMsgLoopNext;
+  }
+};
+
+int TestChannelStream() {
+  static char data[kStreamSz];
+  for (size_t ix = 0; ix != kStreamSz; ++ix) {
+    data[ix] = StreamByte(ix);
+  }
+
+  LinkTransport writer_end;
+  LinkTransport reader_end;
+  LinkTransport::Connect(&writer_end, &reader_end);
+  LinkChannel writer_ch(&writer_end);
+  LinkChannel reader_ch(&reader_end);
+
+  StreamWriter writer(&writer_ch, data, kStreamSz);
+  WriterDispatch writer_disp;
+  StreamReader reader;
+  PingCounter pings;
+  ipc::MsgTable<LinkChannel, 52, 51> reader_disp;
+  reader_disp.Add(&reader);
+  reader_disp.Add(&pings);
+
+  if (writer.Offer() != ipc::RcOK)
+    return 1;
+
+  // Each side reads everything the other sent, until the reader sees the end of the stream.
+  size_t rc = ipc::RcErrTransportRead;
+  for (int turn = 0; turn != 1000; ++turn) {
+    rc = reader_ch.Receive(&reader_disp);
+    if (rc != ipc::RcErrTransportRead)
+      break;
+    rc = writer_ch.Receive(&writer_disp);
+    if (rc != ipc::RcErrTransportRead)
+      return 2;
+  }
+  if (rc != ipc::OnMsgReady)
+    return 3;
+  if (!reader.ended() || (reader.status() != 7) || (reader.pos() != kStreamSz))
+    return 4;
+  if (reader.error() || writer.error())
+    return 5;
+  // The pings went along with the data.
+  if ((pings.count() != writer.pings()) || (pings.count() < 3))
+    return 6;
+  // Never more than a window of data, plus the message framing, was waiting to be read.
+  if (reader_end.max_pending() > (kWindow + 1024))
+    return 7;
+
+  // The stream is gone on both sides.
+  size_t written = 0;
+  if (writer_ch.WriteStream(writer.id(), data, 10, &written) != ipc::RcErrBadStreamId)
+    return 8;
+  if (writer_ch.CloseStream(writer.id(), 0) != ipc::RcErrBadStreamId)
+    return 9;
+
+  // Writing past the window is cut off by the receiver.
+  IdleSource idle;
+  unsigned int id = writer_ch.OpenStream(&idle);
+  if (reader_ch.AcceptStream(id, &reader, 16) != ipc::RcOK)
+    return 10;
+  if (writer_ch.Receive(&writer_disp) != ipc::RcErrTransportRead)
+    return 11;
+  ipc::WireType op(static_cast<unsigned int>(ipc::STREAM_DATA));
+  ipc::WireType wt_id(id);
+  ipc::WireType chunk(ipc::ByteArray(17, data));
+  const ipc::WireType* const args[] = { &op, &wt_id, &chunk };
+  writer_ch.Send(ipc::kMessagePrivControl, args, 3);
+  if (reader_ch.Receive(&reader_disp) != ipc::RcErrStreamWindow)
+    return 12;
+  return 0;
+}
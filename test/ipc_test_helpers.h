@@ -22,12 +22,29 @@
 #include "ipc_msg_dispatch.h"
 
 
+// Holds the last message sent. Receive() returns all of it every time, while ReceiveInto()
+// reads it like a stream, in chunks of at most |max_read_| bytes.
 class TestTransport {
 public:
-  bool Send(const void* buf, size_t sz) {
+  TestTransport() : read_pos_(0), max_read_(static_cast<size_t>(-1)), reads_(0), sends_(0) {}
+
+  size_t Send(const void* buf, size_t sz) {
     const char* cb = reinterpret_cast<const char*>(buf);
     buf_.assign(cb, cb + sz);
-    return true;
+    read_pos_ = 0;
+    ++sends_;
+    return ipc::RcOK;
+  }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    buf_.clear();
+    read_pos_ = 0;
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* cb = reinterpret_cast<const char*>(segs[ix].buf_);
+      buf_.insert(buf_.end(), cb, cb + segs[ix].sz_);
+    }
+    ++sends_;
+    return ipc::RcOK;
   }
 
   char* Receive(size_t* size) {
@@ -35,6 +52,25 @@ public:
     return &buf_[0];
   }
 
+  size_t ReceiveInto(char* buf, size_t* size) {
+    size_t sz = buf_.size() - read_pos_;
+    if (sz > *size)
+      sz = *size;
+    if (sz > max_read_)
+      sz = max_read_;
+    if (!sz)
+      return ipc::RcErrTransportRead;
+    memcpy(buf, &buf_[read_pos_], sz);
+    read_pos_ += sz;
+    *size = sz;
+    ++reads_;
+    return ipc::RcOK;
+  }
+
+  void set_max_read(size_t max_read) { max_read_ = max_read; }
+  size_t reads() const { return reads_; }
+  size_t sends() const { return sends_; }
+
   bool Compare(const std::vector<char>& expected, size_t from) const {
     if (from >= buf_.size()) {
       return false;
@@ -53,6 +89,60 @@ public:
 private:
   typedef std::vector<char> Store;
   Store buf_;
+  size_t read_pos_;
+  size_t max_read_;
+  size_t reads_;
+  size_t sends_;
+};
+
+
+// One end of an in-memory connection: what is sent goes to the input of the peer. Reading
+// when there is nothing to read fails instead of blocking, so one thread can drive both ends.
+class LinkTransport {
+public:
+  LinkTransport() : peer_(NULL), read_pos_(0), max_pending_(0) {}
+
+  static void Connect(LinkTransport* a, LinkTransport* b) {
+    a->peer_ = b;
+    b->peer_ = a;
+  }
+
+  size_t Send(const ipc::IOSegment* segs, size_t count) {
+    std::vector<char>& in = peer_->in_;
+    for (size_t ix = 0; ix != count; ++ix) {
+      const char* cb = reinterpret_cast<const char*>(segs[ix].buf_);
+      in.insert(in.end(), cb, cb + segs[ix].sz_);
+    }
+    if (peer_->Pending() > peer_->max_pending_)
+      peer_->max_pending_ = peer_->Pending();
+    return ipc::RcOK;
+  }
+
+  size_t ReceiveInto(char* buf, size_t* size) {
+    size_t sz = Pending();
+    if (sz > *size)
+      sz = *size;
+    if (!sz)
+      return ipc::RcErrTransportRead;
+    memcpy(buf, &in_[read_pos_], sz);
+    read_pos_ += sz;
+    if (read_pos_ == in_.size()) {
+      in_.clear();
+      read_pos_ = 0;
+    }
+    *size = sz;
+    return ipc::RcOK;
+  }
+
+  // Bytes sent by the peer and not read yet, and the most there ever was.
+  size_t Pending() const { return in_.size() - read_pos_; }
+  size_t max_pending() const { return max_pending_; }
+
+private:
+  LinkTransport* peer_;
+  std::vector<char> in_;
+  size_t read_pos_;
+  size_t max_pending_;
 };
 
 
@@ -72,6 +162,7 @@ public:
 
   bool HasConvertError() const { return 0 != error_convert_; }
   bool HasArgCountError() const { return 0 != error_count_; }
+  int ConvertError() const { return error_convert_; }
 
 private:
   int error_convert_;
@@ -0,0 +1,172 @@
+// Copyright (c) 2010 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "ipc_test_helpers.h"
+#include "ipc_trace.h"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Tests of the trace capture and replay, see ipc_trace.h. One thread drives both ends of a
+// LinkTransport and the trace lives in a plain buffer.
+
+namespace {
+
+typedef ipc::TeeTransport<LinkTransport> TeeLink;
+typedef ipc::Channel<TeeLink, ipc::Encoder, ipc::Decoder> TeeChannel;
+typedef ipc::Channel<ipc::ReplayTransport, ipc::Encoder, ipc::Decoder> ReplayChannel;
+
+const int kTraceMsgs = 4;
+
+}  // namespace
+
+DEFINE_IPC_MSG_CONV(60, 2) {
+  IPC_MSG_P1(int, Int32)
+  IPC_MSG_P2(const char*, String8)
+};
+
+namespace {
+
+// Checks that the messages come in order and stops after the last one.
+template <class ChannelT>
+class TraceSvc : public DispTestMsg,
+                 public ipc::MsgIn<60, TraceSvc<ChannelT>, ChannelT>,
+                 public ipc::MsgOut<ChannelT> {
+public:
+  TraceSvc() : count_(0) {}
+
+  size_t Send(ChannelT* ch, int v) {
+    return this->SendMsg(60, ch, v, "traced");
+  }
+
+  size_t OnMsg(ChannelT*, int v, const char* str) {
+    if ((v != count_) || (0 != strcmp(str, "traced")))
+      return ipc::OnMsgAppErrorBase;
+    ++count_;
+    return (count_ == kTraceMsgs) ? ipc::OnMsgReady : ipc::OnMsgLoopNext;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int count_;
+};
+
+}  // namespace
+
+int TestTraceReplay() {
+  std::vector<char> sent_mem(64 * 1024);
+  std::vector<char> received_mem(64 * 1024);
+  ipc::TraceWriter sent_trace;
+  ipc::TraceWriter received_trace;
+  if (!sent_trace.Init(&sent_mem[0], sent_mem.size()) ||
+      !received_trace.Init(&received_mem[0], received_mem.size()))
+    return 1;
+
+  // Each end records what it moves. The messages are sent 2ms apart.
+  TeeLink tr1;
+  TeeLink tr2;
+  LinkTransport::Connect(&tr1, &tr2);
+  tr1.SetTrace(&sent_trace);
+  tr2.SetTrace(&received_trace);
+  TeeChannel ch1(&tr1);
+  TeeChannel ch2(&tr2);
+  TraceSvc<TeeChannel> svc;
+  for (int ix = 0; ix != kTraceMsgs; ++ix) {
+    if (ix) {
+      const unsigned int start = ipc::TickCountMs();
+      while (ipc::ElapsedMs(start) < 3) {
+        ipc::YieldThread();
+      }
+    }
+    if (svc.Send(&ch1, ix) != ipc::RcOK)
+      return 2;
+  }
+  if ((ch2.Receive(&svc) != ipc::OnMsgReady) || (svc.count_ != kTraceMsgs))
+    return 3;
+  if ((sent_trace.header()->records != kTraceMsgs) || (received_trace.header()->records < 1) ||
+      sent_trace.header()->dropped || received_trace.header()->dropped)
+    return 4;
+
+  // Both traces have the same bytes.
+  ipc::TraceReader sent;
+  ipc::TraceReader received;
+  if (!sent.Attach(&sent_mem[0], sent_mem.size()) ||
+      !received.Attach(&received_mem[0], received_mem.size()))
+    return 5;
+  std::vector<char> sent_bytes;
+  std::vector<char> received_bytes;
+  ipc::TraceEvent ev;
+  unsigned int first_us = 0;
+  unsigned int last_us = 0;
+  while (sent.Next(&ev)) {
+    if ((ev.direction != ipc::TRACE_SENT) || (ev.time_us < last_us))
+      return 6;
+    if (sent_bytes.empty())
+      first_us = ev.time_us;
+    last_us = ev.time_us;
+    sent_bytes.insert(sent_bytes.end(), ev.data, ev.data + ev.size);
+  }
+  while (received.Next(&ev)) {
+    if (ev.direction != ipc::TRACE_RECEIVED)
+      return 7;
+    received_bytes.insert(received_bytes.end(), ev.data, ev.data + ev.size);
+  }
+  if (sent_bytes.empty() || (sent_bytes != received_bytes))
+    return 8;
+
+  // Played back as fast as it goes, or at the recorded pace, which takes as long as the
+  // messages took to be sent.
+  ipc::ReplayTransport replay_transport;
+  ReplayChannel replay(&replay_transport);
+  TraceSvc<ReplayChannel> replay_svc;
+  received.Rewind();
+  if ((ipc::ReplayTrace(&received, ipc::TRACE_RECEIVED, &replay, &replay_svc) !=
+       ipc::OnMsgReady) || (replay_svc.count_ != kTraceMsgs))
+    return 9;
+  replay_svc.count_ = 0;
+  sent.Rewind();
+  const unsigned int start = ipc::TickCountUs();
+  if ((ipc::ReplayTrace(&sent, ipc::TRACE_SENT, &replay, &replay_svc, true) !=
+       ipc::OnMsgReady) || (replay_svc.count_ != kTraceMsgs))
+    return 10;
+  if ((ipc::TickCountUs() - start) < (last_us - first_us))
+    return 11;
+  // The other direction has nothing.
+  replay_svc.count_ = 0;
+  sent.Rewind();
+  if ((ipc::ReplayTrace(&sent, ipc::TRACE_RECEIVED, &replay, &replay_svc) !=
+       ipc::OnMsgLoopNext) || replay_svc.count_)
+    return 12;
+
+  // A trace that fills up keeps what came before. This one has room for half the messages.
+  ipc::TraceWriter small_trace;
+  const size_t half = sent_trace.header()->used / 2;
+  if (!small_trace.Init(&sent_mem[0], sizeof(ipc::TraceHeader) + half))
+    return 13;
+  tr1.SetTrace(&small_trace);
+  for (int ix = 0; ix != kTraceMsgs; ++ix) {
+    if (svc.Send(&ch1, ix) != ipc::RcOK)
+      return 14;
+  }
+  if ((small_trace.header()->records != kTraceMsgs / 2) ||
+      (small_trace.header()->dropped != kTraceMsgs / 2))
+    return 15;
+  if (!sent.Attach(&sent_mem[0], sent_mem.size()))
+    return 16;
+  replay_svc.count_ = 0;
+  if ((ipc::ReplayTrace(&sent, ipc::TRACE_SENT, &replay, &replay_svc) != ipc::OnMsgLoopNext) ||
+      (replay_svc.count_ != kTraceMsgs / 2))
+    return 17;
+  if (sent.Attach(&sent_mem[0], sizeof(ipc::TraceHeader)))
+    return 18;
+  return 0;
+}
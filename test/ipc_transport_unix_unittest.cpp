@@ -13,9 +13,21 @@
 // limitations under the License.
 
 #include "os_includes.h"
+#include "ipc_codec_compact.h"
 #include "pipe_unix.h"
+#include "shm_unix.h"
+#include "mapped_file_unix.h"
+#include "reactor_unix.h"
+#include "ipc_sync.h"
+#include "ipc_clock.h"
+#include "ipc_transport_pool.h"
+#include "ipc_trace.h"
+#include "ipc_test_helpers.h"
 
+#include <fcntl.h>
 #include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // Test the Raw Pipe, since pipe operations are blocking, this requires two threads.
@@ -91,3 +103,610 @@ int TestRawPipeTransport() {
   return ctx.result;
 }
 
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test the shared memory transport. The ring is much smaller than the message so both
+// sides have to sleep and wake up each other many times.
+
+struct ShmContext {
+  const ShmPair* pair;
+  const char* data;
+  size_t size;
+  int result;
+};
+
+void* ShmClientThread(void* p) {
+  volatile ShmContext* ctx = reinterpret_cast<ShmContext*> (p);
+  ShmTransport shm;
+  if (!shm.OpenClient(ctx->pair->shm_fd(), ctx->pair->tx2(), ctx->pair->rx2())) {
+    ctx->result = 6;
+    return NULL;
+  }
+
+  const size_t half = ctx->size / 2;
+  ipc::IOSegment segs[] = {
+    { ctx->data, half },
+    { ctx->data + half, ctx->size - half }
+  };
+  if (ipc::RcOK != shm.Send(segs, 2)) {
+    ctx->result = 7;
+    return NULL;
+  }
+
+  size_t read = 0;
+  char* msg_back = shm.Receive(&read);
+  if (!msg_back || (0 != memcmp(msg_back, test_msg2, read))) {
+    ctx->result = 8;
+    return NULL;
+  }
+
+  ctx->result = 0;
+  return NULL;
+}
+
+int TestShmTransport() {
+  ShmPair shm_pair(256);
+  if (shm_pair.shm_fd() == -1)
+    return 1;
+
+  ShmTransport shm;
+  if (!shm.OpenServer(shm_pair.shm_fd(), shm_pair.tx1(), shm_pair.rx1()))
+    return 2;
+
+  static char data[10000];
+  for (size_t ix = 0; ix != sizeof(data); ++ix) {
+    data[ix] = static_cast<char>(ix % 251);
+  }
+
+  ShmContext ctx = {&shm_pair, data, sizeof(data), -1};
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, ShmClientThread, &ctx)) {
+    return 3;
+  }
+
+  size_t start = 0;
+  while (start != sizeof(data)) {
+    size_t read = 0;
+    char* msg = shm.Receive(&read);
+    if (!msg)
+      return 4;
+    if ((start + read > sizeof(data)) || (0 != memcmp(msg, &data[start], read)))
+      return 5;
+    start += read;
+  }
+
+  if (ipc::RcOK != shm.Send(test_msg2, sizeof(test_msg2) - 1))
+    return 9;
+
+  void* status;
+  if (pthread_join(thread, &status)) {
+    return 10;
+  }
+
+  return ctx.result;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test the reactor. Two reactor threads serve several pipes, each server answers every
+// message 43 with a message 44 carrying the value plus one.
+
+typedef ipc::Channel<PipeTransport, ipc::Encoder, ipc::Decoder> PipeChannel;
+
+DEFINE_IPC_MSG_CONV(43, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(44, 1) {
+  IPC_MSG_P1(int, Int32)
+};
+
+class ReactorSvc : public DispTestMsg,
+                   public ipc::MsgIn<43, ReactorSvc, PipeChannel>,
+                   public ipc::MsgOut<PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel* ch, int v) {
+    return SendMsg(44, ch, v + 1);
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+class ReactorCli : public DispTestMsg,
+                   public ipc::MsgIn<44, ReactorCli, PipeChannel>,
+                   public ipc::MsgOut<PipeChannel> {
+public:
+  ReactorCli() : value_(0) {}
+
+  size_t Request(PipeChannel* ch, int v) {
+    return SendMsg(43, ch, v);
+  }
+
+  size_t OnMsg(PipeChannel*, int v) {
+    value_ = v;
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int value_;
+};
+
+class TestReactorChannel : public ipc::ReactorChannel<PipeChannel, ReactorSvc> {
+public:
+  TestReactorChannel(PipeChannel* channel, ReactorSvc* svc, volatile long* detached)
+      : ipc::ReactorChannel<PipeChannel, ReactorSvc>(channel, svc), detached_(detached) {}
+
+  virtual void OnDetach() {
+    ipc::AtomicAdd(detached_, 1);
+  }
+
+private:
+  volatile long* detached_;
+};
+
+int TestReactor() {
+  const size_t kPipes = 6;
+  PipePair pairs[kPipes];
+  PipeTransport server_tr[kPipes];
+  PipeTransport client_tr[kPipes];
+  PipeChannel* server_ch[kPipes];
+  PipeChannel* client_ch[kPipes];
+  TestReactorChannel* rc[kPipes];
+
+  ReactorSvc svc;
+  volatile long detached = 0;
+  ipc::Reactor reactor;
+  if (!reactor.Start(2))
+    return 1;
+
+  for (size_t ix = 0; ix != kPipes; ++ix) {
+    server_tr[ix].OpenServer(pairs[ix].fd1());
+    client_tr[ix].OpenClient(pairs[ix].fd2());
+    server_ch[ix] = new PipeChannel(&server_tr[ix]);
+    client_ch[ix] = new PipeChannel(&client_tr[ix]);
+    rc[ix] = new TestReactorChannel(server_ch[ix], &svc, &detached);
+    if (!reactor.Add(rc[ix]))
+      return 2;
+  }
+  if (reactor.Clients() != kPipes)
+    return 3;
+
+  // Several requests in flight on every pipe before reading the answers back.
+  ReactorCli out;
+  for (int round = 0; round != 3; ++round) {
+    for (size_t ix = 0; ix != kPipes; ++ix) {
+      if (ipc::RcOK != out.Request(client_ch[ix], int(ix * 100 + round)))
+        return 4;
+    }
+  }
+  for (int round = 0; round != 3; ++round) {
+    for (size_t ix = 0; ix != kPipes; ++ix) {
+      ReactorCli cli;
+      if (client_ch[ix]->Receive(&cli) != ipc::OnMsgReady)
+        return 5;
+      if (cli.value_ != int(ix * 100 + round + 1))
+        return 6;
+    }
+  }
+
+  // Closing the client end detaches the server side.
+  for (size_t ix = 0; ix != kPipes; ++ix) {
+    close(pairs[ix].fd2());
+  }
+  unsigned int start = ipc::TickCountMs();
+  while (reactor.Clients() != 0) {
+    if (ipc::ElapsedMs(start) > 5000)
+      return 7;
+    ipc::YieldThread();
+  }
+  if (ipc::AtomicLoad(&detached) != long(kPipes))
+    return 8;
+  for (size_t ix = 0; ix != kPipes; ++ix) {
+    if (rc[ix]->result() != ipc::RcErrTransportRead)
+      return 9;
+  }
+
+  reactor.Stop();
+  for (size_t ix = 0; ix != kPipes; ++ix) {
+    delete rc[ix];
+    delete server_ch[ix];
+    delete client_ch[ix];
+    close(pairs[ix].fd1());
+  }
+  return 0;
+}
+
+
+// A message bigger than kMaxRetainedSz that reaches the reactor in pieces. The channel goes
+// idle between them, which must not trim the half received message.
+DEFINE_IPC_MSG_CONV(63, 1) {
+  IPC_MSG_P1(ipc::ByteArray, ByteArray)
+};
+
+class ReactorBigSvc : public DispTestMsg,
+                      public ipc::MsgIn<63, ReactorBigSvc, PipeChannel>,
+                      public ipc::MsgOut<PipeChannel> {
+public:
+  size_t OnMsg(PipeChannel* ch, ipc::ByteArray ba) {
+    for (size_t ix = 0; ix != ba.sz_; ++ix) {
+      if (ba.buf_[ix] != static_cast<char>(ix * 13))
+        return SendMsg(44, ch, -1);
+    }
+    return SendMsg(44, ch, static_cast<int>(ba.sz_));
+  }
+
+  void* OnNewTransport() { return NULL; }
+};
+
+bool WriteFully(int fd, const char* buf, size_t sz) {
+  while (sz) {
+    ssize_t written = write(fd, buf, sz);
+    if (written <= 0)
+      return false;
+    buf += written;
+    sz -= written;
+  }
+  return true;
+}
+
+int TestReactorLargeMsg() {
+  const size_t kArraySz = 200 * 1024;
+  std::vector<char> arr(kArraySz);
+  for (size_t ix = 0; ix != kArraySz; ++ix) {
+    arr[ix] = static_cast<char>(ix * 13);
+  }
+  ipc::Encoder encoder;
+  encoder.Open(1);
+  encoder.OnString8(&arr[0], arr.size(), ipc::TYPE_BARRAY);
+  encoder.SetMsgId(63);
+  encoder.Close();
+  size_t n_segs = 0;
+  const ipc::IOSegment* segs = encoder.GetSegments(&n_segs);
+  std::vector<char> msg;
+  for (size_t ix = 0; ix != n_segs; ++ix) {
+    const char* buf = static_cast<const char*>(segs[ix].buf_);
+    msg.insert(msg.end(), buf, buf + segs[ix].sz_);
+  }
+
+  PipePair pair;
+  PipeTransport server_tr;
+  PipeTransport client_tr;
+  server_tr.OpenServer(pair.fd1());
+  client_tr.OpenClient(pair.fd2());
+  PipeChannel server_ch(&server_tr);
+  PipeChannel client_ch(&client_tr);
+  ReactorBigSvc svc;
+  ipc::ReactorChannel<PipeChannel, ReactorBigSvc> rc(&server_ch, &svc);
+
+  ipc::Reactor reactor;
+  if (!reactor.Start(1))
+    return 1;
+  if (!reactor.Add(&rc))
+    return 2;
+
+  // The first half, then a pause long enough for the reactor to read it all and find the
+  // pipe empty, then the rest.
+  const size_t half = msg.size() / 2;
+  if (!WriteFully(pair.fd2(), &msg[0], half))
+    return 3;
+  usleep(100 * 1000);
+  if (!WriteFully(pair.fd2(), &msg[half], msg.size() - half))
+    return 4;
+
+  ReactorCli cli;
+  if (client_ch.Receive(&cli) != ipc::OnMsgReady)
+    return 5;
+  if (cli.value_ != static_cast<int>(kArraySz))
+    return 6;
+
+  close(pair.fd2());
+  unsigned int start = ipc::TickCountMs();
+  while (reactor.Clients() != 0) {
+    if (ipc::ElapsedMs(start) > 5000)
+      return 7;
+    ipc::YieldThread();
+  }
+  reactor.Stop();
+  close(pair.fd1());
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test passing file descriptors. Message 53 carries the read end of a pipe and a value, the
+// receiver reads what was written to the pipe through its own descriptor. Message 54 carries
+// two of them with the compact codec.
+
+typedef ipc::Channel<PipeTransport, ipc::CompactEncoder, ipc::CompactDecoder> CompactPipeChannel;
+
+DEFINE_IPC_MSG_CONV(53, 2) {
+  IPC_MSG_P1(ipc::OsHandle, Handle)
+  IPC_MSG_P2(int, Int32)
+};
+
+DEFINE_IPC_MSG_CONV(54, 2) {
+  IPC_MSG_P1(ipc::OsHandle, Handle)
+  IPC_MSG_P2(ipc::OsHandle, Handle)
+};
+
+// Reads what is left in |fd| and closes it.
+IPCString ReadAndClose(int fd) {
+  IPCString str;
+  char buf[64];
+  ssize_t read_sz;
+  while ((read_sz = read(fd, buf, sizeof(buf) - 1)) > 0) {
+    buf[read_sz] = 0;
+    str.append(buf);
+  }
+  close(fd);
+  return str;
+}
+
+template <class ChannelT>
+class FdOut : public ipc::MsgOut<ChannelT> {
+public:
+  using ipc::MsgOut<ChannelT>::SendMsg;
+};
+
+class FdSvc : public DispTestMsg,
+              public ipc::MsgIn<53, FdSvc, PipeChannel> {
+public:
+  FdSvc() : fd_(-1), value_(0) {}
+
+  size_t OnMsg(PipeChannel*, ipc::OsHandle h, int v) {
+    fd_ = h.h_;
+    value_ = v;
+    str_ = ReadAndClose(h.h_);
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  int fd_;
+  int value_;
+  IPCString str_;
+};
+
+class FdPairSvc : public DispTestMsg,
+                  public ipc::MsgIn<54, FdPairSvc, CompactPipeChannel> {
+public:
+  size_t OnMsg(CompactPipeChannel*, ipc::OsHandle h1, ipc::OsHandle h2) {
+    str_ = ReadAndClose(h1.h_);
+    str_.append(ReadAndClose(h2.h_).c_str());
+    return ipc::OnMsgReady;
+  }
+
+  void* OnNewTransport() { return NULL; }
+
+  IPCString str_;
+};
+
+// Returns the read end of a pipe that has |str| in it and no writers left.
+int MakeFilledPipe(const char* str) {
+  int fds[2];
+  if (pipe(fds))
+    return -1;
+  if (write(fds[1], str, strlen(str)) != ssize_t(strlen(str)))
+    return -1;
+  close(fds[1]);
+  return fds[0];
+}
+
+// A pipe whose non-blocking read end tells when every copy of the write end is closed.
+bool MakeWatchedPipe(int* read_fd, int* write_fd) {
+  int fds[2];
+  if (pipe(fds))
+    return false;
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  *read_fd = fds[0];
+  *write_fd = fds[1];
+  return true;
+}
+
+bool WritersGone(int read_fd) {
+  char c;
+  return read(read_fd, &c, 1) == 0;
+}
+
+int TestPipeHandles() {
+  PipePair pair;
+  PipeTransport server_tr;
+  PipeTransport client_tr;
+  server_tr.OpenServer(pair.fd1());
+  client_tr.OpenClient(pair.fd2());
+  PipeChannel server(&server_tr);
+  PipeChannel client(&client_tr);
+
+  FdSvc svc;
+  FdOut<PipeChannel> out;
+  int fd = MakeFilledPipe("passed along");
+  if (fd < 0)
+    return 1;
+  if (ipc::RcOK != out.SendMsg(53, &client, ipc::OsHandle(fd), 77))
+    return 2;
+  // The receiver has its own descriptor so the sender can close its one right away.
+  close(fd);
+  if (server.Receive(&svc) != ipc::OnMsgReady)
+    return 3;
+  if ((svc.value_ != 77) || (svc.fd_ < 0) || (svc.str_ != "passed along"))
+    return 4;
+
+  // Several in a row are matched with their messages, even if they are read together.
+  for (int ix = 0; ix != 3; ++ix) {
+    char str[] = "pipe 0";
+    str[5] = static_cast<char>('0' + ix);
+    fd = MakeFilledPipe(str);
+    if (ipc::RcOK != out.SendMsg(53, &client, ipc::OsHandle(fd), ix))
+      return 5;
+    close(fd);
+  }
+  for (int ix = 0; ix != 3; ++ix) {
+    if (server.Receive(&svc) != ipc::OnMsgReady)
+      return 6;
+    char str[] = "pipe 0";
+    str[5] = static_cast<char>('0' + ix);
+    if ((svc.value_ != ix) || (svc.str_ != str))
+      return 7;
+  }
+
+  // A batch is a plain buffer, so it cannot carry descriptors.
+  fd = MakeFilledPipe("batched");
+  client.BeginBatch(64 * 1024, 0);
+  if (ipc::RcErrEncoderType != out.SendMsg(53, &client, ipc::OsHandle(fd), 1))
+    return 8;
+  client.EndBatch();
+  if (ipc::RcOK != out.SendMsg(53, &client, ipc::OsHandle(fd), 2))
+    return 9;
+  close(fd);
+  if ((server.Receive(&svc) != ipc::OnMsgReady) || (svc.str_ != "batched"))
+    return 10;
+
+  // The compact codec, with two descriptors in one message.
+  CompactPipeChannel compact_server(&server_tr);
+  CompactPipeChannel compact_client(&client_tr);
+  FdPairSvc pair_svc;
+  FdOut<CompactPipeChannel> compact_out;
+  int fd1 = MakeFilledPipe("one,");
+  int fd2 = MakeFilledPipe("two");
+  if (ipc::RcOK != compact_out.SendMsg(54, &compact_client, ipc::OsHandle(fd1),
+                                       ipc::OsHandle(fd2)))
+    return 11;
+  close(fd1);
+  close(fd2);
+  if (compact_server.Receive(&pair_svc) != ipc::OnMsgReady)
+    return 12;
+  if (pair_svc.str_ != "one,two")
+    return 13;
+
+  // Transports that cannot pass descriptors refuse the message.
+  typedef ipc::Channel<TestTransport, ipc::Encoder, ipc::Decoder> PlainChannel;
+  TestTransport plain;
+  PlainChannel plain_ch(&plain);
+  FdOut<PlainChannel> plain_out;
+  if (ipc::RcErrEncoderType != plain_out.SendMsg(53, &plain_ch, ipc::OsHandle(0), 1))
+    return 14;
+
+  // The descriptors of the messages that nobody takes are closed, and the message that
+  // follows still gets its own: an unknown id, a wrong argument type, a wrong argument count
+  // and a message that does not decode.
+  for (int ix = 0; ix != 4; ++ix) {
+    int watched, sent;
+    if (!MakeWatchedPipe(&watched, &sent))
+      return 15;
+    size_t expected = ipc::OnMsgReady;
+    if (ix == 0) {
+      out.SendMsg(55, &client, ipc::OsHandle(sent), 1);
+      expected = ipc::RcErrBadMessageId;
+    } else if (ix == 1) {
+      out.SendMsg(53, &client, 1, ipc::OsHandle(sent));
+    } else if (ix == 2) {
+      out.SendMsg(53, &client, ipc::OsHandle(sent));
+    } else {
+      char garbage[64];
+      memset(garbage, 'x', sizeof(garbage));
+      const ipc::IOSegment seg = { garbage, sizeof(garbage) };
+      client_tr.Send(&seg, 1, &sent, 1);
+      expected = ipc::RcErrDecoderFormat;
+    }
+    close(sent);
+    fd = MakeFilledPipe("next");
+    if (ipc::RcOK != out.SendMsg(53, &client, ipc::OsHandle(fd), 3))
+      return 16;
+    close(fd);
+    if (server.Receive(&svc) != expected)
+      return 17;
+    if (!WritersGone(watched))
+      return 18;
+    close(watched);
+    if ((expected != ipc::OnMsgReady) && (server.Receive(&svc) != ipc::OnMsgReady))
+      return 19;
+    if (svc.str_ != "next")
+      return 20;
+  }
+
+  close(pair.fd1());
+  close(pair.fd2());
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test the pool of ready pipe pairs. The pairs work and the ones taken are replaced in the
+// background.
+
+int TestTransportPool() {
+  typedef ipc::TransportPool<PipePair> Pool;
+  Pool pool;
+  if (pool.Start(0) || pool.Start(Pool::kMaxReady + 1))
+    return 1;
+  if (!pool.Start(3) || (pool.Ready() != 3))
+    return 2;
+
+  // More than are ready, the last ones are made on the spot.
+  for (int ix = 0; ix != 5; ++ix) {
+    PipePair* pair = pool.Take();
+    if (!pair || !pair->IsValid())
+      return 3;
+    PipeUnix server;
+    PipeUnix client;
+    if (!server.OpenServer(pair->fd1()) || !client.OpenClient(pair->fd2()))
+      return 4;
+    char c = static_cast<char>('a' + ix);
+    if (!server.Write(&c, 1))
+      return 5;
+    char got = 0;
+    size_t sz = 1;
+    if (!client.Read(&got, &sz) || (sz != 1) || (got != c))
+      return 6;
+    pair->Close();
+    delete pair;
+  }
+
+  const unsigned int start = ipc::TickCountMs();
+  while (pool.Ready() != 3) {
+    if (ipc::ElapsedMs(start) > 5000)
+      return 7;
+    ipc::YieldThread();
+  }
+  pool.Stop();
+  if (pool.Ready())
+    return 8;
+  // Without the thread every pair is made when asked for.
+  PipePair* pair = pool.Take();
+  if (!pair || !pair->IsValid())
+    return 9;
+  pair->Close();
+  delete pair;
+  return 0;
+}
+
+int TestMappedFile() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/sipc_trace.%d", static_cast<int>(getpid()));
+  const char data[] = "recorded";
+  {
+    MappedFile file;
+    if (!file.Create(path, 4096) || (file.size() != 4096))
+      return 1;
+    ipc::TraceWriter trace;
+    if (!trace.Init(file.base(), file.size()))
+      return 2;
+    trace.Record(ipc::TRACE_SENT, data, sizeof(data));
+  }
+
+  // What was written is in the file after it is unmapped.
+  MappedFile file;
+  if (!file.Open(path) || (file.size() != 4096))
+    return 3;
+  unlink(path);
+  ipc::TraceReader reader;
+  ipc::TraceEvent ev;
+  if (!reader.Attach(file.base(), file.size()) || !reader.Next(&ev))
+    return 4;
+  if ((ev.direction != ipc::TRACE_SENT) || (ev.size != sizeof(data)) ||
+      (0 != memcmp(ev.data, data, sizeof(data))) || reader.Next(&ev))
+    return 5;
+  file.Close();
+  if (file.base() || file.Open(path))
+    return 6;
+  return 0;
+}
@@ -13,7 +13,12 @@
 // limitations under the License.
 
 #include "os_includes.h"
+#include "ipc_clock.h"
+#include "ipc_trace.h"
+#include "ipc_transport_pool.h"
+#include "mapped_file_win.h"
 #include "pipe_win.h"
+#include "shm_win.h"
 
 /////////////////////////////////////////////////////////////////////////////////////////
 // Test the Raw Pipe, since pipe operations are blocking, this requires two threads.
@@ -72,3 +77,152 @@ int TestRawPipeTransport() {
   return exit_code;
 }
 
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test the shared memory transport. The ring is much smaller than the message so both
+// sides have to sleep and wake up each other many times.
+
+char g_shm_data[10000];
+
+DWORD WINAPI ShmClientThread(void* ctx) {
+  const ShmPair* pair = reinterpret_cast<const ShmPair*>(ctx);
+  ShmTransport shm;
+  if (!shm.OpenClient(pair->mapping(), pair->events()))
+    return 6;
+
+  const size_t half = sizeof(g_shm_data) / 2;
+  ipc::IOSegment segs[] = {
+    { g_shm_data, half },
+    { g_shm_data + half, sizeof(g_shm_data) - half }
+  };
+  if (ipc::RcOK != shm.Send(segs, 2))
+    return 7;
+
+  size_t read = 0;
+  char* msg_back = shm.Receive(&read);
+  if (!msg_back)
+    return 8;
+
+  return memcmp(msg_back, test_msg2, read);
+}
+
+int TestShmTransport() {
+  ShmPair shm_pair(false, 256);
+  if (NULL == shm_pair.mapping())
+    return 1;
+
+  ShmTransport shm;
+  if (!shm.OpenServer(shm_pair.mapping(), shm_pair.events()))
+    return 2;
+
+  for (size_t ix = 0; ix != sizeof(g_shm_data); ++ix) {
+    g_shm_data[ix] = static_cast<char>(ix % 251);
+  }
+
+  HANDLE thread = ::CreateThread(NULL, 0, ShmClientThread, &shm_pair, 0, NULL);
+  if (NULL == thread)
+    return 3;
+
+  size_t start = 0;
+  while (start != sizeof(g_shm_data)) {
+    size_t read = 0;
+    char* msg = shm.Receive(&read);
+    if (!msg)
+      return 4;
+    if ((start + read > sizeof(g_shm_data)) || (0 != memcmp(msg, &g_shm_data[start], read)))
+      return 5;
+    start += read;
+  }
+
+  if (ipc::RcOK != shm.Send(test_msg2, sizeof(test_msg2) - 1))
+    return 9;
+
+  ::WaitForSingleObject(thread, INFINITE);
+
+  DWORD exit_code = 0;
+  ::GetExitCodeThread(thread, &exit_code); 
+  return exit_code;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+// Test the pool of ready pipe pairs. The pairs work and the ones taken are replaced in the
+// background.
+
+int TestTransportPool() {
+  typedef ipc::TransportPool<PipePair> Pool;
+  Pool pool;
+  if (pool.Start(0) || pool.Start(Pool::kMaxReady + 1))
+    return 1;
+  if (!pool.Start(3) || (pool.Ready() != 3))
+    return 2;
+
+  // More than are ready, the last ones are made on the spot.
+  for (int ix = 0; ix != 5; ++ix) {
+    PipePair* pair = pool.Take();
+    if (!pair || !pair->IsValid())
+      return 3;
+    // The pipes close their handles.
+    PipeWin server;
+    PipeWin client;
+    if (!server.OpenServer(pair->fd1()) || !client.OpenClient(pair->fd2()))
+      return 4;
+    delete pair;
+    char c = static_cast<char>('a' + ix);
+    if (!server.Write(&c, 1))
+      return 5;
+    char got = 0;
+    size_t sz = 1;
+    if (!client.Read(&got, &sz) || (sz != 1) || (got != c))
+      return 6;
+  }
+
+  const unsigned int start = ipc::TickCountMs();
+  while (pool.Ready() != 3) {
+    if (ipc::ElapsedMs(start) > 5000)
+      return 7;
+    ::Sleep(1);
+  }
+  pool.Stop();
+  if (pool.Ready())
+    return 8;
+  // Without the thread every pair is made when asked for.
+  PipePair* pair = pool.Take();
+  if (!pair || !pair->IsValid())
+    return 9;
+  pair->Close();
+  delete pair;
+  return 0;
+}
+
+int TestMappedFile() {
+  wchar_t path[MAX_PATH];
+  wchar_t dir[MAX_PATH];
+  if (!::GetTempPathW(MAX_PATH, dir) || !::GetTempFileNameW(dir, L"sipc", 0, path))
+    return 1;
+  const char data[] = "recorded";
+  {
+    MappedFile file;
+    if (!file.Create(path, 4096) || (file.size() != 4096))
+      return 2;
+    ipc::TraceWriter trace;
+    if (!trace.Init(file.base(), file.size()))
+      return 3;
+    trace.Record(ipc::TRACE_SENT, data, sizeof(data));
+  }
+
+  // What was written is in the file after it is unmapped.
+  MappedFile file;
+  if (!file.Open(path) || (file.size() != 4096))
+    return 4;
+  ipc::TraceReader reader;
+  ipc::TraceEvent ev;
+  if (!reader.Attach(file.base(), file.size()) || !reader.Next(&ev))
+    return 5;
+  if ((ev.direction != ipc::TRACE_SENT) || (ev.size != sizeof(data)) ||
+      (0 != memcmp(ev.data, data, sizeof(data))) || reader.Next(&ev))
+    return 6;
+  file.Close();
+  ::DeleteFileW(path);
+  if (file.base() || file.Open(path))
+    return 7;
+  return 0;
+}
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "ipc_utils.h"
+#include "shm_ring.h"
 
 namespace {
 
@@ -116,6 +117,41 @@ int TestFixedArray() {
   return 0;
 }
 
+int TestSmallArray() {
+  ipc::SmallArray<NonPod, 4> sar;
+  if (sar.size() || (sar.capacity() != 4))
+    return 1;
+
+  // Grows past the inline storage, copying from its own last element each time.
+  sar.push_back(NonPod(0));
+  for (int ix = 0; ix != 9; ++ix) {
+    if (!sar.push_back(sar[ix]))
+      return 2;
+  }
+  if ((sar.size() != 10) || (sar.capacity() != 16))
+    return 3;
+  for (int ix = 0; ix != 10; ++ix) {
+    if (!sar[ix].has_the_bar())
+      return 4;
+  }
+  // Element 0 was copied once when pushed and moved twice when the array grew.
+  if (sar[0].get_foo() != 3)
+    return 5;
+
+  NonPod::dtor_called = 0;
+  sar.clear();
+  if (sar.size() || (NonPod::dtor_called != 10))
+    return 6;
+  // The heap block is kept.
+  if (sar.capacity() != 16)
+    return 7;
+  sar.push_back(NonPod(7));
+  if ((sar.size() != 1) || (sar[0].get_foo() != 8))
+    return 8;
+
+  return 0;
+}
+
 
 #pragma warning(push)
 #pragma warning(disable : 4245)
@@ -236,6 +272,17 @@ int TestPodVector() {
       return 28;
   }
 
+  {
+    ipc::PodVector<int> vec;
+    int a[] = {1, 0x10203, 0x40506, 0x70809};
+    vec.insert(vec.end(), &a[0], &a[countof(a)]);
+    vec.erase(vec.begin(), vec.begin() + 1);
+    if (vec.size() != 3)
+      return 29;
+    if ((vec[0] != a[1]) || (vec[1] != a[2]) || (vec[2] != a[3]))
+      return 30;
+  }
+
   return 0;
 }
 
@@ -351,4 +398,131 @@ int TestHolderString() {
 }
 
 
+int TestArena() {
+  ipc::Arena arena;
+  if (arena.Held() != 0)
+    return 1;
+
+  char* p1 = static_cast<char*>(arena.Alloc(3));
+  char* p2 = static_cast<char*>(arena.Alloc(5));
+  if ((p2 - p1) != sizeof(void*))
+    return 2;
+  if (reinterpret_cast<size_t>(p2) % sizeof(void*))
+    return 3;
+  // Larger than a block gets its own block.
+  char* p3 = static_cast<char*>(arena.Alloc(ipc::Arena::kBlockSz * 2));
+  memset(p3, 1, ipc::Arena::kBlockSz * 2);
+  size_t held = arena.Held();
+  if (held != ipc::Arena::kBlockSz * 3)
+    return 4;
+
+  // The second round reuses the same memory.
+  arena.Reset();
+  if (arena.Alloc(3) != p1)
+    return 5;
+  arena.Alloc(5);
+  if (arena.Alloc(ipc::Arena::kBlockSz * 2) != p3)
+    return 6;
+  if (arena.Held() != held)
+    return 7;
+
+  arena.Reset();
+  arena.Trim(ipc::Arena::kBlockSz);
+  if (arena.Held() != ipc::Arena::kBlockSz)
+    return 8;
+
+  // A first block sized for one huge message is not kept either.
+  {
+    ipc::Arena big;
+    big.Alloc(ipc::Arena::kBlockSz * 16);
+    big.Reset();
+    big.Trim(ipc::Arena::kBlockSz * 2);
+    if (big.Held() != 0)
+      return 13;
+    char* p4 = static_cast<char*>(big.Alloc(5));
+    memset(p4, 1, 5);
+    if (big.Held() != ipc::Arena::kBlockSz)
+      return 14;
+  }
+
+  // Containers can take their memory from the arena.
+  arena.Reset();
+  {
+    ipc::ArenaAlloc alloc(&arena);
+    ipc::PodVector<int, ipc::ArenaAlloc> vec(alloc);
+    int a[] = {5, 4, 3, 2, 1, 0, -1, -2};
+    for (int ix = 0; ix != 100; ++ix) {
+      vec.Add(a, countof(a));
+    }
+    if (vec.size() != 800)
+      return 9;
+    if ((vec[0] != 5) || (vec[799] != -2))
+      return 10;
+
+    ipc::HolderString<char, ipc::ArenaAlloc> str(alloc);
+    str = "We the people";
+    ipc::HolderString<char, ipc::ArenaAlloc> str2(str);
+    if (str2 != "We the people")
+      return 11;
+    if (str2.get_allocator().arena() != &arena)
+      return 12;
+  }
+  return 0;
+}
+
+int TestShmRing() {
+  const size_t ring_sz = ipc::ShmRing::RoundSize(10);
+  size_t mem[(sizeof(ipc::ShmRingHeader) + 64) / sizeof(size_t)];
+  if (ipc::ShmRing::BytesNeeded(ring_sz) != sizeof(mem))
+    return 12;
+  ipc::ShmRing::Init(mem, ring_sz);
+  ipc::ShmRing tx;
+  ipc::ShmRing rx;
+  if (!tx.Attach(mem, sizeof(mem)) || !rx.Attach(mem, sizeof(mem)))
+    return 1;
+
+  char in[100];
+  char out[100];
+  for (size_t ix = 0; ix != sizeof(in); ++ix) {
+    in[ix] = static_cast<char>(ix);
+  }
+  if ((tx.Put(in, 50) != 50) || (rx.Get(out, sizeof(out)) != 50))
+    return 2;
+  // Wraps around the end of the ring.
+  if ((tx.Put(in, sizeof(in)) != ring_sz) || (rx.Get(out, sizeof(out)) != ring_sz))
+    return 3;
+  if (0 != memcmp(in, out, ring_sz))
+    return 4;
+
+  // The peer growing the size in shared memory does not let Put() write past the ring.
+  ipc::ShmRingHeader* hdr = reinterpret_cast<ipc::ShmRingHeader*>(mem);
+  hdr->sz_ = 1024 * 1024;
+  if ((tx.Put(in, sizeof(in)) != ring_sz) || tx.Broken())
+    return 5;
+  if ((rx.Get(out, sizeof(out)) != ring_sz) || rx.Broken())
+    return 6;
+
+  // A consumer counter ahead of the producer breaks the producer side.
+  const size_t head = hdr->head_;
+  hdr->tail_ = head + 1;
+  if ((tx.Put(in, 1) != 0) || !tx.Broken())
+    return 7;
+  if (tx.PrepareWaitSpace())
+    return 8;
+  // And a producer counter more than a ring ahead breaks the consumer side.
+  hdr->head_ = head + ring_sz + 2;
+  if ((rx.Get(out, sizeof(out)) != 0) || !rx.Broken())
+    return 9;
+  if (rx.PrepareWaitData())
+    return 10;
+
+  // Attaching to such a ring fails.
+  hdr->sz_ = ring_sz;
+  ipc::ShmRing late;
+  if (late.Attach(mem, sizeof(mem)))
+    return 11;
+  return 0;
+}
+
+
 #pragma warning(pop)
\ No newline at end of file
@@ -45,8 +45,11 @@ void TestRunner(const char* test, int result) {
 // Main test driver
 
 int TestFixedArray();
+int TestSmallArray();
 int TestPodVector();
 int TestHolderString();
+int TestArena();
+int TestShmRing();
 int TestCodecRaw1();
 int TestCodecRaw2();
 int TestCodecRaw3();
@@ -55,9 +58,53 @@ int TestCodecRaw5();
 int TestCodecRaw6();
 int TestCodecRaw7();
 int TestCodecRaw8();
+int TestCodecZeroCopy();
+int TestCodecBadLength();
+int TestCodecLazyString();
+int TestCodecWideTypes();
+int TestCodecGather();
+int TestCodecPackStr();
+int TestCodecInPlaceDecode();
+int TestCodecFastPack();
+int TestCodecPacked();
+int TestCodecCompactRoundTrip();
+int TestCodecCompactFormat();
+int TestCodecCompactWideTypes();
+int TestCodecFixedRoundTrip();
+int TestCodecFixedFormat();
+int TestHelloNegotiation();
 int TestForwardDispatch();
 int TestDispatchRoundTrip();
+int TestMsgTableDispatch();
+int TestMsgSchemaEncoding();
+int TestMsgSchemaCall();
+#if defined(IPC_USE_VARIADIC)
+int TestVariadicDispatch();
+#endif
+int TestChannelReuse();
+int TestChannelLargeRead();
+int TestChannelBatch();
+int TestChannelCalls();
+int TestDispatchPool();
+int TestPooledDispatch();
+int TestPooledDispatchDrain();
+int TestChannelConcurrentSend();
+int TestChannelLanes();
+int TestChannelBatchFlush();
+int TestChannelStream();
+int TestMetricsHistogram();
+int TestChannelMetrics();
+int TestChannelReceiveSpin();
+int TestTraceReplay();
 int TestRawPipeTransport();
+int TestShmTransport();
+int TestTransportPool();
+int TestMappedFile();
+#if !defined(WIN32)
+int TestReactor();
+int TestReactorLargeMsg();
+int TestPipeHandles();
+#endif
 int TestFullRoundTrip();
 
 #if defined(WIN32)
@@ -67,8 +114,11 @@ int wmain(int argc, wchar_t* argv[]) {
 int main(int argc, char* const argv[]) {
 #endif
   TEST_FN(TestFixedArray());
+  TEST_FN(TestSmallArray());
   TEST_FN(TestPodVector());
   TEST_FN(TestHolderString());
+  TEST_FN(TestArena());
+  TEST_FN(TestShmRing());
   TEST_FN(TestCodecRaw1());
   TEST_FN(TestCodecRaw2());
   TEST_FN(TestCodecRaw3());
@@ -77,9 +127,53 @@ int main(int argc, char* const argv[]) {
   TEST_FN(TestCodecRaw6());
   TEST_FN(TestCodecRaw7());
   TEST_FN(TestCodecRaw8());
+  TEST_FN(TestCodecZeroCopy());
+  TEST_FN(TestCodecBadLength());
+  TEST_FN(TestCodecLazyString());
+  TEST_FN(TestCodecWideTypes());
+  TEST_FN(TestCodecGather());
+  TEST_FN(TestCodecPackStr());
+  TEST_FN(TestCodecInPlaceDecode());
+  TEST_FN(TestCodecFastPack());
+  TEST_FN(TestCodecPacked());
+  TEST_FN(TestCodecCompactRoundTrip());
+  TEST_FN(TestCodecCompactFormat());
+  TEST_FN(TestCodecCompactWideTypes());
+  TEST_FN(TestCodecFixedRoundTrip());
+  TEST_FN(TestCodecFixedFormat());
+  TEST_FN(TestHelloNegotiation());
   TEST_FN(TestForwardDispatch());
   TEST_FN(TestDispatchRoundTrip());
+  TEST_FN(TestMsgTableDispatch());
+  TEST_FN(TestMsgSchemaEncoding());
+  TEST_FN(TestMsgSchemaCall());
+#if defined(IPC_USE_VARIADIC)
+  TEST_FN(TestVariadicDispatch());
+#endif
+  TEST_FN(TestChannelReuse());
+  TEST_FN(TestChannelLargeRead());
+  TEST_FN(TestChannelBatch());
+  TEST_FN(TestChannelCalls());
+  TEST_FN(TestDispatchPool());
+  TEST_FN(TestPooledDispatch());
+  TEST_FN(TestPooledDispatchDrain());
+  TEST_FN(TestChannelConcurrentSend());
+  TEST_FN(TestChannelLanes());
+  TEST_FN(TestChannelBatchFlush());
+  TEST_FN(TestChannelStream());
+  TEST_FN(TestMetricsHistogram());
+  TEST_FN(TestChannelMetrics());
+  TEST_FN(TestChannelReceiveSpin());
+  TEST_FN(TestTraceReplay());
   TEST_FN(TestRawPipeTransport());
+  TEST_FN(TestShmTransport());
+  TEST_FN(TestTransportPool());
+  TEST_FN(TestMappedFile());
+#if !defined(WIN32)
+  TEST_FN(TestReactor());
+  TEST_FN(TestReactorLargeMsg());
+  TEST_FN(TestPipeHandles());
+#endif
   TEST_FN(TestFullRoundTrip());
   printf("Test succeeded\n");
 	return 0;